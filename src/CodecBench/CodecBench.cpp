@@ -0,0 +1,237 @@
+//
+// Lossless codec benchmark.
+//
+// Compresses frames with the raw codec of MultiCamSHM (see BayerCodec),
+// checks that they decode to the same pixels and prints the compression
+// ratio and the encode and decode rates, to tell whether rawCodec keeps a
+// camera within the write rate of its disk and how many rawThreads it
+// needs:
+//
+// Usage: CodecBench <image|imageDir|frames.raws>... [-threads n] [-repeat n]
+//
+// e.g. "CodecBench ../../Temp ../../test_sfm/image -threads 2". Directories
+// are read for .jpg, .png, .pgm and .tif files, in frame order (see
+// ImageFiles). Colour images are turned back into an RGGB mosaic, the
+// frames a camera would have sent; gray ones are taken as a mosaic
+// already. Rates are the best of -repeat runs
+// (default 10) on -threads threads (default 1), in MB of frame data per
+// second.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "BayerCodec.h"
+#include "RawSession.h"
+#include "ImageFiles.h"
+
+using namespace std;
+using namespace cv;
+
+
+struct Totals
+{
+	Totals() : numFrames(0), frameBytes(0), encodedBytes(0), encodeSeconds(0), decodeSeconds(0) {}
+
+	int numFrames;
+	double frameBytes;
+	double encodedBytes;
+	double encodeSeconds;
+	double decodeSeconds;
+};
+
+
+static bool IsDirectory(const string &path)
+{
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+
+// RGGB mosaic of a BGR image
+static void Mosaic(const Mat &bgr, Mat &bayer)
+{
+	bayer.create(bgr.rows, bgr.cols, CV_MAKETYPE(bgr.depth(), 1));
+	for(int y=0; y<bgr.rows; y++)
+	{
+		for(int x=0; x<bgr.cols; x++)
+		{
+			// Red on even rows and columns, blue on odd ones, green between
+			int channel = (y & 1) ? ((x & 1) ? 0 : 1) : ((x & 1) ? 1 : 2);
+			if(bgr.depth() == CV_16U)
+				bayer.at<uint16_t>(y, x) = bgr.at<Vec3w>(y, x)[channel];
+			else
+				bayer.at<uchar>(y, x) = bgr.at<Vec3b>(y, x)[channel];
+		}
+	}
+}
+
+
+// -1 when the frame does not come back as it was
+static int Measure(const string &name, const Mat &frame, int numThreads, int repeat, Totals &totals)
+{
+	vector<uint8_t> payload;
+	Mat decoded(frame.rows, frame.cols, frame.type());
+	double encodeSeconds = 1e9, decodeSeconds = 1e9;
+
+	for(int i=0; i<repeat; i++)
+	{
+		auto start = chrono::steady_clock::now();
+		if(EncodeBayer(frame, payload, numThreads) < 0)
+			return -1;
+		auto encoded = chrono::steady_clock::now();
+		if(DecodeBayer(&payload[0], payload.size(), decoded, numThreads) < 0)
+		{
+			cout << name << ": does not decode" << endl;
+			return -1;
+		}
+		auto end = chrono::steady_clock::now();
+
+		encodeSeconds = min(encodeSeconds, chrono::duration<double>(encoded - start).count());
+		decodeSeconds = min(decodeSeconds, chrono::duration<double>(end - encoded).count());
+	}
+
+	size_t rowBytes = frame.cols * frame.elemSize();
+	for(int y=0; y<frame.rows; y++)
+	{
+		if(memcmp(frame.ptr(y), decoded.ptr(y), rowBytes) != 0)
+		{
+			cout << name << ": row " << y << " differs after decoding" << endl;
+			return -1;
+		}
+	}
+
+	double frameBytes = (double)rowBytes * frame.rows;
+	cout << fixed << setprecision(2) << name << "  " << frame.cols << "x" << frame.rows << "x" << frame.elemSize() * 8
+		 << "  " << frameBytes / payload.size() << ":1  encode " << setprecision(0) << frameBytes / encodeSeconds / 1e6
+		 << " MB/s  decode " << frameBytes / decodeSeconds / 1e6 << " MB/s" << endl;
+
+	totals.numFrames++;
+	totals.frameBytes += frameBytes;
+	totals.encodedBytes += payload.size();
+	totals.encodeSeconds += encodeSeconds;
+	totals.decodeSeconds += decodeSeconds;
+	return 0;
+}
+
+
+static int MeasureImage(const string &fileName, int numThreads, int repeat, Totals &totals)
+{
+	Mat img = imread(fileName, IMREAD_UNCHANGED | IMREAD_ANYDEPTH);
+	if(img.empty())
+	{
+		cout << "Unable to read " << fileName << endl;
+		return -1;
+	}
+	if(img.depth() != CV_8U && img.depth() != CV_16U)
+	{
+		cout << fileName << ": 8 or 16-bit images only" << endl;
+		return -1;
+	}
+
+	Mat frame;
+	if(img.channels() == 3)
+		Mosaic(img, frame);
+	else if(img.channels() == 1)
+		frame = img;
+	else
+	{
+		cout << fileName << ": gray or colour images only" << endl;
+		return -1;
+	}
+	return Measure(fileName, frame, numThreads, repeat, totals);
+}
+
+
+static int MeasureRecording(const string &fileName, int numThreads, int repeat, Totals &totals)
+{
+	RawReader reader;
+	if(reader.Open(fileName) < 0)
+		return -1;
+
+	int result = 0;
+	RawFrameHeader header;
+	vector<uint8_t> payload;
+	Mat frame;
+	while(reader.Next(header))
+	{
+		if(reader.ReadPayload(payload) < 0 || DecodeRawFrame(header, payload, frame) < 0)
+			break;
+		if(Measure(fileName + ":" + to_string(header.slot), frame, numThreads, repeat, totals) < 0)
+			result = -1;
+	}
+	return result;
+}
+
+
+int main(int argc, char** argv)
+{
+	vector<string> paths;
+	int numThreads = 1;
+	int repeat = 10;
+	for(int i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-threads") == 0 && i+1 < argc)
+			numThreads = max(atoi(argv[++i]), 1);
+		else if(strcmp(argv[i], "-repeat") == 0 && i+1 < argc)
+			repeat = max(atoi(argv[++i]), 1);
+		else if(argv[i][0] == '-')
+		{
+			cout << "Unknown option " << argv[i] << endl;
+			return -1;
+		}
+		else
+			paths.push_back(argv[i]);
+	}
+	if(paths.empty())
+	{
+		cout << "Usage: CodecBench <image|imageDir|frames.raws>... [-threads n] [-repeat n]" << endl;
+		return -1;
+	}
+
+	int result = 0;
+	Totals totals;
+	for(unsigned int i=0; i<paths.size(); i++)
+	{
+		const string &path = paths[i];
+		if(IsDirectory(path))
+		{
+			vector<string> images = FindImages(path);
+			if(images.empty())
+				cout << path << ": no images" << endl;
+			for(unsigned int j=0; j<images.size(); j++)
+			{
+				if(MeasureImage(path + "/" + images[j], numThreads, repeat, totals) < 0)
+					result = -1;
+			}
+		}
+		else if(path.size() > 5 && path.compare(path.size() - 5, 5, ".raws") == 0)
+		{
+			if(MeasureRecording(path, numThreads, repeat, totals) < 0)
+				result = -1;
+		}
+		else if(MeasureImage(path, numThreads, repeat, totals) < 0)
+			result = -1;
+	}
+
+	if(totals.numFrames == 0)
+		return -1;
+
+	cout << fixed << setprecision(2) << totals.numFrames << " frames, " << numThreads << " threads: "
+		 << totals.frameBytes / totals.encodedBytes << ":1, encode " << setprecision(0)
+		 << totals.frameBytes / totals.encodeSeconds / 1e6 << " MB/s, decode "
+		 << totals.frameBytes / totals.decodeSeconds / 1e6 << " MB/s" << endl;
+	if(result < 0)
+		cout << "Some frames failed" << endl;
+	return result;
+}
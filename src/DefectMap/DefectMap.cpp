@@ -0,0 +1,131 @@
+//
+// Defect map builder.
+//
+// Finds the hot, dead and bright pixels of each camera from the dark and
+// flat reference frames recorded with "MultiCamSHM <rig> -calibrate dark|flat"
+// and writes <serial>.defects next to them. MultiCamSHM then replaces those
+// pixels in every recorded frame.
+//
+// Usage: DefectMap <calibrationDir> [serial...] [-mono]
+//
+// Without serials every camera with a .dark or .flat file in the directory
+// is processed. -mono treats the sensors as monochrome: neighbours are the
+// adjacent pixels instead of the next pixel of the same Bayer colour.
+//
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <set>
+#include <cstring>
+#include <dirent.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "FlatField.h"
+#include "PixelDefects.h"
+
+using namespace std;
+using namespace cv;
+
+
+// Serials of the reference frames in a directory
+static vector<string> FindSerials(const string &dir)
+{
+	set<string> serials;
+
+	DIR *d = opendir(dir.c_str());
+	if(d == NULL)
+	{
+		cout << "Unable to open " << dir << endl;
+		return vector<string>();
+	}
+
+	struct dirent *entry;
+	while((entry = readdir(d)) != NULL)
+	{
+		string name = entry->d_name;
+		size_t dot = name.rfind('.');
+		if(dot == string::npos || dot == 0)
+			continue;
+
+		string kind = name.substr(dot + 1);
+		if(kind == "dark" || kind == "flat")
+			serials.insert(name.substr(0, dot));
+	}
+	closedir(d);
+
+	return vector<string>(serials.begin(), serials.end());
+}
+
+
+static int BuildDefectMap(const string &dir, const string &serial, bool bayer)
+{
+	Mat dark, flat;
+	int darkResult = LoadReference(ReferenceFileName(dir, serial, "dark"), dark);
+	int flatResult = LoadReference(ReferenceFileName(dir, serial, "flat"), flat);
+	if(darkResult < 0 || flatResult < 0)
+		return -1;
+	if(darkResult != 0 && flatResult != 0)
+	{
+		cout << "Camera " << serial << ": no reference frames" << endl;
+		return -1;
+	}
+
+	DefectDetector detector;
+	DefectMap map;
+	if(detector.Detect(dark, flat, bayer, map) != 0)
+		return -1;
+
+	int counts[4] = {0, 0, 0, 0};
+	for(unsigned int i=0; i<map.defects.size(); i++)
+		counts[map.defects[i].type]++;
+
+	string fileName = DefectMapFileName(dir, serial);
+	if(map.Save(fileName) != 0)
+		return -1;
+
+	cout << "Camera " << serial << ": " << map.defects.size() << " defects ("
+		 << counts[DEFECT_HOT] << " hot, " << counts[DEFECT_DEAD] << " dead, " << counts[DEFECT_BRIGHT] << " bright"
+		 << (darkResult != 0 ? ", no dark frame" : "") << (flatResult != 0 ? ", no flat frame" : "")
+		 << ") written to " << fileName << endl;
+	return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		cout << "Usage: DefectMap <calibrationDir> [serial...] [-mono]" << endl;
+		return -1;
+	}
+
+	string dir = argv[1];
+	vector<string> serials;
+	bool bayer = true;
+	for(int i=2; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-mono") == 0)
+			bayer = false;
+		else
+			serials.push_back(argv[i]);
+	}
+
+	if(serials.empty())
+		serials = FindSerials(dir);
+	if(serials.empty())
+	{
+		cout << "No reference frames in " << dir << endl;
+		return -1;
+	}
+
+	int result = 0;
+	for(unsigned int i=0; i<serials.size(); i++)
+	{
+		if(BuildDefectMap(dir, serials[i], bayer) != 0)
+			result = -1;
+	}
+
+	return result;
+}
@@ -0,0 +1,143 @@
+//
+// Checks of FramesetAssembler with a camera that stops delivering:
+//
+//  - away: the camera delivers missing slots at the trigger rate, as
+//    CameraRecovery::GrabNext() does while it re-arms or is unplugged, and
+//    comes back later. No frame of any camera may be dropped as late and
+//    every slot must come out as one frameset.
+//  - silent: the camera pushes nothing at all after a while. The other
+//    cameras must still get all their frames out, by timeout.
+//
+// Usage: FramesetAssemblerTest (make test). Prints the failed checks,
+// returns -1 if there are any.
+//
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "FramesetAssembler.h"
+
+using namespace std;
+using namespace cv;
+
+
+static const int numCams = 3;
+static const int numSlots = 1000;
+static const int periodUs = 1000;
+
+
+struct Counts
+{
+	mutex countMutex;
+	uint64_t numFramesets;
+	vector<int> numFrames;		// delivered per camera
+	int lastSlot;				// frameId of the last frameset
+	bool inOrder;
+
+	Counts() : numFramesets(0), numFrames(numCams, 0), lastSlot(-1), inOrder(true) {}
+};
+
+
+// One camera; cam 2 is away for the slots [awayFrom, awayTo) and silent
+// from silentFrom on
+static void Capture(int camNum, FramesetAssembler *assembler, int awayFrom, int awayTo, int silentFrom)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(int slot=0; slot<numSlots; slot++)
+	{
+		// Every camera, present or not, takes a trigger period per slot
+		this_thread::sleep_until(start + chrono::microseconds(periodUs * (slot + 1)));
+		if(slot >= silentFrom)
+			continue;
+
+		CameraFrame frame;
+		frame.frameId = slot;
+		frame.rigTime = (uint64_t)slot * periodUs * 1000;
+		frame.missing = (slot >= awayFrom && slot < awayTo);
+		if(!frame.missing)
+			frame.img = Mat(4, 4, CV_8UC1);
+		assembler->Push(camNum, frame);
+	}
+	assembler->Finish(camNum);
+}
+
+
+static int Run(const char *name, int awayFrom, int awayTo, int silentFrom, int expectedFrames)
+{
+	FramesetAssembler assembler(numCams, 200, 64);
+	Counts counts;
+	assembler.AddSink([&counts](Frameset &frameset) {
+		lock_guard<mutex> lock(counts.countMutex);
+		counts.numFramesets++;
+		if((int)frameset.frameId <= counts.lastSlot)
+			counts.inOrder = false;
+		counts.lastSlot = (int)frameset.frameId;
+		for(int i=0; i<numCams; i++)
+		{
+			if(!frameset.frames[i].missing)
+				counts.numFrames[i]++;
+		}
+	});
+	assembler.Start();
+
+	vector<thread> threads;
+	for(int i=0; i<numCams; i++)
+	{
+		if(i == numCams - 1)
+			threads.push_back(thread(Capture, i, &assembler, awayFrom, awayTo, silentFrom));
+		else
+			threads.push_back(thread(Capture, i, &assembler, numSlots, numSlots, numSlots));
+	}
+	for(unsigned int i=0; i<threads.size(); i++)
+		threads[i].join();
+	assembler.Stop();
+
+	int failed = 0;
+	if(assembler.numLate > 0)
+	{
+		cout << name << ": " << assembler.numLate << " frames dropped as late" << endl;
+		failed++;
+	}
+	if(counts.numFramesets != (uint64_t)numSlots || !counts.inOrder)
+	{
+		cout << name << ": " << counts.numFramesets << " framesets of " << numSlots << (counts.inOrder ? "" : ", out of order") << endl;
+		failed++;
+	}
+	for(int i=0; i<numCams; i++)
+	{
+		int expected = (i == numCams - 1) ? expectedFrames : numSlots;
+		if(counts.numFrames[i] != expected)
+		{
+			cout << name << ": camera " << i << " has " << counts.numFrames[i] << " frames in framesets, not " << expected << endl;
+			failed++;
+		}
+	}
+	return failed;
+}
+
+
+int main(int argc, char** argv)
+{
+	int failed = 0;
+
+	// Away from slot 100 to 600, then back
+	failed += Run("away", 100, 600, numSlots, numSlots - 500);
+	// Away from slot 100 to the end, as a camera that failed for good
+	failed += Run("failed", 100, numSlots, numSlots, 100);
+	// Nothing at all after slot 100
+	failed += Run("silent", numSlots, numSlots, 100, 100);
+
+	if(failed > 0)
+	{
+		cout << failed << " checks failed" << endl;
+		return -1;
+	}
+	cout << "All checks passed" << endl;
+	return 0;
+}
@@ -0,0 +1,191 @@
+//
+// Capture thread scaling benchmark.
+//
+// Measures how frameset throughput grows with the number of cameras for the
+// two capture layouts of MultiCamSHM:
+//
+//   single      one thread grabs from every camera in turn (old AcquireImages)
+//   percamera   one capture thread per camera feeding the FramesetAssembler
+//
+// The cameras are synthetic: every frame is a Bayer pattern that is
+// converted to Mono8 and cloned, the per frame work of the capture loop.
+// Frames are produced as fast as the cores allow, so the numbers give the
+// processing capacity of the host, not a camera frame rate.
+//
+// Usage: FramesetScaling [numFrames] [maxCams] [width height]
+//
+// Speedup is the frame rate with N cameras over the frame rate with one
+// camera of the same layout; efficiency is speedup / N. Compare the two
+// layouts on the capture host; what the per camera threads gain depends
+// on its cores and on how much of the frame time is the SDK's.
+//
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "FramesetAssembler.h"
+
+using namespace std;
+using namespace cv;
+
+
+//
+// Camera that produces Bayer frames of a fixed size
+//
+class SyntheticCamera
+{
+public:
+	SyntheticCamera(int width, int height, int camNum)
+		: width(width), height(height), bayer(width * height), frameId(0)
+	{
+		for(int i=0; i<width*height; i++)
+			bayer[i] = (unsigned char)((i * 7 + camNum * 13) & 0xff);
+	}
+
+	// Grab, convert to Mono8 and copy out; as the capture loop does
+	CameraFrame Grab()
+	{
+		Mat converted(height, width, CV_8UC1);
+		unsigned char *dst = converted.data;
+
+		// Average of the 2x2 Bayer cell of each pixel
+		for(int y=0; y<height; y++)
+		{
+			const unsigned char *row = &bayer[(y & ~1) * width];
+			const unsigned char *nextRow = row + width;
+			for(int x=0; x<width; x++)
+			{
+				int x0 = x & ~1;
+				dst[y*width + x] = (unsigned char)((row[x0] + row[x0+1] + nextRow[x0] + nextRow[x0+1] + frameId) >> 2);
+			}
+		}
+
+		CameraFrame frame;
+		frame.img = converted.clone();
+		frame.frameId = frameId;
+		frame.rigTime = frameId * 1000;
+		frame.missing = false;
+		frameId++;
+		return frame;
+	}
+
+private:
+	int width;
+	int height;
+	vector<unsigned char> bayer;
+	uint64_t frameId;
+};
+
+
+void CaptureCamera(SyntheticCamera *camera, int camNum, int numFrames, FramesetAssembler *assembler)
+{
+	for(int i=0; i<numFrames; i++)
+		assembler->Push(camNum, camera->Grab());
+	assembler->Finish(camNum);
+}
+
+
+void CaptureAll(vector<SyntheticCamera*> *cameras, int numFrames, FramesetAssembler *assembler)
+{
+	for(int i=0; i<numFrames; i++)
+	{
+		for(unsigned int camNum=0; camNum<cameras->size(); camNum++)
+			assembler->Push(camNum, (*cameras)[camNum]->Grab());
+	}
+	for(unsigned int camNum=0; camNum<cameras->size(); camNum++)
+		assembler->Finish(camNum);
+}
+
+
+// Framesets per second for numCams cameras
+double RunCapture(int numCams, bool perCamera, int numFrames, int width, int height)
+{
+	vector<SyntheticCamera*> cameras;
+	for(int i=0; i<numCams; i++)
+		cameras.push_back(new SyntheticCamera(width, height, i));
+
+	// Frames are dropped by the sink; only assembly is measured
+	FramesetAssembler assembler(numCams, 1000, 2 * numFrames);
+	assembler.AddSink([](Frameset &frameset) {});
+	assembler.Start();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	vector<thread> threads;
+	if(perCamera)
+	{
+		for(int i=0; i<numCams; i++)
+			threads.push_back(thread(CaptureCamera, cameras[i], i, numFrames, &assembler));
+	}
+	else
+	{
+		threads.push_back(thread(CaptureAll, &cameras, numFrames, &assembler));
+	}
+
+	for(unsigned int i=0; i<threads.size(); i++)
+		threads[i].join();
+	assembler.Stop();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	if(assembler.numFramesets != (uint64_t)numFrames || assembler.numIncomplete > 0)
+		cout << "Warning: " << assembler.numFramesets << " framesets, " << assembler.numIncomplete << " incomplete" << endl;
+
+	for(int i=0; i<numCams; i++)
+		delete cameras[i];
+
+	return assembler.numFramesets / seconds;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int numFrames = 200;
+	int maxCams = thread::hardware_concurrency();
+	int width = 1280;
+	int height = 1024;
+
+	if(argc > 1)
+		numFrames = atoi(argv[1]);
+	if(argc > 2)
+		maxCams = atoi(argv[2]);
+	if(argc > 4)
+	{
+		width = atoi(argv[3]);
+		height = atoi(argv[4]);
+	}
+	if(maxCams < 1)
+		maxCams = 1;
+
+	cout << "Frames per camera: " << numFrames << ", frame size: " << width << "x" << height
+		 << ", cores: " << thread::hardware_concurrency() << endl << endl;
+
+	cout << "cams\tlayout\t\tframesets/s\tframes/s\tspeedup\tefficiency" << endl;
+
+	double singleBase = 0, perCameraBase = 0;
+	for(int numCams=1; numCams<=maxCams; numCams++)
+	{
+		for(int layout=0; layout<2; layout++)
+		{
+			bool perCamera = (layout == 1);
+			double framesetRate = RunCapture(numCams, perCamera, numFrames, width, height);
+			double frameRate = framesetRate * numCams;
+
+			double &base = perCamera ? perCameraBase : singleBase;
+			if(numCams == 1)
+				base = frameRate;
+			double speedup = frameRate / base;
+
+			cout << numCams << "\t" << (perCamera ? "percamera" : "single\t") << "\t"
+				 << framesetRate << "\t\t" << frameRate << "\t\t" << speedup << "\t" << speedup / numCams << endl;
+		}
+	}
+
+	return 0;
+}
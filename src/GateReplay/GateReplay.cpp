@@ -0,0 +1,151 @@
+//
+// Motion gate replay.
+//
+// Runs the motion gate of MultiCamSHM over a recorded image sequence and
+// prints the change of every frame, whether it would have been written and
+// how many writes and bytes the gate saves, so the threshold and the pre-
+// and post-roll can be tuned off the rig:
+//
+// Usage: GateReplay <imageDir> [-threshold t] [-preRoll n] [-postRoll n] [-bits b]
+//
+// The image files of the directory are read in frame order (see
+// ImageFiles), e.g.
+// "GateReplay ../../test_sfm/image -preRoll 1 -postRoll 1". -bits is the
+// significant bits of 16-bit images (default 16).
+//
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+
+#include "MotionGate.h"
+#include "ImageFiles.h"
+
+using namespace std;
+using namespace cv;
+
+
+static uint64_t FileSize(const string &fileName)
+{
+	struct stat info;
+	if(stat(fileName.c_str(), &info) != 0)
+		return 0;
+	return info.st_size;
+}
+
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		cout << "Usage: GateReplay <imageDir> [-threshold t] [-preRoll n] [-postRoll n] [-bits b]" << endl;
+		return -1;
+	}
+
+	string dir = argv[1];
+	MotionGateSettings settings;
+	int bitDepth = 16;
+	for(int i=2; i+1<argc; i+=2)
+	{
+		if(strcmp(argv[i], "-threshold") == 0)
+			settings.threshold = atof(argv[i + 1]);
+		else if(strcmp(argv[i], "-preRoll") == 0)
+			settings.preRoll = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "-postRoll") == 0)
+			settings.postRoll = atoi(argv[i + 1]);
+		else if(strcmp(argv[i], "-bits") == 0)
+			bitDepth = atoi(argv[i + 1]);
+		else
+		{
+			cout << "Unknown option " << argv[i] << endl;
+			return -1;
+		}
+	}
+
+	vector<string> names = FindImages(dir);
+	if(names.empty())
+	{
+		cout << "No images in " << dir << endl;
+		return -1;
+	}
+
+	cout << names.size() << " images, threshold " << settings.threshold << ", pre-roll " << settings.preRoll
+		 << ", post-roll " << settings.postRoll << endl;
+
+	// A rig of one camera
+	MotionDetector detector(settings.threshold, vector<int>(1, bitDepth));
+	MotionGate gate(settings);
+	Frameset frameset;
+	frameset.frames.resize(1);
+	vector<CameraFrame> release, skipped;
+	map<uint64_t, bool> written;
+	double gateTime = 0;
+
+	for(unsigned int i=0; i<names.size(); i++)
+	{
+		CameraFrame frame;
+		frame.img = imread(dir + "/" + names[i], IMREAD_GRAYSCALE | IMREAD_ANYDEPTH);
+		frame.frameId = i;
+		frame.rigTime = 0;
+		frame.missing = frame.img.empty();
+		if(frame.missing)
+			cout << "Unable to read " << names[i] << endl;
+
+		release.clear();
+		skipped.clear();
+		auto gateStart = chrono::steady_clock::now();
+		frameset.frameId = frame.frameId;
+		frameset.frames[0] = frame;
+		frameset.numMissing = frame.missing ? 1 : 0;
+		bool changed = detector.Decide(frameset);
+		gate.Offer(frame, changed, release, skipped);
+		gateTime += chrono::duration<double, milli>(chrono::steady_clock::now() - gateStart).count();
+
+		for(unsigned int r=0; r<release.size(); r++)
+			written[release[r].frameId] = true;
+		for(unsigned int s=0; s<skipped.size(); s++)
+			written[skipped[s].frameId] = false;
+
+		// The change against the reference, the last frame that changed
+		cout << setw(24) << names[i] << "  change " << fixed << setprecision(2) << setw(7) << detector.GetLastDifference()
+			 << (changed ? "  *" : "") << endl;
+	}
+
+	skipped.clear();
+	gate.Flush(skipped);
+	for(unsigned int s=0; s<skipped.size(); s++)
+		written[skipped[s].frameId] = false;
+
+	// Encoded bytes the skipped frames took on disk
+	uint64_t bytesTotal = 0, bytesSkipped = 0;
+	cout << "Written:";
+	for(unsigned int i=0; i<names.size(); i++)
+	{
+		uint64_t size = FileSize(dir + "/" + names[i]);
+		bytesTotal += size;
+		if(written[i])
+			cout << " " << i;
+		else
+			bytesSkipped += size;
+	}
+	cout << endl;
+
+	gate.PrintStatistics(0);
+	cout << "Encoded bytes skipped: " << bytesSkipped << " of " << bytesTotal;
+	if(bytesTotal > 0)
+		cout << " (" << setprecision(1) << 100.0 * bytesSkipped / bytesTotal << "%)";
+	cout << endl;
+	cout << "Gate time: " << setprecision(3) << gateTime / names.size() << " ms per frame" << endl;
+
+	return 0;
+}
@@ -0,0 +1,100 @@
+//
+// Loopback test for the MJPEG preview server. No cameras are needed.
+//
+// Feeds synthetic 1280x1024 frames for a number of fake cameras at capture
+// rate and prints how long PushFrame() takes in the capture loop. While it
+// runs, open http://127.0.0.1:8080/ in a browser or run
+//
+//     curl -s http://127.0.0.1:8080/cam0 > /dev/null
+//
+// several times to check that slow or many clients do not change the push
+// time.
+//
+// Usage: MJPEGServerTest <numCams> <numFrames> [port]
+//
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+
+#include <opencv2/core/core.hpp>
+
+#include "MJPEGServer.h"
+
+using namespace std;
+using namespace cv;
+
+
+// Moving gradient so the stream visibly updates
+void FillFrame(Mat &img, int camNum, int frameNum)
+{
+	for(int y=0; y<img.rows; y++)
+	{
+		uchar *row = img.ptr<uchar>(y);
+		for(int x=0; x<img.cols; x++)
+			row[x] = (uchar)(x + y + 8*frameNum + 40*camNum);
+	}
+}
+
+
+int main(int argc, char *argv[])
+{
+	int numCams = (argc > 1) ? atoi(argv[1]) : 6;
+	int numFrames = (argc > 2) ? atoi(argv[2]) : 10000;
+	int port = (argc > 3) ? atoi(argv[3]) : 8080;
+	double captureFps = 170;
+
+	MJPEGServer previewServer(port);
+	vector<int> camStream(numCams);
+	for(int camNum=0; camNum<numCams; camNum++)
+	{
+		camStream[camNum] = previewServer.AddStream("cam" + to_string(camNum));
+	}
+
+	if(previewServer.Start() < 0)
+		return -1;
+
+	vector<Mat> frames(numCams);
+	for(int camNum=0; camNum<numCams; camNum++)
+	{
+		frames[camNum] = Mat(1024, 1280, CV_8UC1);
+	}
+
+	double pushTime = 0, maxPushTime = 0;
+	chrono::steady_clock::time_point next = chrono::steady_clock::now();
+
+	for(int frameNum=0; frameNum<numFrames; frameNum++)
+	{
+		for(int camNum=0; camNum<numCams; camNum++)
+		{
+			FillFrame(frames[camNum], camNum, frameNum);
+		}
+
+		chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+		for(int camNum=0; camNum<numCams; camNum++)
+		{
+			previewServer.PushFrame(camStream[camNum], frames[camNum]);
+		}
+		double t = chrono::duration<double, micro>(chrono::steady_clock::now() - tStart).count();
+		pushTime += t;
+		maxPushTime = max(maxPushTime, t);
+
+		if((frameNum+1) % 500 == 0)
+		{
+			cout << "Clients: " << previewServer.GetNumClients()
+				 << "  PushFrame avg: " << pushTime/500 << " us"
+				 << "  max: " << maxPushTime << " us" << endl;
+			pushTime = maxPushTime = 0;
+		}
+
+		next += chrono::microseconds((int)(1e6/captureFps));
+		this_thread::sleep_until(next);
+	}
+
+	previewServer.Stop();
+	cout << "Done" << endl;
+
+	return 0;
+}
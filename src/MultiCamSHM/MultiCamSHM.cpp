@@ -6,6 +6,11 @@
 #include <thread>
 #include <mutex>
 #include <future>
+#include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <cstdlib>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -13,6 +18,26 @@
 #include <ctime>
 #include <sys/timeb.h>
 
+#include "ClockSync.h"
+#include "CameraRecovery.h"
+#include "BufferFlush.h"
+#include "HotPlug.h"
+#include "UserSetSnapshot.h"
+#include "RigPlan.h"
+#include "ThreadTopology.h"
+#include "FramesetAssembler.h"
+#include "PixelUnpack.h"
+#include "FlatField.h"
+#include "PixelDefects.h"
+#include "Undistort.h"
+#include "RigExposure.h"
+#include "HdrBracket.h"
+#include "MotionGate.h"
+#include "RawSession.h"
+#include "VideoRecorder.h"
+#include "FramePool.h"
+#include "CaptureProfile.h"
+
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
 using namespace Spinnaker::GenICam;
@@ -21,12 +46,13 @@ using namespace cv;
 
 
 // Function Declarations
-int ConfigureTrigger(INodeMap & nodeMap, bool isPrimary);
+int ConfigureTrigger(INodeMap & nodeMap, bool isPrimary, const char *triggerSource);
 int ResetTrigger(INodeMap & nodeMap);
 int GrabNextImageByTrigger(INodeMap & nodeMap, CameraPtr pCam);
-int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap);
-void emptyImageBuffer(CameraPtr pCam);
-int RunMultipleCameras(CameraList camList);
+int SetImageFormat(INodeMap & nodeMap, const CameraPlan &plan);
+int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap, const CameraPlan &plan);
+void DescribeRigConfiguration(UserSetSnapshot &snapshot, const CameraPlan &plan);
+int RunMultipleCameras(SystemPtr system, CameraList camList, ThreadTopology &topology);
 int getMilliCount();
 int getMilliSpan(int nTimeStart);
 
@@ -45,6 +71,18 @@ const triggerType chosenTrigger = HARDWARE;
 
 std::mutex m;
 
+// Set once all capture threads are done; the writers then drain their buffers
+std::atomic<bool> captureDone(false);
+
+// Cameras, roles and outputs; read from the rig file given on the command line
+RigPlan rig;
+const char *defaultRigFile = "../rig/lab.rig";
+
+// -calibrate dark|flat [numFrames]: average reference frames instead of
+// recording
+string calibrateKind;
+int numCalibrationFrames = 64;
+
 
 int getMilliCount(){
         timeb tb; 
@@ -71,7 +109,7 @@ int getMilliSpan(int nTimeStart){
 // 3. if camera is secondary, trigger overlap is set to readout.
 // 4. trigger selector is set to frame start.
 // 5. trigger is enabled
-int ConfigureTrigger(INodeMap & nodeMap, bool isPrimary)
+int ConfigureTrigger(INodeMap & nodeMap, bool isPrimary, const char *triggerSource)
 {
     int result = 0;
 
@@ -116,7 +154,7 @@ int ConfigureTrigger(INodeMap & nodeMap, bool isPrimary)
 		if(isPrimary == true)
 		{
 			// Set trigger mode to hardware for all primary cameras ('Line2')
-		    CEnumEntryPtr ptrTriggerSourceHardware = ptrTriggerSource->GetEntryByName("Line2");
+		    CEnumEntryPtr ptrTriggerSourceHardware = ptrTriggerSource->GetEntryByName(triggerSource);
 		    if (!IsAvailable(ptrTriggerSourceHardware) || !IsReadable(ptrTriggerSourceHardware))
 		    {
 		     	cout << "Unable to set trigger mode (enum entry retrieval). Aborting..." << endl;
@@ -124,7 +162,7 @@ int ConfigureTrigger(INodeMap & nodeMap, bool isPrimary)
 		    }
 
 		    ptrTriggerSource->SetIntValue(ptrTriggerSourceHardware->GetValue());
-		    cout << "Trigger source for primary camera set to hardware Line2" << endl;
+		    cout << "Trigger source for primary camera set to " << triggerSource << endl;
 
 
 	#if 0   //Enable the 3.3V option i.e. make it true
@@ -156,7 +194,7 @@ int ConfigureTrigger(INodeMap & nodeMap, bool isPrimary)
 			///////////////////////
             //TriggerSource = Line3
 			///////////////////////
-            CEnumEntryPtr ptrTriggerSourceHardware = ptrTriggerSource->GetEntryByName("Line3");
+            CEnumEntryPtr ptrTriggerSourceHardware = ptrTriggerSource->GetEntryByName(triggerSource);
             if (!IsAvailable(ptrTriggerSourceHardware) || !IsReadable(ptrTriggerSourceHardware))
             {
                 cout << "Unable to set trigger mode (enum entry retrieval). Aborting..." << endl;
@@ -164,7 +202,7 @@ int ConfigureTrigger(INodeMap & nodeMap, bool isPrimary)
             }
 
             ptrTriggerSource->SetIntValue(ptrTriggerSourceHardware->GetValue());
-            cout << "Secondary Camera: TriggerSource = Line3." << endl;
+            cout << "Secondary Camera: TriggerSource = " << triggerSource << "." << endl;
 			//TriggerSource set to Line3
 
 	
@@ -278,10 +316,82 @@ int ResetTrigger(INodeMap & nodeMap)
 
 
 
+//////////////////////////////////////////////////////
+// Set ROI, pixel format and frame rate of the rig plan
+//////////////////////////////////////////////////////
+int SetImageFormat(INodeMap & nodeMap, const CameraPlan &plan)
+{
+	try
+	{
+		if (!plan.pixelFormat.empty())
+		{
+			CEnumerationPtr ptrPixelFormat = nodeMap.GetNode("PixelFormat");
+			if (!IsAvailable(ptrPixelFormat) || !IsWritable(ptrPixelFormat))
+			{
+				cout << "Unable to set pixel format. Aborting..." << endl;
+				return -1;
+			}
+			ptrPixelFormat->FromString(plan.pixelFormat.c_str());
+			cout << "Pixel format set to " << plan.pixelFormat << endl;
+		}
+
+		if (plan.width > 0 && plan.height > 0)
+		{
+			CIntegerPtr ptrOffsetX = nodeMap.GetNode("OffsetX");
+			CIntegerPtr ptrOffsetY = nodeMap.GetNode("OffsetY");
+			CIntegerPtr ptrWidth = nodeMap.GetNode("Width");
+			CIntegerPtr ptrHeight = nodeMap.GetNode("Height");
+			if (!IsAvailable(ptrOffsetX) || !IsWritable(ptrOffsetX) || !IsAvailable(ptrOffsetY) || !IsWritable(ptrOffsetY)
+				|| !IsAvailable(ptrWidth) || !IsWritable(ptrWidth) || !IsAvailable(ptrHeight) || !IsWritable(ptrHeight))
+			{
+				cout << "Unable to set ROI. Aborting..." << endl;
+				return -1;
+			}
+
+			// Offsets first to zero so any width and height fit
+			ptrOffsetX->SetValue(0);
+			ptrOffsetY->SetValue(0);
+			ptrWidth->SetValue(plan.width);
+			ptrHeight->SetValue(plan.height);
+			ptrOffsetX->SetValue(plan.offsetX);
+			ptrOffsetY->SetValue(plan.offsetY);
+			cout << "ROI set to " << plan.width << "x" << plan.height << " at " << plan.offsetX << "," << plan.offsetY << endl;
+		}
+
+		if (plan.fps > 0)
+		{
+			// Named AcquisitionFrameRateEnabled on older firmware
+			CBooleanPtr ptrFrameRateEnable = nodeMap.GetNode("AcquisitionFrameRateEnable");
+			if (!IsAvailable(ptrFrameRateEnable))
+				ptrFrameRateEnable = nodeMap.GetNode("AcquisitionFrameRateEnabled");
+			if (IsAvailable(ptrFrameRateEnable) && IsWritable(ptrFrameRateEnable))
+				ptrFrameRateEnable->SetValue(true);
+
+			CFloatPtr ptrFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
+			if (!IsAvailable(ptrFrameRate) || !IsWritable(ptrFrameRate))
+			{
+				cout << "Unable to set frame rate. Aborting..." << endl;
+				return -1;
+			}
+			ptrFrameRate->SetValue(min(plan.fps, ptrFrameRate->GetMax()));
+			cout << "Frame rate set to " << ptrFrameRate->GetValue() << " fps" << endl;
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
 ///////////////////////////////
 // Function to configure Camera
 ///////////////////////////////
-int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap) 
+int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap, const CameraPlan &plan) 
 {
 
     //
@@ -357,7 +467,7 @@ int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap)
 		
 			// Ensure desired exposure time does not exceed the maximum
 			const double exposureTimeMax = ptrExposureTime->GetMax();
-			double exposureTimeToSet = 5500.0;
+			double exposureTimeToSet = plan.exposureTime;
 
 			if (exposureTimeToSet > exposureTimeMax)
 			{
@@ -368,6 +478,23 @@ int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap)
 		
 			cout << "Exposure time set to " << exposureTimeToSet << " us..." << endl << endl;
 
+			// Readout mode of the profile; a roi of the rig is set after it,
+			// by SetImageFormat()
+			if (!plan.profile.empty())
+			{
+				CaptureProfileResult profileResult;
+				profileResult.serial = plan.serial;
+				if (ApplyCaptureProfile(nodeMap, *FindCaptureProfile(plan.profile), plan.exposureTime, profileResult) < 0)
+				{
+					cout << "Unable to apply capture profile " << plan.profile << ". Aborting..." << endl << endl;
+					return -1;
+				}
+				PrintCaptureProfileReport(vector<CaptureProfileResult>(1, profileResult), cout);
+			}
+
+			if (SetImageFormat(nodeMap, plan) < 0)
+				return -1;
+
 #if 0
 		    // Setting up Acquisition frame rate --------------------------------------------//
 		    CFloatPtr ptrAcquisitionFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
@@ -413,9 +540,6 @@ int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap)
 		    acquisitionFrameRate = static_cast<float>(ptrAcquisitionFrameRate->GetValue());
 		    cout << "Acquisition Frame Rate: " << acquisitionFrameRate << endl << endl;
 
-		    // Begin acquiring images
-		    pCam->BeginAcquisition();
-
     	} 
 		catch (Spinnaker::Exception &e) 
 		{
@@ -473,160 +597,427 @@ int GrabNextImageByTrigger(INodeMap & nodeMap, CameraPtr pCam)
 
 
 
-////////////////
-// AcquireImages
-////////////////
+/////////////////////////////////////////
+// Settings stored in the camera user set
+/////////////////////////////////////////
 //
-// This function  acquires images from all the initialized cameras
+// Must list what ConfigureTrigger() and ConfigureCamera() set. A change
+// here changes the hash, so every camera gets the full configuration
+// once and is snapshotted again. Nodes whose value comes from the camera
+// (the ROI of a profile, the frame rate without fps) are listed with a
+// placeholder; their read back values still go into the hash.
 //
-void AcquireImages(CameraList camList, vector< vector<Mat> > &bufferList)
+void DescribeRigConfiguration(UserSetSnapshot &snapshot, const CameraPlan &plan)
 {
-    int result = 0;
-    int counter = 0;
-	vector<int> v_time;
-    int imgCount = 0;
-	int numImages = 1000;
-	int numCams = camList.GetSize();
-	CameraPtr camPtr[numCams];
-	ImagePtr pResultImage[numCams];
+	snapshot.Add("AcquisitionMode", "Continuous");
+	snapshot.Add("ExposureAuto", "Off");
+	snapshot.Add("ExposureTime", to_string(plan.exposureTime).c_str());
 
-	// Extract cameras from camList
-	for(int i=0; i<numCams; i++)
+	if(!plan.pixelFormat.empty())
+		snapshot.Add("PixelFormat", plan.pixelFormat.c_str());
+	if(!plan.profile.empty())
 	{
-		camPtr[i] = camList.GetByIndex(i);
+		const CaptureProfile *profile = FindCaptureProfile(plan.profile);
+		snapshot.Add("BinningHorizontal", to_string(profile->binning).c_str());
+		snapshot.Add("BinningVertical", to_string(profile->binning).c_str());
+		snapshot.Add("DecimationHorizontal", to_string(profile->decimation).c_str());
+		snapshot.Add("DecimationVertical", to_string(profile->decimation).c_str());
+	}
+	if(plan.width > 0 && plan.height > 0)
+	{
+		snapshot.Add("Width", to_string(plan.width).c_str());
+		snapshot.Add("Height", to_string(plan.height).c_str());
+		snapshot.Add("OffsetX", to_string(plan.offsetX).c_str());
+		snapshot.Add("OffsetY", to_string(plan.offsetY).c_str());
+	}
+	else if(!plan.profile.empty())
+	{
+		snapshot.Add("Width", plan.profile.c_str());
+		snapshot.Add("Height", plan.profile.c_str());
+		snapshot.Add("OffsetX", plan.profile.c_str());
+		snapshot.Add("OffsetY", plan.profile.c_str());
 	}
-	
-	// Acquire Images from all the cameras at the same time
-    try
-    {
-        int start = getMilliCount();
 
-		// Empty image buffer before capturing images
-		// emptyImageBuffer(pCam);
-		// Buffer emptied
-	
-		cout << "Acquiring Images" << endl;
+	// Either name of the enable, see SetImageFormat(); a missing node is
+	// hashed by name only
+	const char *frameRate = (plan.fps > 0) ? "1" : "camera";
+	snapshot.Add("AcquisitionFrameRateEnable", frameRate);
+	snapshot.Add("AcquisitionFrameRateEnabled", frameRate);
+	snapshot.Add("AcquisitionFrameRate", (plan.fps > 0) ? to_string(plan.fps).c_str() : frameRate);
+
+	if(plan.isPrimary)
+	{
+		snapshot.Add("TriggerMode", "Off");
+		snapshot.Add("TriggerSource", plan.triggerSource.c_str());
+	}
+	else
+	{
+		snapshot.Add("TriggerSource", plan.triggerSource.c_str());
+		snapshot.Add("TriggerOverlap", "ReadOut");
+		snapshot.Add("TriggerSelector", "FrameStart");
+		snapshot.Add("TriggerMode", "On");
+	}
+}
+
+
+
+
+/////////////
+// ImageToMat
+/////////////
+//
+// Copies a grabbed image into a Mat owned by the caller; a frame of pool
+// when it is given
+//
+void ImageToMat(ImagePtr pResultImage, Mat &img, FramePool *pool = NULL)
+{
+	// 12 and 16 bit formats are kept at full depth, in a 16 bit image
+	UnpackFormat unpackFormat = UnpackFormatFromName(pResultImage->GetPixelFormatName().c_str());
+	bool wide = (unpackFormat != UNPACK_UNSUPPORTED && unpackFormat != UNPACK_MONO8);
+	if (pool != NULL)
+		img = pool->Get(pResultImage->GetHeight(), pResultImage->GetWidth(), wide ? CV_16UC1 : CV_8UC1);
+
+	if (wide)
+	{
+		UnpackImage((const uint8_t *)pResultImage->GetData(), pResultImage->GetStride(),
+		            pResultImage->GetWidth(), pResultImage->GetHeight(), unpackFormat, img);
+	}
+	else
+	{
+		// Convert image to Mono8
+		ImagePtr convertedImage = pResultImage->Convert(PixelFormat_BayerRG8, HQ_LINEAR);
+
+		unsigned int rowBytes = (int)convertedImage->GetImageSize()/convertedImage->GetHeight();
+
+		Mat imgTemp = Mat(convertedImage->GetHeight(),
+		              convertedImage->GetWidth(), CV_8UC1, convertedImage->GetData(), rowBytes);
+		imgTemp.copyTo(img);
+	}
+}
+
+
+
+////////////////
+// CaptureCamera
+////////////////
+//
+// Capture thread of one camera. Each camera has its own thread, so a slow
+// or re-arming camera does not hold up the others; the assembler puts the
+// frames of all cameras back together into framesets.
+//
+// With a bracket, merger is set: the corrected frames go to it instead of
+// the assembler, and its merge thread undistorts and pushes the HDR frames.
+//
+void CaptureCamera(int camNum, CameraRecovery *recovery, FramesetAssembler &assembler, ClockSync &clockSync, ThreadTopology &topology, FlatFieldCorrector &corrector, DefectCorrector &defects, UndistortMap &lens, RigExposure *exposure, HdrMerger *merger)
+{
+	topology.PlaceAcquisition(camNum, "capture " + rig.cameras[camNum].serial);
+
+	// Frame memory on the NUMA node of the camera, allocated by this
+	// thread and reused
+	topology.BindMemory(camNum);
+	FramePool pool;
+
+	// rig.numImages framesets of numSteps frames each
+	int numSteps = max((int)rig.cameras[camNum].bracket.size(), 1);
+	int numImages = rig.numImages * numSteps;
 
+	// Flat field correction on the cores of this camera
+	int numCorrectionThreads = max((int)rig.cameras[camNum].cpus.size(), 1);
+
+	// Frame IDs of the camera, re-based to count from 0 at the first slot
+	uint64_t firstFrameId = 0;
+	uint64_t lastCameraFrameId = 0;
+	uint64_t nextId = 0;
+	bool started = false;
+
+	try
+	{
 		for(int imgNum=0; imgNum<numImages; imgNum++)
-        {
-            // Retrieve the next image from the trigger
-            //result = result | GrabNextImageByTrigger(primaryNodeMap, primaryCam);
+		{
+			// Returns NULL if the slot is missing; the camera then recovers
+			// on its own, or rejoins after being unplugged
+			ImagePtr pResultImage = recovery->GrabNext();
 
-			// Repeat the below line for each camera. Avoiding for loop for performance gain
-			pResultImage[0] = camPtr[0]->GetNextImage();
-			pResultImage[1] = camPtr[1]->GetNextImage();
-			
-			// Add the images from each camera to their respetive buffer
-			for(int camNum=0; camNum<numCams; camNum++)
-			{	
+			CameraFrame frame;
+			frame.rigTime = 0;
+			frame.missing = !pResultImage.IsValid();
+			int step = -1;
 
-				if (pResultImage[camNum]->IsIncomplete())
+			if (frame.missing)
+			{
+				frame.frameId = nextId;
+			}
+			else
+			{
+				// The camera restarts counting after a re-arm or a rejoin;
+				// carry on from the current slot
+				uint64_t cameraFrameId = pResultImage->GetFrameID();
+				if (!started || cameraFrameId <= lastCameraFrameId)
 				{
-		        	cout << "Image incomplete with image status " << pResultImage[camNum]->GetImageStatus() << "..." << endl << endl;
-					camPtr[camNum]->EndAcquisition();	
+					firstFrameId = cameraFrameId - nextId;
+					started = true;
 				}
-				else
-		        {
-				    // Convert image to Mono8
-				    ImagePtr convertedImage = pResultImage[camNum]->Convert(PixelFormat_BayerRG8, HQ_LINEAR);
+				lastCameraFrameId = cameraFrameId;
+				frame.frameId = cameraFrameId - firstFrameId;
 
-					// Add image to buffer
-					unsigned int rowBytes = (int)convertedImage->GetImageSize()/convertedImage->GetHeight();
+				// Stamp the frame with the unified rig time
+				frame.rigTime = clockSync.ToRigTime(camNum, pResultImage->GetTimeStamp());
 
-					Mat imgTemp = Mat(convertedImage->GetHeight(),
-				                  convertedImage->GetWidth(), CV_8UC1, convertedImage->GetData(), rowBytes);
-					m.lock();
-					bufferList[camNum].push_back(imgTemp.clone());
-					m.unlock();
+				ImageToMat(pResultImage, frame.img, &pool);
+				corrector.Apply(frame.img, numCorrectionThreads);
+				defects.Apply(frame.img);
 
+				if (merger != NULL)
+				{
+					step = BracketStep(pResultImage, frame.frameId, numSteps);
+				}
+				else
+				{
+					lens.Apply(frame.img, numCorrectionThreads);
 
-	#if 0
-					if(imgCount == 0)
-						imageBuffer.pop_front();
-					else
-					{	
-						cv::imshow("Camera-1", imageBuffer.front());
-						imageBuffer.pop_front();
-					}
-	#endif
+					// Statistics of every few frames for the rig exposure
+					if (exposure != NULL)
+						exposure->Offer(camNum, frame.frameId, frame.img);
+				}
 
-	#if 0                		
-					// Calculate FPS
-			   		int timeElapsed = getMilliSpan(start);
-				    v_time.push_back(timeElapsed);
-
-				    if (v_time.size() > 10)
-				    {
-				    	int t = timeElapsed-v_time[v_time.size()-10];
-				        double fps = 10000.0/t;
-				        cout << fps << endl;
-				    }
-					//cv::waitKey(1);
-	#endif
-		   		}
 				// Release Image
-		       	pResultImage[camNum]->Release();
-				
-		  	}// End of camera loop
-
-			// End acquisiton for the camera	  
-			//pCam->EndAcquisition();
-		}// End of image loop
-  
-  	}// End of Try block
+				pResultImage->Release();
+			}
+
+			nextId = frame.frameId + 1;
+			if (merger != NULL)
+				merger->Push(frame, step);
+			else
+				assembler.Push(camNum, frame);
+		}
+	}
 	catch (Spinnaker::Exception &e)
-    {
-        cout << "Error: " << e.what() << endl;
-        result = -1;
-    }
+	{
+		cout << "Camera " << camNum << ": Error: " << e.what() << endl;
+	}
+
+	// The last brackets reach the assembler before the camera finishes
+	if (merger != NULL)
+		merger->Stop();
+	assembler.Finish(camNum);
 
-    //return result;
-	cout << endl <<"Finished Acquiring Images... " <<endl;
+	if (pool.numMisses > 0)
+		cout << "Camera " << camNum << ": " << pool.numMisses << " frames allocated outside the pool of " << pool.GetSize() << endl;
 }
 
 
 
 
-void SaveImages(int camNum, vector<Mat> &imageBuffer)
+////////////////////
+// CaptureReference
+////////////////////
+//
+// Calibration mode: averages numCalibrationFrames frames of camNum into its
+// dark or flat reference frame, stored under the camera serial
+//
+void CaptureReference(int camNum, CameraRecovery *recovery, ThreadTopology &topology, int *result)
+{
+	topology.PlaceAcquisition(camNum, "reference " + rig.cameras[camNum].serial);
+
+	FrameAverager averager;
+	Mat img;
+
+	try
+	{
+		for(int imgNum=0; imgNum<numCalibrationFrames; imgNum++)
+		{
+			ImagePtr pResultImage = recovery->GrabNext();
+			if (!pResultImage.IsValid())
+				continue;
+
+			ImageToMat(pResultImage, img);
+			pResultImage->Release();
+
+			if (averager.Add(img) < 0)
+				cout << "Camera " << camNum << ": frame size changed during calibration" << endl;
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Camera " << camNum << ": Error: " << e.what() << endl;
+	}
+
+	if (averager.GetCount() < numCalibrationFrames / 2)
+	{
+		cout << "Camera " << camNum << ": only " << averager.GetCount() << " of " << numCalibrationFrames << " frames. Reference not saved." << endl;
+		*result = -1;
+		return;
+	}
+
+	Mat mean = averager.GetMean();
+	string fileName = ReferenceFileName(rig.calibrationDir, rig.cameras[camNum].serial, calibrateKind);
+	if (SaveReference(fileName, mean, averager.GetCount()) < 0)
+	{
+		*result = -1;
+		return;
+	}
+
+	double level = 0;
+	for(int y=0; y<mean.rows; y++)
+	{
+		const float *row = mean.ptr<float>(y);
+		for(int x=0; x<mean.cols; x++)
+			level += row[x];
+	}
+	cout << "Camera " << camNum << ": " << calibrateKind << " frame of " << averager.GetCount() << " images, mean level "
+		 << level / ((double)mean.rows * mean.cols) << " -> " << fileName << endl;
+}
+
+
+
+////////////////
+// SaveImages
+////////////////
+//
+// Writer thread of one camera. Files are numbered by frameset slot from 1.
+// With a motion gate, frames of static stretches are not written; their
+// slots are listed as "gated" in the timestamps file. motion decides which
+// slots changed for all cameras at once, so every camera writes the same
+// framesets. With "format: raw"
+// the frames go into frames.raws instead of one file each, as they are or
+// losslessly compressed with rawCodec (see BayerCodec); with
+// "format: mjpg" or "h264" into video files, encoded on a thread of their
+// own (see VideoRecorder). Frames the encoder has no room for are listed
+// as "dropped".
+//
+void SaveImages(int camNum, vector<CameraFrame> &imageBuffer, ThreadTopology &topology, MotionDetector *motion)
 {
+	topology.PlaceWriter(camNum, "writer " + rig.cameras[camNum].serial);
 	cout << "Saving from Camera: " << camNum << endl;	
 	
 	int result = 0;
-	int numImages = 1000;
 	vector<int> v_time;
 	int start = getMilliCount();
 	int imgCount = 1;
+	int numSaved = 0;
+	const char *outputDir = rig.cameras[camNum].outputDir.c_str();
+
+	MotionGate *gate = NULL;
+	if(motion != NULL)
+	{
+		MotionGateSettings settings;
+		settings.threshold = rig.gateThreshold;
+		settings.preRoll = rig.gatePreRoll;
+		settings.postRoll = rig.gatePostRoll;
+		gate = new MotionGate(settings);
+	}
+	vector<CameraFrame> release, skipped;
+
+	RawWriter raw;
+	if(rig.recordFormat == "raw")
+	{
+		const string &pixelFormat = rig.cameras[camNum].pixelFormat;
+		int bitDepth = rig.cameras[camNum].bracket.empty() ? rig.cameras[camNum].bitsPerPixel : 16;
+		if(raw.Open(rig.cameras[camNum].outputDir + "/frames.raws", pixelFormat.empty() ? "BayerRG8" : pixelFormat, bitDepth,
+		            ParseRawCodec(rig.rawCodec), rig.rawThreads) < 0)
+		{
+			delete gate;
+			return;
+		}
+	}
+
+	VideoRecorder *video = NULL;
+	if(rig.recordFormat == "mjpg" || rig.recordFormat == "h264")
+	{
+		VideoSettings settings;
+		settings.codec = rig.recordFormat;
+		settings.frameRate = (rig.videoFps > 0) ? rig.videoFps : (rig.cameras[camNum].fps > 0 ? rig.cameras[camNum].fps : 30);
+		settings.quality = rig.videoQuality;
+		settings.bitrate = rig.videoBitrate;
+		settings.segmentMB = rig.segmentMB;
+		settings.segmentSeconds = rig.segmentSeconds;
+		settings.maxQueue = rig.videoQueue;
+		const string &pixelFormat = rig.cameras[camNum].pixelFormat;
+		int bitDepth = rig.cameras[camNum].bracket.empty() ? rig.cameras[camNum].bitsPerPixel : 16;
+		video = new VideoRecorder(rig.cameras[camNum].outputDir + "/video", pixelFormat.empty() ? "BayerRG8" : pixelFormat, bitDepth, settings);
+		video->Start();
+	}
 
 	std::this_thread::sleep_for(std::chrono::seconds(2));
 
+	// Rig timestamp of every saved image
+	char timeFileName[1000];
+	sprintf(timeFileName, "%s/timestamps.txt", outputDir);
+	ofstream timeFile(timeFileName);
+
 	try
 	{
 
-		while(imgCount <= numImages)
+		while(true)
 		{
-			//while(imageBuffer.empty())
-				//std::this_thread::sleep_for(std::chrono::nanoseconds(1));
-				//this_thread::yield();
-			
+			// Don't spin on an empty buffer; the capture threads need the cores
+			if(imageBuffer.empty())
+			{
+				if(captureDone)
+					break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
 			
 			char fileName[1000];
-		
-			// Create unique filename
-			if(camNum == 1)
-				sprintf(fileName, "/home/umh-admin/Downloads/spinnaker_1_0_0_295_amd64/bin/bufferTest/Cam1/%d.jpg", imgCount);
-			else if(camNum == 2)
-				sprintf(fileName, "/home/umh-admin/Downloads/spinnaker_1_0_0_295_amd64/bin/bufferTest/Cam2/%d.jpg", imgCount);
-
 
 			// Pop front image from the buffer
 			if(!imageBuffer.empty())
 			{
 				// Don't save. Wait till the next image is available
 				m.lock();
-				Mat imgTemp = imageBuffer.front();
+				CameraFrame frame = imageBuffer.front();
 				imageBuffer.erase(imageBuffer.begin());
 				m.unlock();
-				imwrite(fileName, imgTemp);
+
+				// The slot goes with the frame through the gate
+				frame.frameId = imgCount;
+				release.clear();
+				skipped.clear();
+				if(gate != NULL)
+					gate->Offer(frame, motion->Changed(imgCount), release, skipped);
+				else
+					release.push_back(frame);
+
+				for(unsigned int i=0; i<skipped.size(); i++)
+				{
+					timeFile << skipped[i].frameId << (skipped[i].missing ? " missing" : " gated") << endl;
+				}
+				for(unsigned int i=0; i<release.size(); i++)
+				{
+					CameraFrame &out = release[i];
+					if(out.missing)
+					{
+						timeFile << out.frameId << " missing" << endl;
+						continue;
+					}
+
+					if(video != NULL)
+					{
+						if(!video->Push(out.img, out.frameId, out.rigTime))
+						{
+							timeFile << out.frameId << " dropped" << endl;
+							continue;
+						}
+					}
+					else if(raw.IsOpen())
+					{
+						if(raw.Write(out.img, out.frameId, out.rigTime) < 0)
+						{
+							cout << "Camera " << camNum << ": unable to write frame " << out.frameId << endl;
+							continue;
+						}
+					}
+					else
+					{
+						// Create unique filename. JPEG is 8 bit only; 16 bit
+						// images go to lossless PNG.
+						sprintf(fileName, "%s/%d.%s", outputDir, (int)out.frameId, (out.img.depth() == CV_16U) ? "png" : "jpg");
+						imwrite(fileName, out.img);
+					}
+					timeFile << out.frameId << " " << out.rigTime << endl;
+					numSaved++;
+				}
 #if 0
 				Mat imgTemp = bufferList[camNum][imgCount];
 				cout << "Saving. Cam: " << camNum << " Image: " << imgCount << endl;
@@ -649,12 +1040,36 @@ void SaveImages(int camNum, vector<Mat> &imageBuffer)
 			}
 			
 		}
-		cout << "Saved Images: " << numImages << endl;
+		if(gate != NULL)
+		{
+			skipped.clear();
+			gate->Flush(skipped);
+			for(unsigned int i=0; i<skipped.size(); i++)
+			{
+				timeFile << skipped[i].frameId << (skipped[i].missing ? " missing" : " gated") << endl;
+			}
+			gate->PrintStatistics(camNum);
+		}
+		if(video != NULL)
+		{
+			video->Stop();
+			video->PrintStatistics("Camera " + to_string(camNum) + " video");
+		}
+		cout << "Saved Images: " << numSaved << " of " << imgCount-1 << endl;
+		if(raw.IsOpen())
+		{
+			cout << "Camera " << camNum << ": " << raw.bytesWritten / (1024 * 1024) << " MB raw";
+			if(rig.rawCodec != "none" && raw.bytesWritten > 0)
+				cout << ", " << rig.rawCodec << " " << (double)raw.frameBytes / raw.bytesWritten << ":1";
+			cout << endl;
+		}
 	}catch (Spinnaker::Exception &e)
     {
         cout << "Error: " << e.what() << endl;
         result = -1;
     }
+	delete gate;
+	delete video;
 	//return result;
 }
 
@@ -687,33 +1102,173 @@ void SaveImages(vector<int> &imageBuffer)
 #endif
 
 
-///////////////////
-// emptyImageBuffer
-///////////////////
-
+////////////////
+// RecordImages
+////////////////
 //
-// Function to clear buffer before acquiring images
+// Captures rig.numImages framesets: one capture and one writer thread per
+// camera. Frames are corrected with the dark and flat references and the
+// defect map of the camera when the calibration directory has them, then
+// undistorted when the camera has a lens calibration. exposure is NULL
+// unless the rig has autoExposure. With a bracket, every frameset holds
+// the HDR frames merged from one bracket of each camera.
 //
-void emptyImageBuffer(CameraPtr pCam)
-{	
-		try
-		{
-			// Get next image
-			ImagePtr pResultImage = pCam->GetNextImage();
+int RecordImages(vector<CameraRecovery*> &recovery, vector< vector<CameraFrame> > &bufferList, ClockSync &clockSync, ThreadTopology &topology, RigExposure *exposure)
+{
+	vector<FlatFieldCorrector> correctors(recovery.size());
+	for(unsigned int i=0; i<recovery.size(); i++)
+	{
+		int loaded = correctors[i].Load(rig.calibrationDir, rig.cameras[i].serial);
+		if(loaded < 0)
+			return -1;
+		if(loaded == 0)
+			cout << "Camera " << i << ": correcting with" << (correctors[i].hasDark ? " dark" : "")
+				 << (correctors[i].hasFlat ? " flat" : "") << " reference" << endl;
+	}
 
-			while(pResultImage != NULL)
-			{
-				pResultImage = pCam->GetNextImage(1000);
-				pResultImage->Release();
+	vector<DefectCorrector> defectCorrectors(recovery.size());
+	for(unsigned int i=0; i<recovery.size(); i++)
+	{
+		const string &format = rig.cameras[i].pixelFormat;
+		bool bayer = format.empty() || format.compare(0, 5, "Bayer") == 0;
+		if(defectCorrectors[i].Load(rig.calibrationDir, rig.cameras[i].serial, bayer) < 0)
+			return -1;
+		if(defectCorrectors[i].IsActive())
+			cout << "Camera " << i << ": replacing " << defectCorrectors[i].GetNumDefects() << " defective pixels" << endl;
+	}
+
+	// Remap tables are built here, not in the capture threads
+	vector<UndistortMap> lenses(recovery.size());
+	for(unsigned int i=0; i<recovery.size(); i++)
+	{
+		if(rig.cameras[i].lensFile.empty())
+			continue;
+		// Raw Bayer frames are remapped one colour plane at a time
+		const string &format = rig.cameras[i].pixelFormat;
+		bool bayer = format.empty() || format.compare(0, 5, "Bayer") == 0;
+		if(lenses[i].Load(rig.cameras[i].lensFile, bayer) < 0)
+			return -1;
+		cout << "Camera " << i << ": undistorting with " << rig.cameras[i].lensFile << endl;
+	}
+
+	// One change decision per frameset for the writers of all cameras.
+	// Merged HDR frames use the full 16 bits.
+	MotionDetector *motion = NULL;
+	if(rig.motionGate)
+	{
+		vector<int> bitDepths;
+		for(unsigned int i=0; i<recovery.size(); i++)
+			bitDepths.push_back(rig.cameras[i].bracket.empty() ? rig.cameras[i].bitsPerPixel : 16);
+		motion = new MotionDetector(rig.gateThreshold, bitDepths);
+	}
+
+	// Framesets go to the writer buffers, after the motion decision for
+	// their slot. Spread of the rig timestamps within each frameset.
+	double skewSum = 0, skewMax = 0;
+	int numSkewFramesets = 0;
+	FramesetAssembler assembler(recovery.size());
+	assembler.AddSink([&](Frameset &frameset)
+	{
+		if(motion != NULL)
+			motion->Decide(frameset);
 
+		uint64_t firstTime = UINT64_MAX, lastTime = 0;
+		m.lock();
+		for(unsigned int i=0; i<frameset.frames.size(); i++)
+		{
+			CameraFrame &frame = frameset.frames[i];
+			if(!frame.missing)
+			{
+				firstTime = min(firstTime, frame.rigTime);
+				lastTime = max(lastTime, frame.rigTime);
 			}
-			pResultImage->Release();
+			bufferList[i].push_back(frame);
 		}
-		catch(Spinnaker::Exception &e)
-        {
-        	cout << "Camera buffer cleared"  << endl;
-        }
-	
+		m.unlock();
+
+		if((int)frameset.frames.size() - frameset.numMissing > 1)
+		{
+			double skew = (lastTime - firstTime) / 1000.0;
+			skewSum += skew;
+			skewMax = max(skewMax, skew);
+			numSkewFramesets++;
+		}
+	});
+	assembler.Start();
+
+	// One merger per camera, on the cores of the camera
+	vector<HdrMerger*> mergers(recovery.size(), NULL);
+	for(unsigned int i=0; i<recovery.size() && !rig.cameras[i].bracket.empty(); i++)
+	{
+		int numMergeThreads = max((int)rig.cameras[i].cpus.size(), 1);
+		mergers[i] = new HdrMerger(rig.cameras[i].bracket, rig.cameras[i].bitsPerPixel, numMergeThreads);
+		mergers[i]->SetSink([&, i, numMergeThreads](CameraFrame &frame)
+		{
+			if(!frame.missing)
+				lenses[i].Apply(frame.img, numMergeThreads);
+			assembler.Push(i, frame);
+		});
+		mergers[i]->Start();
+	}
+
+	cout << "Acquiring Images" << endl;
+	int acquisitionStart = getMilliCount();
+
+	vector<thread> captureThreads;
+	for(unsigned int i=0; i<recovery.size(); i++)
+	{
+		captureThreads.push_back(thread(CaptureCamera, i, recovery[i], std::ref(assembler), std::ref(clockSync), std::ref(topology), std::ref(correctors[i]), std::ref(defectCorrectors[i]), std::ref(lenses[i]), exposure, mergers[i]));
+	}
+	vector<thread> saveThreads;
+	for(unsigned int i=0; i<recovery.size(); i++)
+	{
+		saveThreads.push_back(thread(SaveImages, i, std::ref(bufferList[i]), std::ref(topology), motion));
+	}
+
+	for(unsigned int i=0; i<captureThreads.size(); i++)
+	{
+		captureThreads[i].join();
+	}
+	assembler.Stop();
+	int acquisitionTime = getMilliSpan(acquisitionStart);
+	captureDone = true;
+
+	cout << endl << "Finished Acquiring Images... " << endl;
+	for(unsigned int i=0; i<recovery.size(); i++)
+	{
+		recovery[i]->PrintStatistics();
+	}
+	assembler.PrintStatistics();
+	if(exposure != NULL)
+		exposure->PrintReport();
+	for(unsigned int i=0; i<mergers.size(); i++)
+	{
+		if(mergers[i] == NULL)
+			continue;
+		mergers[i]->PrintStatistics(i);
+		delete mergers[i];
+	}
+	if(acquisitionTime > 0)
+	{
+		cout << "Acquisition: " << acquisitionTime << " ms, " << assembler.numFramesets * 1000.0 / acquisitionTime << " framesets/s" << endl;
+	}
+	if(numSkewFramesets > 0)
+	{
+		cout << "Frameset skew in rig time: mean " << skewSum/numSkewFramesets << " us, max " << skewMax << " us" << endl;
+		cout << "Clock sync residual skew: " << clockSync.GetResidualSkew()/1000.0 << " us" << endl;
+	}
+
+	for(unsigned int i=0; i<saveThreads.size(); i++)
+	{
+		saveThreads[i].join();
+	}
+	if(motion != NULL)
+	{
+		motion->PrintStatistics();
+		delete motion;
+	}
+
+	return 0;
 }
 
 
@@ -727,22 +1282,33 @@ void emptyImageBuffer(CameraPtr pCam)
 
 
 // Function to initialize and deinitialize each camera
-int RunMultipleCameras(CameraList camList)
+int RunMultipleCameras(SystemPtr system, CameraList camList, ThreadTopology &topology)
 {
     int result = 0;
 	int bufferSize = 3000;
 	CameraPtr pCam = NULL;
 
 	// Vector of Buffers. Each buffer is also a vector
-	vector< vector<Mat> > bufferList;
+	vector< vector<CameraFrame> > bufferList;
+	vector<CameraPtr> cameras;
+	vector<CameraRecovery*> recovery;
 		
     try
     {
-        // Initialize camera and trigger for each camera
-        for (int i = 0; i < camList.GetSize(); i++)
+		int startupStart = getMilliCount();
+
+        // Initialize camera and trigger for each camera of the rig
+        for (unsigned int i = 0; i < rig.cameras.size(); i++)
         {
+			const CameraPlan &plan = rig.cameras[i];
+
             // Select camera
-            pCam = camList.GetByIndex(i);
+            pCam = camList.GetBySerial(plan.serial);
+			if (!pCam.IsValid())
+			{
+				cout << "Camera " << plan.serial << " of the rig is not connected" << endl;
+				return -1;
+			}
 
 			// Print Camera Serial Number
 			cout << "Initializing Camera: " << i << " SerialNum:" << pCam->GetUniqueID() << endl;
@@ -751,47 +1317,195 @@ int RunMultipleCameras(CameraList camList)
             pCam->Init();
 
             // Retrieve GenICam nodemap
-            INodeMap & nodeMap = camList.GetByIndex(i)->GetNodeMap();
-
-            // Set camera with index 0 as Primary camera.
-			// FUTURE: Update this part of code to set camera with specific serial number as Primary
-			if(pCam->GetUniqueID() == "16276645")
-				result = ConfigureTrigger(nodeMap, true);
-            else
-            	result = ConfigureTrigger(nodeMap, false);
+            INodeMap & nodeMap = pCam->GetNodeMap();
 
-            if (result < 0)
-            {
-				cout << "Error configuring trigger" << endl;
-                return result;
-            }
+			// Load the rig configuration from the user set. Only when the
+			// hash does not match is every node written and the user set saved.
+			int configStart = getMilliCount();
+			UserSetSnapshot snapshot;
+			DescribeRigConfiguration(snapshot, plan);
 
-            result = ConfigureCamera(pCam, nodeMap);
+			result = snapshot.Load(pCam);
 			if (result < 0)
-            {
-				cout << "Error configuring camera" << endl;
-                return result;
-            }
+			{
+				cout << "Error loading user set" << endl;
+				return result;
+			}
+
+			if (result == 0)
+			{
+				cout << "Camera " << i << ": configuration loaded from user set in " << getMilliSpan(configStart) << " ms" << endl;
+			}
+			else
+			{
+				result = ConfigureTrigger(nodeMap, plan.isPrimary, plan.triggerSource.c_str());
+				if (result < 0)
+				{
+					cout << "Error configuring trigger" << endl;
+				    return result;
+				}
+
+				result = ConfigureCamera(pCam, nodeMap, plan);
+				if (result < 0)
+				{
+					cout << "Error configuring camera" << endl;
+				    return result;
+				}
+
+				// Not fatal: the next startup configures the camera again
+				snapshot.Save(pCam);
+				cout << "Camera " << i << ": full configuration in " << getMilliSpan(configStart) << " ms" << endl;
+			}
+
+			// Sequencer sets are not part of the user set
+			if (!plan.bracket.empty() && calibrateKind.empty())
+			{
+				result = ConfigureBracket(nodeMap, plan.bracket);
+				if (result < 0)
+				{
+					cout << "Error configuring exposure bracket" << endl;
+					return result;
+				}
+			}
 
 			// Create buffer to store images
 			//vector<Mat> *buffer = new vector<Mat> (bufferSize);
-			vector<Mat> buffer;
+			vector<CameraFrame> buffer;
+			buffer.reserve(rig.numImages);
 			bufferList.push_back(buffer);
+			cameras.push_back(pCam);
 			
         }// End of initialization of trigger and camera
+
+		cout << "Cameras configured in " << getMilliSpan(startupStart) << " ms" << endl << endl;
+
+		// Estimate camera clock offsets and drift while capturing
+		// Counters reset and latched before any camera acquires, so no frame
+		// has a timestamp from before the reset
+		ClockSync clockSync(cameras);
+		if (clockSync.Start() < 0)
+		{
+			cout << "Error starting clock sync" << endl;
+			return -1;
+		}
+		clockSync.PrintReport();
+
+		// Begin acquiring images; the secondaries are armed before the
+		// primary starts to trigger them
+		for (unsigned int i = 0; i < cameras.size(); i++)
+		{
+			if (!rig.cameras[i].isPrimary)
+				cameras[i]->BeginAcquisition();
+		}
+		for (unsigned int i = 0; i < cameras.size(); i++)
+		{
+			if (rig.cameras[i].isPrimary)
+				cameras[i]->BeginAcquisition();
+		}
+
+		// Drop images captured before the recording starts
+		FlushImageBuffers(cameras);
+
+		// Slots of a camera that is away are paced at the trigger rate, the
+		// rate of the primary; without one the grab timeout
+		int primary = rig.GetPrimary();
+		double triggerFps = (primary >= 0) ? rig.cameras[primary].fps : 0;
+		for(unsigned int i=0; i<cameras.size(); i++)
+		{
+			recovery.push_back(new CameraRecovery(cameras[i], i, CameraRecovery::RETRY));
+			double fps = (triggerFps > 0) ? triggerFps : rig.cameras[i].fps;
+			if (fps > 0)
+				recovery[i]->slotPeriodMs = max(1, (int)(1000 / fps));
+		}
+
+		// Keep recording when a camera is unplugged; it rejoins with the
+		// configuration cached here
+		HotPlugMonitor hotPlug(system, cameras);
+		hotPlug.CacheConfiguration();
+		// Exposure and gain of the rig set from the frames, not by each camera
+		RigExposure *exposure = NULL;
+		if (rig.autoExposure && rig.cameras[0].bracket.empty() && calibrateKind.empty())
+		{
+			RigExposureSettings settings;
+			settings.target = rig.aeTarget;
+			settings.maxExposure = rig.aeMaxExposure;
+			settings.maxGain = rig.aeMaxGain;
+			settings.every = rig.aeEvery;
+
+			vector<int> bitDepths;
+			for (unsigned int i = 0; i < rig.cameras.size(); i++)
+				bitDepths.push_back(rig.cameras[i].bitsPerPixel);
+
+			exposure = new RigExposure(cameras, bitDepths, settings, rig.cameras[0].exposureTime);
+			if (exposure->Start() < 0)
+			{
+				cout << "Recording with fixed exposure" << endl;
+				delete exposure;
+				exposure = NULL;
+			}
+		}
+
+		hotPlug.onRemoval = [&](int camNum)
+		{
+			recovery[camNum]->Quarantine();
+			clockSync.Detach(camNum);
+			if (exposure != NULL)
+				exposure->Detach(camNum);
+		};
+		hotPlug.onConfigured = [&](int camNum, CameraPtr pRejoinCam)
+		{
+			// Before it acquires, as at startup
+			clockSync.Attach(camNum, pRejoinCam);
+			// The sequencer of a camera that came back starts unprogrammed
+			if (!rig.cameras[camNum].bracket.empty() && calibrateKind.empty()
+			    && ConfigureBracket(pRejoinCam->GetNodeMap(), rig.cameras[camNum].bracket) < 0)
+			{
+				cout << "Camera " << camNum << ": unable to program the exposure bracket" << endl;
+			}
+		};
+		hotPlug.onRejoin = [&](int camNum, CameraPtr pRejoinCam)
+		{
+			if (exposure != NULL)
+				exposure->Attach(camNum, pRejoinCam);
+			recovery[camNum]->Rejoin(pRejoinCam);
+		};
+		hotPlug.Start();
 		
 		//vector<Mat> imageBuffer1 (bufferSize);
 		//vector<Mat> imageBuffer2 (bufferSize);
 
 
 
-		thread t1(AcquireImages, camList, std::ref(bufferList));
-		thread t2(SaveImages, 1, std::ref(bufferList[0]));
-		thread t3(SaveImages, 2, std::ref(bufferList[1]));
+		if (!calibrateKind.empty())
+		{
+			// One thread per camera, as for recording
+			vector<int> referenceResult(cameras.size(), 0);
+			vector<thread> referenceThreads;
+			for(unsigned int i=0; i<cameras.size(); i++)
+			{
+				referenceThreads.push_back(thread(CaptureReference, i, recovery[i], std::ref(topology), &referenceResult[i]));
+			}
+			for(unsigned int i=0; i<referenceThreads.size(); i++)
+			{
+				referenceThreads[i].join();
+				result = result | referenceResult[i];
+			}
+		}
+		else
+		{
+			result = result | RecordImages(recovery, bufferList, clockSync, topology, exposure);
+		}
 
-		t1.join();
-		t2.join();
-		t3.join();
+		hotPlug.Stop();
+		if (exposure != NULL)
+		{
+			exposure->Stop();
+			delete exposure;
+		}
+		cout << "Cameras rejoined: " << hotPlug.GetNumRejoins() << endl;
+
+		clockSync.Stop();
+		clockSync.PrintReport();
 
 #if 0		
 		t3.join();
@@ -837,21 +1551,44 @@ int RunMultipleCameras(CameraList camList)
 
         // Deinitialize each camera
 		sleep(3);
-		for (int i = 0; i < camList.GetSize(); i++)
+		for (unsigned int i = 0; i < cameras.size(); i++)
 		{
 			// Delete buffer associated with the camera
 			//delete bufferList[i];
 			
-		   	// Select camera
-		    pCam = camList.GetByIndex(i);
+		   	// Select camera; it may have been replaced after a rejoin
+		    pCam = hotPlug.GetCamera(i);
+			if (!hotPlug.IsPresent(i))
+			{
+				cout << "Camera " << i << " is not connected" << endl;
+				continue;
+			}
 
-			pCam->EndAcquisition();
+			// Acquisition may already be stopped if the camera failed to recover
+			try
+			{
+				pCam->EndAcquisition();
+			}
+			catch (Spinnaker::Exception &e)
+			{
+				cout << "Camera " << i << ": " << e.what() << endl;
+			}
 
 		    // Retrieve GenICam nodemap
 		    INodeMap & nodeMap = pCam->GetNodeMap();
 
 		    // Reset trigger
 		    result = result | ResetTrigger(nodeMap);
+		    if (!rig.cameras[i].bracket.empty())
+		        result = result | ResetBracket(nodeMap);
+
+		    // Back to the full sensor for the other programs; the next
+		    // startup loads the profile again with the user set
+		    if (!rig.cameras[i].profile.empty())
+		    {
+		        CaptureProfileResult fullResult;
+		        result = result | ApplyCaptureProfile(nodeMap, *FindCaptureProfile("full"), rig.cameras[i].exposureTime, fullResult);
+		    }
 
 		    // Deinitialize camera
 		    pCam->DeInit();
@@ -863,6 +1600,11 @@ int RunMultipleCameras(CameraList camList)
 		cout << "Error: " << e.what() << endl;
 		result = -1;
 	}
+
+	for(unsigned int i=0; i<recovery.size(); i++)
+	{
+		delete recovery[i];
+	}
 	cout << "RunMultipleCameras Function has ended" << endl;
 	return result;
 	
@@ -870,13 +1612,41 @@ int RunMultipleCameras(CameraList camList)
 
 
 // Init: Get conneceted cameras
-int main(int /*argc*/, char** /*argv*/)
+int main(int argc, char** argv)
 {
     int result = 0;
 
     // Print application build information
     cout << "Program build date: " << __DATE__ << " " << __TIME__ << endl << endl;
 
+	const char *rigFile = defaultRigFile;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-calibrate") == 0 && i+1 < argc)
+		{
+			calibrateKind = argv[++i];
+			if (i+1 < argc && argv[i+1][0] != '-')
+				numCalibrationFrames = atoi(argv[++i]);
+		}
+		else
+			rigFile = argv[i];
+	}
+
+	// Parse the rig once; output directories exist before the first frame
+	if (rig.Load(rigFile) < 0 || rig.Preallocate() < 0 ||
+		(!calibrateKind.empty() && calibrateKind != "dark" && calibrateKind != "flat"))
+	{
+		cout << "Usage: " << argv[0] << " [rigFile] [-calibrate dark|flat [numFrames]]  (default " << defaultRigFile << ")" << endl;
+		return -1;
+	}
+	rig.Print(cout);
+
+	// Pin this thread before the SDK starts its own threads, which
+	// inherit the affinity; capture threads place themselves
+	ThreadTopology topology(rig);
+	topology.PlaceSdkThreads();
+	topology.Print(cout);
+
     // Retrieve singleton reference to system object
     SystemPtr system = System::GetInstance();
 
@@ -905,7 +1675,7 @@ int main(int /*argc*/, char** /*argv*/)
     }
 
 	//Configure cameras and create separate thread for each camera to acquire images
-    result = RunMultipleCameras(camList);
+    result = RunMultipleCameras(system, camList, topology);
 
     cout << "Closing Program. Doing Clean Up" << endl << endl;
 
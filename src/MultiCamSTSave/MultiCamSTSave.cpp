@@ -13,6 +13,10 @@
 #include <ctime>
 #include <sys/timeb.h>
 #include <cstdlib>
+#include <cstring>
+
+#include "RigPlan.h"
+#include "CaptureProfile.h"
 
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
@@ -25,36 +29,21 @@ using namespace cv;
 int ConfigureTrigger(INodeMap & nodeMap);
 int ResetTrigger(INodeMap & nodeMap);
 int GrabNextImageByTrigger(CameraList camList);
-int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap);
+int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap, double exposureTime);
 void emptyImageBuffer(CameraList camList);
 int RunMultipleCameras(CameraList camList);
 int getMilliCount();
 int getMilliSpan(int nTimeStart);
 
 
-/*
-string camTopSerial[] = 
-{"17092848", "17092850", "16290117", 
- "17012292", "16276645", "16290054",
- "16290150", "17012295", "17012305",
- "16290122", "17012302", "17012281",
- "17092876", "17092867", "17092868",
- "17092873", "17092874"};
-
- string camBottomSerial[] = 
- {"17092869", "17012333", "17092847", 
-  "17092853", "17092849", "17012303",
-  "17012306", "17012339", "16290137",
-  "17012354", "17092851", "17012304",
-  "17092870", "17092872", "17092875"};
-*/
-
-
-// Camera serial numbers
-//string camSerial[] = {"16290150", "17012295","17012305", 
-//"17012306", "17012339", "16290137"};
+// Camera serial numbers, in the order of the rig file (-rig <file>)
+vector<string> camSerial;
+string rigFile = "../rig/stream.rig";
 
-string camSerial[] = {"16290150", "17012295", "17012305", "17012306", "17012339", "16290137"};
+// Exposure (us) and capture profile of each camera, from the rig file;
+// empty profile: camera left as it is
+vector<double> camExposure;
+vector<string> camProfile;
 
 int numImages = 0;
 
@@ -222,7 +211,7 @@ int ResetTrigger(INodeMap & nodeMap)
 ///////////////////////////////
 // Function to configure Camera
 ///////////////////////////////
-int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap) 
+int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap, double exposureTime) 
 {
 
     float acquisitionFrameRate = 0, AcFrameRate = 0;
@@ -284,7 +273,7 @@ int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap)
 		
 			// Ensure desired exposure time does not exceed the maximum
 			const double exposureTimeMax = ptrExposureTime->GetMax();
-			double exposureTimeToSet = 5500.0;
+			double exposureTimeToSet = exposureTime;
 
 			if (exposureTimeToSet > exposureTimeMax)
 			{
@@ -294,7 +283,6 @@ int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap)
 			ptrExposureTime->SetValue(exposureTimeToSet);
 		
 			cout << "Exposure time set to " << exposureTimeToSet << " us..." << endl << endl;
-			// Exposure set to 5500.0
 
 #if 0
 		    // Setting up Acquisition frame rate --------------------------------------------//
@@ -401,7 +389,7 @@ int GrabNextImageByTrigger(CameraList camList)
     try
     {
     	// Send software trigger command to each camera
-	    for(int i=0; i<camList.GetSize(); i++)
+	    for(int i=0; i<(int)camSerial.size(); i++)
 	   	{
 	   		INodeMap & nodeMap = camList.GetBySerial(camSerial[i])->GetNodeMap();
 	   		// Execute software trigger
@@ -439,7 +427,7 @@ void StreamSyncVideo(CameraList camList)
 	vector<int> v_time;
     int imgCount = 0;
 	int numImages = 1000;
-	int numCams = camList.GetSize();
+	int numCams = camSerial.size();
 	CameraPtr camPtr;
 	ImagePtr pResultImage;
 	int start = getMilliCount();
@@ -517,7 +505,7 @@ void StreamSyncVideo(CameraList camList)
 	vector<int> v_time;
     int imgCount = 0;
 	//int numImages = 100000;
-	int numCams = camList.GetSize();
+	int numCams = camSerial.size();
 	CameraPtr camPtr[numCams];
 	ImagePtr pResultImage[numCams];
 	int start = getMilliCount();
@@ -678,7 +666,7 @@ void AcquireImages(CameraList camList)
 	vector<int> v_time;
     int imgCount = 0;
 	int numImages = 100;
-	int numCams = camList.GetSize();
+	int numCams = camSerial.size();
 	CameraPtr camPtr[numCams];
 	ImagePtr pResultImage[numCams];
 	int start = getMilliCount();
@@ -686,7 +674,7 @@ void AcquireImages(CameraList camList)
 	// Extract cameras from camList
 	for(int camNum=0; camNum<numCams; camNum++)
 	{
-		camPtr[camNum] = camList.GetBySerial(camNum);
+		camPtr[camNum] = camList.GetBySerial(camSerial[camNum]);
 	}
 	
 	// Acquire Images from all the cameras at the same time
@@ -857,7 +845,7 @@ void SaveImages(int camNum, vector<Mat> &imageBuffer)
 ///////////////////
 void emptyImageBuffer(CameraList camList)
 {
-	int numCams = camList.GetSize();
+	int numCams = camSerial.size();
 	ImagePtr pResultImage;
 
 	try
@@ -902,11 +890,12 @@ int RunMultipleCameras(CameraList camList)
 {
     int result = 0;
 	CameraPtr pCam = NULL;
+	vector<CaptureProfileResult> profileResults;
 		
     try
     {
         // Initialize camera and trigger for each camera
-        for (int i = 0; i < camList.GetSize(); i++)
+        for (int i = 0; i < (int)camSerial.size(); i++)
         {
             // Select camera
             pCam = camList.GetBySerial(camSerial[i]);
@@ -929,8 +918,23 @@ int RunMultipleCameras(CameraList camList)
                 return result;
             }
 
+            // Readout mode; image size and binning are locked once the
+            // camera acquires
+            if (!camProfile[i].empty())
+            {
+                CaptureProfileResult profileResult;
+                profileResult.serial = camSerial[i];
+                result = ApplyCaptureProfile(nodeMap, *FindCaptureProfile(camProfile[i]), camExposure[i], profileResult);
+                if (result < 0)
+                {
+                    cout << "Error applying capture profile" << endl;
+                    return result;
+                }
+                profileResults.push_back(profileResult);
+            }
+
             // Configure Cameras
-            result = ConfigureCamera(pCam, nodeMap);
+            result = ConfigureCamera(pCam, nodeMap, camExposure[i]);
 			if (result < 0)
             {
 				cout << "Error configuring camera" << endl;
@@ -939,6 +943,9 @@ int RunMultipleCameras(CameraList camList)
 			
         }// End of initialization of trigger and camera
 
+        if (!profileResults.empty())
+            PrintCaptureProfileReport(profileResults, cout);
+
 
         // Acquire and save images from each camera
         StreamSyncVideo(camList);
@@ -946,7 +953,7 @@ int RunMultipleCameras(CameraList camList)
 
         // Deinitialize each camera
 		sleep(3);
-		for (int i = 0; i < camList.GetSize(); i++)
+		for (int i = 0; i < (int)camSerial.size(); i++)
 		{			
 		   	// Select camera
 		    pCam = camList.GetBySerial(camSerial[i]);
@@ -956,6 +963,13 @@ int RunMultipleCameras(CameraList camList)
 		    // Retrieve GenICam nodemap
 		    INodeMap & nodeMap = pCam->GetNodeMap();
 
+		    // Back to the full sensor for the other programs
+		    if (!camProfile[i].empty())
+		    {
+		        CaptureProfileResult fullResult;
+		        result = result | ApplyCaptureProfile(nodeMap, *FindCaptureProfile("full"), camExposure[i], fullResult);
+		    }
+
 		    // Reset trigger
 		    result = result | ResetTrigger(nodeMap);
 
@@ -979,7 +993,27 @@ int RunMultipleCameras(CameraList camList)
 int main(int argc, char *argv[])
 {
     int result = 0;
+    if (argc < 2)
+    {
+    	cout << "Usage: MultiCamSTSave <numImages> [-rig <file>]" << endl;
+    	return -1;
+    }
     numImages = atoi(argv[1]);
+    for (int i = 2; i < argc; i++)
+    {
+    	if (strcmp(argv[i], "-rig") == 0 && i+1 < argc)
+    		rigFile = argv[++i];
+    }
+
+    RigPlan rig;
+    if (rig.Load(rigFile) < 0)
+    	return -1;
+    for (unsigned int i = 0; i < rig.cameras.size(); i++)
+    {
+    	camSerial.push_back(rig.cameras[i].serial);
+    	camExposure.push_back(rig.cameras[i].exposureTime);
+    	camProfile.push_back(rig.cameras[i].profile);
+    }
 
     // Print application build information
     cout << "Program build date: " << __DATE__ << " " << __TIME__ << endl << endl;
@@ -995,8 +1029,8 @@ int main(int argc, char *argv[])
 
     cout << "Number of cameras detected: " << numCameras << endl << endl;
 
-    // Finish if there are no cameras
-    if (numCameras == 0)
+    // Finish if the cameras of the rig are not all there
+    if (numCameras < camSerial.size())
     {
         // Clear camera list before releasing system
         camList.Clear();
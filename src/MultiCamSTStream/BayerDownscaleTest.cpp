@@ -0,0 +1,156 @@
+//
+// Checks of BayerDownscale2x2, used for the composite preview:
+//
+//  - on random mosaics of several widths, the SIMD and scalar paths must
+//    give the same image, also into a view (ROI) of a larger image;
+//  - every output pixel must be the quad average rounded once,
+//    (sum + 2) >> 2, e.g. 0,0,1,1 gives 1 and 0,0,0,1 gives 0.
+//
+// Usage: BayerDownscaleTest (make test). Prints the failed checks, returns
+// -1 if there are any.
+//
+
+#include <iostream>
+#include <cstdlib>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "PixelUnpack.h"
+
+using namespace std;
+using namespace cv;
+
+
+static void RandomMosaic(Mat &img)
+{
+	for(int y=0; y<img.rows; y++)
+	{
+		uint8_t *row = img.ptr<uint8_t>(y);
+		for(int x=0; x<img.cols; x++)
+			row[x] = (uint8_t)(rand() & 0xff);
+	}
+}
+
+
+// Number of pixels where a and b differ
+static int CountDiffs(const Mat &a, const Mat &b)
+{
+	int diffs = 0;
+	for(int y=0; y<a.rows; y++)
+	{
+		for(int x=0; x<a.cols; x++)
+		{
+			if(a.ptr<uint8_t>(y)[x] != b.ptr<uint8_t>(y)[x])
+				diffs++;
+		}
+	}
+	return diffs;
+}
+
+
+static int CheckRandom(int width, int height)
+{
+	int failed = 0;
+	Mat src(height, width, CV_8UC1);
+	RandomMosaic(src);
+
+	Mat simd(height / 2, width / 2, CV_8UC1);
+	Mat scalar(height / 2, width / 2, CV_8UC1);
+	BayerDownscale2x2(src, simd, true);
+	BayerDownscale2x2(src, scalar, false);
+
+	int diffs = CountDiffs(simd, scalar);
+	if(diffs > 0)
+	{
+		cout << width << "x" << height << ": " << diffs << " pixels differ between SIMD and scalar" << endl;
+		failed++;
+	}
+
+	// Into a tile of a composite, as the preview does
+	Mat composite(height / 2 + 3, width / 2 + 5, CV_8UC1);
+	Mat roi = composite(Rect(5, 3, width / 2, height / 2));
+	BayerDownscale2x2(src, roi, true);
+	diffs = CountDiffs(roi, scalar);
+	if(diffs > 0)
+	{
+		cout << width << "x" << height << ": " << diffs << " pixels differ in a ROI" << endl;
+		failed++;
+	}
+	return failed;
+}
+
+
+// Quads whose rounding differs between one rounding step and two averages
+static int CheckRounding(bool useSimd)
+{
+	static const uint8_t quads[][5] = {
+		// r0[0] r0[1] r1[0] r1[1] expected
+		{0, 0, 1, 1, 1},
+		{0, 0, 0, 1, 0},
+		{0, 1, 0, 1, 1},
+		{1, 2, 2, 2, 2},
+		{255, 254, 255, 255, 255},
+		{255, 0, 0, 0, 64},
+		{3, 0, 0, 0, 1},
+	};
+	const int numQuads = sizeof(quads) / sizeof(quads[0]);
+
+	// Each quad repeated over a full SIMD step and a scalar tail
+	const int width = 2 * 37;
+	Mat src(2, width * numQuads, CV_8UC1);
+	for(int q=0; q<numQuads; q++)
+	{
+		for(int x=0; x<width; x+=2)
+		{
+			src.ptr<uint8_t>(0)[q*width + x] = quads[q][0];
+			src.ptr<uint8_t>(0)[q*width + x + 1] = quads[q][1];
+			src.ptr<uint8_t>(1)[q*width + x] = quads[q][2];
+			src.ptr<uint8_t>(1)[q*width + x + 1] = quads[q][3];
+		}
+	}
+
+	Mat dst(1, src.cols / 2, CV_8UC1);
+	BayerDownscale2x2(src, dst, useSimd);
+
+	int failed = 0;
+	for(int q=0; q<numQuads; q++)
+	{
+		for(int x=0; x<width/2; x++)
+		{
+			int value = dst.ptr<uint8_t>(0)[q*width/2 + x];
+			if(value != quads[q][4])
+			{
+				cout << (useSimd ? "SIMD" : "scalar") << ": quad " << (int)quads[q][0] << "," << (int)quads[q][1] << ","
+					 << (int)quads[q][2] << "," << (int)quads[q][3] << " gives " << value << ", not " << (int)quads[q][4] << endl;
+				failed++;
+				break;
+			}
+		}
+	}
+	return failed;
+}
+
+
+int main(int argc, char** argv)
+{
+	int failed = 0;
+	srand(26);
+
+	// Widths around the 16 pixel SIMD step, and a full sensor frame
+	const int widths[] = {2, 30, 32, 34, 62, 64, 66, 100, 1280, 2448};
+	for(unsigned int i=0; i<sizeof(widths)/sizeof(widths[0]); i++)
+		failed += CheckRandom(widths[i], 10);
+	failed += CheckRandom(2448, 2048);
+
+	failed += CheckRounding(true);
+	failed += CheckRounding(false);
+
+	if(failed > 0)
+	{
+		cout << failed << " checks failed" << endl;
+		return -1;
+	}
+	cout << "All checks passed" << endl;
+	return 0;
+}
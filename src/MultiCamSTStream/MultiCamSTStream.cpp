@@ -13,6 +13,13 @@
 #include <ctime>
 #include <sys/timeb.h>
 #include <cstdlib>
+#include <chrono>
+#include <cstring>
+
+#include "MJPEGServer.h"
+#include "RigPlan.h"
+#include "PixelUnpack.h"
+#include "CaptureProfile.h"
 
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
@@ -25,7 +32,7 @@ using namespace cv;
 int ConfigureTrigger(INodeMap & nodeMap);
 int ResetTrigger(INodeMap & nodeMap);
 int GrabNextImageByTrigger(CameraList camList);
-int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap);
+int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap, double exposureTime);
 void emptyImageBuffer(CameraList camList);
 int RunMultipleCameras(CameraList camList);
 int getMilliCount();
@@ -50,14 +57,41 @@ string camTopSerial[] =
 */
 
 
-// Camera serial numbers
-//string camSerial[] = {"16290150", "17012295","17012305", 
-//"17012306", "17012339", "16290137"};
+// Camera serial numbers, in the order of the rig file (-rig <file>)
+vector<string> camSerial;
+string rigFile = "../rig/stream.rig";
+
+// Capture profile of each camera (rig file, or -profile <name> for all);
+// empty: camera left as it is
+vector<string> camProfile;
+string profileOverride;
 
-string camSerial[] = {"16290150", "17012295", "17012305", "17012306", "17012339", "16290137"};
+// Frame size of each camera once configured; sets the preview tiles
+vector<Size> camFrameSize;
 
 int numImages = 0;
 
+// Exposure of each camera, us (rig file); capture profiles measure their
+// frame rates at it
+vector<double> camExposure;
+
+// Preview options. fastBayerPreview builds the composite by averaging Bayer
+// quads instead of resizing; benchmarkComposite also runs the old composite
+// path on every frame and prints the average time of both.
+bool fastBayerPreview = false;
+bool benchmarkComposite = false;
+
+// Previews of 12 and 16 bit formats: tone mapped with toneMapPreview,
+// otherwise the top 8 bits
+bool toneMapPreview = false;
+
+// Serve previews over HTTP instead of imshow, for hosts without X11
+// (-headless, -port <port>). The server only listens on 127.0.0.1 unless
+// -bind <addr> is given, e.g. -bind 0.0.0.0 to watch from another host.
+bool headless = false;
+int previewPort = 8080;
+string previewBind = "127.0.0.1";
+
 // Use the following enum and global constant to select whether a software or
 // hardware trigger is used.
 enum triggerType
@@ -222,7 +256,7 @@ int ResetTrigger(INodeMap & nodeMap)
 ///////////////////////////////
 // Function to configure Camera
 ///////////////////////////////
-int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap) 
+int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap, double exposureTime) 
 {
 
     float acquisitionFrameRate = 0, AcFrameRate = 0;
@@ -284,7 +318,7 @@ int ConfigureCamera(CameraPtr pCam, INodeMap & nodeMap)
 		
 			// Ensure desired exposure time does not exceed the maximum
 			const double exposureTimeMax = ptrExposureTime->GetMax();
-			double exposureTimeToSet = 5500.0;
+			double exposureTimeToSet = exposureTime;
 
 			if (exposureTimeToSet > exposureTimeMax)
 			{
@@ -401,7 +435,7 @@ int GrabNextImageByTrigger(CameraList camList)
     try
     {
     	// Send software trigger command to each camera
-	    for(int i=0; i<camList.GetSize(); i++)
+	    for(int i=0; i<(int)camSerial.size(); i++)
 	   	{
 	   		INodeMap & nodeMap = camList.GetBySerial(camSerial[i])->GetNodeMap();
 	   		// Execute software trigger
@@ -510,20 +544,155 @@ void StreamSyncVideo(CameraList camList)
 
 
 
+////////////////////
+// Composite Builder
+////////////////////
+
+// Tile size of the composite: the largest camera frame, halved until it
+// fits 640x512. Full sensor frames are halved once as before; binned and
+// ROI frames are often shown as they are, without a resize.
+Size PreviewTileSize()
+{
+	Size tile(0, 0);
+	for(unsigned int i=0; i<camFrameSize.size(); i++)
+	{
+		tile.width = max(tile.width, camFrameSize[i].width);
+		tile.height = max(tile.height, camFrameSize[i].height);
+	}
+	if(tile.width == 0 || tile.height == 0)
+		return Size(640, 512);
+
+	while(tile.width > 640 || tile.height > 512)
+	{
+		tile.width /= 2;
+		tile.height /= 2;
+	}
+	return tile;
+}
+
+
+// Compute the position of every camera tile in the composite image.
+// Cameras are laid out on two rows, as in the original preview.
+Size CompositeLayout(int numCams, Size tileSize, vector<Rect> &tileRoi)
+{
+	int gridRows = (numCams > 1) ? 2 : 1;
+	int gridCols = (numCams + gridRows - 1) / gridRows;
+
+	tileRoi.clear();
+	for(int i=0; i<numCams; i++)
+	{
+		tileRoi.push_back(Rect((i % gridCols) * tileSize.width,
+							   (i / gridCols) * tileSize.height,
+							   tileSize.width, tileSize.height));
+	}
+
+	return Size(gridCols * tileSize.width, gridRows * tileSize.height);
+}
+
+
+// Build the composite image by resizing each camera frame directly into its
+// tile. The composite buffer is allocated once by the caller and reused for
+// every frame. Cameras are processed in parallel.
+void BuildComposite(vector<Mat> &imgRaw, Mat &imgComposite, const vector<Rect> &tileRoi)
+{
+	int numCams = imgRaw.size();
+
+	#pragma omp parallel for
+	for(int camNum=0; camNum<numCams; camNum++)
+	{
+		Mat roi = imgComposite(tileRoi[camNum]);
+
+		if(imgRaw[camNum].size() == roi.size())
+			imgRaw[camNum].copyTo(roi);
+		else if(fastBayerPreview && imgRaw[camNum].cols == 2*roi.cols && imgRaw[camNum].rows == 2*roi.rows)
+			BayerDownscale2x2(imgRaw[camNum], roi);
+		else
+			resize(imgRaw[camNum], roi, roi.size());
+	}
+}
+
+
+// Previous composite path, kept to benchmark BuildComposite against
+void BuildCompositeLegacy(vector<Mat> &imgRaw, Mat &imgCompositeOut, Size size)
+{
+	int numCams = imgRaw.size();
+	vector<Mat> imgAllCam(numCams);
+	Mat imgTemp;
+
+	for(int camNum=0; camNum<numCams; camNum++)
+	{
+		resize(imgRaw[camNum], imgTemp, size);
+		imgAllCam[camNum] = imgTemp.clone();
+	}
+
+	int gridCols = (numCams > 1) ? (numCams + 1)/2 : 1;
+	Mat imgComposite(imgAllCam[0].rows * ((numCams > 1) ? 2 : 1), imgAllCam[0].cols * gridCols, imgAllCam[0].type());
+
+	int x = 0, y = 0;
+	for(int i=0; i<numCams; i++)
+	{
+		Mat roi = imgComposite(Rect(x, y, imgAllCam[i].cols, imgAllCam[i].rows));
+		imgAllCam[i].copyTo(roi);
+
+		// Update x and y values
+		if(((i+1) % gridCols) == 0)
+		{
+			x = 0;
+			y += imgAllCam[i].rows;
+		}
+		else
+			x += imgAllCam[i].cols;
+	}
+
+	imgCompositeOut = imgComposite;
+}
+
+
+double getMicroSpan(chrono::steady_clock::time_point tStart)
+{
+	return chrono::duration<double, micro>(chrono::steady_clock::now() - tStart).count();
+}
+
+
+
 void StreamSyncVideo(CameraList camList)
 {
     int result = 0;
-    int counter = 0;
 	vector<int> v_time;
-    int imgCount = 0;
-	//int numImages = 100000;
-	int numCams = camList.GetSize();
+	int numCams = camSerial.size();
 	CameraPtr camPtr[numCams];
 	ImagePtr pResultImage[numCams];
-	int start = getMilliCount();
-	Mat imgTemp;
-	Size size(640, 512);
+	Size size = PreviewTileSize();
 	//Size size(320, 256);
+	cout << "Preview tile size: " << size.width << "x" << size.height << endl;
+
+	// Composite buffer and tile positions are set up once and reused
+	vector<Mat> imgRaw(numCams);
+	vector<Mat> imgUnpacked(numCams);
+	vector<Mat> imgPreview(numCams);
+	vector<ToneMapper> toneMapper(numCams, ToneMapper(16));
+	vector<Rect> tileRoi;
+	Mat imgComposite(CompositeLayout(numCams, size, tileRoi), CV_8UC1);
+	Mat imgCompositeLegacy;
+
+	// Composite timing in microseconds, used when benchmarkComposite is set
+	double timeComposite = 0, timeLegacy = 0;
+	int numTimed = 0;
+
+	// Preview server with one stream for the composite and one per camera
+	MJPEGServer previewServer(previewPort, previewBind);
+	int compositeStream = previewServer.AddStream("composite");
+	vector<int> camStream(numCams);
+	for(int camNum=0; camNum<numCams; camNum++)
+	{
+		camStream[camNum] = previewServer.AddStream("cam" + camSerial[camNum]);
+	}
+
+	if(headless && previewServer.Start() < 0)
+	{
+		cout << "Unable to start preview server" << endl;
+		return;
+	}
 
 
 	// Extract cameras from CameraList
@@ -543,7 +712,6 @@ void StreamSyncVideo(CameraList camList)
 	
 		cout << "Streaming Video" << endl;
 
-		//#pragma omp parallel for
 		for(int imgNum=0; imgNum<numImages; imgNum++)
         {
             // Retrieve the next image from the trigger
@@ -560,64 +728,61 @@ void StreamSyncVideo(CameraList camList)
 		        	cout << "Image incomplete with image status " << pResultImage[camNum]->GetImageStatus() << "..." << endl << endl;
 					camPtr[camNum]->EndAcquisition();	
 				}
-			}
 
-			vector<Mat> imgAllCam(numCams);
-			
-			// Display acquired image from each camera
-			for(int camNum=0; camNum<numCams; camNum++)
-			{
+				// High bit depth formats are unpacked and brought down to 8 bits
+				UnpackFormat unpackFormat = UnpackFormatFromName(pResultImage[camNum]->GetPixelFormatName().c_str());
+				if(unpackFormat != UNPACK_UNSUPPORTED && unpackFormat != UNPACK_MONO8)
+				{
+					UnpackImage((const uint8_t *)pResultImage[camNum]->GetData(), pResultImage[camNum]->GetStride(),
+					            pResultImage[camNum]->GetWidth(), pResultImage[camNum]->GetHeight(), unpackFormat, imgUnpacked[camNum]);
+					if(toneMapPreview)
+						toneMapper[camNum].Apply(imgUnpacked[camNum], imgPreview[camNum]);
+					else
+						ToneMapper::Shift(imgUnpacked[camNum], imgPreview[camNum], UnpackBitDepth(pResultImage[camNum]->GetPixelFormatName().c_str()));
+					imgRaw[camNum] = imgPreview[camNum];
+				}
+				else
+				{
+					// Wrap the image data without copying it
+					unsigned int rowBytes = (int)pResultImage[camNum]->GetImageSize()/pResultImage[camNum]->GetHeight();
 
-				// Convert image to Mono8
-				//ImagePtr convertedImage = pResultImage[camNum]->Convert(PixelFormat_Mono8, HQ_LINEAR);
-				ImagePtr convertedImage = pResultImage[camNum];
+					imgRaw[camNum] = Mat(pResultImage[camNum]->GetHeight(),
+					                  pResultImage[camNum]->GetWidth(), CV_8UC1, pResultImage[camNum]->GetData(), rowBytes);
+				}
+			}
 
-				// Add image to buffer
-				unsigned int rowBytes = (int)convertedImage->GetImageSize()/convertedImage->GetHeight();
+			// Create composite image
+			chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+			BuildComposite(imgRaw, imgComposite, tileRoi);
+			timeComposite += getMicroSpan(tStart);
 
-				imgTemp = Mat(convertedImage->GetHeight(),
-				                  convertedImage->GetWidth(), CV_8UC1, convertedImage->GetData(), rowBytes);
+			if(benchmarkComposite)
+			{
+				tStart = chrono::steady_clock::now();
+				BuildCompositeLegacy(imgRaw, imgCompositeLegacy, size);
+				timeLegacy += getMicroSpan(tStart);
+			}
+			numTimed++;
 
-				resize(imgTemp, imgTemp, size);
+			if(headless)
+			{
+				for(int camNum=0; camNum<numCams; camNum++)
+				{
+					previewServer.PushFrame(camStream[camNum], imgRaw[camNum]);
+				}
+				previewServer.PushFrame(compositeStream, imgComposite);
+			}
 
-				imgAllCam[camNum] = imgTemp.clone();
-	
-				// Release Image
+			// Release Images
+			for(int camNum=0; camNum<numCams; camNum++)
+			{
 		       	pResultImage[camNum]->Release();
+			}
 
-		   	}// End of camera loop
-
-
-		   	// Create composite image
-		   	Mat imgComposite(imgAllCam[0].rows * 2, imgAllCam[0].cols * numCams/2, imgAllCam[0].type());
-
-		   	//cout << "Composite image rows = " << imgComposite.rows << endl;
-		   	//cout << "Composite image cols = " << imgComposite.cols << endl;
-
-		   	int x = 0, y =0;
-
-		   	for(int i=0; i<numCams; i++)
-		   	{
-		   		//cout << "x = " << x << endl;
-		   		//cout << "y = " << y << endl;
-
-		   		Mat roi = imgComposite(Rect(x, y, imgAllCam[i].cols, imgAllCam[i].rows));
-		   		imgAllCam[i].copyTo(roi);
-
-		   		// Update x and y values
-		   		if(((i+1) % (numCams/2)) == 0)
-		   		{
-		   			x = 0;
-		   			y += imgAllCam[i].rows;
-		   		}
-		   		else
-		   			x += imgAllCam[i].cols;
-
-		   	}
-
-		   	//resize(imgComposite, imgComposite, size);
-
-		   	imshow("All Cam Video", imgComposite);
+			if(!headless)
+			{
+		   		imshow("All Cam Video", imgComposite);
+			}
 
 		   	// Calculate FPS
 			int timeElapsed = getMilliSpan(start);
@@ -633,9 +798,18 @@ void StreamSyncVideo(CameraList camList)
 					}
 			   	}
 
-			
+			if(benchmarkComposite && numTimed == 100)
+			{
+				cout << "Composite: " << timeComposite/numTimed << " us/frame";
+				cout << "  Legacy composite: " << timeLegacy/numTimed << " us/frame" << endl;
+				timeComposite = timeLegacy = 0;
+				numTimed = 0;
+			}
  	
-			waitKey(1);
+			if(!headless)
+			{
+				waitKey(1);
+			}
 		}// End image loop
 
 
@@ -850,7 +1024,7 @@ void SaveImages(int camNum, vector<Mat> &imageBuffer)
 ///////////////////
 void emptyImageBuffer(CameraList camList)
 {
-	int numCams = camList.GetSize();
+	int numCams = camSerial.size();
 	ImagePtr pResultImage;
 
 	try
@@ -895,11 +1069,12 @@ int RunMultipleCameras(CameraList camList)
 {
     int result = 0;
 	CameraPtr pCam = NULL;
+	vector<CaptureProfileResult> profileResults;
 		
     try
     {
         // Initialize camera and trigger for each camera
-        for (int i = 0; i < camList.GetSize(); i++)
+        for (int i = 0; i < (int)camSerial.size(); i++)
         {
             // Select camera
             pCam = camList.GetBySerial(camSerial[i]);
@@ -922,8 +1097,27 @@ int RunMultipleCameras(CameraList camList)
                 return result;
             }
 
+            // Readout mode; image size and binning are locked once the
+            // camera acquires
+            if (!camProfile[i].empty())
+            {
+                CaptureProfileResult profileResult;
+                profileResult.serial = camSerial[i];
+                result = ApplyCaptureProfile(nodeMap, *FindCaptureProfile(camProfile[i]), camExposure[i], profileResult);
+                if (result < 0)
+                {
+                    cout << "Error applying capture profile" << endl;
+                    return result;
+                }
+                profileResults.push_back(profileResult);
+            }
+
+            CIntegerPtr ptrWidth = nodeMap.GetNode("Width");
+            CIntegerPtr ptrHeight = nodeMap.GetNode("Height");
+            camFrameSize.push_back(Size((int)ptrWidth->GetValue(), (int)ptrHeight->GetValue()));
+
             // Configure Cameras
-            result = ConfigureCamera(pCam, nodeMap);
+            result = ConfigureCamera(pCam, nodeMap, camExposure[i]);
 			if (result < 0)
             {
 				cout << "Error configuring camera" << endl;
@@ -932,6 +1126,9 @@ int RunMultipleCameras(CameraList camList)
 			
         }// End of initialization of trigger and camera
 
+        if (!profileResults.empty())
+            PrintCaptureProfileReport(profileResults, cout);
+
 
         // Acquire and save images from each camera
         StreamSyncVideo(camList);
@@ -939,7 +1136,7 @@ int RunMultipleCameras(CameraList camList)
 
         // Deinitialize each camera
 		sleep(3);
-		for (int i = 0; i < camList.GetSize(); i++)
+		for (int i = 0; i < (int)camSerial.size(); i++)
 		{			
 		   	// Select camera
 		    pCam = camList.GetBySerial(camSerial[i]);
@@ -949,6 +1146,13 @@ int RunMultipleCameras(CameraList camList)
 		    // Retrieve GenICam nodemap
 		    INodeMap & nodeMap = pCam->GetNodeMap();
 
+		    // Back to the full sensor for the other programs
+		    if (!camProfile[i].empty())
+		    {
+		        CaptureProfileResult fullResult;
+		        result = result | ApplyCaptureProfile(nodeMap, *FindCaptureProfile("full"), camExposure[i], fullResult);
+		    }
+
 		    // Reset trigger
 		    result = result | ResetTrigger(nodeMap);
 
@@ -974,6 +1178,43 @@ int main(int argc, char *argv[])
     int result = 0;
     numImages = atoi(argv[1]);
 
+    for(int i=2; i<argc; i++)
+    {
+    	if(strcmp(argv[i], "-fast") == 0)
+    		fastBayerPreview = true;
+    	else if(strcmp(argv[i], "-bench") == 0)
+    		benchmarkComposite = true;
+    	else if(strcmp(argv[i], "-tonemap") == 0)
+    		toneMapPreview = true;
+    	else if(strcmp(argv[i], "-headless") == 0)
+    		headless = true;
+    	else if(strcmp(argv[i], "-port") == 0 && i+1 < argc)
+    		previewPort = atoi(argv[++i]);
+    	else if(strcmp(argv[i], "-bind") == 0 && i+1 < argc)
+    		previewBind = argv[++i];
+    	else if(strcmp(argv[i], "-rig") == 0 && i+1 < argc)
+    		rigFile = argv[++i];
+    	else if(strcmp(argv[i], "-profile") == 0 && i+1 < argc)
+    		profileOverride = argv[++i];
+    }
+
+    RigPlan rig;
+    if(rig.Load(rigFile) < 0)
+    	return -1;
+    for(unsigned int i=0; i<rig.cameras.size(); i++)
+    {
+    	camSerial.push_back(rig.cameras[i].serial);
+    	camExposure.push_back(rig.cameras[i].exposureTime);
+    	camProfile.push_back(profileOverride.empty() ? rig.cameras[i].profile : profileOverride);
+
+    	if(!camProfile[i].empty() && FindCaptureProfile(camProfile[i]) == NULL)
+    	{
+    		cout << "Unknown capture profile " << camProfile[i] << ". Profiles:" << endl;
+    		PrintCaptureProfiles(cout);
+    		return -1;
+    	}
+    }
+
     // Print application build information
     cout << "Program build date: " << __DATE__ << " " << __TIME__ << endl << endl;
 
@@ -988,8 +1229,8 @@ int main(int argc, char *argv[])
 
     cout << "Number of cameras detected: " << numCameras << endl << endl;
 
-    // Finish if there are no cameras
-    if (numCameras == 0)
+    // Finish if the cameras of the rig are not all there
+    if (numCameras < camSerial.size())
     {
         // Clear camera list before releasing system
         camList.Clear();
@@ -37,11 +37,22 @@
 #include <sstream>
 #include <string>
 #include <boost/filesystem.hpp>
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/opencv.hpp>
 
+#include "MJPEGServer.h"
+#include "RigPlan.h"
+#include "FrameSelector.h"
+#include "BoardCoverage.h"
+#include "CaptureProfile.h"
+
 using namespace Spinnaker;
 using namespace Spinnaker::GenApi;
 using namespace Spinnaker::GenICam;
@@ -64,7 +75,58 @@ string camTopSerial[] = {"17092848", "17092850", "16290117", "17012292",
 */
 
 
- string camSerial[] = {"17092873", "17092874"};
+ // Cameras to calibrate and where their images go; from the rig file (-rig <file>)
+ vector<string> camSerial;
+ vector<string> camOutput;
+ string rigFile = "../rig/calib.rig";
+
+// Capture profile of each camera, from the rig file, so the cameras are
+// calibrated in the readout mode they record in; empty: left as it is
+vector<string> camProfile;
+
+// Serve previews over HTTP instead of imshow, for hosts without X11.
+// Keys are then read from the terminal (type a key and press Enter).
+// The server only listens on 127.0.0.1 unless -bind <addr> is given,
+// e.g. -bind 0.0.0.0 to watch from another host.
+bool headless = false;
+int previewPort = 8080;
+string previewBind = "127.0.0.1";
+atomic<int> stdinKey(-1);
+atomic<bool> stopKeys(false);
+thread keyReader;
+
+// Save sharp frames of new board poses without a keypress (-auto); see
+// FrameSelector. It finds the board of -board (default 9x6); -sharpness,
+// -difference and -maxFrames tune it.
+bool autoSelect = false;
+FrameSelectorSettings selectorSettings;
+
+// Find the board in the preview and show where it has been, with a first
+// estimate of the intrinsics (-board <cols>x<rows> of inner corners); see
+// BoardCoverage. -square, -every and -workers tune it.
+bool showCoverage = false;
+BoardCoverageSettings coverageSettings;
+
+
+// Read keys from the terminal when there are no preview windows, until
+// stopKeys is set. Polls instead of blocking in getchar(), so main() can
+// join it before its own getchar() and the two never read stdin at once.
+void ReadKeys()
+{
+	pollfd pfd;
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
+	while(!stopKeys)
+	{
+		if(poll(&pfd, 1, 100) <= 0)
+			continue;
+		char c;
+		if(read(STDIN_FILENO, &c, 1) != 1)
+			break;
+		if(c != '\n')
+			stdinKey = c;
+	}
+}
 
 
 int PrintDeviceInfo(INodeMap & nodeMap, unsigned int camNum)
@@ -101,11 +163,10 @@ int PrintDeviceInfo(INodeMap & nodeMap, unsigned int camNum)
 
 void createFolders(CameraList camList)
 {
-	for(int i=0; i<camList.GetSize(); i++)
+	for(int i=0; i<(int)camSerial.size(); i++)
 	{
-		string dir_path = "/home/umh-admin/LabWork/MultiCamSystem/ImagesForCalib/" + camSerial[i];
-		boost::filesystem::path dir(dir_path.c_str());
-		if(boost::filesystem::create_directory(dir)) 
+		boost::filesystem::path dir(camOutput[i].c_str());
+		if(boost::filesystem::create_directories(dir)) 
 		{
 			std::cout << "Success" << "\n";
 		}
@@ -137,9 +198,9 @@ int AcquireImages(CameraList camList)
 		// Serial numbers are the only persistent objects we gather in this
 		// example, which is why a vector is created.
 		//
-		vector<gcstring> strSerialNumbers(camList.GetSize());
+		vector<gcstring> strSerialNumbers((int)camSerial.size());
 
-		for (int i = 0; i < camList.GetSize(); i++)
+		for (int i = 0; i < (int)camSerial.size(); i++)
 		{
 			// Select camera
 			pCam = camList.GetBySerial(camSerial[i]);
@@ -186,10 +247,39 @@ int AcquireImages(CameraList camList)
 		int key = -1;
 		int old_key = -1;
   		bool saveImg = false;
-		cv::Mat src[10];
+		vector<cv::Mat> src(camSerial.size());
 		string label = "Cam";
 		int imgCount = 1;
 
+		MJPEGServer previewServer(previewPort, previewBind);
+		vector<int> camStream(camSerial.size());
+		for (int i = 0; i < (int)camSerial.size(); i++)
+		{
+			camStream[i] = previewServer.AddStream(label + camSerial[i]);
+		}
+
+		if (headless)
+		{
+			if (previewServer.Start() < 0)
+				return -1;
+
+			keyReader = thread(ReadKeys);
+		}
+
+		// Board detection of all cameras on a few worker threads
+		BoardCoverage coverage(camSerial.size(), coverageSettings);
+		if (showCoverage)
+			coverage.Start();
+		int frameNum = 0;
+
+		// One selector thread per camera, scoring next to the live stream
+		vector<FrameSelector*> selectors;
+		for (int i = 0; i < (int)camSerial.size() && autoSelect; i++)
+		{
+			selectors.push_back(new FrameSelector(camOutput[i], selectorSettings));
+			selectors.back()->Start();
+		}
+
 		while(char(key)!='q')
 		{
 			//cout << "Press Enter to capture images" << endl;
@@ -208,7 +298,7 @@ int AcquireImages(CameraList camList)
 			}
 
 			#pragma omp parallel for
-			for (int i = 0; i < camList.GetSize(); i++)
+			for (int i = 0; i < (int)camSerial.size(); i++)
 			{
 				try
 				{
@@ -239,13 +329,24 @@ int AcquireImages(CameraList camList)
 						//cv::resize(src[i], src[i], Size(640, 480), 0,0, INTER_LINEAR);
 
 						//cv::namedWindow("image", 1);
-						cv::imshow(label+to_string(i), src[i]);
+						cv::Mat preview = src[i];
+						if(showCoverage)
+						{
+							coverage.Offer(i, frameNum, src[i]);
+							coverage.Overlay(i, src[i], preview);
+						}
+						if(headless)
+							previewServer.PushFrame(camStream[i], preview);
+						else
+							cv::imshow(label+to_string(i), preview);
 						if(saveImg)
 						{
-							string filename = "/home/umh-admin/LabWork/MultiCamSystem/ImagesForCalib/" + camSerial[i] + "/"
+							string filename = camOutput[i] + "/"
 							+ to_string(imgCount) + ".jpg";
 							imwrite(filename, src[i]);
 						}
+						if(autoSelect)
+							selectors[i]->Offer(src[i]);
 
 						
 
@@ -288,7 +389,29 @@ cv::imshow( "image", dst );
 				imgCount++;	
 				saveImg = false;
 			}	
-			key = cv::waitKey(1);	
+			frameNum++;
+			if(headless)
+				key = stdinKey.exchange(-1);
+			else
+				key = cv::waitKey(1);	
+		}
+
+		for (unsigned int i = 0; i < selectors.size(); i++)
+		{
+			selectors[i]->Stop();
+			selectors[i]->PrintStatistics(label + camSerial[i]);
+			delete selectors[i];
+		}
+
+		if (showCoverage)
+		{
+			coverage.Stop();
+			for (int i = 0; i < (int)camSerial.size(); i++)
+			{
+				coverage.PrintSummary(i, label + camSerial[i]);
+				if (coverage.SaveEstimate(i, camOutput[i] + "/calib_estimate.txt") == 0)
+					cout << "Estimate saved to " << camOutput[i] << "/calib_estimate.txt" << endl;
+			}
 		}
 
 		//
@@ -303,7 +426,7 @@ cv::imshow( "image", dst );
 		// GetBySerial(); this is an alternative to retrieving cameras as
 		// CameraPtr objects that can be quick and easy for small tasks.
 		//
-		for (int i = 0; i < camList.GetSize(); i++)
+		for (int i = 0; i < (int)camSerial.size(); i++)
 		{
 			// End acquisition
 			camList.GetBySerial(camSerial[i])->EndAcquisition();
@@ -339,7 +462,7 @@ int RunMultipleCameras(CameraList camList)
 		//
 		cout << endl << "*** DEVICE INFORMATION ***" << endl << endl;
 
-		for (int i = 0; i < camList.GetSize(); i++)
+		for (int i = 0; i < (int)camSerial.size(); i++)
 		{
 			// Select camera
 			pCam = camList.GetBySerial(camSerial[i]);
@@ -364,13 +487,26 @@ int RunMultipleCameras(CameraList camList)
 		// Each camera needs to be deinitialized once all images have been
 		// acquired.
 		//
-		for (int i = 0; i < camList.GetSize(); i++)
+		for (int i = 0; i < (int)camSerial.size(); i++)
 		{
 			// Select camera
 			pCam = camList.GetBySerial(camSerial[i]);
 
 			// Initialize camera
 			pCam->Init();
+
+			// Readout mode at the camera's own exposure
+			if (!camProfile[i].empty())
+			{
+				CaptureProfileResult profileResult;
+				profileResult.serial = camSerial[i];
+				if (ApplyCaptureProfile(pCam->GetNodeMap(), *FindCaptureProfile(camProfile[i]), 0, profileResult) < 0)
+				{
+					cout << "Error applying capture profile" << endl;
+					return -1;
+				}
+				PrintCaptureProfileReport(vector<CaptureProfileResult>(1, profileResult), cout);
+			}
 		}
 
 		createFolders(camList);
@@ -385,11 +521,18 @@ int RunMultipleCameras(CameraList camList)
 		// Again, each camera must be deinitialized separately by first
 		// selecting the camera and then deinitializing it.
 		//
-		for (int i = 0; i < camList.GetSize(); i++)
+		for (int i = 0; i < (int)camSerial.size(); i++)
 		{
 			// Select camera
 			pCam = camList.GetBySerial(camSerial[i]);
 
+			// Back to the full sensor for the other programs
+			if (!camProfile[i].empty())
+			{
+				CaptureProfileResult fullResult;
+				result = result | ApplyCaptureProfile(pCam->GetNodeMap(), *FindCaptureProfile("full"), 0, fullResult);
+			}
+
 			// Deinitialize camera
 			pCam->DeInit();
 		}
@@ -405,10 +548,56 @@ int RunMultipleCameras(CameraList camList)
 
 // Example entry point; please see Enumeration example for more in-depth
 // comments on preparing and cleaning up the system.
-int main(int /*argc*/, char** /*argv*/)
+int main(int argc, char** argv)
 {
 	int result = 0;
 
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-headless") == 0)
+			headless = true;
+		else if (strcmp(argv[i], "-port") == 0 && i+1 < argc)
+			previewPort = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-bind") == 0 && i+1 < argc)
+			previewBind = argv[++i];
+		else if (strcmp(argv[i], "-rig") == 0 && i+1 < argc)
+			rigFile = argv[++i];
+		else if (strcmp(argv[i], "-auto") == 0)
+			autoSelect = true;
+		else if (strcmp(argv[i], "-sharpness") == 0 && i+1 < argc)
+			selectorSettings.minSharpness = atof(argv[++i]);
+		else if (strcmp(argv[i], "-difference") == 0 && i+1 < argc)
+			selectorSettings.minDifference = atof(argv[++i]);
+		else if (strcmp(argv[i], "-maxFrames") == 0 && i+1 < argc)
+			selectorSettings.maxFrames = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-board") == 0 && i+1 < argc)
+		{
+			if (sscanf(argv[++i], "%dx%d", &coverageSettings.boardSize.width, &coverageSettings.boardSize.height) != 2)
+			{
+				cout << "Board size is <cols>x<rows>, e.g. 9x6" << endl;
+				return -1;
+			}
+			selectorSettings.boardSize = coverageSettings.boardSize;
+			showCoverage = true;
+		}
+		else if (strcmp(argv[i], "-square") == 0 && i+1 < argc)
+			coverageSettings.squareSize = atof(argv[++i]);
+		else if (strcmp(argv[i], "-every") == 0 && i+1 < argc)
+			coverageSettings.every = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-workers") == 0 && i+1 < argc)
+			coverageSettings.numWorkers = atoi(argv[++i]);
+	}
+
+	RigPlan rig;
+	if (rig.Load(rigFile) < 0)
+		return -1;
+	for (unsigned int i = 0; i < rig.cameras.size(); i++)
+	{
+		camSerial.push_back(rig.cameras[i].serial);
+		camOutput.push_back(rig.cameras[i].outputDir);
+		camProfile.push_back(rig.cameras[i].profile);
+	}
+
 	// Print application build information
 	cout << "Application build date: " << __DATE__ << " " << __TIME__ << endl << endl;
 
@@ -422,8 +611,8 @@ int main(int /*argc*/, char** /*argv*/)
 
 	cout << "Number of cameras detected: " << numCameras << endl << endl;
 
-	// Finish if there are no cameras
-	if (numCameras == 0)
+	// Finish if the cameras of the rig are not all there
+	if (numCameras < camSerial.size())
 	{
 		// Clear camera list before releasing system
 		camList.Clear();
@@ -443,6 +632,10 @@ int main(int /*argc*/, char** /*argv*/)
 
 	result = RunMultipleCameras(camList);
 
+	stopKeys = true;
+	if (keyReader.joinable())
+		keyReader.join();
+
 	cout << "Example complete..." << endl << endl;
 
 	// Clear camera list before releasing system
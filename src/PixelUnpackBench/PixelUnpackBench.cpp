@@ -0,0 +1,137 @@
+//
+// Unpack throughput benchmark.
+//
+// Unpacks synthetic frames of every supported camera format to 16 bits,
+// with the scalar and the SIMD kernels, and checks that both agree. Also
+// times the 8-bit preview paths (shift and tone map).
+//
+// Usage: PixelUnpackBench [width height] [numFrames]
+//
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "PixelUnpack.h"
+
+using namespace std;
+using namespace cv;
+
+
+// Bytes per row of a frame in the given format
+size_t RowBytes(UnpackFormat format, int width)
+{
+	switch(format)
+	{
+	case UNPACK_MONO8:	return width;
+	case UNPACK_MONO16:	return width * 2;
+	default:			return (width * 3 + 1) / 2;
+	}
+}
+
+
+double TimeUnpack(const vector<uint8_t> &raw, UnpackFormat format, int width, int height, int numFrames, bool useSimd, Mat &out)
+{
+	size_t stride = RowBytes(format, width);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(int i=0; i<numFrames; i++)
+		UnpackImage(&raw[0], stride, width, height, format, out, useSimd);
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+
+bool SameImage(const Mat &a, const Mat &b)
+{
+	for(int y=0; y<a.rows; y++)
+	{
+		if(memcmp(a.ptr<uint16_t>(y), b.ptr<uint16_t>(y), a.cols * sizeof(uint16_t)) != 0)
+			return false;
+	}
+	return true;
+}
+
+
+void PrintRate(const char *name, const char *kernel, double seconds, int width, int height, int numFrames, size_t frameBytes)
+{
+	double pixels = (double)width * height * numFrames;
+	cout << name << "\t" << kernel << "\t" << pixels / seconds / 1e6 << " MPix/s\t"
+		 << frameBytes * (double)numFrames / seconds / 1e9 << " GB/s in\t"
+		 << seconds * 1000.0 / numFrames << " ms/frame" << endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int width = 2048;
+	int height = 1536;
+	int numFrames = 50;
+
+	if(argc > 2)
+	{
+		width = atoi(argv[1]);
+		height = atoi(argv[2]);
+	}
+	if(argc > 3)
+		numFrames = atoi(argv[3]);
+
+	cout << "Frame size: " << width << "x" << height << ", frames: " << numFrames
+		 << ", SIMD: " << (UnpackHasSimd() ? "SSSE3" : "none") << endl << endl;
+
+	UnpackFormat formats[] = { UNPACK_MONO8, UNPACK_MONO12P, UNPACK_MONO12_PACKED, UNPACK_MONO16 };
+	int result = 0;
+	Mat unpacked;
+
+	for(unsigned int f=0; f<sizeof(formats)/sizeof(formats[0]); f++)
+	{
+		UnpackFormat format = formats[f];
+		size_t frameBytes = RowBytes(format, width) * height;
+
+		vector<uint8_t> raw(frameBytes);
+		srand(f + 1);
+		for(size_t i=0; i<frameBytes; i++)
+			raw[i] = rand() & 0xff;
+
+		Mat scalarOut, simdOut;
+		double scalarTime = TimeUnpack(raw, format, width, height, numFrames, false, scalarOut);
+		PrintRate(UnpackFormatName(format), "scalar", scalarTime, width, height, numFrames, frameBytes);
+
+		if(UnpackHasSimd() && format != UNPACK_MONO16)
+		{
+			double simdTime = TimeUnpack(raw, format, width, height, numFrames, true, simdOut);
+			PrintRate(UnpackFormatName(format), "simd", simdTime, width, height, numFrames, frameBytes);
+			cout << "\t\tspeedup " << scalarTime / simdTime << endl;
+
+			if(!SameImage(scalarOut, simdOut))
+			{
+				cout << "Error: SIMD and scalar results differ for " << UnpackFormatName(format) << endl;
+				result = -1;
+			}
+		}
+
+		if(format == UNPACK_MONO12P)
+			unpacked = scalarOut;
+	}
+
+	// 8-bit previews of a 12-bit frame
+	Mat preview;
+	ToneMapper toneMapper(12);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(int i=0; i<numFrames; i++)
+		ToneMapper::Shift(unpacked, preview, 12);
+	PrintRate("preview", "shift", chrono::duration<double>(chrono::steady_clock::now() - start).count(), width, height, numFrames, width * height * 2);
+
+	start = chrono::steady_clock::now();
+	for(int i=0; i<numFrames; i++)
+		toneMapper.Apply(unpacked, preview);
+	PrintRate("preview", "tonemap", chrono::duration<double>(chrono::steady_clock::now() - start).count(), width, height, numFrames, width * height * 2);
+	cout << "Tone map levels: black " << toneMapper.blackPoint << ", white " << toneMapper.whitePoint << endl;
+
+	return result;
+}
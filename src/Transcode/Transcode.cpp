@@ -0,0 +1,398 @@
+//
+// Batch transcoder for raw recordings.
+//
+// Turns the frames.raws files of a MultiCamSHM session ("format: raw" in
+// the rig file) into one folder of images per camera:
+//
+// Usage: Transcode <sessionDir> <outputDir> [-format jpg|png|tiff]
+//        [-quality q] [-mosaic] [-threads n] [-writers n]
+//
+// Every subdirectory of sessionDir with a frames.raws file is a camera and
+// gets a subdirectory of the same name in outputDir, with <slot>.<format>
+// files numbered as MultiCamSHM numbers them.
+//
+// *** NOTES ***
+// Three stages with bounded queues between them, so no stage runs far
+// ahead of the others or fills the memory:
+//
+//   read     one thread per camera file, so several disks are read at once
+//   encode   -threads workers (default: all cores) decode the payload
+//            (raw or rawCodec compressed), demosaic Bayer frames (unless
+//            -mosaic) and encode in memory
+//   write    -writers threads write the encoded files
+//
+// Files are written as <name>.part and renamed when complete, so a run
+// that is stopped can be started again and carries on: frames whose image
+// already exists are skipped without reading their payload. The report at
+// the end gives the throughput of the run and how long each stage waited
+// on the next one, i.e. which stage limited it.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "RawSession.h"
+
+using namespace std;
+using namespace cv;
+
+
+// Queue between two stages; Push waits while it is full, Pop while it is
+// empty and not closed
+template <typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) : capacity(capacity), closed(false), waitMs(0) {}
+
+	void Push(T &item)
+	{
+		unique_lock<mutex> lock(queueMutex);
+		if(items.size() >= capacity)
+		{
+			auto waitStart = chrono::steady_clock::now();
+			notFull.wait(lock, [this] { return items.size() < capacity; });
+			waitMs += chrono::duration<double, milli>(chrono::steady_clock::now() - waitStart).count();
+		}
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
+	}
+
+	bool Pop(T &item)
+	{
+		unique_lock<mutex> lock(queueMutex);
+		notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+		if(items.empty())
+			return false;
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
+
+	void Close()
+	{
+		lock_guard<mutex> lock(queueMutex);
+		closed = true;
+		notEmpty.notify_all();
+	}
+
+	// Time producers spent waiting for room
+	double GetWaitMs()
+	{
+		lock_guard<mutex> lock(queueMutex);
+		return waitMs;
+	}
+
+private:
+	size_t capacity;
+	deque<T> items;
+	bool closed;
+	double waitMs;
+	mutex queueMutex;
+	condition_variable notEmpty, notFull;
+};
+
+
+struct DecodeJob
+{
+	RawFrameHeader header;
+	vector<uint8_t> payload;
+	string fileName;
+};
+
+struct WriteJob
+{
+	vector<uchar> data;
+	string fileName;
+};
+
+
+// Settings of the run
+string format = "jpg";
+int quality = 95;
+bool keepMosaic = false;
+
+atomic<uint64_t> numRead(0), numSkipped(0), numWritten(0), numFailed(0);
+atomic<uint64_t> bytesRead(0), bytesWritten(0);
+
+
+static bool FileExists(const string &fileName)
+{
+	struct stat info;
+	return stat(fileName.c_str(), &info) == 0 && info.st_size > 0;
+}
+
+
+// Cameras of a session: subdirectories with a frames.raws file
+static vector<string> FindCameras(const string &sessionDir)
+{
+	vector<string> names;
+
+	DIR *d = opendir(sessionDir.c_str());
+	if(d == NULL)
+	{
+		cout << "Unable to open " << sessionDir << endl;
+		return names;
+	}
+
+	struct dirent *entry;
+	while((entry = readdir(d)) != NULL)
+	{
+		string name = entry->d_name;
+		if(name == "." || name == "..")
+			continue;
+		if(FileExists(sessionDir + "/" + name + "/frames.raws"))
+			names.push_back(name);
+	}
+	closedir(d);
+
+	sort(names.begin(), names.end());
+	return names;
+}
+
+
+void ReadCamera(const string &rawFile, const string &outputDir, BoundedQueue<DecodeJob> &decodeQueue)
+{
+	RawReader reader;
+	if(reader.Open(rawFile) < 0)
+		return;
+
+	DecodeJob job;
+	while(reader.Next(job.header))
+	{
+		job.fileName = outputDir + "/" + to_string(job.header.slot) + "." + format;
+
+		// Done in an earlier run
+		if(FileExists(job.fileName))
+		{
+			reader.SkipPayload();
+			numSkipped++;
+			continue;
+		}
+
+		if(reader.ReadPayload(job.payload) < 0)
+		{
+			cout << rawFile << ": frame " << job.header.slot << " cut off" << endl;
+			break;
+		}
+		numRead++;
+		bytesRead += job.payload.size();
+
+		decodeQueue.Push(job);
+	}
+}
+
+
+void Encode(BoundedQueue<DecodeJob> &decodeQueue, BoundedQueue<WriteJob> &writeQueue, atomic<double> *busyMs)
+{
+	vector<int> params;
+	if(format == "jpg")
+	{
+		params.push_back(IMWRITE_JPEG_QUALITY);
+		params.push_back(quality);
+	}
+	else if(format == "png")
+	{
+		// Fast compression; the files are still lossless
+		params.push_back(IMWRITE_PNG_COMPRESSION);
+		params.push_back(1);
+	}
+
+	DecodeJob job;
+	Mat img, bgr;
+	while(decodeQueue.Pop(job))
+	{
+		auto start = chrono::steady_clock::now();
+
+		if(DecodeRawFrame(job.header, job.payload, img) < 0)
+		{
+			numFailed++;
+			continue;
+		}
+
+		const Mat *out = &img;
+		int code = DemosaicCode(job.header.pixelFormat);
+		if(!keepMosaic && code >= 0)
+		{
+			cvtColor(img, bgr, code);
+			out = &bgr;
+		}
+
+		// JPEG is 8 bit only; 16-bit frames keep their significant bits
+		Mat shifted;
+		if(format == "jpg" && out->depth() == CV_16U)
+		{
+			out->convertTo(shifted, CV_8U, 1.0 / (1 << max((int)job.header.bitDepth - 8, 0)));
+			out = &shifted;
+		}
+
+		WriteJob writeJob;
+		writeJob.fileName = job.fileName;
+		if(!imencode("." + format, *out, writeJob.data, params))
+		{
+			cout << job.fileName << ": encoding failed" << endl;
+			numFailed++;
+			continue;
+		}
+
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		double expected = busyMs->load();
+		while(!busyMs->compare_exchange_weak(expected, expected + ms))
+			;
+
+		writeQueue.Push(writeJob);
+	}
+}
+
+
+void WriteFiles(BoundedQueue<WriteJob> &writeQueue)
+{
+	WriteJob job;
+	while(writeQueue.Pop(job))
+	{
+		// Complete files only under the final name, for resuming
+		string partName = job.fileName + ".part";
+		FILE *file = fopen(partName.c_str(), "wb");
+		if(file == NULL || fwrite(&job.data[0], job.data.size(), 1, file) != 1)
+		{
+			cout << "Unable to write " << partName << endl;
+			if(file != NULL)
+				fclose(file);
+			numFailed++;
+			continue;
+		}
+		fclose(file);
+
+		if(rename(partName.c_str(), job.fileName.c_str()) != 0)
+		{
+			cout << "Unable to rename " << partName << endl;
+			numFailed++;
+			continue;
+		}
+		numWritten++;
+		bytesWritten += job.data.size();
+	}
+}
+
+
+int main(int argc, char** argv)
+{
+	if(argc < 3)
+	{
+		cout << "Usage: Transcode <sessionDir> <outputDir> [-format jpg|png|tiff] [-quality q] [-mosaic] [-threads n] [-writers n]" << endl;
+		return -1;
+	}
+
+	string sessionDir = argv[1];
+	string outputDir = argv[2];
+	int numThreads = max((int)thread::hardware_concurrency(), 1);
+	int numWriters = 2;
+	for(int i=3; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-format") == 0 && i+1 < argc)
+			format = argv[++i];
+		else if(strcmp(argv[i], "-quality") == 0 && i+1 < argc)
+			quality = atoi(argv[++i]);
+		else if(strcmp(argv[i], "-mosaic") == 0)
+			keepMosaic = true;
+		else if(strcmp(argv[i], "-threads") == 0 && i+1 < argc)
+			numThreads = max(atoi(argv[++i]), 1);
+		else if(strcmp(argv[i], "-writers") == 0 && i+1 < argc)
+			numWriters = max(atoi(argv[++i]), 1);
+		else
+		{
+			cout << "Unknown option " << argv[i] << endl;
+			return -1;
+		}
+	}
+	if(format == "tif")
+		format = "tiff";
+	if(format != "jpg" && format != "png" && format != "tiff")
+	{
+		cout << "Format is jpg, png or tiff" << endl;
+		return -1;
+	}
+
+	vector<string> cameras = FindCameras(sessionDir);
+	if(cameras.empty())
+	{
+		cout << "No frames.raws files in the subdirectories of " << sessionDir << endl;
+		return -1;
+	}
+
+	mkdir(outputDir.c_str(), 0755);
+	for(unsigned int i=0; i<cameras.size(); i++)
+		mkdir((outputDir + "/" + cameras[i]).c_str(), 0755);
+
+	cout << cameras.size() << " cameras, " << format << ", " << numThreads << " encode threads, "
+		 << numWriters << " writers" << endl;
+
+	// A few frames per thread in flight
+	BoundedQueue<DecodeJob> decodeQueue(2 * numThreads);
+	BoundedQueue<WriteJob> writeQueue(4 * numWriters);
+	atomic<double> encodeMs(0);
+
+	auto start = chrono::steady_clock::now();
+
+	vector<thread> readers, encoders, writers;
+	for(unsigned int i=0; i<cameras.size(); i++)
+	{
+		readers.push_back(thread(ReadCamera, sessionDir + "/" + cameras[i] + "/frames.raws",
+		                         outputDir + "/" + cameras[i], std::ref(decodeQueue)));
+	}
+	for(int i=0; i<numThreads; i++)
+		encoders.push_back(thread(Encode, std::ref(decodeQueue), std::ref(writeQueue), &encodeMs));
+	for(int i=0; i<numWriters; i++)
+		writers.push_back(thread(WriteFiles, std::ref(writeQueue)));
+
+	for(unsigned int i=0; i<readers.size(); i++)
+		readers[i].join();
+	decodeQueue.Close();
+	for(unsigned int i=0; i<encoders.size(); i++)
+		encoders[i].join();
+	writeQueue.Close();
+	for(unsigned int i=0; i<writers.size(); i++)
+		writers[i].join();
+
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	cout << fixed << setprecision(1);
+	cout << "Transcoded " << numWritten << " frames in " << seconds << " s";
+	if(numSkipped > 0)
+		cout << ", " << numSkipped << " already done";
+	if(numFailed > 0)
+		cout << ", " << numFailed << " failed";
+	cout << endl;
+	if(seconds > 0)
+	{
+		cout << numWritten / seconds << " frames/s, read " << bytesRead / seconds / 1e6 << " MB/s, written "
+			 << bytesWritten / seconds / 1e6 << " MB/s" << endl;
+	}
+	if(numRead > 0)
+	{
+		cout << "Encode: " << encodeMs.load() / numRead << " ms per frame on one thread" << endl;
+	}
+	cout << "Waiting for room: readers " << decodeQueue.GetWaitMs() / 1000 << " s (encode bound), encoders "
+		 << writeQueue.GetWaitMs() / 1000 << " s (write bound)" << endl;
+
+	return numFailed > 0 ? -1 : 0;
+}
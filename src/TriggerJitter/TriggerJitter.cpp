@@ -0,0 +1,405 @@
+//
+// Trigger-to-exposure jitter benchmark.
+//
+// Enables the ExposureEnd device event on every camera, triggers a number of
+// framesets and correlates EventExposureEndTimestamp per camera per trigger.
+// Timestamps are brought to rig time with ClockSync before the comparison.
+//
+// Usage: TriggerJitter hardware|software|mock [numTriggers] [-rig <file>]
+//
+// The cameras and the primary are those of the rig file (default
+// ../rig/lab.rig).
+//
+//   hardware  primary camera on Line2, secondaries on Line3 (as MultiCamSHM)
+//   software  TriggerSoftware executed on each camera in turn (as MultiCamSTStream)
+//   mock      no cameras; feeds simulated events to the analysis
+//
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+
+#include "ClockSync.h"
+#include "TriggerJitter.h"
+#include "RigPlan.h"
+#include "CaptureProfile.h"
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+
+
+enum triggerType
+{
+	SOFTWARE,
+	HARDWARE
+};
+
+triggerType chosenTrigger = HARDWARE;
+RigPlan rig;
+string rigFile = "../rig/lab.rig";
+
+
+//
+// Device event handler that records the exposure end of every frame
+//
+class ExposureEndHandler : public DeviceEvent
+{
+public:
+
+	ExposureEndHandler(CameraPtr pCam, int camNum, ClockSync &clockSync, TriggerJitterAnalyzer &analyzer)
+		: m_pCam(pCam), m_camNum(camNum), m_clockSync(clockSync), m_analyzer(analyzer) {}
+	~ExposureEndHandler() {};
+
+	void OnDeviceEvent(gcstring eventName)
+	{
+		if (eventName != "EventExposureEnd")
+			return;
+
+		try
+		{
+			INodeMap & nodeMap = m_pCam->GetNodeMap();
+			CIntegerPtr ptrTimestamp = nodeMap.GetNode("EventExposureEndTimestamp");
+			CIntegerPtr ptrFrameID = nodeMap.GetNode("EventExposureEndFrameID");
+			if (!IsAvailable(ptrTimestamp) || !IsReadable(ptrTimestamp) || !IsAvailable(ptrFrameID) || !IsReadable(ptrFrameID))
+				return;
+
+			uint64_t rigTime = m_clockSync.ToRigTime(m_camNum, ptrTimestamp->GetValue());
+			m_analyzer.AddEvent(m_camNum, ptrFrameID->GetValue(), rigTime);
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			cout << "Error: " << e.what() << endl;
+		}
+	}
+
+private:
+
+	CameraPtr m_pCam;
+	int m_camNum;
+	ClockSync &m_clockSync;
+	TriggerJitterAnalyzer &m_analyzer;
+};
+
+
+// Select an entry of an enumeration node. Returns -1 if it is not available.
+int SetEnumNode(INodeMap & nodeMap, const char *nodeName, const char *entryName)
+{
+	CEnumerationPtr ptrNode = nodeMap.GetNode(nodeName);
+	if (!IsAvailable(ptrNode) || !IsWritable(ptrNode))
+	{
+		cout << "Unable to set " << nodeName << " (node retrieval). Aborting..." << endl;
+		return -1;
+	}
+
+	CEnumEntryPtr ptrEntry = ptrNode->GetEntryByName(entryName);
+	if (!IsAvailable(ptrEntry) || !IsReadable(ptrEntry))
+	{
+		cout << "Unable to set " << nodeName << " to " << entryName << " (enum entry retrieval). Aborting..." << endl;
+		return -1;
+	}
+
+	ptrNode->SetIntValue(ptrEntry->GetValue());
+	return 0;
+}
+
+
+// Trigger setup of MultiCamSHM (hardware) and MultiCamSTStream (software)
+int ConfigureTrigger(INodeMap & nodeMap, bool isPrimary)
+{
+	int result = 0;
+
+	try
+	{
+		result = result | SetEnumNode(nodeMap, "TriggerMode", "Off");
+
+		if (chosenTrigger == SOFTWARE)
+		{
+			result = result | SetEnumNode(nodeMap, "TriggerSource", "Software");
+			result = result | SetEnumNode(nodeMap, "TriggerMode", "On");
+		}
+		else if (isPrimary)
+		{
+			result = result | SetEnumNode(nodeMap, "TriggerSource", "Line2");
+		}
+		else
+		{
+			result = result | SetEnumNode(nodeMap, "TriggerSource", "Line3");
+			result = result | SetEnumNode(nodeMap, "TriggerOverlap", "ReadOut");
+			result = result | SetEnumNode(nodeMap, "TriggerSelector", "FrameStart");
+			result = result | SetEnumNode(nodeMap, "TriggerMode", "On");
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		result = -1;
+	}
+
+	return result;
+}
+
+
+// Enable only the ExposureEnd event (pattern of the DeviceEvents example)
+int ConfigureExposureEndEvent(INodeMap & nodeMap)
+{
+	int result = 0;
+
+	try
+	{
+		result = result | SetEnumNode(nodeMap, "EventSelector", "ExposureEnd");
+		result = result | SetEnumNode(nodeMap, "EventNotification", "On");
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		result = -1;
+	}
+
+	return result;
+}
+
+
+int ResetCamera(INodeMap & nodeMap)
+{
+	int result = 0;
+
+	try
+	{
+		result = result | SetEnumNode(nodeMap, "EventSelector", "ExposureEnd");
+		result = result | SetEnumNode(nodeMap, "EventNotification", "Off");
+		result = result | SetEnumNode(nodeMap, "TriggerMode", "Off");
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		result = -1;
+	}
+
+	return result;
+}
+
+
+// Software trigger fan-out: one TriggerSoftware per camera, in turn
+int ExecuteSoftwareTrigger(vector<CameraPtr> &cameras)
+{
+	try
+	{
+		for (unsigned int i = 0; i < cameras.size(); i++)
+		{
+			CCommandPtr ptrSoftwareTriggerCommand = cameras[i]->GetNodeMap().GetNode("TriggerSoftware");
+			if (!IsAvailable(ptrSoftwareTriggerCommand) || !IsWritable(ptrSoftwareTriggerCommand))
+			{
+				cout << "Unable to execute trigger. Aborting..." << endl;
+				return -1;
+			}
+			ptrSoftwareTriggerCommand->Execute();
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int RunJitterBenchmark(CameraList camList, int numTriggers)
+{
+	int result = 0;
+	int numCams = rig.cameras.size();
+	vector<CameraPtr> cameras;
+	vector<ExposureEndHandler*> handlers;
+	int primary = rig.GetPrimary();
+
+	try
+	{
+		for (int i = 0; i < numCams; i++)
+		{
+			CameraPtr pCam = camList.GetBySerial(rig.cameras[i].serial);
+			if (!pCam.IsValid())
+			{
+				cout << "Camera " << rig.cameras[i].serial << " of the rig is not connected" << endl;
+				return -1;
+			}
+			cout << "Initializing Camera: " << i << " SerialNum:" << pCam->GetUniqueID() << endl;
+			pCam->Init();
+
+			INodeMap & nodeMap = pCam->GetNodeMap();
+			bool isPrimary = (i == primary);
+
+			// Readout mode of the rig, which sets how fast the primary runs
+			if (!rig.cameras[i].profile.empty())
+			{
+				CaptureProfileResult profileResult;
+				profileResult.serial = rig.cameras[i].serial;
+				if (ApplyCaptureProfile(nodeMap, *FindCaptureProfile(rig.cameras[i].profile), 0, profileResult) < 0)
+				{
+					cout << "Error applying capture profile to camera " << i << endl;
+					return -1;
+				}
+			}
+
+			if (ConfigureTrigger(nodeMap, isPrimary) < 0 || ConfigureExposureEndEvent(nodeMap) < 0)
+			{
+				cout << "Error configuring camera " << i << endl;
+				return -1;
+			}
+			result = result | SetEnumNode(nodeMap, "AcquisitionMode", "Continuous");
+
+			cameras.push_back(pCam);
+		}
+
+		ClockSync clockSync(cameras);
+		if (clockSync.Start() < 0)
+		{
+			cout << "Error starting clock sync" << endl;
+			return -1;
+		}
+
+		// The secondaries are armed before the free running primary starts
+		// to trigger them, so all cameras see its first frame; the analyzer
+		// also aligns cameras that missed it
+		TriggerJitterAnalyzer analyzer(numCams);
+		for (int i = 0; i < numCams; i++)
+		{
+			handlers.push_back(new ExposureEndHandler(cameras[i], i, clockSync, analyzer));
+			cameras[i]->RegisterEvent(*handlers[i], "EventExposureEnd");
+			if (i != primary)
+				cameras[i]->BeginAcquisition();
+		}
+		if (primary >= 0)
+			cameras[primary]->BeginAcquisition();
+
+		cout << "Capturing " << numTriggers << " triggers..." << endl;
+
+		for (int imgNum = 0; imgNum < numTriggers; imgNum++)
+		{
+			if (chosenTrigger == SOFTWARE)
+				result = result | ExecuteSoftwareTrigger(cameras);
+
+			for (int i = 0; i < numCams; i++)
+			{
+				ImagePtr pResultImage = cameras[i]->GetNextImage(1000);
+				pResultImage->Release();
+			}
+		}
+
+		for (int i = 0; i < numCams; i++)
+		{
+			cameras[i]->EndAcquisition();
+			cameras[i]->UnregisterEvent(*handlers[i]);
+			delete handlers[i];
+			result = result | ResetCamera(cameras[i]->GetNodeMap());
+			if (!rig.cameras[i].profile.empty())
+			{
+				CaptureProfileResult fullResult;
+				result = result | ApplyCaptureProfile(cameras[i]->GetNodeMap(), *FindCaptureProfile("full"), 0, fullResult);
+			}
+		}
+		handlers.clear();
+
+		clockSync.Stop();
+		clockSync.PrintReport();
+		analyzer.Report(cout);
+
+		for (int i = 0; i < numCams; i++)
+			cameras[i]->DeInit();
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		result = -1;
+	}
+
+	return result;
+}
+
+
+// Run the analysis on simulated events; no cameras needed
+int RunMock(int numTriggers)
+{
+	int numCams = 6;
+	double periodUs = 1e6 / 170.0;
+	double jitterUs = 4.0;
+
+	MockExposureEndSource source(numCams, periodUs, jitterUs, 0.1, 0.01);
+	TriggerJitterAnalyzer analyzer(numCams);
+	source.Run(analyzer, numTriggers);
+
+	cout << "Simulated latency per camera (us):" << endl;
+	double meanLatency = 0;
+	for (int i = 0; i < numCams; i++)
+		meanLatency += source.latencyUs[i] / numCams;
+	for (int i = 0; i < numCams; i++)
+		cout << "  Camera " << i << ": " << source.latencyUs[i] - meanLatency << " against mean, jitter " << jitterUs << endl;
+
+	analyzer.Report(cout);
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int result = 0;
+
+	if (argc < 2)
+	{
+		cout << "Usage: " << argv[0] << " hardware|software|mock [numTriggers] [-rig <file>]" << endl;
+		return -1;
+	}
+
+	string mode = argv[1];
+	int numTriggers = 1000;
+	if (argc > 2 && argv[2][0] != '-')
+		numTriggers = atoi(argv[2]);
+
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-rig") == 0 && i+1 < argc)
+			rigFile = argv[++i];
+	}
+
+	if (mode == "mock")
+		return RunMock(numTriggers);
+
+	chosenTrigger = (mode == "software") ? SOFTWARE : HARDWARE;
+
+	if (rig.Load(rigFile) < 0)
+		return -1;
+	if (chosenTrigger == HARDWARE && rig.GetPrimary() < 0)
+	{
+		cout << rigFile << ": hardware triggering needs a camera with role: primary" << endl;
+		return -1;
+	}
+
+	// Print application build information
+	cout << "Program build date: " << __DATE__ << " " << __TIME__ << endl << endl;
+
+	SystemPtr system = System::GetInstance();
+	CameraList camList = system->GetCameras();
+
+	cout << "Number of cameras detected: " << camList.GetSize() << endl << endl;
+
+	if (camList.GetSize() < (unsigned int)rig.cameras.size())
+	{
+		camList.Clear();
+		system->ReleaseInstance();
+		cout << "Not enough cameras!" << endl;
+		return -1;
+	}
+
+	result = RunJitterBenchmark(camList, numTriggers);
+
+	camList.Clear();
+	system->ReleaseInstance();
+
+	return result;
+}
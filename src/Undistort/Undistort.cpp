@@ -0,0 +1,157 @@
+//
+// Lens undistortion of saved images, and benchmark of the remap tables of
+// Undistort against cv::undistort (the myUndistort.py path).
+//
+// Usage: Undistort [-o outDir] [-threads N] [-repeat N] calibFile image [image...] [calibFile image...]
+//
+// A calib*.txt argument applies to the images after it, so the images of
+// several cameras can be given at once:
+//
+//     Undistort -o out ../../Temp/calib00.txt ../../Temp/0a_1.jpg ../../Temp/calib01.txt ../../Temp/1a_1.jpg
+//
+// For every image the time of cv::undistort, which computes the maps again
+// on every call, is compared with the time of applying the table, whose
+// build time is reported once per calibration. diff is the largest
+// difference of a pixel between the two outputs.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "Undistort.h"
+
+using namespace std;
+using namespace cv;
+
+
+static double Milliseconds(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+
+static bool IsCalibrationFile(const string &name)
+{
+	return name.size() > 4 && name.compare(name.size() - 4, 4, ".txt") == 0;
+}
+
+
+// Largest difference of a pixel, 8-bit images
+static int MaxDifference(const Mat &a, const Mat &b)
+{
+	int largest = 0;
+	for(int y=0; y<a.rows; y++)
+	{
+		const uint8_t *pa = a.ptr<uint8_t>(y);
+		const uint8_t *pb = b.ptr<uint8_t>(y);
+		for(int x=0; x<a.cols * a.channels(); x++)
+			largest = max(largest, abs(pa[x] - pb[x]));
+	}
+	return largest;
+}
+
+
+int main(int argc, char** argv)
+{
+	string outDir;
+	int numThreads = 1;
+	int numRepeats = 10;
+	vector<string> files;
+
+	for(int i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+			outDir = argv[++i];
+		else if(strcmp(argv[i], "-threads") == 0 && i+1 < argc)
+			numThreads = max(atoi(argv[++i]), 1);
+		else if(strcmp(argv[i], "-repeat") == 0 && i+1 < argc)
+			numRepeats = max(atoi(argv[++i]), 1);
+		else
+			files.push_back(argv[i]);
+	}
+
+	if(files.empty() || !IsCalibrationFile(files[0]))
+	{
+		cout << "Usage: Undistort [-o outDir] [-threads N] [-repeat N] calibFile image [image...] [calibFile image...]" << endl;
+		return -1;
+	}
+
+	LensCalibration lens;
+	UndistortMap map;
+	Mat cameraMatrix, distCoeffs;
+	double tableTotal = 0, opencvTotal = 0;
+	int numImages = 0;
+
+	cout << fixed << setprecision(2);
+
+	for(unsigned int f=0; f<files.size(); f++)
+	{
+		if(IsCalibrationFile(files[f]))
+		{
+			if(lens.Load(files[f]) != 0)
+				return -1;
+
+			auto start = chrono::steady_clock::now();
+			map.Build(lens, lens.width, lens.height);
+			cout << files[f] << ": table built in " << Milliseconds(start) << " ms" << endl;
+
+			cameraMatrix = Mat::eye(3, 3, CV_64F);
+			cameraMatrix.at<double>(0, 0) = lens.fx;
+			cameraMatrix.at<double>(1, 1) = lens.fy;
+			cameraMatrix.at<double>(0, 2) = lens.cx;
+			cameraMatrix.at<double>(1, 2) = lens.cy;
+			distCoeffs = Mat::zeros(1, 4, CV_64F);
+			distCoeffs.at<double>(0) = lens.k1;
+			distCoeffs.at<double>(1) = lens.k2;
+			continue;
+		}
+
+		Mat img = imread(files[f]);
+		if(img.empty())
+		{
+			cout << "Unable to read " << files[f] << endl;
+			continue;
+		}
+
+		Mat reference, corrected;
+		auto start = chrono::steady_clock::now();
+		for(int r=0; r<numRepeats; r++)
+			undistort(img, reference, cameraMatrix, distCoeffs);
+		double opencvTime = Milliseconds(start) / numRepeats;
+
+		start = chrono::steady_clock::now();
+		for(int r=0; r<numRepeats; r++)
+			map.Apply(img, corrected, numThreads);
+		double tableTime = Milliseconds(start) / numRepeats;
+
+		cout << files[f] << ": cv::undistort " << opencvTime << " ms, table " << tableTime << " ms ("
+			 << opencvTime / tableTime << "x), diff " << MaxDifference(reference, corrected) << endl;
+		opencvTotal += opencvTime;
+		tableTotal += tableTime;
+		numImages++;
+
+		if(!outDir.empty())
+		{
+			size_t slash = files[f].rfind('/');
+			string outFile = outDir + "/" + (slash == string::npos ? files[f] : files[f].substr(slash + 1));
+			if(!imwrite(outFile, corrected))
+				cout << "Unable to write " << outFile << endl;
+		}
+	}
+
+	if(numImages > 0)
+	{
+		cout << numImages << " images, " << numThreads << " threads: cv::undistort " << opencvTotal / numImages
+			 << " ms, table " << tableTotal / numImages << " ms per image" << endl;
+	}
+
+	return 0;
+}
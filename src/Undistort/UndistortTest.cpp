@@ -0,0 +1,139 @@
+//
+// Checks of the Bayer remap of UndistortMap on synthetic mosaics:
+//
+//  - with a calibration without distortion every pixel must come back as
+//    it was, 8 and 16 bit;
+//  - a mosaic of four flat colour planes must stay four flat planes under
+//    a strong distortion, i.e. no output pixel takes anything from a pixel
+//    of another colour.
+//
+// Usage: UndistortTest (make test). Prints the failed checks, returns -1
+// if there are any.
+//
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+#include <opencv2/core/core.hpp>
+
+#include "Undistort.h"
+
+using namespace std;
+using namespace cv;
+
+
+static LensCalibration TestCalibration(int width, int height, double k1, double k2)
+{
+	LensCalibration lens;
+	lens.width = width;
+	lens.height = height;
+	lens.fx = 0.8 * width;
+	lens.fy = 0.8 * width;
+	lens.cx = 0.47 * width;
+	lens.cy = 0.52 * height;
+	lens.k1 = k1;
+	lens.k2 = k2;
+	return lens;
+}
+
+
+// Noise on a different level in each of the four planes
+template <typename T>
+static void SyntheticMosaic(Mat &img, int width, int height, int maxValue)
+{
+	static const int levels[4] = { 200, 90, 110, 30 };
+	img.create(height, width, sizeof(T) == 1 ? CV_8UC1 : CV_16UC1);
+	srand(1);
+	for(int y=0; y<height; y++)
+	{
+		for(int x=0; x<width; x++)
+		{
+			int level = levels[(y & 1) * 2 + (x & 1)] * maxValue / 255;
+			img.at<T>(y, x) = (T)min(level + rand() % (maxValue / 8), maxValue);
+		}
+	}
+}
+
+
+template <typename T>
+static int CheckIdentity(int width, int height, int maxValue)
+{
+	Mat src, dst;
+	SyntheticMosaic<T>(src, width, height, maxValue);
+
+	UndistortMap map;
+	map.Build(TestCalibration(width, height, 0, 0), width, height, true);
+	map.Apply(src, dst);
+
+	for(int y=0; y<height; y++)
+	{
+		if(memcmp(src.ptr(y), dst.ptr(y), width * sizeof(T)) != 0)
+		{
+			cout << "Identity, " << sizeof(T) * 8 << " bit " << width << "x" << height << ": row " << y << " differs" << endl;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+template <typename T>
+static int CheckPlanes(int width, int height, int maxValue)
+{
+	const int levels[4] = { maxValue * 4 / 5, maxValue / 3, maxValue / 2, maxValue / 9 };
+	Mat src(height, width, sizeof(T) == 1 ? CV_8UC1 : CV_16UC1), dst;
+	for(int y=0; y<height; y++)
+		for(int x=0; x<width; x++)
+			src.at<T>(y, x) = (T)levels[(y & 1) * 2 + (x & 1)];
+
+	UndistortMap map;
+	map.Build(TestCalibration(width, height, -0.35, 0.12), width, height, true);
+	map.Apply(src, dst);
+
+	// Black outside the image, the colour of the plane everywhere else
+	int numInside = 0;
+	for(int y=0; y<height; y++)
+	{
+		for(int x=0; x<width; x++)
+		{
+			int value = dst.at<T>(y, x);
+			int expected = levels[(y & 1) * 2 + (x & 1)];
+			if(value == expected)
+				numInside++;
+			else if(value != 0)
+			{
+				cout << "Planes, " << sizeof(T) * 8 << " bit: (" << x << ", " << y << ") is " << value << ", not " << expected << endl;
+				return -1;
+			}
+		}
+	}
+	if(numInside < width * height / 2)
+	{
+		cout << "Planes, " << sizeof(T) * 8 << " bit: only " << numInside << " pixels inside" << endl;
+		return -1;
+	}
+	return 0;
+}
+
+
+int main(int argc, char** argv)
+{
+	int failed = 0;
+
+	// Odd sizes have planes of different sizes
+	failed += (CheckIdentity<uint8_t>(64, 48, 255) < 0);
+	failed += (CheckIdentity<uint8_t>(63, 47, 255) < 0);
+	failed += (CheckIdentity<uint16_t>(64, 48, 4095) < 0);
+	failed += (CheckIdentity<uint16_t>(1280, 1024, 65535) < 0);
+	failed += (CheckPlanes<uint8_t>(64, 48, 255) < 0);
+	failed += (CheckPlanes<uint16_t>(1280, 1024, 4095) < 0);
+
+	if(failed > 0)
+	{
+		cout << failed << " checks failed" << endl;
+		return -1;
+	}
+	cout << "All checks passed" << endl;
+	return 0;
+}
@@ -0,0 +1,172 @@
+//
+// Undistortion of SIFT keypoints for the SfM feed.
+//
+// Instead of undistorting every image (undis8.m) and running SIFT on the
+// result, SIFT runs on the original images and only the keypoint
+// coordinates of its Lowe format .key files are undistorted:
+//
+//     <number of keypoints> <descriptor length>
+//     <row> <col> <scale> <orientation> <descriptor...>
+//
+// Usage: UndistortKeys -o outDir calibFile keyFile [keyFile...] [calibFile keyFile...]
+//
+// A calib*.txt argument applies to the .key files after it. The files are
+// written to outDir under the same name, with the descriptors as they are.
+// Coordinates follow the Undistort convention (pixel centers at integer
+// coordinates, as cv::undistort), so the keypoints match the output of
+// the Undistort tool. Scale and orientation are kept.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+
+#include "Undistort.h"
+
+using namespace std;
+
+
+struct KeyFile
+{
+	int descriptorLength;
+	vector<double> row, col;
+	vector<string> rest;		// scale, orientation and descriptor, as read
+};
+
+
+static int ReadKeyFile(const string &fileName, KeyFile &keys)
+{
+	ifstream file(fileName.c_str());
+	if(!file)
+	{
+		cout << "Unable to open " << fileName << endl;
+		return -1;
+	}
+
+	int numKeys;
+	if(!(file >> numKeys >> keys.descriptorLength) || numKeys < 0)
+	{
+		cout << fileName << " is not a key file" << endl;
+		return -1;
+	}
+
+	keys.row.resize(numKeys);
+	keys.col.resize(numKeys);
+	keys.rest.resize(numKeys);
+
+	for(int i=0; i<numKeys; i++)
+	{
+		// Lowe's own files spread the descriptor over several lines
+		ostringstream rest;
+		string token;
+		file >> keys.row[i] >> keys.col[i];
+		for(int t=0; t<2 + keys.descriptorLength && file >> token; t++)
+			rest << ' ' << token;
+		keys.rest[i] = rest.str();
+
+		if(!file)
+		{
+			cout << fileName << " is truncated at keypoint " << i << endl;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+static int WriteKeyFile(const string &fileName, const KeyFile &keys)
+{
+	ofstream file(fileName.c_str());
+	if(!file)
+	{
+		cout << "Unable to write " << fileName << endl;
+		return -1;
+	}
+
+	file << keys.row.size() << " " << keys.descriptorLength << "\n" << fixed << setprecision(2);
+	for(unsigned int i=0; i<keys.row.size(); i++)
+		file << keys.row[i] << " " << keys.col[i] << keys.rest[i] << "\n";
+
+	return file ? 0 : -1;
+}
+
+
+static string BaseName(const string &path)
+{
+	size_t slash = path.rfind('/');
+	return (slash == string::npos) ? path : path.substr(slash + 1);
+}
+
+
+int main(int argc, char** argv)
+{
+	string outDir;
+	vector<string> files;
+
+	for(int i=1; i<argc; i++)
+	{
+		if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+			outDir = argv[++i];
+		else
+			files.push_back(argv[i]);
+	}
+
+	if(outDir.empty() || files.empty() || files[0].find(".txt") == string::npos)
+	{
+		cout << "Usage: UndistortKeys -o outDir calibFile keyFile [keyFile...] [calibFile keyFile...]" << endl;
+		return -1;
+	}
+
+	LensCalibration lens;
+	int result = 0;
+	size_t totalKeys = 0;
+	double solveTotal = 0;
+
+	for(unsigned int f=0; f<files.size(); f++)
+	{
+		if(files[f].find(".txt") != string::npos)
+		{
+			if(lens.Load(files[f]) != 0)
+				return -1;
+			continue;
+		}
+
+		string outFile = outDir + "/" + BaseName(files[f]);
+		if(outFile == files[f])
+		{
+			cout << "Not overwriting " << files[f] << endl;
+			result = -1;
+			continue;
+		}
+
+		KeyFile keys;
+		if(ReadKeyFile(files[f], keys) != 0)
+		{
+			result = -1;
+			continue;
+		}
+
+		// x is the column, y the row
+		auto start = chrono::steady_clock::now();
+		UndistortPoints(lens, keys.col.data(), keys.row.data(), keys.row.size());
+		double solveTime = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+		if(WriteKeyFile(outFile, keys) != 0)
+		{
+			result = -1;
+			continue;
+		}
+
+		cout << files[f] << ": " << keys.row.size() << " keypoints in " << fixed << setprecision(3) << solveTime << " ms -> " << outFile << endl;
+		totalKeys += keys.row.size();
+		solveTotal += solveTime;
+	}
+
+	cout << totalKeys << " keypoints undistorted in " << fixed << setprecision(3) << solveTotal << " ms" << endl;
+	return result;
+}
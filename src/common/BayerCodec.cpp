@@ -0,0 +1,417 @@
+#include "BayerCodec.h"
+
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+
+// Longest unary part of a code; larger residuals are escaped
+static const int kEscape = 24;
+// Rows of a strip, even to keep the Bayer phase
+static const int kStripRows = 64;
+// Residuals sharing a Rice parameter
+static const int kBlock = 32;
+// Bits of the Rice parameter of a block
+static const int kParameterBits = 5;
+
+
+static inline void StoreBigEndian(uint8_t *out, uint64_t value)
+{
+	value = __builtin_bswap64(value);
+	memcpy(out, &value, sizeof(value));
+}
+
+static inline uint64_t LoadBigEndian(const uint8_t *in)
+{
+	uint64_t value;
+	memcpy(&value, in, sizeof(value));
+	return __builtin_bswap64(value);
+}
+
+
+// MSB first. Every Put() stores the pending bits as one 64-bit word and
+// moves on by the whole bytes, so the buffer needs 8 bytes to spare.
+struct BitWriter
+{
+	uint8_t *out;
+	uint64_t acc;		// pending bits at the bottom
+	int bits;			// 0-7 between calls
+
+	BitWriter(uint8_t *out) : out(out), acc(0), bits(0) {}
+
+	// n <= 32
+	inline void Put(uint32_t value, int n)
+	{
+		acc = (acc << n) | value;
+		bits += n;
+		StoreBigEndian(out, acc << (64 - bits));
+		out += bits >> 3;
+		bits &= 7;
+	}
+
+	void Flush()
+	{
+		if(bits > 0)
+			out++;
+		bits = 0;
+	}
+};
+
+
+// Reads 64 bits at a time from any bit position; the strip is copied
+// into a buffer with zeros past its end. Reading may go on past the end
+// by up to padBytes - 8 before Overrun() is looked at.
+struct BitReader
+{
+	std::vector<uint8_t> buffer;
+	size_t pos;			// bits read
+	size_t limit;		// bits in the strip
+
+	BitReader(const uint8_t *in, size_t bytes, size_t padBytes) : buffer(bytes + padBytes, 0), pos(0), limit(bytes * 8)
+	{
+		memcpy(&buffer[0], in, bytes);
+	}
+
+	// Next bits at the top; at least 57 valid
+	inline uint64_t Peek() const
+	{
+		return LoadBigEndian(&buffer[pos >> 3]) << (pos & 7);
+	}
+
+	// n <= 32
+	inline uint32_t Get(int n)
+	{
+		uint32_t value = (n == 0) ? 0 : (uint32_t)(Peek() >> (64 - n));
+		pos += n;
+		return value;
+	}
+
+	bool Overrun() const { return pos > limit; }
+};
+
+
+// Without branches; the compiler does not always use conditional moves,
+// and a mispredicted branch per pixel costs more than the whole coding
+static inline int Min(int a, int b)
+{
+	int d = a - b;
+	return b + (d & (d >> 31));
+}
+
+static inline int Max(int a, int b)
+{
+	int d = a - b;
+	return a - (d & (d >> 31));
+}
+
+
+// Median edge detector: a + b - c clamped to the range of a and b
+static inline int Predict(int a, int b, int c)
+{
+	return Min(Max(a + b - c, Min(a, b)), Max(a, b));
+}
+
+
+// Neighbours of the same colour; a and b stand in for each other at the
+// edges of the strip, c for both at the first pixel
+template <typename T>
+static inline void Neighbours(const T *row, const T *up, int x, int &a, int &b, int &c)
+{
+	if(up != NULL)
+	{
+		b = up[x];
+		a = (x >= 2) ? row[x - 2] : b;
+		c = (x >= 2) ? up[x - 2] : b;
+	}
+	else
+	{
+		a = (x >= 2) ? row[x - 2] : 0;
+		b = a;
+		c = a;
+	}
+}
+
+
+// Residual modulo 2^bits of T, in -half..half-1, zigzag mapped
+template <typename T>
+static inline uint32_t Residual(int value, int predicted)
+{
+	const int half = 1 << (sizeof(T) * 8 - 1);
+	int e = (int)(T)(value - predicted);
+	e -= (e & half) << 1;
+	return ((uint32_t)e << 1) ^ (uint32_t)(e >> 31);
+}
+
+template <typename T>
+static inline T Reconstruct(uint32_t u, int predicted)
+{
+	int e = (int)(u >> 1) ^ -(int)(u & 1);
+	return (T)(predicted + e);
+}
+
+
+// Zigzag residuals of a row
+template <typename T>
+static void RowResiduals(const T *row, const T *up, int width, uint32_t *u)
+{
+	int a, b, c;
+	int x = 0;
+	int edge = (up == NULL) ? width : min(2, width);
+	for(; x<edge; x++)
+	{
+		Neighbours(row, up, x, a, b, c);
+		u[x] = Residual<T>(row[x], Predict(a, b, c));
+	}
+	for(; x<width; x++)
+		u[x] = Residual<T>(row[x], Predict(row[x - 2], up[x], up[x - 2]));
+}
+
+
+// Rice parameter that codes a block shortest, of the three around the
+// mean; escapes are left out of the count
+static inline int ChooseParameter(const uint32_t *u, int n, int maxK)
+{
+	uint32_t sum = 0;
+	for(int i=0; i<n; i++)
+		sum += u[i];
+
+	int k = 0;
+	while(((uint32_t)n << k) < sum && k < maxK)
+		k++;
+	k = max(k - 1, 0);
+
+	uint32_t bits0 = 0, bits1 = 0, bits2 = 0;
+	for(int i=0; i<n; i++)
+	{
+		uint32_t q = u[i] >> k;
+		bits0 += q;
+		bits1 += q >> 1;
+		bits2 += q >> 2;
+	}
+	bits1 += n;
+	bits2 += 2 * n;
+
+	int best = k;
+	if(bits1 < bits0)
+	{
+		best = k + 1;
+		bits0 = bits1;
+	}
+	if(bits2 < bits0)
+		best = k + 2;
+	return min(best, maxK);
+}
+
+
+template <typename T>
+static size_t EncodeStrip(const Mat &img, int y0, int y1, uint8_t *out)
+{
+	const int rawBits = sizeof(T) * 8;
+
+	vector<uint32_t> u(img.cols);
+	BitWriter writer(out);
+	for(int y=y0; y<y1; y++)
+	{
+		const T *up = (y - 2 >= y0) ? img.ptr<T>(y - 2) : NULL;
+		RowResiduals(img.ptr<T>(y), up, img.cols, &u[0]);
+
+		for(int x0=0; x0<img.cols; x0+=kBlock)
+		{
+			int n = min(kBlock, img.cols - x0);
+			int k = ChooseParameter(&u[x0], n, rawBits);
+			writer.Put(k, kParameterBits);
+
+			for(int i=0; i<n; i++)
+			{
+				uint32_t value = u[x0 + i];
+				uint32_t q = value >> k;
+				if(q < (uint32_t)kEscape)
+				{
+					// q zeros, a one, the low k bits
+					uint32_t low = value & ((1u << k) - 1);
+					if(q + 1 + k <= 32)
+						writer.Put((1u << k) | low, q + 1 + k);
+					else
+					{
+						writer.Put(1, q + 1);
+						writer.Put(low, k);
+					}
+				}
+				else
+				{
+					writer.Put(1, kEscape + 1);
+					writer.Put(value, rawBits);
+				}
+			}
+		}
+	}
+	writer.Flush();
+	return writer.out - out;
+}
+
+
+template <typename T>
+static int DecodeStrip(const uint8_t *in, size_t bytes, int y0, int y1, Mat &img)
+{
+	const int rawBits = sizeof(T) * 8;
+
+	// Damaged data reads at most a block's worst case past the end before
+	// the check ahead of the next block
+	BitReader reader(in, bytes, (kParameterBits + kBlock * (kEscape + 1 + rawBits)) / 8 + 16);
+	for(int y=y0; y<y1; y++)
+	{
+		T *row = img.ptr<T>(y);
+		const T *up = (y - 2 >= y0) ? img.ptr<T>(y - 2) : NULL;
+
+		for(int x0=0; x0<img.cols; x0+=kBlock)
+		{
+			if(reader.Overrun())
+				return -1;
+
+			int n = min(kBlock, img.cols - x0);
+			int k = reader.Get(kParameterBits);
+			if(k > rawBits)
+				return -1;
+
+			for(int x=x0; x<x0+n; x++)
+			{
+				uint64_t bits = reader.Peek();
+				int q = (bits == 0) ? 64 : __builtin_clzll(bits);
+				uint32_t value;
+				if(q < kEscape)
+				{
+					// The unary part and the low bits are within the 57 of Peek()
+					value = ((uint32_t)q << k) | (k == 0 ? 0 : (uint32_t)((bits << (q + 1)) >> (64 - k)));
+					reader.pos += q + 1 + k;
+				}
+				else if(q == kEscape)
+				{
+					reader.pos += kEscape + 1;
+					value = reader.Get(rawBits);
+				}
+				else
+					return -1;
+
+				int a, b, c;
+				if(up != NULL && x >= 2)
+				{
+					a = row[x - 2];
+					b = up[x];
+					c = up[x - 2];
+				}
+				else
+					Neighbours(row, up, x, a, b, c);
+				row[x] = Reconstruct<T>(value, Predict(a, b, c));
+			}
+		}
+	}
+
+	// Nothing read past the end
+	if(reader.Overrun())
+		return -1;
+	return 0;
+}
+
+
+// Escaped pixels take kEscape + 1 bits more than their raw size, the
+// parameters less than a bit per pixel
+static size_t MaxStripBytes(int cols, int elemBits)
+{
+	return (size_t)kStripRows * cols * (elemBits + kEscape + 2) / 8 + 8;
+}
+
+
+size_t MaxEncodedBytes(int rows, int cols, int elemBits)
+{
+	size_t numStrips = (rows + kStripRows - 1) / kStripRows;
+	return (2 + numStrips) * sizeof(uint32_t) + numStrips * MaxStripBytes(cols, elemBits);
+}
+
+
+int EncodeBayer(const Mat &img, vector<uint8_t> &payload, int numThreads)
+{
+	if(img.type() != CV_8UC1 && img.type() != CV_16UC1)
+	{
+		cout << "Bayer codec: 8 or 16-bit single channel frames only" << endl;
+		return -1;
+	}
+
+	int numStrips = (img.rows + kStripRows - 1) / kStripRows;
+	size_t headerBytes = (2 + numStrips) * sizeof(uint32_t);
+	size_t maxStripBytes = MaxStripBytes(img.cols, img.elemSize() * 8);
+
+	// Strips are coded in place at their worst case offset and moved
+	// together afterwards
+	payload.resize(headerBytes + numStrips * maxStripBytes);
+	vector<uint32_t> stripBytes(numStrips);
+
+	#pragma omp parallel for num_threads(numThreads) schedule(dynamic)
+	for(int s=0; s<numStrips; s++)
+	{
+		int y0 = s * kStripRows;
+		int y1 = min(y0 + kStripRows, img.rows);
+		uint8_t *out = &payload[headerBytes + s * maxStripBytes];
+		if(img.depth() == CV_8U)
+			stripBytes[s] = EncodeStrip<uint8_t>(img, y0, y1, out);
+		else
+			stripBytes[s] = EncodeStrip<uint16_t>(img, y0, y1, out);
+	}
+
+	uint32_t header[2] = { (uint32_t)kStripRows, (uint32_t)numStrips };
+	memcpy(&payload[0], header, sizeof(header));
+	memcpy(&payload[sizeof(header)], &stripBytes[0], numStrips * sizeof(uint32_t));
+	size_t offset = headerBytes;
+	for(int s=0; s<numStrips; s++)
+	{
+		memmove(&payload[offset], &payload[headerBytes + s * maxStripBytes], stripBytes[s]);
+		offset += stripBytes[s];
+	}
+	payload.resize(offset);
+	return 0;
+}
+
+
+int DecodeBayer(const uint8_t *payload, size_t payloadBytes, Mat &img, int numThreads)
+{
+	if((img.type() != CV_8UC1 && img.type() != CV_16UC1) || payloadBytes < 2 * sizeof(uint32_t))
+		return -1;
+
+	uint32_t header[2];
+	memcpy(header, payload, sizeof(header));
+	uint32_t stripRows = header[0];
+	uint32_t numStrips = header[1];
+	if(stripRows == 0 || stripRows % 2 != 0 || numStrips != (img.rows + stripRows - 1) / stripRows)
+		return -1;
+
+	size_t headerBytes = (2 + numStrips) * sizeof(uint32_t);
+	if(payloadBytes < headerBytes)
+		return -1;
+	vector<uint32_t> stripBytes(numStrips);
+	vector<size_t> stripOffset(numStrips);
+	memcpy(&stripBytes[0], payload + sizeof(header), numStrips * sizeof(uint32_t));
+	size_t offset = headerBytes;
+	for(uint32_t s=0; s<numStrips; s++)
+	{
+		stripOffset[s] = offset;
+		offset += stripBytes[s];
+	}
+	if(offset != payloadBytes)
+		return -1;
+
+	int failed = 0;
+	#pragma omp parallel for num_threads(numThreads) schedule(dynamic) reduction(+:failed)
+	for(int s=0; s<(int)numStrips; s++)
+	{
+		int y0 = s * stripRows;
+		int y1 = min(y0 + (int)stripRows, img.rows);
+		const uint8_t *in = payload + stripOffset[s];
+		if(img.depth() == CV_8U)
+			failed += (DecodeStrip<uint8_t>(in, stripBytes[s], y0, y1, img) < 0);
+		else
+			failed += (DecodeStrip<uint16_t>(in, stripBytes[s], y0, y1, img) < 0);
+	}
+	return failed > 0 ? -1 : 0;
+}
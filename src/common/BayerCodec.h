@@ -0,0 +1,51 @@
+#ifndef BAYER_CODEC_H
+#define BAYER_CODEC_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+
+//
+// Lossless compression of raw Bayer frames (CV_8UC1 or CV_16UC1), fast
+// enough for the recording path; the codec of RAW_CODEC_RICE records (see
+// RawSession).
+//
+// *** NOTES ***
+// Every pixel is predicted from its neighbours of the same colour, two
+// pixels to the left and two rows up, with the median edge detector of
+// LOCO-I / JPEG-LS: the smaller of left and up next to an edge above or
+// to the left, their sum minus up-left otherwise. The residual, modulo
+// 256 or 65536, is zigzag mapped (0, -1, 1, -2, ...) and Golomb-Rice coded.
+// Every block of 32 residuals of a row has its own Rice parameter, in 5
+// bits ahead of it: of the three around the block mean, the one that codes
+// the block shortest. Residuals too large for the code are escaped and
+// stored as they are, so no frame ever fails to encode. There are no
+// dictionaries or adaptive models, which keeps it within ~10 ns a pixel;
+// LZ-style matching finds little in sensor noise.
+//
+// The frame is cut into strips of an even number of rows, coded
+// independently and in parallel on numThreads OpenMP threads; a strip
+// predicts its first two rows from the left only. Payload:
+//
+//   uint32 stripRows, uint32 numStrips, uint32 bytes of every strip,
+//   then the strips
+//
+// Sensor noise sets the ratio: 2.0:1 on the 1280x1024 frames of
+// test_sfm/image, 1.7:1 on the 640x480 ones in Temp/, more on dark or
+// defocused frames and on 10 or 12-bit data in 16 bits, whose unused top
+// bits cost nothing. CodecBench measures it on any images or recordings.
+//
+int EncodeBayer(const cv::Mat &img, std::vector<uint8_t> &payload, int numThreads = 1);
+
+// Largest payload EncodeBayer() produces for a frame of that size and
+// bits per pixel (8 or 16)
+size_t MaxEncodedBytes(int rows, int cols, int elemBits);
+
+// img must be created with the size and type of the encoded frame;
+// -1 for a payload that does not decode to it
+int DecodeBayer(const uint8_t *payload, size_t payloadBytes, cv::Mat &img, int numThreads = 1);
+
+#endif
@@ -0,0 +1,371 @@
+#include "BoardCoverage.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+using namespace std;
+using namespace cv;
+
+
+BoardCoverageSettings::BoardCoverageSettings()
+	: boardSize(9, 6), squareSize(1), every(5), numWorkers(2),
+	  gridWidth(16), gridHeight(12), minMotion(0.05), maxViews(40)
+{
+}
+
+
+BoardCoverage::CameraCoverage::CameraCoverage()
+	: inFlight(false), numCellsCovered(0), rms(0), numDetections(0), numOffered(0)
+{
+}
+
+
+BoardCoverage::BoardCoverage(int numCameras, const BoardCoverageSettings &settings)
+	: settings(settings), running(false)
+{
+	for(int y=0; y<settings.boardSize.height; y++)
+	{
+		for(int x=0; x<settings.boardSize.width; x++)
+			boardPoints.push_back(Point3f((float)(x * settings.squareSize), (float)(y * settings.squareSize), 0));
+	}
+
+	for(int i=0; i<numCameras; i++)
+	{
+		cameras.push_back(new CameraCoverage());
+		cameras.back()->cells.assign(settings.gridWidth * settings.gridHeight, 0);
+	}
+}
+
+
+BoardCoverage::~BoardCoverage()
+{
+	Stop();
+	for(unsigned int i=0; i<cameras.size(); i++)
+		delete cameras[i];
+}
+
+
+void BoardCoverage::Start()
+{
+	running = true;
+	for(int i=0; i<max(settings.numWorkers, 1); i++)
+		workers.push_back(thread(&BoardCoverage::WorkLoop, this));
+}
+
+
+void BoardCoverage::Stop()
+{
+	{
+		lock_guard<mutex> lock(jobMutex);
+		if(!running)
+			return;
+		running = false;
+		jobs.clear();
+	}
+	jobReady.notify_all();
+	for(unsigned int i=0; i<workers.size(); i++)
+		workers[i].join();
+	workers.clear();
+}
+
+
+void BoardCoverage::Offer(int camNum, int frameNum, const Mat &gray)
+{
+	if(frameNum % max(settings.every, 1) != 0)
+		return;
+
+	CameraCoverage &camera = *cameras[camNum];
+	{
+		lock_guard<mutex> lock(camera.coverageMutex);
+		if(camera.inFlight)
+			return;
+		camera.inFlight = true;
+		camera.numOffered++;
+	}
+
+	// The preview buffer goes back to the camera; the job keeps a copy
+	Job job;
+	job.camNum = camNum;
+	gray.copyTo(job.gray);
+	{
+		lock_guard<mutex> lock(jobMutex);
+		jobs.push_back(job);
+	}
+	jobReady.notify_one();
+}
+
+
+void BoardCoverage::WorkLoop()
+{
+	unique_lock<mutex> lock(jobMutex);
+	while(true)
+	{
+		jobReady.wait(lock, [this] { return !jobs.empty() || !running; });
+		if(!running)
+			break;
+
+		Job job = jobs.front();
+		jobs.pop_front();
+		lock.unlock();
+
+		Detect(job);
+
+		CameraCoverage &camera = *cameras[job.camNum];
+		{
+			lock_guard<mutex> cameraLock(camera.coverageMutex);
+			camera.inFlight = false;
+		}
+
+		lock.lock();
+	}
+}
+
+
+void BoardCoverage::Detect(const Job &job)
+{
+	CameraCoverage &camera = *cameras[job.camNum];
+
+	// Find the board at half size, then refine at full size
+	Mat half;
+	resize(job.gray, half, Size(job.gray.cols / 2, job.gray.rows / 2), 0, 0, INTER_AREA);
+
+	vector<Point2f> corners;
+	bool found = findChessboardCorners(half, settings.boardSize, corners,
+	                                   CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE | CALIB_CB_FAST_CHECK);
+	if(!found)
+	{
+		lock_guard<mutex> lock(camera.coverageMutex);
+		camera.lastCorners.clear();
+		return;
+	}
+
+	for(unsigned int i=0; i<corners.size(); i++)
+	{
+		corners[i].x = corners[i].x * 2 + 0.5f;
+		corners[i].y = corners[i].y * 2 + 0.5f;
+	}
+	cornerSubPix(job.gray, corners, Size(5, 5), Size(-1, -1), TermCriteria(TermCriteria::EPS + TermCriteria::COUNT, 30, 0.01));
+
+	bool newView;
+	{
+		lock_guard<mutex> lock(camera.coverageMutex);
+		camera.numDetections++;
+		camera.lastCorners = corners;
+		camera.imageSize = job.gray.size();
+
+		// A view is new when the board moved since the last one
+		newView = camera.views.empty();
+		if(!newView)
+		{
+			const vector<Point2f> &last = camera.views.back();
+			double motion = 0;
+			for(unsigned int i=0; i<corners.size(); i++)
+				motion += fabs(corners[i].x - last[i].x) + fabs(corners[i].y - last[i].y);
+			newView = (motion / corners.size() > settings.minMotion * job.gray.cols);
+		}
+	}
+
+	if(newView)
+		AddView(camera, corners);
+}
+
+
+// Cells whose centre lies inside the quadrilateral of the outer corners
+static void MarkCells(const vector<Point2f> &corners, Size boardSize, Size imageSize, int gridWidth, int gridHeight, vector<int> &cells, int &numCovered)
+{
+	int w = boardSize.width, h = boardSize.height;
+	Point2f quad[4] = { corners[0], corners[w - 1], corners[w * h - 1], corners[w * (h - 1)] };
+
+	// Sign of the cross products tells the side of every edge; a point is
+	// inside when it is on the same side of all four
+	for(int gy=0; gy<gridHeight; gy++)
+	{
+		for(int gx=0; gx<gridWidth; gx++)
+		{
+			float px = (gx + 0.5f) * imageSize.width / gridWidth;
+			float py = (gy + 0.5f) * imageSize.height / gridHeight;
+			int positive = 0, negative = 0;
+			for(int e=0; e<4; e++)
+			{
+				const Point2f &a = quad[e], &b = quad[(e + 1) % 4];
+				float cross = (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+				if(cross > 0)
+					positive++;
+				else if(cross < 0)
+					negative++;
+			}
+			if(positive == 4 || negative == 4)
+			{
+				if(cells[gy * gridWidth + gx]++ == 0)
+					numCovered++;
+			}
+		}
+	}
+}
+
+
+void BoardCoverage::AddView(CameraCoverage &camera, const vector<Point2f> &corners)
+{
+	vector< vector<Point2f> > views;
+	{
+		lock_guard<mutex> lock(camera.coverageMutex);
+		MarkCells(corners, settings.boardSize, camera.imageSize, settings.gridWidth, settings.gridHeight, camera.cells, camera.numCellsCovered);
+		camera.views.push_back(corners);
+
+		// Keep every other view when there are too many, so what is left
+		// still spans the whole capture
+		if((int)camera.views.size() > settings.maxViews)
+		{
+			vector< vector<Point2f> > kept;
+			for(unsigned int i=0; i<camera.views.size(); i+=2)
+				kept.push_back(camera.views[i]);
+			camera.views.swap(kept);
+		}
+	}
+
+	DrawHeat(camera);
+	Estimate(camera);
+}
+
+
+void BoardCoverage::Estimate(CameraCoverage &camera)
+{
+	// Only this worker changes the views and the estimate of the camera
+	// while its job is in flight; copy them and calibrate outside the lock
+	vector< vector<Point2f> > imagePoints;
+	Mat cameraMatrix, distCoeffs;
+	Size imageSize;
+	{
+		lock_guard<mutex> lock(camera.coverageMutex);
+		imagePoints = camera.views;
+		imageSize = camera.imageSize;
+		camera.cameraMatrix.copyTo(cameraMatrix);
+		camera.distCoeffs.copyTo(distCoeffs);
+	}
+	if(imagePoints.size() < 3)
+		return;
+
+	vector< vector<Point3f> > objectPoints(imagePoints.size(), boardPoints);
+	vector<Mat> rvecs, tvecs;
+	int flags = CALIB_ZERO_TANGENT_DIST | CALIB_FIX_K3;
+	if(!cameraMatrix.empty())
+		flags |= CALIB_USE_INTRINSIC_GUESS;
+
+	double rms;
+	try
+	{
+		rms = calibrateCamera(objectPoints, imagePoints, imageSize, cameraMatrix, distCoeffs, rvecs, tvecs, flags);
+	}
+	catch (cv::Exception &e)
+	{
+		cout << "Calibration estimate failed: " << e.what() << endl;
+		return;
+	}
+
+	lock_guard<mutex> lock(camera.coverageMutex);
+	camera.cameraMatrix = cameraMatrix;
+	camera.distCoeffs = distCoeffs;
+	camera.rms = rms;
+}
+
+
+void BoardCoverage::DrawHeat(CameraCoverage &camera)
+{
+	Mat counts(settings.gridHeight, settings.gridWidth, CV_8UC1);
+	Size imageSize;
+	{
+		lock_guard<mutex> lock(camera.coverageMutex);
+		for(int c=0; c<settings.gridWidth * settings.gridHeight; c++)
+			counts.ptr<uint8_t>(c / settings.gridWidth)[c % settings.gridWidth] = (uint8_t)(min(camera.cells[c], 5) * 51);
+		imageSize = camera.imageSize;
+	}
+
+	// A new image every time, so Overlay() can keep using the last one
+	Mat colour, heat;
+	applyColorMap(counts, colour, COLORMAP_JET);
+	resize(colour, heat, imageSize, 0, 0, INTER_NEAREST);
+
+	lock_guard<mutex> lock(camera.coverageMutex);
+	camera.heat = heat;
+}
+
+
+void BoardCoverage::Overlay(int camNum, const Mat &gray, Mat &preview)
+{
+	CameraCoverage &camera = *cameras[camNum];
+
+	Mat heat;
+	vector<Point2f> corners;
+	ostringstream text;
+	{
+		lock_guard<mutex> lock(camera.coverageMutex);
+		heat = camera.heat;
+		corners = camera.lastCorners;
+
+		text << camera.views.size() << " views, " << 100 * camera.numCellsCovered / (settings.gridWidth * settings.gridHeight) << "% covered";
+		if(!camera.cameraMatrix.empty())
+		{
+			text << fixed << setprecision(1) << "  fx " << camera.cameraMatrix.at<double>(0, 0) << " fy " << camera.cameraMatrix.at<double>(1, 1)
+				 << " cx " << camera.cameraMatrix.at<double>(0, 2) << " cy " << camera.cameraMatrix.at<double>(1, 2)
+				 << setprecision(3) << " k1 " << camera.distCoeffs.at<double>(0) << " k2 " << camera.distCoeffs.at<double>(1)
+				 << setprecision(2) << " rms " << camera.rms;
+		}
+	}
+
+	cvtColor(gray, preview, COLOR_GRAY2BGR);
+	if(!heat.empty() && heat.size() == preview.size())
+		addWeighted(preview, 0.65, heat, 0.35, 0, preview);
+	if(!corners.empty())
+		drawChessboardCorners(preview, settings.boardSize, corners, true);
+	putText(preview, text.str(), Point(10, 30), FONT_HERSHEY_SIMPLEX, 0.8, Scalar(255, 255, 255), 2);
+}
+
+
+int BoardCoverage::SaveEstimate(int camNum, const string &fileName)
+{
+	CameraCoverage &camera = *cameras[camNum];
+	lock_guard<mutex> lock(camera.coverageMutex);
+	if(camera.cameraMatrix.empty())
+		return 1;
+
+	ofstream file(fileName.c_str());
+	if(!file)
+	{
+		cout << "Unable to write " << fileName << endl;
+		return -1;
+	}
+
+	// The keys of LensCalibration, then what it skips
+	file << fixed << setprecision(5);
+	file << "ImageWidth: " << camera.imageSize.width << endl;
+	file << "ImageHeight: " << camera.imageSize.height << endl;
+	file << "FocalLengthX: " << camera.cameraMatrix.at<double>(0, 0) << endl;
+	file << "FocalLengthY: " << camera.cameraMatrix.at<double>(1, 1) << endl;
+	file << "PrincipalPointX: " << camera.cameraMatrix.at<double>(0, 2) << endl;
+	file << "PrincipalPointY: " << camera.cameraMatrix.at<double>(1, 2) << endl;
+	file << "k1: " << camera.distCoeffs.at<double>(0) << endl;
+	file << "k2: " << camera.distCoeffs.at<double>(1) << endl;
+	file << "RmsError: " << camera.rms << endl;
+	file << "Views: " << camera.views.size() << endl;
+	return 0;
+}
+
+
+void BoardCoverage::PrintSummary(int camNum, const string &name)
+{
+	CameraCoverage &camera = *cameras[camNum];
+	lock_guard<mutex> lock(camera.coverageMutex);
+	cout << name << ": board in " << camera.numDetections << " of " << camera.numOffered << " frames checked, "
+		 << camera.views.size() << " views, " << 100 * camera.numCellsCovered / (settings.gridWidth * settings.gridHeight)
+		 << "% of the image covered";
+	if(!camera.cameraMatrix.empty())
+		cout << ", rms " << camera.rms;
+	cout << endl;
+}
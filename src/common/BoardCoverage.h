@@ -0,0 +1,113 @@
+#ifndef BOARD_COVERAGE_H
+#define BOARD_COVERAGE_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <opencv2/core/core.hpp>
+
+
+struct BoardCoverageSettings
+{
+	BoardCoverageSettings();
+
+	cv::Size boardSize;		// inner corners
+	double squareSize;		// any unit; only the intrinsics are estimated
+	int every;				// frames of a camera between two detections
+	int numWorkers;
+	int gridWidth, gridHeight;	// cells of the coverage map
+	double minMotion;		// mean corner motion for a new view, fraction of the width
+	int maxViews;			// views a camera keeps for its estimate
+};
+
+
+//
+// Live checkerboard detection and calibration coverage for the cameras of
+// a calibration capture.
+//
+// *** NOTES ***
+// Offer() is called by the preview loop with every frame. Every
+// settings.every-th frame of a camera is copied into a job for a shared
+// pool of worker threads, unless that camera still has a job waiting or
+// being worked on; nothing in Offer() or Overlay() waits for a detection.
+//
+// A worker finds the board on a half size copy (fast check, so frames
+// without a board cost little) and refines the corners on the full frame.
+// A board that moved by more than minMotion since the last view of the
+// camera is a new view: its corners add to the coverage map of the camera
+// (cells of a gridWidth x gridHeight grid the board covers) and the
+// intrinsics are estimated again from the views so far, starting from the
+// last estimate (fx, fy, cx, cy, k1, k2, the model of LensCalibration).
+// At most maxViews views are kept, spread over the capture.
+//
+// Overlay() blends the coverage map, built by the worker as a colour image
+// of the frame size, over the gray preview and adds the last corners and
+// the estimate. SaveEstimate() writes the estimate as a calib*.txt file
+// that Undistort reads.
+//
+class BoardCoverage
+{
+public:
+	BoardCoverage(int numCameras, const BoardCoverageSettings &settings);
+	~BoardCoverage();
+
+	void Start();
+	void Stop();
+
+	// 8-bit gray frame of camera camNum, frameNum counting its frames
+	void Offer(int camNum, int frameNum, const cv::Mat &gray);
+
+	// BGR preview of gray with the coverage of camNum
+	void Overlay(int camNum, const cv::Mat &gray, cv::Mat &preview);
+
+	int SaveEstimate(int camNum, const std::string &fileName);
+	void PrintSummary(int camNum, const std::string &name);
+
+private:
+	struct Job
+	{
+		int camNum;
+		cv::Mat gray;
+	};
+
+	struct CameraCoverage
+	{
+		CameraCoverage();
+
+		std::mutex coverageMutex;
+		bool inFlight;
+		std::vector<int> cells;
+		int numCellsCovered;
+		cv::Mat heat;						// BGR, frame size; empty until the first view
+		std::vector<cv::Point2f> lastCorners;
+		std::vector< std::vector<cv::Point2f> > views;
+		cv::Size imageSize;
+		cv::Mat cameraMatrix;
+		cv::Mat distCoeffs;
+		double rms;
+		int numDetections;
+		int numOffered;
+	};
+
+	void WorkLoop();
+	void Detect(const Job &job);
+	void AddView(CameraCoverage &camera, const std::vector<cv::Point2f> &corners);
+	void Estimate(CameraCoverage &camera);
+	void DrawHeat(CameraCoverage &camera);
+
+	BoardCoverageSettings settings;
+	std::vector<cv::Point3f> boardPoints;
+	std::vector<CameraCoverage*> cameras;
+
+	std::mutex jobMutex;
+	std::condition_variable jobReady;
+	std::deque<Job> jobs;
+	bool running;
+	std::vector<std::thread> workers;
+};
+
+#endif
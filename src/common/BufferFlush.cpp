@@ -0,0 +1,113 @@
+#include "BufferFlush.h"
+
+#include <iostream>
+#include <thread>
+#include <chrono>
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+
+
+// Images in the output queue of the stream, -1 if the SDK does not
+// report it (StreamOutputBufferCount is in newer versions only)
+static int64_t ImagesWaiting(CameraPtr pCam)
+{
+	CIntegerPtr ptrOutputCount = pCam->GetTLStreamNodeMap().GetNode("StreamOutputBufferCount");
+	if (!IsAvailable(ptrOutputCount) || !IsReadable(ptrOutputCount))
+		return -1;
+	return ptrOutputCount->GetValue();
+}
+
+
+// Next image without waiting; false if there is none. Without
+// StreamOutputBufferCount an empty queue is only seen as the timeout
+// error; every other error is passed on.
+static bool NextImageNoWait(CameraPtr pCam, ImagePtr &pResultImage)
+{
+	try
+	{
+		pResultImage = pCam->GetNextImage(EVENT_TIMEOUT_NONE);
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		if (e.GetError() == SPINNAKER_ERR_TIMEOUT)
+			return false;
+		throw;
+	}
+	return true;
+}
+
+
+static void FlushCamera(CameraPtr pCam, int *numDiscarded)
+{
+	*numDiscarded = 0;
+
+	// Upper bound: the number of buffers of the stream
+	int64_t maxImages = 100;
+	try
+	{
+		CIntegerPtr ptrBufferCount = pCam->GetTLStreamNodeMap().GetNode("StreamDefaultBufferCount");
+		if (IsAvailable(ptrBufferCount) && IsReadable(ptrBufferCount))
+			maxImages = ptrBufferCount->GetValue();
+	}
+	catch (Spinnaker::Exception &e)
+	{
+	}
+
+	try
+	{
+		while (*numDiscarded < maxImages)
+		{
+			int64_t waiting = ImagesWaiting(pCam);
+			if (waiting == 0)
+				break;
+
+			ImagePtr pResultImage;
+			if (waiting > 0)
+				pResultImage = pCam->GetNextImage(EVENT_TIMEOUT_NONE);
+			else if (!NextImageNoWait(pCam, pResultImage))
+				break;
+
+			pResultImage->Release();
+			(*numDiscarded)++;
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Unable to flush the buffers of camera " << pCam->GetUniqueID() << ": " << e.what() << endl;
+	}
+}
+
+
+int FlushImageBuffers(vector<CameraPtr> &cameras, vector<int> *numDiscarded)
+{
+	int numCams = cameras.size();
+	vector<int> discarded(numCams, 0);
+	vector<thread> threads;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	for (int i = 0; i < numCams; i++)
+		threads.push_back(thread(FlushCamera, cameras[i], &discarded[i]));
+
+	int total = 0;
+	for (int i = 0; i < numCams; i++)
+	{
+		threads[i].join();
+		total += discarded[i];
+	}
+
+	double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	cout << "Camera buffers flushed in " << elapsedMs << " ms. Discarded images:";
+	for (int i = 0; i < numCams; i++)
+		cout << " " << discarded[i];
+	cout << " (total " << total << ")" << endl;
+
+	if (numDiscarded != NULL)
+		*numDiscarded = discarded;
+
+	return total;
+}
@@ -0,0 +1,30 @@
+#ifndef BUFFER_FLUSH_H
+#define BUFFER_FLUSH_H
+
+#include <vector>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+
+//
+// Discards the stale images waiting in the stream buffers of all cameras.
+//
+// Replaces emptyImageBuffer(), which blocked in GetNextImage(1000) on one
+// camera after the other and waited out the full timeout on every camera.
+//
+// *** NOTES ***
+// Every camera is drained on its own thread with GetNextImage(EVENT_TIMEOUT_NONE),
+// which returns immediately, for as long as StreamOutputBufferCount of the
+// stream says images are waiting. SDK versions without that node signal
+// the empty queue with the timeout error, which ends the drain there;
+// any other error is reported. At most StreamDefaultBufferCount images
+// are discarded per camera, so a free running camera cannot keep the
+// flush busy.
+//
+// Returns the total number of images discarded. numDiscarded, if given,
+// receives the count of every camera.
+//
+int FlushImageBuffers(std::vector<Spinnaker::CameraPtr> &cameras, std::vector<int> *numDiscarded = NULL);
+
+#endif
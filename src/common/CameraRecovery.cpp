@@ -0,0 +1,187 @@
+#include "CameraRecovery.h"
+
+#include <iostream>
+#include <chrono>
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+
+
+CameraRecovery::CameraRecovery(CameraPtr pCam, int camNum, Policy policy, int grabTimeoutMs)
+	: maxRetries(2), maxFailures(3), maxRearms(5), slotPeriodMs(grabTimeoutMs),
+	  numGrabbed(0), numIncomplete(0), numTimeouts(0), numMissing(0), numRearms(0),
+	  pCam(pCam), camNum(camNum), policy(policy), grabTimeoutMs(grabTimeoutMs),
+	  consecutiveFailures(0), consecutiveRearms(0), state(STREAMING)
+{
+}
+
+
+CameraRecovery::~CameraRecovery()
+{
+	lock_guard<mutex> lock(cameraMutex);
+	if(rearmThread.joinable())
+		rearmThread.join();
+}
+
+
+ImagePtr CameraRecovery::GrabNext()
+{
+	// A slot of a camera that is away takes as long as a trigger would,
+	// so its frame IDs keep pace with the other cameras
+	if(state != STREAMING)
+	{
+		unique_lock<mutex> lock(stateMutex);
+		stateChanged.wait_for(lock, chrono::milliseconds(slotPeriodMs), [this] { return state == STREAMING; });
+		if(state != STREAMING)
+		{
+			numMissing++;
+			return ImagePtr();
+		}
+	}
+
+	// Held until the grab is over; Rejoin() waits for it
+	lock_guard<mutex> lock(cameraMutex);
+
+	// A previous re-arm has finished
+	if(rearmThread.joinable())
+		rearmThread.join();
+
+	int attempts = (policy == RETRY) ? maxRetries + 1 : 1;
+
+	for(int attempt=0; attempt<attempts; attempt++)
+	{
+		try
+		{
+			ImagePtr pResultImage = pCam->GetNextImage(grabTimeoutMs);
+
+			if(pResultImage->IsIncomplete())
+			{
+				cout << "Camera " << camNum << ": image incomplete with image status " << pResultImage->GetImageStatus() << "..." << endl;
+				pResultImage->Release();
+				numIncomplete++;
+				break;
+			}
+
+			numGrabbed++;
+			consecutiveFailures = 0;
+			consecutiveRearms = 0;
+			return pResultImage;
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			// Timeout, or the stream went away
+			numTimeouts++;
+		}
+	}
+
+	SlotMissing();
+	return ImagePtr();
+}
+
+
+// Called by GrabNext() with cameraMutex held
+void CameraRecovery::SlotMissing()
+{
+	numMissing++;
+	consecutiveFailures++;
+
+	if(consecutiveFailures < maxFailures)
+		return;
+
+	// A camera quarantined meanwhile stays quarantined
+	int expected = STREAMING;
+	if(consecutiveRearms >= maxRearms)
+	{
+		if(state.compare_exchange_strong(expected, FAILED))
+			cout << "Camera " << camNum << ": re-arming failed " << consecutiveRearms << " times. Camera dropped from capture." << endl;
+		return;
+	}
+
+	if(!state.compare_exchange_strong(expected, REARMING))
+		return;
+
+	cout << "Camera " << camNum << ": " << consecutiveFailures << " frames missing. Re-arming acquisition..." << endl;
+	consecutiveFailures = 0;
+	consecutiveRearms++;
+	rearmThread = thread(&CameraRecovery::Rearm, this, pCam);
+}
+
+
+// Restart acquisition without blocking the capture loop; pCam is the
+// camera at the time, Rejoin() may hand over another one meanwhile
+void CameraRecovery::Rearm(CameraPtr pCam)
+{
+	numRearms++;
+
+	try
+	{
+		try
+		{
+			pCam->EndAcquisition();
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			// Acquisition was already stopped
+		}
+
+		pCam->BeginAcquisition();
+		cout << "Camera " << camNum << ": acquisition re-armed" << endl;
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Camera " << camNum << ": re-arm failed. Error: " << e.what() << endl;
+	}
+
+	// The next grab decides whether the camera is really back. A camera
+	// quarantined meanwhile stays quarantined.
+	int expected = REARMING;
+	SetState(expected, STREAMING);
+}
+
+
+// Compare and swap, waking up a GrabNext() waiting for the camera
+bool CameraRecovery::SetState(int expected, int newState)
+{
+	bool changed;
+	{
+		lock_guard<mutex> lock(stateMutex);
+		changed = state.compare_exchange_strong(expected, newState);
+	}
+	if(changed)
+		stateChanged.notify_all();
+	return changed;
+}
+
+
+void CameraRecovery::Quarantine()
+{
+	state = QUARANTINED;
+}
+
+
+void CameraRecovery::Rejoin(CameraPtr pCam)
+{
+	// A grab on the old camera finishes first
+	lock_guard<mutex> lock(cameraMutex);
+	if(rearmThread.joinable())
+		rearmThread.join();
+
+	this->pCam = pCam;
+	consecutiveFailures = 0;
+	consecutiveRearms = 0;
+	{
+		lock_guard<mutex> stateLock(stateMutex);
+		state = STREAMING;
+	}
+	stateChanged.notify_all();
+}
+
+
+void CameraRecovery::PrintStatistics()
+{
+	cout << "Camera " << camNum << ": grabbed " << numGrabbed << ", missing " << numMissing
+		 << " (incomplete " << numIncomplete << ", timeouts " << numTimeouts << "), re-arms " << numRearms
+		 << ((state == FAILED) ? ", FAILED" : "") << ((state == QUARANTINED) ? ", QUARANTINED" : "") << endl;
+}
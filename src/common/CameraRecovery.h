@@ -0,0 +1,112 @@
+#ifndef CAMERA_RECOVERY_H
+#define CAMERA_RECOVERY_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+
+//
+// Per camera recovery state machine for the capture loops.
+//
+// Replaces the GetNextImage() / IsIncomplete() / EndAcquisition() sequence,
+// which left the camera stopped and the next GetNextImage() blocked forever.
+//
+// *** NOTES ***
+// GrabNext() always returns within a bounded time. It returns a complete
+// image, or a null ImagePtr when the frameset slot of this camera has to be
+// marked as missing.
+//
+//   STREAMING   normal operation. GetNextImage() waits at most grabTimeoutMs.
+//               SKIP policy: an incomplete image or a timeout makes the slot
+//               missing straight away.
+//               RETRY policy: after a timeout the grab is retried up to
+//               maxRetries times, so frames that arrive late are not lost.
+//               Incomplete images cannot be retried and are always missing.
+//   REARMING    after maxFailures consecutive missing slots acquisition is
+//               restarted (EndAcquisition / BeginAcquisition) on a background
+//               thread. Meanwhile GrabNext() waits up to slotPeriodMs for
+//               the camera to stream again and returns null if it does not,
+//               so the other cameras keep capturing and the missing slots
+//               come at the trigger rate instead of running ahead of them.
+//   FAILED      re-arming failed maxRearms times in a row. The camera stays
+//               out of the capture and all its slots are missing, one every
+//               slotPeriodMs.
+//   QUARANTINED the camera was unplugged (see HotPlugMonitor). Slots are
+//               missing, one every slotPeriodMs, until Rejoin() hands over
+//               the camera that came back.
+//
+// Only STREAMING moves to REARMING or FAILED, so a camera quarantined by the
+// hot plug thread while its capture thread counts missing slots stays
+// quarantined. The camera and the re-arm thread are guarded by a mutex that
+// GrabNext() holds for the whole grab, so Rejoin() waits for a grab that is
+// still running on the old camera (at most grabTimeoutMs per attempt)
+// before it swaps the camera.
+//
+class CameraRecovery
+{
+public:
+	enum State
+	{
+		STREAMING,
+		REARMING,
+		FAILED,
+		QUARANTINED
+	};
+
+	enum Policy
+	{
+		SKIP,
+		RETRY
+	};
+
+	CameraRecovery(Spinnaker::CameraPtr pCam, int camNum, Policy policy = SKIP, int grabTimeoutMs = 500);
+	~CameraRecovery();
+
+	Spinnaker::ImagePtr GrabNext();
+
+	State GetState() { return (State)state.load(); }
+
+	// Stop grabbing from a camera that went away
+	void Quarantine();
+	// Resume with the re-initialized camera, already acquiring
+	void Rejoin(Spinnaker::CameraPtr pCam);
+	void PrintStatistics();
+
+	int maxRetries;
+	int maxFailures;
+	int maxRearms;
+	int slotPeriodMs;	// trigger period; defaults to grabTimeoutMs
+
+	// Counters
+	int numGrabbed;
+	int numIncomplete;
+	int numTimeouts;
+	int numMissing;
+	int numRearms;
+
+private:
+	void SlotMissing();
+	void Rearm(Spinnaker::CameraPtr pCam);
+	bool SetState(int expected, int newState);
+
+	// pCam, rearmThread and the consecutive counts
+	std::mutex cameraMutex;
+	Spinnaker::CameraPtr pCam;
+	int camNum;
+	Policy policy;
+	int grabTimeoutMs;
+
+	int consecutiveFailures;
+	int consecutiveRearms;
+	std::atomic<int> state;
+	std::mutex stateMutex;					// for stateChanged only
+	std::condition_variable stateChanged;	// back to STREAMING
+	std::thread rearmThread;
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "CaptureProfile.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+
+
+static const CaptureProfile profiles[] =
+{
+	{ "full",   1, 1, 1.0, 1.0,  "full sensor" },
+	{ "bin2",   2, 1, 1.0, 1.0,  "2x2 binning" },
+	{ "decim2", 1, 2, 1.0, 1.0,  "2x2 decimation" },
+	{ "strip",  1, 1, 1.0, 0.25, "full width, center quarter of the height" }
+};
+
+
+const CaptureProfile *FindCaptureProfile(const string &name)
+{
+	for(unsigned int i=0; i<sizeof(profiles)/sizeof(profiles[0]); i++)
+	{
+		if(name == profiles[i].name)
+			return &profiles[i];
+	}
+	return NULL;
+}
+
+
+void PrintCaptureProfiles(ostream &out)
+{
+	for(unsigned int i=0; i<sizeof(profiles)/sizeof(profiles[0]); i++)
+		out << "  " << profiles[i].name << "\t" << profiles[i].description << endl;
+}
+
+
+// Set an integer node to the value nearest to the request that respects
+// its minimum, maximum and increment. Returns -1 if it is not writable.
+static int SetIntNode(INodeMap & nodeMap, const char *nodeName, int64_t value)
+{
+	CIntegerPtr ptrNode = nodeMap.GetNode(nodeName);
+	if (!IsAvailable(ptrNode) || !IsWritable(ptrNode))
+		return -1;
+
+	int64_t minValue = ptrNode->GetMin();
+	int64_t increment = ptrNode->GetInc();
+	if (increment < 1)
+		increment = 1;
+
+	value = minValue + (value - minValue) / increment * increment;
+	if (value < minValue)
+		value = minValue;
+	if (value > ptrNode->GetMax())
+		value = ptrNode->GetMax();
+
+	ptrNode->SetValue(value);
+	return 0;
+}
+
+
+static int64_t GetIntNode(INodeMap & nodeMap, const char *nodeName)
+{
+	CIntegerPtr ptrNode = nodeMap.GetNode(nodeName);
+	if (!IsAvailable(ptrNode) || !IsReadable(ptrNode))
+		return 0;
+	return ptrNode->GetValue();
+}
+
+
+static int64_t GetIntMax(INodeMap & nodeMap, const char *nodeName)
+{
+	CIntegerPtr ptrNode = nodeMap.GetNode(nodeName);
+	if (!IsAvailable(ptrNode) || !IsReadable(ptrNode))
+		return 0;
+	return ptrNode->GetMax();
+}
+
+
+// Binning or decimation in both directions. Cameras that bin both
+// directions together only have the vertical node writable.
+static int SetReduction(INodeMap & nodeMap, const char *horizontal, const char *vertical, int factor)
+{
+	int result = SetIntNode(nodeMap, vertical, factor);
+
+	CIntegerPtr ptrHorizontal = nodeMap.GetNode(horizontal);
+	if (IsAvailable(ptrHorizontal) && IsWritable(ptrHorizontal))
+		result = result | SetIntNode(nodeMap, horizontal, factor);
+
+	if (GetIntNode(nodeMap, vertical) != factor)
+		return -1;
+	return result;
+}
+
+
+// Frame size and the highest frame rate of the current settings at the
+// given exposure. The resulting rate is capped by the frame rate limit
+// and by the exposure the camera has now, so the limit is switched off
+// and the exposure set for the measurement, and both put back after it.
+static void MeasureMode(INodeMap & nodeMap, double exposureTime, int &width, int &height, int64_t &payload, double &fps)
+{
+	width = (int)GetIntNode(nodeMap, "Width");
+	height = (int)GetIntNode(nodeMap, "Height");
+	payload = GetIntNode(nodeMap, "PayloadSize");
+
+	// Named AcquisitionFrameRateEnabled on older firmware
+	CBooleanPtr ptrFrameRateEnable = nodeMap.GetNode("AcquisitionFrameRateEnable");
+	if (!IsAvailable(ptrFrameRateEnable))
+		ptrFrameRateEnable = nodeMap.GetNode("AcquisitionFrameRateEnabled");
+	CFloatPtr ptrFrameRate = nodeMap.GetNode("AcquisitionFrameRate");
+	CFloatPtr ptrExposureTime = nodeMap.GetNode("ExposureTime");
+
+	bool restoreEnable = IsAvailable(ptrFrameRateEnable) && IsReadable(ptrFrameRateEnable) && IsWritable(ptrFrameRateEnable);
+	bool frameRateEnable = restoreEnable ? ptrFrameRateEnable->GetValue() : false;
+	bool restoreFrameRate = IsAvailable(ptrFrameRate) && IsReadable(ptrFrameRate);
+	double frameRate = restoreFrameRate ? ptrFrameRate->GetValue() : 0;
+	bool restoreExposure = exposureTime > 0 && IsAvailable(ptrExposureTime) && IsReadable(ptrExposureTime) && IsWritable(ptrExposureTime);
+	double exposure = restoreExposure ? ptrExposureTime->GetValue() : 0;
+
+	if (restoreEnable)
+		ptrFrameRateEnable->SetValue(false);
+	if (restoreExposure)
+		ptrExposureTime->SetValue(min(max(exposureTime, ptrExposureTime->GetMin()), ptrExposureTime->GetMax()));
+
+	// With the limit off the maximum of AcquisitionFrameRate is what the
+	// readout and the exposure allow; cameras without it report the
+	// resulting rate
+	fps = 0;
+	CFloatPtr ptrResultingFrameRate = nodeMap.GetNode("AcquisitionResultingFrameRate");
+	if (restoreFrameRate)
+		fps = ptrFrameRate->GetMax();
+	else if (IsAvailable(ptrResultingFrameRate) && IsReadable(ptrResultingFrameRate))
+		fps = ptrResultingFrameRate->GetValue();
+
+	if (restoreExposure)
+		ptrExposureTime->SetValue(exposure);
+	if (restoreEnable)
+	{
+		ptrFrameRateEnable->SetValue(frameRateEnable);
+		if (frameRateEnable && IsWritable(ptrFrameRate))
+			ptrFrameRate->SetValue(min(frameRate, ptrFrameRate->GetMax()));
+	}
+}
+
+
+int ApplyCaptureProfile(INodeMap & nodeMap, const CaptureProfile &profile, double exposureTime, CaptureProfileResult &result)
+{
+	result.profile = profile.name;
+
+	try
+	{
+		// Full sensor first: offsets to 0 so the size can grow, no
+		// binning or decimation
+		SetIntNode(nodeMap, "OffsetX", 0);
+		SetIntNode(nodeMap, "OffsetY", 0);
+		SetReduction(nodeMap, "BinningHorizontal", "BinningVertical", 1);
+		SetReduction(nodeMap, "DecimationHorizontal", "DecimationVertical", 1);
+		SetIntNode(nodeMap, "Width", GetIntMax(nodeMap, "Width"));
+		SetIntNode(nodeMap, "Height", GetIntMax(nodeMap, "Height"));
+
+		MeasureMode(nodeMap, exposureTime, result.fullWidth, result.fullHeight, result.fullPayload, result.fullFps);
+
+		if (profile.binning > 1 && SetReduction(nodeMap, "BinningHorizontal", "BinningVertical", profile.binning) < 0)
+		{
+			cout << "Unable to set " << profile.binning << "x" << profile.binning << " binning. Non-fatal error..." << endl;
+		}
+		if (profile.decimation > 1 && SetReduction(nodeMap, "DecimationHorizontal", "DecimationVertical", profile.decimation) < 0)
+		{
+			cout << "Unable to set " << profile.decimation << "x" << profile.decimation << " decimation. Non-fatal error..." << endl;
+		}
+
+		// ROI within the sensor as it is now, after binning
+		int64_t maxWidth = GetIntMax(nodeMap, "Width");
+		int64_t maxHeight = GetIntMax(nodeMap, "Height");
+		int64_t width = (int64_t)floor(maxWidth * profile.roiWidth);
+		int64_t height = (int64_t)floor(maxHeight * profile.roiHeight);
+
+		if (SetIntNode(nodeMap, "Width", width) < 0 || SetIntNode(nodeMap, "Height", height) < 0)
+		{
+			cout << "Unable to set the image size for profile " << profile.name << ". Aborting..." << endl;
+			return -1;
+		}
+
+		// Center the ROI
+		SetIntNode(nodeMap, "OffsetX", (maxWidth - GetIntNode(nodeMap, "Width")) / 2);
+		SetIntNode(nodeMap, "OffsetY", (maxHeight - GetIntNode(nodeMap, "Height")) / 2);
+
+		MeasureMode(nodeMap, exposureTime, result.width, result.height, result.payload, result.fps);
+
+		cout << "Capture profile " << profile.name << ": " << result.width << "x" << result.height
+			 << " at offset " << GetIntNode(nodeMap, "OffsetX") << "," << GetIntNode(nodeMap, "OffsetY") << endl;
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+void PrintCaptureProfileReport(const vector<CaptureProfileResult> &results, ostream &out)
+{
+	out << endl << "*** CAPTURE PROFILES ***" << endl << endl;
+
+	// Freed bandwidth is taken at the full sensor frame rate: what the
+	// profile saves if the rig keeps its rate. The gained rate is the
+	// highest rate the camera allows with the profile.
+	double totalFull = 0, totalFreed = 0;
+	for(unsigned int i=0; i<results.size(); i++)
+	{
+		const CaptureProfileResult &r = results[i];
+		double fullBandwidth = r.fullPayload * r.fullFps;
+		double freed = (r.fullPayload - r.payload) * r.fullFps;
+
+		out << "Camera " << i << " (" << r.serial << "), " << r.profile << ": "
+			<< r.fullWidth << "x" << r.fullHeight << " -> " << r.width << "x" << r.height
+			<< ", frees " << freed / 1e6 << " of " << fullBandwidth / 1e6 << " MB/s"
+			<< ", max " << r.fullFps << " -> " << r.fps << " fps";
+		if(r.fullFps > 0)
+			out << " (+" << r.fps - r.fullFps << ")";
+		out << endl;
+
+		totalFull += fullBandwidth;
+		totalFreed += freed;
+	}
+
+	out << "Rig: frees " << totalFreed / 1e6 << " of " << totalFull / 1e6 << " MB/s" << endl << endl;
+}
@@ -0,0 +1,71 @@
+#ifndef CAPTURE_PROFILE_H
+#define CAPTURE_PROFILE_H
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+
+//
+// Named on-camera readout modes. Binning, decimation and ROI reduce the
+// data before it leaves the camera, which raises the frame rate the link
+// and the sensor allow.
+//
+// *** NOTES ***
+// Profiles:
+//
+//   full    full sensor, no binning
+//   bin2    2x2 binning, full field of view at half resolution
+//   decim2  2x2 decimation, as bin2 without the noise benefit of binning
+//   strip   full width, centered band of a quarter of the height
+//
+// The ROI of a profile is a fraction of the sensor after binning, rounded
+// to the increments of the Width/Height/Offset nodes.
+//
+struct CaptureProfile
+{
+	const char *name;
+	int binning;
+	int decimation;
+	double roiWidth;
+	double roiHeight;
+	const char *description;
+};
+
+const CaptureProfile *FindCaptureProfile(const std::string &name);
+void PrintCaptureProfiles(std::ostream &out);
+
+
+// Frame size and rate of a camera before (full sensor) and after applying
+// a profile
+struct CaptureProfileResult
+{
+	std::string serial;
+	std::string profile;
+	int fullWidth, fullHeight;
+	int64_t fullPayload;		// bytes per frame
+	double fullFps;				// highest rate the camera allows
+	int width, height;
+	int64_t payload;
+	double fps;
+};
+
+
+//
+// Applies a profile to a camera that is not acquiring. The full sensor
+// mode is set first and its highest frame rate and payload measured,
+// so the result shows what the profile gains on this camera model.
+// The rates are taken at exposureTime (us, the one the capture will
+// use; 0 keeps the camera's) with the frame rate limit off; exposure
+// and limit are left as they were. Binning or decimation the camera
+// does not support is reported and skipped; the ROI is still applied.
+//
+int ApplyCaptureProfile(Spinnaker::GenApi::INodeMap & nodeMap, const CaptureProfile &profile, double exposureTime, CaptureProfileResult &result);
+
+void PrintCaptureProfileReport(const std::vector<CaptureProfileResult> &results, std::ostream &out);
+
+#endif
@@ -0,0 +1,314 @@
+#include "ClockSync.h"
+
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+
+
+static double Median(vector<double> &v)
+{
+	if(v.empty())
+		return 0;
+
+	size_t mid = v.size() / 2;
+	nth_element(v.begin(), v.begin() + mid, v.end());
+	return v[mid];
+}
+
+
+ClockSync::ClockSync(vector<CameraPtr> cameras, int periodMs, unsigned int windowSize)
+	: cameras(cameras), clocks(cameras.size()), periodMs(periodMs), windowSize(windowSize),
+	  hostEpoch(0), cameraEpoch(cameras.size(), 0), epochValid(cameras.size(), false),
+	  active(cameras.size(), true), running(false)
+{
+	for(unsigned int i=0; i<clocks.size(); i++)
+	{
+		clocks[i].offset = 0;
+		clocks[i].slope = 1;
+		clocks[i].residual = 0;
+		clocks[i].roundTrip = 0;
+		clocks[i].valid = false;
+	}
+}
+
+
+ClockSync::~ClockSync()
+{
+	Stop();
+}
+
+
+uint64_t ClockSync::HostTime()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+int ClockSync::Start(bool resetTimestamps)
+{
+	try
+	{
+		for(unsigned int i=0; i<cameras.size(); i++)
+		{
+			INodeMap & nodeMap = cameras[i]->GetNodeMap();
+
+			CCommandPtr ptrLatch = nodeMap.GetNode("TimestampLatch");
+			CIntegerPtr ptrLatchValue = nodeMap.GetNode("TimestampLatchValue");
+			if (!IsAvailable(ptrLatch) || !IsWritable(ptrLatch) || !IsAvailable(ptrLatchValue) || !IsReadable(ptrLatchValue))
+			{
+				cout << "Camera " << i << ": unable to latch timestamp. Aborting..." << endl;
+				return -1;
+			}
+
+			// Its first frames would carry timestamps from before the reset
+			// and the first samples
+			if(cameras[i]->IsStreaming())
+				cout << "Camera " << i << ": clock sync started while acquiring; call it before BeginAcquisition" << endl;
+		}
+
+		// All counters reset back to back, once every camera is known to
+		// latch, so no camera is left reset alone
+		for(unsigned int i=0; i<cameras.size() && resetTimestamps; i++)
+		{
+			CCommandPtr ptrReset = cameras[i]->GetNodeMap().GetNode("TimestampReset");
+			if (IsAvailable(ptrReset) && IsWritable(ptrReset))
+				ptrReset->Execute();
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+
+	// Two samples are needed for a slope
+	if(LatchAll() < 0)
+		return -1;
+	this_thread::sleep_for(chrono::milliseconds(periodMs));
+	if(LatchAll() < 0)
+		return -1;
+
+	running = true;
+	serviceThread = thread(&ClockSync::ServiceLoop, this);
+
+	return 0;
+}
+
+
+void ClockSync::Stop()
+{
+	{
+		lock_guard<mutex> lock(clockMutex);
+		if(!running)
+			return;
+		running = false;
+	}
+	stopRequested.notify_all();
+	serviceThread.join();
+}
+
+
+void ClockSync::ServiceLoop()
+{
+	unique_lock<mutex> lock(clockMutex);
+	while(running)
+	{
+		stopRequested.wait_for(lock, chrono::milliseconds(periodMs));
+		if(!running)
+			break;
+
+		lock.unlock();
+		LatchAll();
+		lock.lock();
+	}
+}
+
+
+int ClockSync::LatchAll()
+{
+	int result = 0;
+	vector<Sample> samples(cameras.size());
+	vector<uint64_t> cameraTicks(cameras.size());
+	vector<uint64_t> hostTicks(cameras.size());
+	vector<bool> latched(cameras.size(), false);
+
+	vector<CameraPtr> latchCameras;
+	vector<bool> latchActive;
+	{
+		lock_guard<mutex> lock(clockMutex);
+		latchCameras = cameras;
+		latchActive = active;
+	}
+
+	// A camera that fails is skipped so the others keep their fit
+	for(unsigned int i=0; i<latchCameras.size(); i++)
+	{
+		if(!latchActive[i])
+			continue;
+
+		try
+		{
+			INodeMap & nodeMap = latchCameras[i]->GetNodeMap();
+			CCommandPtr ptrLatch = nodeMap.GetNode("TimestampLatch");
+			CIntegerPtr ptrLatchValue = nodeMap.GetNode("TimestampLatchValue");
+
+			uint64_t before = HostTime();
+			ptrLatch->Execute();
+			uint64_t after = HostTime();
+
+			cameraTicks[i] = ptrLatchValue->GetValue();
+			samples[i].roundTrip = after - before;
+			hostTicks[i] = before + (after - before) / 2;
+			latched[i] = true;
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			cout << "Camera " << i << ": " << e.what() << endl;
+			result = -1;
+		}
+	}
+
+	lock_guard<mutex> lock(clockMutex);
+
+	for(unsigned int i=0; i<cameras.size(); i++)
+	{
+		if(!latched[i] || !active[i])
+			continue;
+
+		if(hostEpoch == 0)
+			hostEpoch = hostTicks[i];
+		if(!epochValid[i])
+		{
+			cameraEpoch[i] = cameraTicks[i];
+			epochValid[i] = true;
+		}
+
+		samples[i].hostTime = (double)((int64_t)(hostTicks[i] - hostEpoch));
+		samples[i].cameraTime = (double)((int64_t)(cameraTicks[i] - cameraEpoch[i]));
+
+		clocks[i].samples.push_back(samples[i]);
+		if(clocks[i].samples.size() > windowSize)
+			clocks[i].samples.pop_front();
+
+		Fit(clocks[i]);
+	}
+
+	return result;
+}
+
+
+void ClockSync::Fit(CameraClock &clock)
+{
+	const deque<Sample> &s = clock.samples;
+	if(s.size() < 2)
+		return;
+
+	vector<double> slopes;
+	for(unsigned int i=0; i<s.size(); i++)
+	{
+		for(unsigned int j=i+1; j<s.size(); j++)
+		{
+			double dx = s[j].cameraTime - s[i].cameraTime;
+			if(dx != 0)
+				slopes.push_back((s[j].hostTime - s[i].hostTime) / dx);
+		}
+	}
+	if(slopes.empty())
+		return;
+
+	clock.slope = Median(slopes);
+
+	vector<double> offsets, roundTrips;
+	for(unsigned int i=0; i<s.size(); i++)
+	{
+		offsets.push_back(s[i].hostTime - clock.slope * s[i].cameraTime);
+		roundTrips.push_back(s[i].roundTrip);
+	}
+	clock.offset = Median(offsets);
+
+	vector<double> residuals;
+	for(unsigned int i=0; i<s.size(); i++)
+	{
+		residuals.push_back(fabs(s[i].hostTime - clock.offset - clock.slope * s[i].cameraTime));
+	}
+	clock.residual = Median(residuals);
+	clock.roundTrip = Median(roundTrips);
+	clock.valid = true;
+}
+
+
+void ClockSync::Detach(int camNum)
+{
+	lock_guard<mutex> lock(clockMutex);
+	active[camNum] = false;
+}
+
+
+int ClockSync::Attach(int camNum, CameraPtr pCam)
+{
+	{
+		lock_guard<mutex> lock(clockMutex);
+		cameras[camNum] = pCam;
+		clocks[camNum].samples.clear();
+		clocks[camNum].valid = false;
+		epochValid[camNum] = false;
+		active[camNum] = true;
+	}
+
+	// Two samples for a first slope; the service thread refines it
+	int result = LatchAll();
+	this_thread::sleep_for(chrono::milliseconds(min(periodMs, 100)));
+	result = result | LatchAll();
+
+	return result;
+}
+
+
+uint64_t ClockSync::ToRigTime(int camNum, uint64_t cameraTime)
+{
+	lock_guard<mutex> lock(clockMutex);
+	const CameraClock &clock = clocks[camNum];
+
+	double x = (double)((int64_t)(cameraTime - cameraEpoch[camNum]));
+	return hostEpoch + (int64_t)llround(clock.offset + clock.slope * x);
+}
+
+
+double ClockSync::GetResidualSkew()
+{
+	lock_guard<mutex> lock(clockMutex);
+	double skew = 0;
+	for(unsigned int i=0; i<clocks.size(); i++)
+	{
+		skew = max(skew, clocks[i].residual + clocks[i].roundTrip / 2);
+	}
+	return skew;
+}
+
+
+void ClockSync::PrintReport()
+{
+	lock_guard<mutex> lock(clockMutex);
+
+	cout << endl << "*** CLOCK SYNC ***" << endl;
+	for(unsigned int i=0; i<clocks.size(); i++)
+	{
+		const CameraClock &clock = clocks[i];
+		cout << "Camera " << i << " SerialNum:" << cameras[i]->GetUniqueID()
+			 << "  drift: " << (clock.slope - 1.0) * 1e6 << " ppm"
+			 << "  residual: " << clock.residual / 1000.0 << " us"
+			 << "  latch round trip: " << clock.roundTrip / 1000.0 << " us"
+			 << (clock.valid ? "" : "  (not fitted)") << endl;
+	}
+
+	double skew = 0;
+	for(unsigned int i=0; i<clocks.size(); i++)
+		skew = max(skew, clocks[i].residual + clocks[i].roundTrip / 2);
+	cout << "Residual skew: " << skew / 1000.0 << " us" << endl << endl;
+}
@@ -0,0 +1,103 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+
+//
+// Maps the free running Timestamp counter of every camera onto one rig
+// clock (the host steady clock, in nanoseconds).
+//
+// *** NOTES ***
+// A service thread latches all camera clocks every periodMs with
+// TimestampLatch and reads TimestampLatchValue. The host time of a sample
+// is the midpoint of the latch command. For every camera a line
+//     hostTime = offset + slope * cameraTime
+// is fitted over the last windowSize samples with a Theil-Sen fit (median
+// of pairwise slopes), so a few samples delayed by USB traffic do not move
+// the estimate. Drift is (slope - 1) in ppm.
+//
+// The residual skew is the median absolute residual of the fit plus half
+// the median latch round trip. It is the uncertainty of a unified
+// timestamp and is reported per camera by PrintReport().
+//
+class ClockSync
+{
+public:
+	ClockSync(std::vector<Spinnaker::CameraPtr> cameras, int periodMs = 1000, unsigned int windowSize = 60);
+	~ClockSync();
+
+	// Reset camera counters, take the first samples and start the service
+	// thread. Returns -1 if a camera does not support timestamp latching.
+	// Call it before any camera begins acquisition, so every frame has a
+	// timestamp of the reset counter and a fit to map it with.
+	int Start(bool resetTimestamps = true);
+	void Stop();
+
+	// Latch all cameras once and refit. Called by the service thread.
+	int LatchAll();
+
+	// Stop latching a camera that went away
+	void Detach(int camNum);
+	// Start over with a camera that came back. Its counter restarted, so
+	// the old fit is dropped and two new samples are taken; before the
+	// camera acquires again, as for Start().
+	int Attach(int camNum, Spinnaker::CameraPtr pCam);
+
+	// Convert a camera timestamp (Image::GetTimeStamp) to rig time in ns
+	uint64_t ToRigTime(int camNum, uint64_t cameraTime);
+
+	// Residual skew of the worst camera in ns
+	double GetResidualSkew();
+
+	void PrintReport();
+
+	static uint64_t HostTime();
+
+private:
+	struct Sample
+	{
+		double cameraTime;
+		double hostTime;
+		double roundTrip;
+	};
+
+	struct CameraClock
+	{
+		std::deque<Sample> samples;
+		double offset;
+		double slope;
+		double residual;
+		double roundTrip;
+		bool valid;
+	};
+
+	void Fit(CameraClock &clock);
+	void ServiceLoop();
+
+	std::vector<Spinnaker::CameraPtr> cameras;
+	std::vector<CameraClock> clocks;
+	int periodMs;
+	unsigned int windowSize;
+
+	// Times are kept relative to these to keep full precision in doubles
+	uint64_t hostEpoch;
+	std::vector<uint64_t> cameraEpoch;
+	std::vector<bool> epochValid;
+	std::vector<bool> active;
+
+	std::mutex clockMutex;
+	std::condition_variable stopRequested;
+	bool running;
+	std::thread serviceThread;
+};
+
+#endif
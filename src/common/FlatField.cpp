@@ -0,0 +1,279 @@
+#include "FlatField.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+
+static const char referenceMagic[8] = "FFREF01";
+
+
+FrameAverager::FrameAverager()
+	: count(0)
+{
+}
+
+
+int FrameAverager::Add(const Mat &img)
+{
+	if(count == 0)
+		sum = Mat::zeros(img.rows, img.cols, CV_64FC1);
+	else if(img.rows != sum.rows || img.cols != sum.cols)
+		return -1;
+
+	bool wide = (img.depth() == CV_16U);
+	for(int y=0; y<img.rows; y++)
+	{
+		double *s = sum.ptr<double>(y);
+		if(wide)
+		{
+			const uint16_t *p = img.ptr<uint16_t>(y);
+			for(int x=0; x<img.cols; x++)
+				s[x] += p[x];
+		}
+		else
+		{
+			const uint8_t *p = img.ptr<uint8_t>(y);
+			for(int x=0; x<img.cols; x++)
+				s[x] += p[x];
+		}
+	}
+
+	count++;
+	return 0;
+}
+
+
+Mat FrameAverager::GetMean()
+{
+	Mat mean(sum.rows, sum.cols, CV_32FC1);
+	for(int y=0; y<sum.rows; y++)
+	{
+		const double *s = sum.ptr<double>(y);
+		float *m = mean.ptr<float>(y);
+		for(int x=0; x<sum.cols; x++)
+			m[x] = (float)(s[x] / max(count, 1));
+	}
+	return mean;
+}
+
+
+int SaveReference(const string &fileName, const Mat &mean, int numFrames)
+{
+	ofstream file(fileName.c_str(), ios::binary);
+	if(!file)
+	{
+		cout << "Unable to write " << fileName << endl;
+		return -1;
+	}
+
+	int32_t header[3] = { mean.cols, mean.rows, numFrames };
+	file.write(referenceMagic, sizeof(referenceMagic));
+	file.write((const char *)header, sizeof(header));
+	for(int y=0; y<mean.rows; y++)
+		file.write((const char *)mean.ptr<float>(y), mean.cols * sizeof(float));
+
+	return file ? 0 : -1;
+}
+
+
+int LoadReference(const string &fileName, Mat &mean)
+{
+	ifstream file(fileName.c_str(), ios::binary);
+	if(!file)
+		return 1;
+
+	char magic[8];
+	int32_t header[3];
+	file.read(magic, sizeof(magic));
+	file.read((char *)header, sizeof(header));
+	if(!file || memcmp(magic, referenceMagic, sizeof(magic)) != 0 || header[0] <= 0 || header[1] <= 0)
+	{
+		cout << fileName << " is not a reference frame" << endl;
+		return -1;
+	}
+
+	mean.create(header[1], header[0], CV_32FC1);
+	for(int y=0; y<mean.rows; y++)
+		file.read((char *)mean.ptr<float>(y), mean.cols * sizeof(float));
+
+	if(!file)
+	{
+		cout << fileName << " is truncated" << endl;
+		return -1;
+	}
+	return 0;
+}
+
+
+string ReferenceFileName(const string &dir, const string &serial, const string &kind)
+{
+	return dir + "/" + serial + "." + kind;
+}
+
+
+FlatFieldCorrector::FlatFieldCorrector()
+	: hasDark(false), hasFlat(false), active(false), width(0), height(0), sizeWarning(false)
+{
+}
+
+
+int FlatFieldCorrector::Load(const string &dir, const string &serial)
+{
+	Mat dark, flat;
+
+	int darkResult = LoadReference(ReferenceFileName(dir, serial, "dark"), dark);
+	int flatResult = LoadReference(ReferenceFileName(dir, serial, "flat"), flat);
+	if(darkResult < 0 || flatResult < 0)
+		return -1;
+
+	hasDark = (darkResult == 0);
+	hasFlat = (flatResult == 0);
+	if(!hasDark && !hasFlat)
+		return 1;
+
+	if(hasDark && hasFlat && (dark.rows != flat.rows || dark.cols != flat.cols))
+	{
+		cout << "Camera " << serial << ": dark and flat frames differ in size" << endl;
+		return -1;
+	}
+
+	BuildTables(dark, flat);
+	active = true;
+	return 0;
+}
+
+
+void FlatFieldCorrector::BuildTables(const Mat &dark, const Mat &flat)
+{
+	const Mat &reference = hasDark ? dark : flat;
+	width = reference.cols;
+	height = reference.rows;
+
+	darkQ4.assign(width * height, 0);
+	gainQ12.assign(width * height, 1 << 12);
+
+	if(hasDark)
+	{
+		for(int y=0; y<height; y++)
+		{
+			const float *d = dark.ptr<float>(y);
+			for(int x=0; x<width; x++)
+				darkQ4[y*width + x] = (uint16_t)min(floor(d[x] * 16.0f + 0.5f), 65535.0f);
+		}
+	}
+
+	if(!hasFlat)
+		return;
+
+	// Mean response per 2x2 phase
+	double phaseSum[4] = {0, 0, 0, 0};
+	int phaseCount[4] = {0, 0, 0, 0};
+	for(int y=0; y<height; y++)
+	{
+		const float *f = flat.ptr<float>(y);
+		for(int x=0; x<width; x++)
+		{
+			int phase = (y & 1) * 2 + (x & 1);
+			phaseSum[phase] += f[x] - darkQ4[y*width + x] / 16.0;
+			phaseCount[phase]++;
+		}
+	}
+
+	for(int y=0; y<height; y++)
+	{
+		const float *f = flat.ptr<float>(y);
+		for(int x=0; x<width; x++)
+		{
+			int phase = (y & 1) * 2 + (x & 1);
+			double response = f[x] - darkQ4[y*width + x] / 16.0;
+
+			// Dead pixels are left alone
+			if(response < 0.5)
+				continue;
+
+			double gain = phaseSum[phase] / phaseCount[phase] / response;
+			gainQ12[y*width + x] = (uint16_t)min(floor(gain * 4096.0 + 0.5), 65535.0);
+		}
+	}
+}
+
+
+// 8-bit rows: ((raw * 16 - dark) * gain) >> 16, i.e. Q4 * Q12 back to Q0
+static void CorrectRow8(uint8_t *row, const uint16_t *dark, const uint16_t *gain, int width)
+{
+	int x = 0;
+
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for(; x+16<=width; x+=16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(row + x));
+		__m128i lo = _mm_slli_epi16(_mm_unpacklo_epi8(v, zero), 4);
+		__m128i hi = _mm_slli_epi16(_mm_unpackhi_epi8(v, zero), 4);
+
+		// Saturating subtract clamps at 0
+		lo = _mm_subs_epu16(lo, _mm_loadu_si128((const __m128i *)(dark + x)));
+		hi = _mm_subs_epu16(hi, _mm_loadu_si128((const __m128i *)(dark + x + 8)));
+
+		lo = _mm_mulhi_epu16(lo, _mm_loadu_si128((const __m128i *)(gain + x)));
+		hi = _mm_mulhi_epu16(hi, _mm_loadu_si128((const __m128i *)(gain + x + 8)));
+
+		_mm_storeu_si128((__m128i *)(row + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+
+	for(; x<width; x++)
+	{
+		int d = max(row[x] * 16 - (int)dark[x], 0);
+		row[x] = (uint8_t)min((d * (int)gain[x]) >> 16, 255);
+	}
+}
+
+
+// 16-bit rows: (raw - dark) * gain >> 12; the dark is rounded to whole DN
+static void CorrectRow16(uint16_t *row, const uint16_t *dark, const uint16_t *gain, int width)
+{
+	for(int x=0; x<width; x++)
+	{
+		uint32_t d0 = ((uint32_t)dark[x] + 8) >> 4;
+		uint32_t d = (row[x] > d0) ? row[x] - d0 : 0;
+		uint32_t v = (d * gain[x]) >> 12;
+		row[x] = (uint16_t)((v > 65535) ? 65535 : v);
+	}
+}
+
+
+void FlatFieldCorrector::Apply(Mat &img, int numThreads)
+{
+	if(!active)
+		return;
+
+	if(img.rows != height || img.cols != width)
+	{
+		if(!sizeWarning)
+			cout << "Flat field: frame is " << img.cols << "x" << img.rows << ", references are " << width << "x" << height << ". Not corrected." << endl;
+		sizeWarning = true;
+		return;
+	}
+
+	bool wide = (img.depth() == CV_16U);
+
+	#pragma omp parallel for num_threads(numThreads) if(numThreads > 1)
+	for(int y=0; y<height; y++)
+	{
+		if(wide)
+			CorrectRow16(img.ptr<uint16_t>(y), &darkQ4[y*width], &gainQ12[y*width], width);
+		else
+			CorrectRow8(img.ptr<uint8_t>(y), &darkQ4[y*width], &gainQ12[y*width], width);
+	}
+}
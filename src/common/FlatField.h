@@ -0,0 +1,90 @@
+#ifndef FLAT_FIELD_H
+#define FLAT_FIELD_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+
+//
+// Running mean of a sequence of frames (CV_8UC1 or CV_16UC1), for the
+// dark and flat reference frames
+//
+class FrameAverager
+{
+public:
+	FrameAverager();
+
+	// Frames of a different size than the first are skipped; returns -1
+	int Add(const cv::Mat &img);
+	int GetCount() { return count; }
+
+	// Mean frame, CV_32FC1
+	cv::Mat GetMean();
+
+private:
+	cv::Mat sum;	// CV_64FC1
+	int count;
+};
+
+
+// Reference frame files: "FFREF01" header, width, height and number of
+// averaged frames, then the float pixels row by row
+int SaveReference(const std::string &fileName, const cv::Mat &mean, int numFrames);
+int LoadReference(const std::string &fileName, cv::Mat &mean);
+
+// <dir>/<serial>.dark and <dir>/<serial>.flat
+std::string ReferenceFileName(const std::string &dir, const std::string &serial, const std::string &kind);
+
+
+//
+// Dark frame and flat field correction of one camera.
+//
+// *** NOTES ***
+// corrected = (raw - dark) * gain, with gain = mean(flat - dark) / (flat - dark)
+//
+// The mean is taken per 2x2 phase, so on a Bayer sensor each colour keeps
+// its level and the flat only removes vignetting and pixel response
+// differences, not the colour of the flat light source.
+//
+// Load() turns the float references into fixed point tables once: the
+// dark in 1/16 DN (Q4) and the gain in Q12 (up to 16x). Apply() then is
+// integer only: 8-bit frames use SSE2 (saturating subtract, mulhi), 16-bit
+// frames a loop the compiler vectorizes. Rows are split across numThreads
+// OpenMP threads; capture threads already run one per camera, so the
+// default is 1.
+//
+// A missing dark is taken as 0, a missing flat as gain 1. Frames of a size
+// other than the references are left as they are.
+//
+class FlatFieldCorrector
+{
+public:
+	FlatFieldCorrector();
+
+	// 0 if at least one reference was loaded, 1 if there are none, -1 on
+	// error (unreadable file, size mismatch between dark and flat)
+	int Load(const std::string &dir, const std::string &serial);
+
+	bool IsActive() { return active; }
+
+	// In place
+	void Apply(cv::Mat &img, int numThreads = 1);
+
+	bool hasDark;
+	bool hasFlat;
+
+private:
+	void BuildTables(const cv::Mat &dark, const cv::Mat &flat);
+
+	bool active;
+	int width;
+	int height;
+	std::vector<uint16_t> darkQ4;
+	std::vector<uint16_t> gainQ12;
+	bool sizeWarning;
+};
+
+#endif
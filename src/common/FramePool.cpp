@@ -0,0 +1,69 @@
+#include "FramePool.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+
+// References to the data of a Mat, the pool's own included. The count is
+// changed atomically by the threads releasing the frame.
+static int References(const Mat &frame)
+{
+#if CV_MAJOR_VERSION >= 3
+	const int *count = (frame.u != NULL) ? &frame.u->refcount : NULL;
+#else
+	const int *count = frame.refcount;
+#endif
+	return (count != NULL) ? __atomic_load_n(count, __ATOMIC_ACQUIRE) : 0;
+}
+
+
+FramePool::FramePool(int numFrames, int maxFrames)
+	: numMisses(0), numFrames(numFrames), maxFrames(max(maxFrames, numFrames)), next(0)
+{
+}
+
+
+void FramePool::Add(int rows, int cols, int type)
+{
+	// Written here, so the pages are placed now
+	frames.push_back(Mat(rows, cols, type, Scalar::all(0)));
+}
+
+
+Mat FramePool::Get(int rows, int cols, int type)
+{
+	if(!frames.empty() && (frames[0].rows != rows || frames[0].cols != cols || frames[0].type() != type))
+	{
+		frames.clear();
+		next = 0;
+	}
+	if(frames.empty())
+	{
+		for(int i=0; i<numFrames; i++)
+			Add(rows, cols, type);
+	}
+
+	// Round robin from the last one handed out; the oldest are the most
+	// likely to be back
+	for(unsigned int i=0; i<frames.size(); i++)
+	{
+		unsigned int k = (next + i) % frames.size();
+		if(References(frames[k]) == 1)
+		{
+			next = (k + 1) % frames.size();
+			return frames[k];
+		}
+	}
+
+	if((int)frames.size() < maxFrames)
+	{
+		Add(rows, cols, type);
+		next = 0;
+		return frames.back();
+	}
+
+	numMisses++;
+	return Mat(rows, cols, type);
+}
@@ -0,0 +1,48 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <vector>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+
+//
+// Frame buffers of one camera, allocated by its capture thread and reused,
+// so they stay on the NUMA node of the camera (see ThreadTopology).
+//
+// *** NOTES ***
+// The capture thread calls Get() after ThreadTopology::BindMemory(). The
+// first call allocates numFrames buffers of the frame size and writes
+// them once, so their pages are placed on the preferred node there and
+// then instead of on the first touch by whichever thread fills them.
+// Get() hands out a buffer whose only reference left is the pool's own:
+// the Mats share the data, and a frame is free again once the assembler,
+// writer, gate and encoder have released theirs. When all buffers are in
+// use another one is added, up to maxFrames; past that Get() returns a
+// buffer of its own, counted as a miss. Buffers of another size or type
+// are dropped from the pool.
+//
+// Get() is not thread safe; one pool per capture thread.
+//
+class FramePool
+{
+public:
+	FramePool(int numFrames = 32, int maxFrames = 256);
+
+	cv::Mat Get(int rows, int cols, int type);
+
+	int GetSize() { return (int)frames.size(); }
+
+	uint64_t numMisses;
+
+private:
+	void Add(int rows, int cols, int type);
+
+	int numFrames;
+	int maxFrames;
+	std::vector<cv::Mat> frames;
+	unsigned int next;
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include "FrameSelector.h"
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+using namespace std;
+using namespace cv;
+
+
+double SharpnessScore(const Mat &gray, vector<int16_t> &half, int &halfWidth, int &halfHeight)
+{
+	halfWidth = gray.cols / 2;
+	halfHeight = gray.rows / 2;
+	half.resize((size_t)halfWidth * halfHeight);
+	if(halfWidth < 3 || halfHeight < 3)
+		return 0;
+
+	// 2x2 means, kept at 4x scale; the noise averages down and the
+	// Laplacian has a quarter of the pixels to go over
+	for(int y=0; y<halfHeight; y++)
+	{
+		const uint8_t *row0 = gray.ptr<uint8_t>(2 * y);
+		const uint8_t *row1 = gray.ptr<uint8_t>(2 * y + 1);
+		int16_t *dst = &half[(size_t)y * halfWidth];
+
+		#pragma omp simd
+		for(int x=0; x<halfWidth; x++)
+			dst[x] = (int16_t)(row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1]);
+	}
+
+	int64_t sum = 0, sumSquares = 0;
+	for(int y=1; y<halfHeight-1; y++)
+	{
+		const int16_t *up = &half[(size_t)(y - 1) * halfWidth];
+		const int16_t *mid = &half[(size_t)y * halfWidth];
+		const int16_t *down = &half[(size_t)(y + 1) * halfWidth];
+
+		#pragma omp simd reduction(+:sum,sumSquares)
+		for(int x=1; x<halfWidth-1; x++)
+		{
+			int lap = up[x] + down[x] + mid[x - 1] + mid[x + 1] - 4 * mid[x];
+			sum += lap;
+			sumSquares += lap * lap;
+		}
+	}
+
+	// Back to the scale of 8-bit pixels
+	double n = (double)(halfWidth - 2) * (halfHeight - 2);
+	double mean = sum / n;
+	return (sumSquares / n - mean * mean) / 16.0;
+}
+
+
+static double EdgeLength(const Point2f &a, const Point2f &b)
+{
+	return max(sqrt((double)(b.x - a.x) * (b.x - a.x) + (double)(b.y - a.y) * (b.y - a.y)), 1e-6);
+}
+
+
+BoardPose BoardPoseFromCorners(const vector<Point2f> &corners, Size boardSize, Size frameSize)
+{
+	BoardPose pose;
+
+	// Outer corners: top left, top right, bottom left, bottom right
+	int cols = boardSize.width, rows = boardSize.height;
+	Point2f c0 = corners[0], c1 = corners[cols - 1];
+	Point2f c2 = corners[(rows - 1) * cols], c3 = corners[rows * cols - 1];
+
+	// The detector may start at either end of the board; start at the
+	// corner nearer the top left of the frame
+	if(c0.x + c0.y > c3.x + c3.y)
+	{
+		swap(c0, c3);
+		swap(c1, c2);
+	}
+
+	double sumX = 0, sumY = 0;
+	for(unsigned int i=0; i<corners.size(); i++)
+	{
+		sumX += corners[i].x;
+		sumY += corners[i].y;
+	}
+	pose.centerX = sumX / corners.size() / frameSize.width;
+	pose.centerY = sumY / corners.size() / frameSize.height;
+
+	// Shoelace area of the quad c0 c1 c3 c2
+	double area = 0.5 * fabs((c0.x * c1.y - c1.x * c0.y) + (c1.x * c3.y - c3.x * c1.y)
+	                         + (c3.x * c2.y - c2.x * c3.y) + (c2.x * c0.y - c0.x * c2.y));
+	pose.scale = sqrt(area) / frameSize.width;
+
+	pose.tiltX = log(EdgeLength(c0, c2) / EdgeLength(c1, c3));
+	pose.tiltY = log(EdgeLength(c0, c1) / EdgeLength(c2, c3));
+	pose.roll = atan2(c1.y - c0.y, c1.x - c0.x);
+	return pose;
+}
+
+
+double PoseDistance(const BoardPose &a, const BoardPose &b)
+{
+	double shift = sqrt((a.centerX - b.centerX) * (a.centerX - b.centerX) + (a.centerY - b.centerY) * (a.centerY - b.centerY));
+	double scale = fabs(log(max(a.scale, 1e-6) / max(b.scale, 1e-6)));
+	double roll = fabs(remainder(a.roll - b.roll, 2 * M_PI));
+
+	double distance = max(shift, scale);
+	distance = max(distance, fabs(a.tiltX - b.tiltX));
+	distance = max(distance, fabs(a.tiltY - b.tiltY));
+	return max(distance, roll);
+}
+
+
+FrameSelectorSettings::FrameSelectorSettings()
+	: boardSize(9, 6), minSharpness(100), minDifference(0.1), maxFrames(0)
+{
+}
+
+
+FrameSelector::FrameSelector(const string &outputDir, const FrameSelectorSettings &settings)
+	: outputDir(outputDir), settings(settings), numScored(0), numBlurred(0), numNoBoard(0), numRedundant(0),
+	  hasPending(false), busy(false), running(false), numSkipped(0), numSaved(0)
+{
+}
+
+
+FrameSelector::~FrameSelector()
+{
+	Stop();
+}
+
+
+void FrameSelector::Start()
+{
+	running = true;
+	worker = thread(&FrameSelector::WorkLoop, this);
+}
+
+
+void FrameSelector::Stop()
+{
+	{
+		lock_guard<mutex> lock(selectorMutex);
+		if(!running)
+			return;
+		running = false;
+	}
+	frameReady.notify_all();
+	worker.join();
+}
+
+
+bool FrameSelector::Offer(const Mat &gray)
+{
+	{
+		lock_guard<mutex> lock(selectorMutex);
+		if(!running || busy || hasPending)
+		{
+			numSkipped++;
+			return false;
+		}
+		if(settings.maxFrames > 0 && numSaved >= settings.maxFrames)
+			return false;
+
+		// The capture buffer goes back to the camera; keep a copy
+		gray.copyTo(pending);
+		hasPending = true;
+	}
+	frameReady.notify_one();
+	return true;
+}
+
+
+int FrameSelector::GetNumSaved()
+{
+	lock_guard<mutex> lock(selectorMutex);
+	return numSaved;
+}
+
+
+void FrameSelector::WorkLoop()
+{
+	Mat frame;
+
+	unique_lock<mutex> lock(selectorMutex);
+	while(true)
+	{
+		frameReady.wait(lock, [this] { return hasPending || !running; });
+		if(!running)
+			break;
+
+		// Swap, so the next copy reuses the buffer of the last frame
+		swap(frame, pending);
+		hasPending = false;
+		busy = true;
+		lock.unlock();
+
+		Select(frame);
+
+		lock.lock();
+		busy = false;
+	}
+}
+
+
+void FrameSelector::Select(const Mat &gray)
+{
+	int halfWidth, halfHeight;
+	double sharpness = SharpnessScore(gray, half, halfWidth, halfHeight);
+	numScored++;
+	if(sharpness < settings.minSharpness)
+	{
+		numBlurred++;
+		return;
+	}
+
+	// The pose only needs the corners as found at half size
+	resize(gray, small, Size(gray.cols / 2, gray.rows / 2), 0, 0, INTER_AREA);
+	if(!findChessboardCorners(small, settings.boardSize, corners,
+	                          CALIB_CB_ADAPTIVE_THRESH | CALIB_CB_NORMALIZE_IMAGE | CALIB_CB_FAST_CHECK))
+	{
+		numNoBoard++;
+		return;
+	}
+
+	BoardPose pose = BoardPoseFromCorners(corners, settings.boardSize, small.size());
+	double closest = HUGE_VAL;
+	for(unsigned int i=0; i<saved.size(); i++)
+		closest = min(closest, PoseDistance(pose, saved[i]));
+	if(closest < settings.minDifference)
+	{
+		numRedundant++;
+		return;
+	}
+
+	saved.push_back(pose);
+	string fileName = outputDir + "/a" + to_string(saved.size()) + ".jpg";
+	imwrite(fileName, gray);
+
+	{
+		lock_guard<mutex> lock(selectorMutex);
+		numSaved++;
+	}
+	cout << fileName << ": sharpness " << sharpness;
+	if(saved.size() > 1)
+		cout << ", difference " << closest;
+	cout << endl;
+}
+
+
+void FrameSelector::PrintStatistics(const string &name)
+{
+	lock_guard<mutex> lock(selectorMutex);
+	cout << name << ": " << numSaved << " frames saved of " << numScored << " scored (" << numBlurred << " blurred, "
+		 << numNoBoard << " without the board, " << numRedundant << " redundant), " << numSkipped << " frames not scored" << endl;
+}
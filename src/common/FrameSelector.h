@@ -0,0 +1,120 @@
+#ifndef FRAME_SELECTOR_H
+#define FRAME_SELECTOR_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+
+//
+// Variance of the 4-neighbour Laplacian of an 8-bit gray frame reduced to
+// half size by 2x2 means. Higher is sharper; motion and focus blur both
+// lower it. The half size image is also returned.
+//
+double SharpnessScore(const cv::Mat &gray, std::vector<int16_t> &half, int &halfWidth, int &halfHeight);
+
+//
+// Where a checkerboard is in a frame, from the inner corners that
+// findChessboardCorners found: centroid, apparent size, tilt and roll.
+// Lengths are fractions of the frame, so the corners may come from a
+// scaled copy of it.
+//
+struct BoardPose
+{
+	double centerX, centerY;	// mean of the corners, fraction of the frame width and height
+	double scale;				// square root of the board area, fraction of the frame width
+	double tiltX;				// log of left over right edge length; turn about the vertical axis
+	double tiltY;				// log of top over bottom edge length; turn about the horizontal axis
+	double roll;				// angle of the top edge, radians
+};
+
+// Pose of the corners of a board of boardSize inner corners (row by row,
+// as findChessboardCorners returns them) in a frame of frameSize. Corner
+// lists the detector returned in reverse order give the same pose.
+BoardPose BoardPoseFromCorners(const std::vector<cv::Point2f> &corners, cv::Size boardSize, cv::Size frameSize);
+
+// Largest change between two poses: centroid shift (fraction of the
+// frame), log of the scale ratio, change of either tilt, and change of
+// roll (radians). 0.1 is a board moved by a tenth of the frame, 10%
+// nearer, turned so one edge is 10% shorter relative to the other, or
+// rolled by 6 degrees.
+double PoseDistance(const BoardPose &a, const BoardPose &b);
+
+
+struct FrameSelectorSettings
+{
+	FrameSelectorSettings();
+
+	cv::Size boardSize;		// inner corners of the checkerboard
+	double minSharpness;	// SharpnessScore below which a frame is blurred
+	double minDifference;	// PoseDistance to every saved frame
+	int maxFrames;			// stop saving after this many; 0: no limit
+};
+
+
+//
+// Automatic selection of calibration frames for one camera.
+//
+// *** NOTES ***
+// Offer() is called from the capture loop with every frame. It only copies
+// the frame when the worker thread is idle and otherwise returns at once,
+// so scoring never slows the live stream down; the worker scores as many
+// frames as it keeps up with.
+//
+// A frame is saved when it is sharp (SharpnessScore, on the half size
+// image, vectorized with "omp simd"), the board is found in it (on a half
+// size copy, as BoardCoverage does) and its BoardPose differs by at least
+// minDifference from every frame saved so far. A board held still is
+// saved once and only new positions, distances and tilts add frames;
+// frames without the board are never saved. Frames are written to
+// <outputDir>/a<n>.jpg, apart from the manually saved <n>.jpg.
+//
+class FrameSelector
+{
+public:
+	FrameSelector(const std::string &outputDir, const FrameSelectorSettings &settings);
+	~FrameSelector();
+
+	void Start();
+	void Stop();
+
+	// 8-bit gray frame; false when the worker was busy and the frame skipped
+	bool Offer(const cv::Mat &gray);
+
+	int GetNumSaved();
+	void PrintStatistics(const std::string &name);
+
+private:
+	void WorkLoop();
+	void Select(const cv::Mat &gray);
+
+	std::string outputDir;
+	FrameSelectorSettings settings;
+
+	// Worker thread only
+	std::vector<int16_t> half;
+	cv::Mat small;
+	std::vector<cv::Point2f> corners;
+	std::vector<BoardPose> saved;
+	int numScored;
+	int numBlurred;
+	int numNoBoard;
+	int numRedundant;
+
+	std::mutex selectorMutex;
+	std::condition_variable frameReady;
+	cv::Mat pending;
+	bool hasPending;
+	bool busy;
+	bool running;
+	int numSkipped;
+	int numSaved;
+	std::thread worker;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include "FramesetAssembler.h"
+
+#include <iostream>
+
+using namespace std;
+using namespace cv;
+
+
+FramesetAssembler::FramesetAssembler(int numCams, int timeoutMs, unsigned int maxPending)
+	: numFramesets(0), numIncomplete(0), numLate(0),
+	  numCams(numCams), timeoutMs(timeoutMs), maxPending(maxPending), running(false),
+	  nextFrameId(numCams, 0), finished(numCams, false), nextEmit(0)
+{
+}
+
+
+FramesetAssembler::~FramesetAssembler()
+{
+	Stop();
+}
+
+
+void FramesetAssembler::AddSink(function<void(Frameset &)> sink)
+{
+	sinks.push_back(sink);
+}
+
+
+void FramesetAssembler::Start()
+{
+	running = true;
+	assemblerThread = thread(&FramesetAssembler::AssemblerLoop, this);
+}
+
+
+void FramesetAssembler::Stop()
+{
+	{
+		lock_guard<mutex> lock(inputMutex);
+		if(!running)
+			return;
+		running = false;
+	}
+	inputReady.notify_all();
+	assemblerThread.join();
+}
+
+
+void FramesetAssembler::Push(int camNum, const CameraFrame &frame)
+{
+	Input item;
+	item.camNum = camNum;
+	item.frame = frame;
+
+	{
+		lock_guard<mutex> lock(inputMutex);
+		input.push_back(item);
+	}
+	inputReady.notify_one();
+}
+
+
+void FramesetAssembler::Finish(int camNum)
+{
+	// Marker: an input without image past every frame of this camera
+	Input item;
+	item.camNum = camNum;
+	item.frame.frameId = UINT64_MAX;
+	item.frame.rigTime = 0;
+	item.frame.missing = true;
+
+	{
+		lock_guard<mutex> lock(inputMutex);
+		input.push_back(item);
+	}
+	inputReady.notify_one();
+}
+
+
+void FramesetAssembler::AssemblerLoop()
+{
+	deque<Input> batch;
+	unique_lock<mutex> lock(inputMutex);
+
+	while(true)
+	{
+		inputReady.wait_for(lock, chrono::milliseconds(max(1, timeoutMs / 4)), [this] { return !input.empty() || !running; });
+		bool stop = !running;
+
+		// Take everything queued and work without holding the lock
+		batch.swap(input);
+		lock.unlock();
+
+		for(unsigned int i=0; i<batch.size(); i++)
+			File(batch[i]);
+		batch.clear();
+		EmitReady(stop);
+
+		lock.lock();
+		if(stop && input.empty())
+			break;
+	}
+}
+
+
+void FramesetAssembler::File(Input &item)
+{
+	int camNum = item.camNum;
+	CameraFrame &frame = item.frame;
+
+	if(frame.frameId == UINT64_MAX)
+	{
+		finished[camNum] = true;
+		return;
+	}
+
+	if(frame.frameId < nextEmit)
+	{
+		if(!frame.missing)
+			numLate++;
+		return;
+	}
+
+	nextFrameId[camNum] = max(nextFrameId[camNum], frame.frameId + 1);
+
+	map<uint64_t, PendingFrameset>::iterator it = pending.find(frame.frameId);
+	if(it == pending.end())
+	{
+		PendingFrameset p;
+		p.frameset.frameId = frame.frameId;
+		p.frameset.frames.resize(numCams);
+		p.frameset.numMissing = 0;
+		for(int i=0; i<numCams; i++)
+		{
+			p.frameset.frames[i].frameId = frame.frameId;
+			p.frameset.frames[i].rigTime = 0;
+			p.frameset.frames[i].missing = true;
+		}
+		p.filled.assign(numCams, false);
+		p.numFilled = 0;
+		p.created = chrono::steady_clock::now();
+		it = pending.insert(make_pair(frame.frameId, p)).first;
+	}
+
+	PendingFrameset &p = it->second;
+	if(p.filled[camNum] && (frame.missing || !p.frameset.frames[camNum].missing))
+		return;
+
+	if(!p.filled[camNum])
+	{
+		p.filled[camNum] = true;
+		p.numFilled++;
+	}
+	p.frameset.frames[camNum] = frame;
+}
+
+
+void FramesetAssembler::EmitReady(bool flush)
+{
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+	while(!pending.empty())
+	{
+		PendingFrameset &p = pending.begin()->second;
+
+		bool ready = (p.numFilled == numCams) || flush || pending.size() > maxPending;
+
+		// Every camera is past this frameset or done
+		if(!ready)
+		{
+			ready = true;
+			for(int i=0; i<numCams && ready; i++)
+				ready = p.filled[i] || finished[i] || nextFrameId[i] > p.frameset.frameId + 1;
+		}
+
+		if(!ready && chrono::duration_cast<chrono::milliseconds>(now - p.created).count() > timeoutMs)
+			ready = true;
+
+		if(!ready)
+			break;
+
+		Emit(p);
+		nextEmit = pending.begin()->first + 1;
+		pending.erase(pending.begin());
+	}
+}
+
+
+void FramesetAssembler::Emit(PendingFrameset &p)
+{
+	Frameset &frameset = p.frameset;
+
+	frameset.numMissing = 0;
+	for(int i=0; i<numCams; i++)
+	{
+		if(frameset.frames[i].missing)
+			frameset.numMissing++;
+	}
+
+	numFramesets++;
+	if(frameset.numMissing > 0)
+		numIncomplete++;
+
+	for(unsigned int i=0; i<sinks.size(); i++)
+		sinks[i](frameset);
+}
+
+
+void FramesetAssembler::PrintStatistics()
+{
+	cout << "Framesets: " << numFramesets << ", incomplete " << numIncomplete << ", late frames dropped " << numLate << endl;
+}
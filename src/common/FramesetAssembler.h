@@ -0,0 +1,118 @@
+#ifndef FRAMESET_ASSEMBLER_H
+#define FRAMESET_ASSEMBLER_H
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+
+// One image of one camera. frameId counts from 0 at the camera's first
+// frame; a missing frame keeps the id of its slot.
+struct CameraFrame
+{
+	cv::Mat img;
+	uint64_t frameId;
+	uint64_t rigTime;
+	bool missing;
+};
+
+
+// The images of all cameras for one trigger
+struct Frameset
+{
+	uint64_t frameId;
+	std::vector<CameraFrame> frames;
+	int numMissing;
+};
+
+
+//
+// Collects the frames of the per camera capture threads into framesets
+// and hands complete framesets to the sinks.
+//
+// *** NOTES ***
+// Capture threads only call Push(), which appends to a queue and returns.
+// The assembler thread files every frame under its frameId. A frameset is
+// emitted, in frameId order,
+// - when all cameras delivered a frame for it,
+// - or when every camera is already past it (the absent frames are marked
+//   missing),
+// - or when it waited longer than timeoutMs,
+// - or when more than maxPending framesets are open.
+// Frames that arrive after their frameset was emitted are dropped and
+// counted. A real frame replaces a missing placeholder of the same slot.
+//
+// Sinks run on the assembler thread, one after the other. A slow sink
+// delays assembly, so sinks should only queue the frames for a writer.
+//
+class FramesetAssembler
+{
+public:
+	FramesetAssembler(int numCams, int timeoutMs = 200, unsigned int maxPending = 64);
+	~FramesetAssembler();
+
+	void AddSink(std::function<void(Frameset &)> sink);
+
+	void Start();
+	// Emit what is still open and stop the assembler thread
+	void Stop();
+
+	// Called from the capture thread of camNum
+	void Push(int camNum, const CameraFrame &frame);
+	// No more frames from this camera
+	void Finish(int camNum);
+
+	void PrintStatistics();
+
+	uint64_t numFramesets;
+	uint64_t numIncomplete;
+	uint64_t numLate;
+
+private:
+	struct PendingFrameset
+	{
+		Frameset frameset;
+		std::vector<bool> filled;
+		int numFilled;
+		std::chrono::steady_clock::time_point created;
+	};
+
+	struct Input
+	{
+		int camNum;
+		CameraFrame frame;
+	};
+
+	void AssemblerLoop();
+	void File(Input &input);
+	void EmitReady(bool flush);
+	void Emit(PendingFrameset &pending);
+
+	int numCams;
+	int timeoutMs;
+	unsigned int maxPending;
+	std::vector< std::function<void(Frameset &)> > sinks;
+
+	// Shared with the capture threads
+	std::mutex inputMutex;
+	std::condition_variable inputReady;
+	std::deque<Input> input;
+	bool running;
+
+	// Assembler thread only
+	std::map<uint64_t, PendingFrameset> pending;
+	std::vector<uint64_t> nextFrameId;		// per camera: highest frameId seen + 1
+	std::vector<bool> finished;
+	uint64_t nextEmit;
+	std::thread assemblerThread;
+};
+
+#endif
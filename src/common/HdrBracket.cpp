@@ -0,0 +1,416 @@
+#include "HdrBracket.h"
+
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+using namespace cv;
+
+
+// Set an enumeration node to one of its entries. Returns -1 with a message
+// if either is not available.
+static int SetEnumNode(INodeMap & nodeMap, const char *nodeName, const char *entryName)
+{
+	CEnumerationPtr ptrNode = nodeMap.GetNode(nodeName);
+	if (!IsAvailable(ptrNode) || !IsWritable(ptrNode))
+	{
+		cout << "Unable to set " << nodeName << " (node retrieval)" << endl;
+		return -1;
+	}
+
+	CEnumEntryPtr ptrEntry = ptrNode->GetEntryByName(entryName);
+	if (!IsAvailable(ptrEntry) || !IsReadable(ptrEntry))
+	{
+		cout << "Unable to set " << nodeName << " to " << entryName << " (enum entry retrieval)" << endl;
+		return -1;
+	}
+
+	ptrNode->SetIntValue(ptrEntry->GetValue());
+	return 0;
+}
+
+
+// True when the sequencer holds a valid configuration, i.e. it may be on
+static bool SequencerValid(INodeMap & nodeMap)
+{
+	CEnumerationPtr ptrValid = nodeMap.GetNode("SequencerConfigurationValid");
+	if (!IsAvailable(ptrValid) || !IsReadable(ptrValid))
+		return false;
+
+	CEnumEntryPtr ptrValidYes = ptrValid->GetEntryByName("Yes");
+	return IsAvailable(ptrValidYes) && IsReadable(ptrValidYes) &&
+	       ptrValid->GetCurrentEntry()->GetValue() == ptrValidYes->GetValue();
+}
+
+
+// Turn on one chunk; cameras without it still work with a fallback
+static void EnableChunk(INodeMap & nodeMap, const char *chunkName)
+{
+	CEnumerationPtr ptrChunkSelector = nodeMap.GetNode("ChunkSelector");
+	if (!IsAvailable(ptrChunkSelector) || !IsWritable(ptrChunkSelector))
+		return;
+
+	CEnumEntryPtr ptrEntry = ptrChunkSelector->GetEntryByName(chunkName);
+	if (!IsAvailable(ptrEntry) || !IsReadable(ptrEntry))
+	{
+		cout << "Chunk " << chunkName << " not available" << endl;
+		return;
+	}
+	ptrChunkSelector->SetIntValue(ptrEntry->GetValue());
+
+	CBooleanPtr ptrChunkEnable = nodeMap.GetNode("ChunkEnable");
+	if (IsAvailable(ptrChunkEnable) && IsWritable(ptrChunkEnable))
+		ptrChunkEnable->SetValue(true);
+}
+
+
+int ConfigureBracket(INodeMap & nodeMap, const vector<double> &exposures)
+{
+	try
+	{
+		// Sequencer mode can only be turned off when the configuration is
+		// valid; configuration mode needs it off
+		if (SequencerValid(nodeMap) && SetEnumNode(nodeMap, "SequencerMode", "Off") < 0)
+			return -1;
+
+		if (SetEnumNode(nodeMap, "ExposureAuto", "Off") < 0 || SetEnumNode(nodeMap, "GainAuto", "Off") < 0)
+			return -1;
+
+		if (SetEnumNode(nodeMap, "SequencerConfigurationMode", "On") < 0)
+			return -1;
+
+		for (unsigned int i = 0; i < exposures.size(); i++)
+		{
+			CIntegerPtr ptrSetSelector = nodeMap.GetNode("SequencerSetSelector");
+			CFloatPtr ptrExposureTime = nodeMap.GetNode("ExposureTime");
+			CIntegerPtr ptrSetNext = nodeMap.GetNode("SequencerSetNext");
+			CCommandPtr ptrSetSave = nodeMap.GetNode("SequencerSetSave");
+			if (!IsAvailable(ptrSetSelector) || !IsWritable(ptrSetSelector) || !IsAvailable(ptrExposureTime) || !IsWritable(ptrExposureTime)
+				|| !IsAvailable(ptrSetNext) || !IsWritable(ptrSetNext) || !IsAvailable(ptrSetSave) || !IsWritable(ptrSetSave))
+			{
+				cout << "Unable to program sequencer set " << i << ". Aborting..." << endl;
+				return -1;
+			}
+
+			ptrSetSelector->SetValue(i);
+			ptrExposureTime->SetValue(min(exposures[i], ptrExposureTime->GetMax()));
+
+			// Every frame moves on to the next set, the last back to the first
+			if (SetEnumNode(nodeMap, "SequencerTriggerSource", "FrameStart") < 0)
+				return -1;
+			ptrSetNext->SetValue((i + 1) % exposures.size());
+
+			ptrSetSave->Execute();
+		}
+
+		if (SetEnumNode(nodeMap, "SequencerConfigurationMode", "Off") < 0 || SetEnumNode(nodeMap, "SequencerMode", "On") < 0)
+			return -1;
+
+		if (!SequencerValid(nodeMap))
+		{
+			cout << "Sequencer configuration not valid. Aborting..." << endl;
+			return -1;
+		}
+
+		// Frame ID and the set of every frame come with the image
+		CBooleanPtr ptrChunkModeActive = nodeMap.GetNode("ChunkModeActive");
+		if (IsAvailable(ptrChunkModeActive) && IsWritable(ptrChunkModeActive))
+		{
+			ptrChunkModeActive->SetValue(true);
+			EnableChunk(nodeMap, "FrameID");
+			EnableChunk(nodeMap, "ExposureTime");
+			EnableChunk(nodeMap, "SequencerSetActive");
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+
+	cout << "Exposure bracket of " << exposures.size() << " steps programmed" << endl;
+	return 0;
+}
+
+
+int ResetBracket(INodeMap & nodeMap)
+{
+	try
+	{
+		if (SequencerValid(nodeMap))
+			return SetEnumNode(nodeMap, "SequencerMode", "Off");
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+	return 0;
+}
+
+
+int BracketStep(ImagePtr pImage, uint64_t frameId, int numSteps)
+{
+	try
+	{
+		int64_t step = pImage->GetChunkData().GetSequencerSetActive();
+		if (step >= 0 && step < numSteps)
+			return (int)step;
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		// No chunk data; the position in the frame count tells the step
+	}
+	return frameId % numSteps;
+}
+
+
+HdrMerger::HdrMerger(const vector<double> &exposures, int bitDepth, int numThreads, unsigned int maxQueue)
+	: numMerged(0), numIncomplete(0), numDropped(0), numOutOfPhase(0),
+	  exposures(exposures), numThreads(numThreads), maxQueue(maxQueue), nextId(0), running(false)
+{
+	double longest = *max_element(exposures.begin(), exposures.end());
+	double shortest = *min_element(exposures.begin(), exposures.end());
+
+	fullScale = (float)((1 << bitDepth) - 1);
+	outputScale = (float)(65535.0 / (fullScale * longest / shortest));
+
+	for(unsigned int i=0; i<exposures.size(); i++)
+	{
+		factors.push_back((float)(longest / exposures[i]));
+		floors.push_back((float)(1e-3 * shortest / exposures[i]));
+	}
+
+	ClearCurrent();
+}
+
+
+HdrMerger::~HdrMerger()
+{
+	Stop();
+}
+
+
+void HdrMerger::SetSink(function<void(CameraFrame &)> sink)
+{
+	this->sink = sink;
+}
+
+
+void HdrMerger::Start()
+{
+	running = true;
+	mergeThread = thread(&HdrMerger::MergeLoop, this);
+}
+
+
+void HdrMerger::Stop()
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		if(!running)
+			return;
+	}
+	QueueCurrent();
+	{
+		lock_guard<mutex> lock(queueMutex);
+		running = false;
+	}
+	queueReady.notify_all();
+	mergeThread.join();
+}
+
+
+void HdrMerger::QueueCurrent()
+{
+	if(current.numFrames == 0)
+		return;
+
+	if(current.numFrames < (int)exposures.size())
+		numIncomplete++;
+
+	{
+		lock_guard<mutex> lock(queueMutex);
+		if(queue.size() >= maxQueue)
+		{
+			// The oldest bracket not dropped yet keeps its place, so the
+			// merge thread emits it as missing
+			for(unsigned int i=0; i<queue.size(); i++)
+			{
+				if(!queue[i].frames.empty())
+				{
+					queue[i].frames.clear();
+					numDropped++;
+					break;
+				}
+			}
+		}
+		queue.push_back(current);
+	}
+	queueReady.notify_one();
+
+	ClearCurrent();
+}
+
+
+void HdrMerger::ClearCurrent()
+{
+	current.numFrames = 0;
+	current.frames.assign(exposures.size(), Mat());
+}
+
+
+void HdrMerger::Push(const CameraFrame &frame, int step)
+{
+	int numSteps = exposures.size();
+
+	// The frame IDs of the open bracket have passed
+	if(current.numFrames > 0 && frame.frameId >= current.firstFrameId + numSteps)
+		QueueCurrent();
+
+	if(frame.missing || step < 0 || step >= numSteps)
+		return;
+
+	// Dropped frames advance the sequencer as well
+	if(current.numFrames > 0)
+	{
+		uint64_t expected = (current.lastStep + (frame.frameId - current.lastFrameId)) % numSteps;
+		if(frame.frameId <= current.lastFrameId || (uint64_t)step != expected)
+		{
+			// The sequencer started again: its steps so far belong to
+			// another cycle
+			numOutOfPhase += current.numFrames;
+			ClearCurrent();
+		}
+	}
+
+	if(step == 0)
+	{
+		QueueCurrent();
+		current.id = max(frame.frameId / numSteps, nextId);
+		current.rigTime = frame.rigTime;
+		current.firstFrameId = frame.frameId;
+		nextId = current.id + 1;
+	}
+	else if(current.numFrames == 0)
+	{
+		// Waiting for the start of a bracket
+		numOutOfPhase++;
+		return;
+	}
+
+	if(current.frames[step].empty())
+		current.numFrames++;
+	current.frames[step] = frame.img;
+	current.lastStep = step;
+	current.lastFrameId = frame.frameId;
+
+	if(current.numFrames == numSteps)
+		QueueCurrent();
+}
+
+
+// Accumulate one step of a row: hat weight plus floor, value scaled to the
+// longest exposure
+template <typename T>
+static void AccumulateRow(const T *src, float *weightSum, float *valueSum, int width,
+                          float fullScale, float factor, float floor)
+{
+	const float halfScale = fullScale * 0.5f;
+	const float invHalf = 1.0f / halfScale;
+
+	#pragma omp simd
+	for(int x=0; x<width; x++)
+	{
+		float v = src[x];
+		float w = (halfScale - fabsf(v - halfScale)) * invHalf + floor;
+		weightSum[x] += w;
+		valueSum[x] += w * v * factor;
+	}
+}
+
+
+void HdrMerger::Merge(const vector<Mat> &frames, Mat &radiance)
+{
+	int first = -1;
+	for(unsigned int i=0; i<frames.size() && first < 0; i++)
+	{
+		if(!frames[i].empty())
+			first = i;
+	}
+	if(first < 0)
+		return;
+
+	int width = frames[first].cols, height = frames[first].rows;
+	bool wide = (frames[first].depth() == CV_16U);
+	radiance.create(height, width, CV_16UC1);
+
+	#pragma omp parallel num_threads(numThreads) if(numThreads > 1)
+	{
+		vector<float> weightSum(width), valueSum(width);
+
+		#pragma omp for
+		for(int y=0; y<height; y++)
+		{
+			fill(weightSum.begin(), weightSum.end(), 0.0f);
+			fill(valueSum.begin(), valueSum.end(), 0.0f);
+
+			for(unsigned int i=0; i<frames.size(); i++)
+			{
+				if(frames[i].empty() || frames[i].rows != height || frames[i].cols != width)
+					continue;
+				if(wide)
+					AccumulateRow(frames[i].ptr<uint16_t>(y), &weightSum[0], &valueSum[0], width, fullScale, factors[i], floors[i]);
+				else
+					AccumulateRow(frames[i].ptr<uint8_t>(y), &weightSum[0], &valueSum[0], width, fullScale, factors[i], floors[i]);
+			}
+
+			uint16_t *dst = radiance.ptr<uint16_t>(y);
+			#pragma omp simd
+			for(int x=0; x<width; x++)
+				dst[x] = (uint16_t)min(valueSum[x] / weightSum[x] * outputScale + 0.5f, 65535.0f);
+		}
+	}
+}
+
+
+void HdrMerger::MergeLoop()
+{
+	unique_lock<mutex> lock(queueMutex);
+	while(true)
+	{
+		queueReady.wait(lock, [this] { return !queue.empty() || !running; });
+		if(queue.empty())
+			break;
+
+		Bracket bracket = queue.front();
+		queue.pop_front();
+		lock.unlock();
+
+		CameraFrame frame;
+		frame.frameId = bracket.id;
+		frame.rigTime = bracket.rigTime;
+		frame.missing = bracket.frames.empty();
+		if(!frame.missing)
+		{
+			Merge(bracket.frames, frame.img);
+			numMerged++;
+		}
+
+		if(sink)
+			sink(frame);
+
+		lock.lock();
+	}
+}
+
+
+void HdrMerger::PrintStatistics(int camNum)
+{
+	cout << "Camera " << camNum << " HDR: " << numMerged << " merged, " << numIncomplete << " incomplete, "
+		 << numDropped << " dropped, " << numOutOfPhase << " frames out of phase" << endl;
+}
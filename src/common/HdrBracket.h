@@ -0,0 +1,135 @@
+#ifndef HDR_BRACKET_H
+#define HDR_BRACKET_H
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+#include "FramesetAssembler.h"
+
+
+//
+// Exposure bracketing with the camera sequencer (see src/Sequencer).
+//
+// *** NOTES ***
+// ConfigureBracket() programs one sequencer set per exposure, each
+// advancing to the next on FrameStart and the last back to the first, and
+// turns on the FrameID, ExposureTime and SequencerSetActive chunks. All
+// cameras start in set 0 with acquisition, so with a common trigger every
+// camera runs the same step of the bracket on the same frame.
+//
+// The camera must not be acquiring. ExposureAuto and GainAuto are turned
+// off. ResetBracket() turns the sequencer off again.
+//
+int ConfigureBracket(Spinnaker::GenApi::INodeMap & nodeMap, const std::vector<double> &exposures);
+int ResetBracket(Spinnaker::GenApi::INodeMap & nodeMap);
+
+// Step of the bracket a frame was taken with: the SequencerSetActive chunk,
+// or frameId modulo the bracket length when the camera does not send it
+int BracketStep(Spinnaker::ImagePtr pImage, uint64_t frameId, int numSteps);
+
+
+//
+// Fuses the frames of one camera's brackets into 16-bit radiance images.
+//
+// *** NOTES ***
+// Frames are grouped by the sequencer set they were taken with (see
+// BracketStep): a frame of step 0 opens a bracket and the following steps
+// join it. frameId is the chunk frame ID, so a dropped frame leaves a gap
+// instead of shifting the steps after it. A bracket is queued when all its
+// steps arrived, or with the steps it has once its frame IDs have passed.
+//
+// After a re-arm or a rejoin the sequencer starts again at set 0, at any
+// frame ID. A step other than the one its frame ID predicts from the step
+// before means the sequence broke: the partial bracket is dropped, and
+// frames are dropped until the next step 0, so no bracket mixes exposures
+// of two cycles. These frames are counted as out of phase. Brackets are
+// numbered by the frame ID of their first frame / bracket length, and
+// always increase.
+//
+// A merge thread per camera fuses the queued brackets in order and hands
+// them to the sink as CameraFrames numbered by bracket, so the assembler
+// builds HDR framesets at the capture rate divided by the bracket length.
+// Rows are split across numThreads OpenMP threads. When more than maxQueue
+// brackets wait, the oldest is dropped and emitted as missing.
+//
+// Merge: every pixel is the weighted mean of value * (longest / exposure)
+// over the steps, with a hat weight that is 0 at black and at full scale,
+// plus a small floor favouring the shorter exposures so pixels saturated
+// in every step still come out at their brightest. The result is scaled
+// so the full scale of the shortest exposure maps to 65535.
+//
+class HdrMerger
+{
+public:
+	// exposures in us, in sequencer set order; bitDepth of the input frames
+	HdrMerger(const std::vector<double> &exposures, int bitDepth, int numThreads = 1, unsigned int maxQueue = 8);
+	~HdrMerger();
+
+	void SetSink(std::function<void(CameraFrame &)> sink);
+
+	void Start();
+	// Queue the bracket still being collected, merge everything queued and
+	// stop the merge thread
+	void Stop();
+
+	// Called from the capture thread of the camera
+	void Push(const CameraFrame &frame, int step);
+
+	// One bracket, frames in step order (empty Mats for absent steps),
+	// CV_8UC1 or CV_16UC1; radiance is CV_16UC1
+	void Merge(const std::vector<cv::Mat> &frames, cv::Mat &radiance);
+
+	void PrintStatistics(int camNum);
+
+	uint64_t numMerged;
+	uint64_t numIncomplete;
+	uint64_t numDropped;
+	uint64_t numOutOfPhase;
+
+private:
+	struct Bracket
+	{
+		uint64_t id;
+		uint64_t rigTime;
+		std::vector<cv::Mat> frames;
+		int numFrames;
+		uint64_t firstFrameId;		// of step 0
+		uint64_t lastFrameId;		// and step of the last frame
+		int lastStep;
+	};
+
+	void QueueCurrent();
+	void ClearCurrent();
+	void MergeLoop();
+
+	std::vector<double> exposures;
+	std::vector<float> factors;		// longest / exposure
+	std::vector<float> floors;		// weight floor per step
+	float fullScale;
+	float outputScale;
+	int numThreads;
+	unsigned int maxQueue;
+	std::function<void(CameraFrame &)> sink;
+
+	// Capture thread only
+	Bracket current;
+	uint64_t nextId;
+
+	std::mutex queueMutex;
+	std::condition_variable queueReady;
+	std::deque<Bracket> queue;
+	bool running;
+	std::thread mergeThread;
+};
+
+#endif
@@ -0,0 +1,295 @@
+#include "HotPlug.h"
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+
+
+int CameraConfigCache::Capture(INodeMap & nodeMap, const vector<string> &nodeNames)
+{
+	values.clear();
+
+	try
+	{
+		for (unsigned int i = 0; i < nodeNames.size(); i++)
+		{
+			CValuePtr ptrValue = nodeMap.GetNode(nodeNames[i].c_str());
+			if (!IsAvailable(ptrValue) || !IsReadable(ptrValue))
+			{
+				cout << "Unable to read " << nodeNames[i] << " for the configuration cache" << endl;
+				continue;
+			}
+			// With the frame rate limit off the rate follows from exposure
+			// and ROI; it cannot be written back
+			if (nodeNames[i] == "AcquisitionFrameRate" && !IsWritable(ptrValue))
+				continue;
+			values.push_back(make_pair(nodeNames[i], string(ptrValue->ToString().c_str())));
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int CameraConfigCache::Apply(INodeMap & nodeMap)
+{
+	int result = 0;
+
+	try
+	{
+		CEnumerationPtr ptrTriggerMode = nodeMap.GetNode("TriggerMode");
+		if (IsAvailable(ptrTriggerMode) && IsWritable(ptrTriggerMode))
+			ptrTriggerMode->FromString("Off");
+
+		for (unsigned int i = 0; i < values.size(); i++)
+		{
+			CValuePtr ptrValue = nodeMap.GetNode(values[i].first.c_str());
+			if (!IsAvailable(ptrValue) || !IsWritable(ptrValue))
+			{
+				cout << "Unable to restore " << values[i].first << endl;
+				result = -1;
+				continue;
+			}
+			ptrValue->FromString(values[i].second.c_str());
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		result = -1;
+	}
+
+	return result;
+}
+
+
+HotPlugMonitor::HotPlugMonitor(SystemPtr system, vector<CameraPtr> cameras)
+	: system(system), cameras(cameras), configCache(cameras.size()),
+	  present(new atomic<bool>[cameras.size()]), numRejoins(0),
+	  arrivalPending(false), running(false)
+{
+	// Everything ConfigureCamera() and ConfigureTrigger() set. Image format
+	// first: the ROI limits depend on it.
+	configNodes.push_back("PixelFormat");
+	configNodes.push_back("Width");
+	configNodes.push_back("Height");
+	configNodes.push_back("OffsetX");
+	configNodes.push_back("OffsetY");
+	configNodes.push_back("AcquisitionMode");
+	configNodes.push_back("ExposureAuto");
+	configNodes.push_back("ExposureTime");
+	// After exposure and ROI, which limit the rate; the enable first, the
+	// rate is only writable with it on
+	configNodes.push_back("AcquisitionFrameRateEnable");
+	configNodes.push_back("AcquisitionFrameRate");
+	configNodes.push_back("TriggerSelector");
+	configNodes.push_back("TriggerSource");
+	configNodes.push_back("TriggerOverlap");
+	configNodes.push_back("TriggerMode");
+
+	for (unsigned int i = 0; i < cameras.size(); i++)
+	{
+		serials.push_back(string(cameras[i]->GetUniqueID().c_str()));
+		present[i] = true;
+	}
+}
+
+
+HotPlugMonitor::~HotPlugMonitor()
+{
+	Stop();
+}
+
+
+int HotPlugMonitor::CacheConfiguration()
+{
+	int result = 0;
+	for (unsigned int i = 0; i < cameras.size(); i++)
+		result = result | configCache[i].Capture(cameras[i]->GetNodeMap(), configNodes);
+	return result;
+}
+
+
+void HotPlugMonitor::Start()
+{
+	running = true;
+	workerThread = thread(&HotPlugMonitor::Worker, this);
+
+	try
+	{
+		system->RegisterInterfaceEvent(*this);
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Unable to register for camera arrival and removal. Error: " << e.what() << endl;
+	}
+}
+
+
+void HotPlugMonitor::Stop()
+{
+	{
+		lock_guard<mutex> lock(cameraMutex);
+		if (!running)
+			return;
+		running = false;
+	}
+
+	try
+	{
+		system->UnregisterInterfaceEvent(*this);
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+	}
+
+	arrival.notify_all();
+	workerThread.join();
+}
+
+
+CameraPtr HotPlugMonitor::GetCamera(int camNum)
+{
+	lock_guard<mutex> lock(cameraMutex);
+	return cameras[camNum];
+}
+
+
+void HotPlugMonitor::OnDeviceRemoval(uint64_t serialNumber)
+{
+	for (unsigned int i = 0; i < serials.size(); i++)
+	{
+		if (strtoull(serials[i].c_str(), NULL, 10) != serialNumber || !present[i])
+			continue;
+
+		cout << "Camera " << i << " SerialNum:" << serials[i] << " removed. Quarantined." << endl;
+		present[i] = false;
+		if (onRemoval)
+			onRemoval(i);
+	}
+}
+
+
+void HotPlugMonitor::OnDeviceArrival()
+{
+	{
+		lock_guard<mutex> lock(cameraMutex);
+		arrivalPending = true;
+	}
+	arrival.notify_all();
+}
+
+
+void HotPlugMonitor::Worker()
+{
+	unique_lock<mutex> lock(cameraMutex);
+	while (running)
+	{
+		// Poll as well, enumeration may not be complete when the event fires
+		arrival.wait_for(lock, chrono::milliseconds(1000));
+		if (!running)
+			break;
+
+		bool missing = false;
+		for (unsigned int i = 0; i < serials.size(); i++)
+			missing = missing || !present[i];
+		if (!arrivalPending && !missing)
+			continue;
+		arrivalPending = false;
+		lock.unlock();
+
+		try
+		{
+			system->UpdateCameras();
+			CameraList camList = system->GetCameras();
+
+			for (unsigned int i = 0; i < serials.size(); i++)
+			{
+				if (present[i])
+					continue;
+
+				CameraPtr pCam = camList.GetBySerial(serials[i]);
+				if (!pCam.IsValid())
+					continue;
+
+				Rejoin(i, pCam);
+			}
+			camList.Clear();
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			cout << "Error: " << e.what() << endl;
+		}
+
+		lock.lock();
+	}
+}
+
+
+int HotPlugMonitor::Rejoin(int camNum, CameraPtr pCam)
+{
+	if (configCache[camNum].IsEmpty())
+	{
+		cout << "Camera " << camNum << ": no cached configuration. Unable to rejoin." << endl;
+		return -1;
+	}
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+	try
+	{
+		// Release the handle of the removed device
+		CameraPtr pOldCam = GetCamera(camNum);
+		try
+		{
+			if (pOldCam->IsInitialized())
+				pOldCam->DeInit();
+		}
+		catch (Spinnaker::Exception &e)
+		{
+		}
+
+		pCam->Init();
+		if (configCache[camNum].Apply(pCam->GetNodeMap()) < 0)
+		{
+			cout << "Camera " << camNum << ": unable to restore configuration" << endl;
+			pCam->DeInit();
+			return -1;
+		}
+		if (onConfigured)
+			onConfigured(camNum, pCam);
+		pCam->BeginAcquisition();
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Camera " << camNum << ": rejoin failed. Error: " << e.what() << endl;
+		return -1;
+	}
+
+	{
+		lock_guard<mutex> lock(cameraMutex);
+		cameras[camNum] = pCam;
+	}
+
+	if (onRejoin)
+		onRejoin(camNum, pCam);
+
+	present[camNum] = true;
+	numRejoins++;
+
+	double elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	cout << "Camera " << camNum << " SerialNum:" << serials[camNum] << " rejoined in " << elapsedMs << " ms" << endl;
+
+	return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef HOT_PLUG_H
+#define HOT_PLUG_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+
+//
+// Values of a list of camera nodes, read once from a configured camera and
+// written back to a camera that comes back after being unplugged.
+//
+// *** NOTES ***
+// Values are stored as strings (ToString / FromString), so any node type
+// works. Apply() writes the nodes in the order of Capture(); the trigger
+// is switched off first because TriggerSource and TriggerSelector are only
+// writable while TriggerMode is Off.
+//
+class CameraConfigCache
+{
+public:
+	int Capture(Spinnaker::GenApi::INodeMap & nodeMap, const std::vector<std::string> &nodeNames);
+	int Apply(Spinnaker::GenApi::INodeMap & nodeMap);
+
+	bool IsEmpty() { return values.empty(); }
+
+private:
+	std::vector< std::pair<std::string, std::string> > values;
+};
+
+
+//
+// Keeps a capture session running while cameras are unplugged and plugged
+// back in.
+//
+// *** NOTES ***
+// Registered on the system for ArrivalEvent and RemovalEvent.
+//
+// Removal: the camera is marked as not present and onRemoval is called so
+// the session can quarantine its pipeline (stop grabbing from it, mark its
+// frameset slots as missing). The other cameras are not touched.
+//
+// Arrival: the event callback only wakes the worker thread. The worker
+// looks up every missing camera by serial number, initializes it, writes
+// the cached configuration and calls onConfigured, so the session can
+// re-sync the clock and set up what the cache does not hold before the
+// camera acquires. It then begins acquisition and calls onRejoin with the
+// new CameraPtr so the session can resume the pipeline. Only then is the
+// camera marked as present again.
+//
+// Call CacheConfiguration() after the cameras are configured and before
+// Start(). A camera without a cached configuration cannot rejoin.
+//
+// With hardware triggering the secondary cameras get no triggers while the
+// primary camera is away; they recover once it has rejoined.
+//
+class HotPlugMonitor : public Spinnaker::InterfaceEvent
+{
+public:
+	HotPlugMonitor(Spinnaker::SystemPtr system, std::vector<Spinnaker::CameraPtr> cameras);
+	~HotPlugMonitor();
+
+	// Nodes cached for rejoin, in the order they are written back
+	std::vector<std::string> configNodes;
+
+	int CacheConfiguration();
+
+	void Start();
+	void Stop();
+
+	bool IsPresent(int camNum) { return present[camNum]; }
+	Spinnaker::CameraPtr GetCamera(int camNum);
+	int GetNumRejoins() { return numRejoins; }
+
+	// Called from the SDK event thread when a camera goes away
+	std::function<void(int camNum)> onRemoval;
+	// Called from the worker thread once a camera that came back is
+	// configured, before it begins acquisition
+	std::function<void(int camNum, Spinnaker::CameraPtr pCam)> onConfigured;
+	// Called from the worker thread once a camera streams again
+	std::function<void(int camNum, Spinnaker::CameraPtr pCam)> onRejoin;
+
+	void OnDeviceArrival();
+	void OnDeviceRemoval(uint64_t serialNumber);
+
+private:
+	void Worker();
+	int Rejoin(int camNum, Spinnaker::CameraPtr pCam);
+
+	Spinnaker::SystemPtr system;
+	std::vector<Spinnaker::CameraPtr> cameras;
+	std::vector<std::string> serials;
+	std::vector<CameraConfigCache> configCache;
+	std::unique_ptr< std::atomic<bool>[] > present;
+	std::atomic<int> numRejoins;
+
+	std::mutex cameraMutex;
+	std::condition_variable arrival;
+	bool arrivalPending;
+	bool running;
+	std::thread workerThread;
+};
+
+#endif
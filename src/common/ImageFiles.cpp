@@ -0,0 +1,61 @@
+#include "ImageFiles.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+
+using namespace std;
+
+
+// Frame number of a file name, "12.jpg" -> 12; -1 if the stem is not a
+// number
+static long FrameNumber(const string &name)
+{
+	char *end;
+	long number = strtol(name.c_str(), &end, 10);
+	if(end == name.c_str() || *end != '.' || number < 0)
+		return -1;
+	return number;
+}
+
+
+static bool FrameOrder(const string &a, const string &b)
+{
+	long na = FrameNumber(a), nb = FrameNumber(b);
+	if(na >= 0 && nb >= 0 && na != nb)
+		return na < nb;
+	if((na >= 0) != (nb >= 0))
+		return na >= 0;
+	return a < b;
+}
+
+
+vector<string> FindImages(const string &dir)
+{
+	vector<string> names;
+
+	DIR *d = opendir(dir.c_str());
+	if(d == NULL)
+	{
+		cout << "Unable to open " << dir << endl;
+		return names;
+	}
+
+	struct dirent *entry;
+	while((entry = readdir(d)) != NULL)
+	{
+		string name = entry->d_name;
+		size_t dot = name.rfind('.');
+		if(dot == string::npos || dot == 0)
+			continue;
+
+		string kind = name.substr(dot + 1);
+		if(kind == "jpg" || kind == "png" || kind == "pgm" || kind == "tif" || kind == "tiff")
+			names.push_back(name);
+	}
+	closedir(d);
+
+	sort(names.begin(), names.end(), FrameOrder);
+	return names;
+}
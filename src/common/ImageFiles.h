@@ -0,0 +1,22 @@
+#ifndef IMAGE_FILES_H
+#define IMAGE_FILES_H
+
+#include <string>
+#include <vector>
+
+
+//
+// Image files of a recorded directory, for the tools that replay or
+// measure recordings (GateReplay, CodecBench).
+//
+// *** NOTES ***
+// Files ending in .jpg, .png, .pgm, .tif or .tiff are listed by name,
+// without the directory. They come in frame order: MultiCamSHM writes
+// %d.jpg without leading zeros, so numbered files are sorted by number
+// (2.jpg before 10.jpg) and other names follow them, sorted by name.
+//
+
+// Image files of dir; empty if there are none or dir cannot be read
+std::vector<std::string> FindImages(const std::string &dir);
+
+#endif
@@ -0,0 +1,370 @@
+#include "MJPEGServer.h"
+
+#include <iostream>
+#include <sstream>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+
+// Seconds a client may block a send before it is dropped
+const int clientSendTimeout = 2;
+
+
+MJPEGServer::MJPEGServer(int port, const string &bindAddress)
+	: maxFps(10), maxSize(640, 512), quality(75),
+	  port(port), bindAddress(bindAddress), listenFd(-1), running(false)
+{
+}
+
+
+MJPEGServer::~MJPEGServer()
+{
+	Stop();
+}
+
+
+int MJPEGServer::AddStream(const string &name)
+{
+	Stream s;
+	s.name = name;
+	s.hasPending = false;
+	s.seq = 0;
+	s.numClients = 0;
+	streams.push_back(s);
+
+	return streams.size() - 1;
+}
+
+
+int MJPEGServer::Start()
+{
+	listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	if(listenFd < 0)
+	{
+		cout << "Preview server: unable to create socket" << endl;
+		return -1;
+	}
+
+	int reuse = 1;
+	setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if(inet_pton(AF_INET, bindAddress.c_str(), &addr.sin_addr) != 1)
+	{
+		cout << "Preview server: invalid bind address " << bindAddress << endl;
+		close(listenFd);
+		listenFd = -1;
+		return -1;
+	}
+
+	if(bind(listenFd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenFd, 8) < 0)
+	{
+		cout << "Preview server: unable to listen on " << bindAddress << ":" << port << endl;
+		close(listenFd);
+		listenFd = -1;
+		return -1;
+	}
+
+	running = true;
+	encodeThread = thread(&MJPEGServer::EncodeLoop, this);
+	acceptThread = thread(&MJPEGServer::AcceptLoop, this);
+
+	cout << "Preview server running at http://" << bindAddress << ":" << port << "/" << endl;
+	return 0;
+}
+
+
+void MJPEGServer::Stop()
+{
+	{
+		lock_guard<mutex> lock(streamMutex);
+		if(!running)
+			return;
+		running = false;
+
+		// Wake up client threads blocked in send()
+		for(unsigned int i=0; i<clientFds.size(); i++)
+			shutdown(clientFds[i], SHUT_RDWR);
+	}
+	framePending.notify_all();
+	frameEncoded.notify_all();
+
+	// Unblock accept()
+	shutdown(listenFd, SHUT_RDWR);
+	close(listenFd);
+	listenFd = -1;
+
+	acceptThread.join();
+	encodeThread.join();
+	for(unsigned int i=0; i<clientThreads.size(); i++)
+		clientThreads[i].join();
+	clientThreads.clear();
+	finishedClients.clear();
+}
+
+
+void MJPEGServer::PushFrame(int streamId, const Mat &img)
+{
+	Stream &s = streams[streamId];
+	chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+	{
+		lock_guard<mutex> lock(streamMutex);
+		if(!running || s.numClients == 0)
+			return;
+		if(now - s.lastPush < chrono::duration<double>(1.0/maxFps))
+			return;
+		s.lastPush = now;
+	}
+
+	// Scale down to the preview size, keeping the aspect ratio
+	Mat preview;
+	double scale = min((double)maxSize.width/img.cols, (double)maxSize.height/img.rows);
+	if(scale < 1.0)
+		resize(img, preview, Size(img.cols*scale, img.rows*scale), 0, 0, INTER_AREA);
+	else
+		preview = img.clone();
+
+	{
+		lock_guard<mutex> lock(streamMutex);
+		s.pending = preview;
+		s.hasPending = true;
+	}
+	framePending.notify_one();
+}
+
+
+int MJPEGServer::GetNumClients()
+{
+	lock_guard<mutex> lock(streamMutex);
+	int numClients = 0;
+	for(unsigned int i=0; i<streams.size(); i++)
+		numClients += streams[i].numClients;
+	return numClients;
+}
+
+
+// Encode pending frames. Each frame is encoded once and shared by all
+// clients of the stream.
+void MJPEGServer::EncodeLoop()
+{
+	vector<int> params;
+	params.push_back(IMWRITE_JPEG_QUALITY);
+	params.push_back(quality);
+
+	unique_lock<mutex> lock(streamMutex);
+	while(running)
+	{
+		bool encoded = false;
+
+		for(unsigned int i=0; i<streams.size(); i++)
+		{
+			if(!streams[i].hasPending)
+				continue;
+
+			Mat img = streams[i].pending;
+			streams[i].pending = Mat();
+			streams[i].hasPending = false;
+
+			lock.unlock();
+			shared_ptr< vector<unsigned char> > jpeg(new vector<unsigned char>);
+			imencode(".jpg", img, *jpeg, params);
+			lock.lock();
+
+			streams[i].jpeg = jpeg;
+			streams[i].seq++;
+			encoded = true;
+		}
+
+		if(encoded)
+			frameEncoded.notify_all();
+		else
+			framePending.wait(lock);
+	}
+}
+
+
+void MJPEGServer::AcceptLoop()
+{
+	while(true)
+	{
+		int clientFd = accept(listenFd, NULL, NULL);
+		if(clientFd < 0)
+			break;
+
+		timeval tv;
+		tv.tv_sec = clientSendTimeout;
+		tv.tv_usec = 0;
+		setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+		lock_guard<mutex> lock(streamMutex);
+		if(!running)
+		{
+			close(clientFd);
+			break;
+		}
+		ReapClients();
+		clientFds.push_back(clientFd);
+		clientThreads.push_back(thread(&MJPEGServer::ClientLoop, this, clientFd));
+	}
+}
+
+
+// Join the client threads that have finished, so a long running server
+// does not keep one per connection it ever had. Called with streamMutex
+// held; a finished thread no longer takes it.
+void MJPEGServer::ReapClients()
+{
+	for(unsigned int i=0; i<finishedClients.size(); i++)
+	{
+		for(unsigned int j=0; j<clientThreads.size(); j++)
+		{
+			if(clientThreads[j].get_id() == finishedClients[i])
+			{
+				clientThreads[j].join();
+				clientThreads.erase(clientThreads.begin() + j);
+				break;
+			}
+		}
+	}
+	finishedClients.clear();
+}
+
+
+// Send the whole buffer, returns false if the client went away or stalled.
+// AcceptLoop() sets SO_SNDTIMEO on every client socket, so a client that
+// does not read for clientSendTimeout seconds fails send() here and its
+// thread drops it.
+static bool SendAll(int fd, const void *data, size_t len)
+{
+	const char *p = (const char*)data;
+	while(len > 0)
+	{
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+		if(n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+
+int MJPEGServer::FindStream(const string &path)
+{
+	for(unsigned int i=0; i<streams.size(); i++)
+	{
+		if(path == "/" + streams[i].name)
+			return i;
+	}
+	return -1;
+}
+
+
+void MJPEGServer::SendIndex(int clientFd)
+{
+	stringstream body;
+	body << "<html><body>";
+	for(unsigned int i=0; i<streams.size(); i++)
+		body << "<div><p>" << streams[i].name << "</p><img src=\"/" << streams[i].name << "\"></div>";
+	body << "</body></html>";
+
+	stringstream header;
+	header << "HTTP/1.0 200 OK\r\nContent-Type: text/html\r\nContent-Length: "
+		   << body.str().size() << "\r\nConnection: close\r\n\r\n";
+
+	SendAll(clientFd, header.str().data(), header.str().size());
+	SendAll(clientFd, body.str().data(), body.str().size());
+}
+
+
+void MJPEGServer::ClientLoop(int clientFd)
+{
+	// Read the request line, e.g. "GET /composite HTTP/1.1"
+	char request[1024];
+	ssize_t n = recv(clientFd, request, sizeof(request) - 1, 0);
+	string path;
+	if(n > 0)
+	{
+		request[n] = 0;
+		stringstream ss(request);
+		string method;
+		ss >> method >> path;
+	}
+
+	int streamId = FindStream(path);
+
+	if(path == "/")
+	{
+		SendIndex(clientFd);
+	}
+	else if(streamId < 0)
+	{
+		const char *notFound = "HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n";
+		SendAll(clientFd, notFound, strlen(notFound));
+	}
+	else
+	{
+		const char *header = "HTTP/1.0 200 OK\r\n"
+							 "Cache-Control: no-cache\r\n"
+							 "Connection: close\r\n"
+							 "Content-Type: multipart/x-mixed-replace; boundary=frame\r\n\r\n";
+		bool ok = SendAll(clientFd, header, strlen(header));
+
+		unique_lock<mutex> lock(streamMutex);
+		Stream &s = streams[streamId];
+		s.numClients++;
+		unsigned long lastSeq = s.seq;
+
+		while(ok && running)
+		{
+			if(s.seq == lastSeq)
+			{
+				frameEncoded.wait(lock);
+				continue;
+			}
+
+			// Take the newest frame; frames encoded while we were sending are skipped
+			shared_ptr< const vector<unsigned char> > jpeg = s.jpeg;
+			lastSeq = s.seq;
+			lock.unlock();
+
+			stringstream part;
+			part << "--frame\r\nContent-Type: image/jpeg\r\nContent-Length: " << jpeg->size() << "\r\n\r\n";
+			ok = SendAll(clientFd, part.str().data(), part.str().size())
+				 && SendAll(clientFd, jpeg->data(), jpeg->size())
+				 && SendAll(clientFd, "\r\n", 2);
+
+			lock.lock();
+		}
+		s.numClients--;
+	}
+
+	lock_guard<mutex> lock(streamMutex);
+	for(unsigned int i=0; i<clientFds.size(); i++)
+	{
+		if(clientFds[i] == clientFd)
+		{
+			clientFds.erase(clientFds.begin() + i);
+			break;
+		}
+	}
+	close(clientFd);
+	finishedClients.push_back(this_thread::get_id());
+}
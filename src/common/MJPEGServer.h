@@ -0,0 +1,89 @@
+#ifndef MJPEG_SERVER_H
+#define MJPEG_SERVER_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <chrono>
+
+#include <opencv2/core/core.hpp>
+
+
+//
+// Small HTTP server that serves live previews as MJPEG streams
+// (multipart/x-mixed-replace), so capture hosts can run without X11.
+//
+// Every stream is opened in a browser at http://<host>:<port>/<name>. The
+// index page at http://<host>:<port>/ shows all streams.
+//
+// *** NOTES ***
+// PushFrame() is called from the capture loop and only keeps the newest
+// frame, at most maxFps times per second and only if someone is watching.
+// A single encoder thread encodes each frame once, however many clients
+// are connected. Each client has its own thread that always sends the
+// newest encoded frame, so a slow browser only skips frames and never
+// slows down capture or the other clients.
+//
+class MJPEGServer
+{
+public:
+	MJPEGServer(int port, const std::string &bindAddress = "127.0.0.1");
+	~MJPEGServer();
+
+	// Register a stream. Must be called before Start(). Returns stream id.
+	int AddStream(const std::string &name);
+
+	// Open the listening socket and start serving. Returns -1 on error.
+	int Start();
+	void Stop();
+
+	// Hand a new frame to a stream. Cheap when the frame is not needed.
+	void PushFrame(int streamId, const cv::Mat &img);
+
+	int GetNumClients();
+
+	// Preview settings
+	double maxFps;
+	cv::Size maxSize;
+	int quality;
+
+private:
+	struct Stream
+	{
+		std::string name;
+		cv::Mat pending;
+		bool hasPending;
+		std::chrono::steady_clock::time_point lastPush;
+		std::shared_ptr< const std::vector<unsigned char> > jpeg;
+		unsigned long seq;
+		int numClients;
+	};
+
+	void AcceptLoop();
+	void EncodeLoop();
+	void ClientLoop(int clientFd);
+	void ReapClients();
+	int FindStream(const std::string &path);
+	void SendIndex(int clientFd);
+
+	int port;
+	std::string bindAddress;
+	int listenFd;
+	bool running;
+
+	std::vector<Stream> streams;
+	std::mutex streamMutex;
+	std::condition_variable frameEncoded;
+	std::condition_variable framePending;
+
+	std::thread acceptThread;
+	std::thread encodeThread;
+	std::vector<std::thread> clientThreads;
+	std::vector<std::thread::id> finishedClients;	// not joined yet
+	std::vector<int> clientFds;
+};
+
+#endif
@@ -0,0 +1,238 @@
+#include "MotionGate.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+
+void MakeThumbnail(const Mat &img, int bitDepth, vector<uint8_t> &thumbnail, int &thumbWidth, int &thumbHeight)
+{
+	thumbWidth = img.cols / 8;
+	thumbHeight = img.rows / 8;
+	thumbnail.resize((size_t)thumbWidth * thumbHeight);
+
+	bool wide = (img.depth() == CV_16U);
+	int shift = 6 + (wide ? max(bitDepth - 8, 0) : 0);
+
+	for(int ty=0; ty<thumbHeight; ty++)
+	{
+		uint8_t *dst = &thumbnail[(size_t)ty * thumbWidth];
+		int bx = 0;
+
+		if(!wide)
+		{
+#ifdef __SSE2__
+			// psadbw against zero sums each 8 byte half, i.e. two blocks of
+			// a row at once; eight rows make the two block sums
+			const __m128i zero = _mm_setzero_si128();
+			for(; bx+2<=thumbWidth; bx+=2)
+			{
+				__m128i acc = zero;
+				for(int r=0; r<8; r++)
+				{
+					const uint8_t *row = img.ptr<uint8_t>(ty * 8 + r) + bx * 8;
+					acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)row), zero));
+				}
+				uint64_t sums[2];
+				_mm_storeu_si128((__m128i *)sums, acc);
+				dst[bx] = (uint8_t)((sums[0] + 32) >> 6);
+				dst[bx + 1] = (uint8_t)((sums[1] + 32) >> 6);
+			}
+#endif
+			for(; bx<thumbWidth; bx++)
+			{
+				uint32_t sum = 0;
+				for(int r=0; r<8; r++)
+				{
+					const uint8_t *row = img.ptr<uint8_t>(ty * 8 + r) + bx * 8;
+					for(int x=0; x<8; x++)
+						sum += row[x];
+				}
+				dst[bx] = (uint8_t)((sum + 32) >> 6);
+			}
+		}
+		else
+		{
+			for(; bx<thumbWidth; bx++)
+			{
+				uint32_t sum = 0;
+				for(int r=0; r<8; r++)
+				{
+					const uint16_t *row = img.ptr<uint16_t>(ty * 8 + r) + bx * 8;
+					for(int x=0; x<8; x++)
+						sum += row[x];
+				}
+				dst[bx] = (uint8_t)min(sum >> shift, 255u);
+			}
+		}
+	}
+}
+
+
+double ThumbnailDifference(const vector<uint8_t> &a, const vector<uint8_t> &b)
+{
+	size_t n = min(a.size(), b.size());
+	if(n == 0)
+		return 0;
+
+	uint64_t sum = 0;
+	size_t i = 0;
+
+#ifdef __SSE2__
+	__m128i acc = _mm_setzero_si128();
+	for(; i+16<=n; i+=16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)&a[i]), _mm_loadu_si128((const __m128i *)&b[i])));
+
+	uint64_t halves[2];
+	_mm_storeu_si128((__m128i *)halves, acc);
+	sum = halves[0] + halves[1];
+#endif
+
+	for(; i<n; i++)
+		sum += abs((int)a[i] - (int)b[i]);
+	return sum / (double)n;
+}
+
+
+MotionGateSettings::MotionGateSettings()
+	: threshold(2.0), preRoll(15), postRoll(30)
+{
+}
+
+
+MotionDetector::MotionDetector(double threshold, const vector<int> &bitDepths)
+	: numFramesets(0), numChanged(0), threshold(threshold), bitDepths(bitDepths),
+	  references(bitDepths.size()), thumbnails(bitDepths.size()), lastDifference(0)
+{
+}
+
+
+bool MotionDetector::Decide(const Frameset &frameset)
+{
+	bool changed = (numFramesets == 0);
+	lastDifference = 0;
+
+	for(unsigned int i=0; i<frameset.frames.size() && i<references.size(); i++)
+	{
+		const CameraFrame &frame = frameset.frames[i];
+		if(frame.missing)
+			continue;
+
+		int thumbWidth, thumbHeight;
+		MakeThumbnail(frame.img, bitDepths[i], thumbnails[i], thumbWidth, thumbHeight);
+		if(thumbnails[i].size() != references[i].size())
+		{
+			changed = true;
+			continue;
+		}
+		double difference = ThumbnailDifference(thumbnails[i], references[i]);
+		lastDifference = max(lastDifference, difference);
+		if(difference > threshold)
+			changed = true;
+	}
+
+	if(changed)
+	{
+		numChanged++;
+		for(unsigned int i=0; i<frameset.frames.size() && i<references.size(); i++)
+		{
+			if(!frameset.frames[i].missing)
+				references[i].swap(thumbnails[i]);
+		}
+	}
+	numFramesets++;
+
+	lock_guard<mutex> lock(decisionMutex);
+	decisions.push_back(changed);
+	return changed;
+}
+
+
+bool MotionDetector::Changed(uint64_t slot)
+{
+	lock_guard<mutex> lock(decisionMutex);
+	// Not decided: better written than lost
+	if(slot < 1 || slot > decisions.size())
+		return true;
+	return decisions[slot - 1];
+}
+
+
+void MotionDetector::PrintStatistics()
+{
+	cout << "Motion gate: " << numChanged << " of " << numFramesets << " framesets changed" << endl;
+}
+
+
+MotionGate::MotionGate(const MotionGateSettings &settings)
+	: numFrames(0), numChanged(0), numSkipped(0), bytesSkipped(0),
+	  settings(settings), postRollLeft(0)
+{
+}
+
+
+void MotionGate::Skip(const CameraFrame &frame, vector<CameraFrame> &skipped)
+{
+	if(!frame.missing)
+	{
+		numSkipped++;
+		bytesSkipped += frame.img.total() * frame.img.elemSize();
+	}
+	skipped.push_back(frame);
+}
+
+
+void MotionGate::Offer(const CameraFrame &frame, bool changed, vector<CameraFrame> &release, vector<CameraFrame> &skipped)
+{
+	if(!frame.missing)
+		numFrames++;
+
+	if(changed)
+	{
+		if(!frame.missing)
+			numChanged++;
+		postRollLeft = settings.postRoll;
+
+		// The lead-in to the change
+		for(unsigned int i=0; i<preRoll.size(); i++)
+			release.push_back(preRoll[i]);
+		preRoll.clear();
+		release.push_back(frame);
+	}
+	else if(postRollLeft > 0)
+	{
+		postRollLeft--;
+		release.push_back(frame);
+	}
+	else
+	{
+		preRoll.push_back(frame);
+		if((int)preRoll.size() > settings.preRoll)
+		{
+			Skip(preRoll.front(), skipped);
+			preRoll.pop_front();
+		}
+	}
+}
+
+
+void MotionGate::Flush(vector<CameraFrame> &skipped)
+{
+	for(unsigned int i=0; i<preRoll.size(); i++)
+		Skip(preRoll[i], skipped);
+	preRoll.clear();
+}
+
+
+void MotionGate::PrintStatistics(int camNum)
+{
+	cout << "Camera " << camNum << " motion gate: " << numChanged << " of " << numFrames << " frames in changed framesets, "
+		 << numSkipped << " writes and " << bytesSkipped / (1024 * 1024) << " MB of raw frames skipped" << endl;
+}
@@ -0,0 +1,133 @@
+#ifndef MOTION_GATE_H
+#define MOTION_GATE_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "FramesetAssembler.h"
+
+
+//
+// 8-bit thumbnail of a frame: the mean of every 8x8 block, the top bits
+// of 16-bit frames with bitDepth significant bits. Partial blocks at the
+// right and bottom edge are left out.
+//
+void MakeThumbnail(const cv::Mat &img, int bitDepth, std::vector<uint8_t> &thumbnail, int &thumbWidth, int &thumbHeight);
+
+// Mean absolute difference of two thumbnails of the same size, in levels
+double ThumbnailDifference(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b);
+
+
+struct MotionGateSettings
+{
+	MotionGateSettings();
+
+	double threshold;		// mean thumbnail difference that counts as change, levels of 255
+	int preRoll;			// frames written before the first changed frame
+	int postRoll;			// frames written after the last changed frame
+};
+
+
+//
+// Change detection of the motion gate, one decision per frameset for the
+// whole rig.
+//
+// *** NOTES ***
+// Every frame is reduced to an 8x8 block mean thumbnail (SSE2 psadbw block
+// sums for 8-bit frames) and compared with the reference of its camera by
+// the mean absolute difference (psadbw again). The reference is the
+// thumbnail of the camera's frame in the last frameset that changed, so
+// motion too slow to show from one frame to the next still adds up and
+// opens the gate. A frameset changed when any camera is above the
+// threshold; then the references of all cameras in it are refreshed. The
+// first frameset always changed. Missing frames do not count.
+//
+// Decide() is called for the framesets in order, before their frames go
+// to the writers (the assembler sink), and keeps the decision of every
+// slot; the writer threads ask for it with Changed(). All cameras thus
+// open and close their gate on the same slots and write the same
+// framesets.
+//
+// The thumbnails are 1/64 of the frame, so the cost is one read of every
+// frame.
+//
+class MotionDetector
+{
+public:
+	// bitDepth of the 16-bit frames of every camera
+	MotionDetector(double threshold, const std::vector<int> &bitDepths);
+
+	// The decision for the next frameset; slots count from 1
+	bool Decide(const Frameset &frameset);
+
+	// Thread safe, for a slot already decided
+	bool Changed(uint64_t slot);
+
+	// Largest difference to a reference in the last frameset, in levels
+	double GetLastDifference() { return lastDifference; }
+
+	void PrintStatistics();
+
+	uint64_t numFramesets;
+	uint64_t numChanged;
+
+private:
+	double threshold;
+	std::vector<int> bitDepths;
+	std::vector< std::vector<uint8_t> > references;
+	std::vector< std::vector<uint8_t> > thumbnails;
+	double lastDifference;
+
+	std::mutex decisionMutex;
+	std::vector<bool> decisions;
+};
+
+
+//
+// Gate that keeps static stretches of a camera off the disk, opened and
+// closed by the decisions of a MotionDetector.
+//
+// *** NOTES ***
+// The gate is open from preRoll frames before a changed slot to postRoll
+// frames after it. Offer() takes the frames of the camera in order, with
+// the decision of their slot, and returns those to write: closed, a frame
+// waits in the pre-roll ring, and the oldest falls out of it unwritten; on
+// a change the ring is released ahead of the frame. Frames come out in the
+// order they went in; missing frames take the same way. As every camera
+// gets the same decisions, the gates of all cameras release the same
+// slots.
+//
+// The frames in the ring share their data, no copies are made.
+//
+class MotionGate
+{
+public:
+	MotionGate(const MotionGateSettings &settings);
+
+	// frame is taken; the frames to write, in order, are appended to release
+	// and the frames dropped for good to skipped
+	void Offer(const CameraFrame &frame, bool changed, std::vector<CameraFrame> &release, std::vector<CameraFrame> &skipped);
+
+	// Frames still in the pre-roll ring at the end; they were not written
+	void Flush(std::vector<CameraFrame> &skipped);
+
+	void PrintStatistics(int camNum);
+
+	uint64_t numFrames;
+	uint64_t numChanged;
+	uint64_t numSkipped;
+	uint64_t bytesSkipped;
+
+private:
+	void Skip(const CameraFrame &frame, std::vector<CameraFrame> &skipped);
+
+	MotionGateSettings settings;
+	std::deque<CameraFrame> preRoll;
+	int postRollLeft;
+};
+
+#endif
@@ -0,0 +1,314 @@
+#include "PixelDefects.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+
+static const char defectMagic[8] = "DEFMAP1";
+
+
+int DefectMap::Save(const string &fileName)
+{
+	ofstream file(fileName.c_str(), ios::binary);
+	if(!file)
+	{
+		cout << "Unable to write " << fileName << endl;
+		return -1;
+	}
+
+	int32_t header[3] = { width, height, (int32_t)defects.size() };
+	file.write(defectMagic, sizeof(defectMagic));
+	file.write((const char *)header, sizeof(header));
+	for(unsigned int i=0; i<defects.size(); i++)
+	{
+		file.write((const char *)&defects[i].index, sizeof(defects[i].index));
+		file.write((const char *)&defects[i].type, sizeof(defects[i].type));
+	}
+
+	return file ? 0 : -1;
+}
+
+
+int DefectMap::Load(const string &fileName)
+{
+	ifstream file(fileName.c_str(), ios::binary);
+	if(!file)
+		return 1;
+
+	char magic[8];
+	int32_t header[3];
+	file.read(magic, sizeof(magic));
+	file.read((char *)header, sizeof(header));
+	// No more defects than pixels, and no frame larger than 2^31 pixels
+	int64_t numPixels = (int64_t)header[0] * header[1];
+	if(!file || memcmp(magic, defectMagic, sizeof(magic)) != 0 || header[0] <= 0 || header[1] <= 0 || header[2] < 0 ||
+	   numPixels > INT32_MAX || header[2] > numPixels)
+	{
+		cout << fileName << " is not a defect map" << endl;
+		return -1;
+	}
+
+	width = header[0];
+	height = header[1];
+	defects.resize(header[2]);
+	for(unsigned int i=0; i<defects.size(); i++)
+	{
+		file.read((char *)&defects[i].index, sizeof(defects[i].index));
+		file.read((char *)&defects[i].type, sizeof(defects[i].type));
+		if(!file)
+		{
+			cout << fileName << " is truncated" << endl;
+			defects.clear();
+			return -1;
+		}
+
+		uint8_t type = defects[i].type;
+		if(defects[i].index >= (uint32_t)numPixels || type < DEFECT_HOT || type > DEFECT_BRIGHT)
+		{
+			cout << fileName << " is corrupt: defect " << i << " at " << defects[i].index << ", type " << (int)type << endl;
+			defects.clear();
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+string DefectMapFileName(const string &dir, const string &serial)
+{
+	return dir + "/" + serial + ".defects";
+}
+
+
+DefectDetector::DefectDetector()
+	: hotSigma(6.0), minHot(4.0), deadRatio(0.5), brightRatio(1.5)
+{
+}
+
+
+static float Median(vector<float> &values)
+{
+	size_t mid = values.size() / 2;
+	nth_element(values.begin(), values.begin() + mid, values.end());
+	return values[mid];
+}
+
+
+int DefectDetector::Detect(const Mat &dark, const Mat &flat, bool bayer, DefectMap &map)
+{
+	const Mat &reference = dark.empty() ? flat : dark;
+	if(reference.empty())
+		return -1;
+	if(!dark.empty() && !flat.empty() && (dark.rows != flat.rows || dark.cols != flat.cols))
+	{
+		cout << "Dark and flat frames differ in size" << endl;
+		return -1;
+	}
+
+	int width = reference.cols;
+	int height = reference.rows;
+	int step = bayer ? 2 : 1;
+	int numPhases = bayer ? 4 : 1;
+	vector<uint8_t> type(width * height, 0);
+
+	// Hot pixels against the spread of the dark frame, per phase
+	if(!dark.empty())
+	{
+		for(int phase=0; phase<numPhases; phase++)
+		{
+			int phaseY = phase / 2, phaseX = phase % 2;
+			vector<float> values;
+			for(int y=phaseY; y<height; y+=step)
+			{
+				const float *row = dark.ptr<float>(y);
+				for(int x=phaseX; x<width; x+=step)
+					values.push_back(row[x]);
+			}
+
+			float median = Median(values);
+			for(unsigned int i=0; i<values.size(); i++)
+				values[i] = fabs(values[i] - median);
+			float sigma = 1.4826f * Median(values);
+			float threshold = median + max((float)(hotSigma * sigma), (float)minHot);
+
+			for(int y=phaseY; y<height; y+=step)
+			{
+				const float *row = dark.ptr<float>(y);
+				for(int x=phaseX; x<width; x+=step)
+				{
+					if(row[x] > threshold)
+						type[y*width + x] = DEFECT_HOT;
+				}
+			}
+		}
+	}
+
+	// Dead and bright pixels against their same colour neighbours
+	if(!flat.empty())
+	{
+		vector<float> response(width * height);
+		for(int y=0; y<height; y++)
+		{
+			const float *f = flat.ptr<float>(y);
+			const float *d = dark.empty() ? NULL : dark.ptr<float>(y);
+			for(int x=0; x<width; x++)
+				response[y*width + x] = f[x] - (d ? d[x] : 0.0f);
+		}
+
+		vector<float> neighbours;
+		for(int y=0; y<height; y++)
+		{
+			for(int x=0; x<width; x++)
+			{
+				if(type[y*width + x] != 0)
+					continue;
+
+				neighbours.clear();
+				for(int dy=-step; dy<=step; dy+=step)
+				{
+					for(int dx=-step; dx<=step; dx+=step)
+					{
+						int nx = x + dx, ny = y + dy;
+						if((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= width || ny >= height)
+							continue;
+						neighbours.push_back(response[ny*width + nx]);
+					}
+				}
+
+				float local = Median(neighbours);
+				if(local <= 0)
+					continue;
+
+				float ratio = response[y*width + x] / local;
+				if(ratio < deadRatio)
+					type[y*width + x] = DEFECT_DEAD;
+				else if(ratio > brightRatio)
+					type[y*width + x] = DEFECT_BRIGHT;
+			}
+		}
+	}
+
+	map.width = width;
+	map.height = height;
+	map.defects.clear();
+	for(int i=0; i<width*height; i++)
+	{
+		if(type[i] != 0)
+		{
+			PixelDefect defect;
+			defect.index = i;
+			defect.type = type[i];
+			map.defects.push_back(defect);
+		}
+	}
+
+	return 0;
+}
+
+
+DefectCorrector::DefectCorrector()
+	: width(0), height(0), sizeWarning(false)
+{
+}
+
+
+int DefectCorrector::Load(const string &dir, const string &serial, bool bayer)
+{
+	DefectMap map;
+	int result = map.Load(DefectMapFileName(dir, serial));
+	if(result != 0)
+		return result;
+
+	Build(map, bayer);
+	return 0;
+}
+
+
+void DefectCorrector::Build(const DefectMap &map, bool bayer)
+{
+	width = map.width;
+	height = map.height;
+	taps.clear();
+
+	// Load() rejects maps with pixels outside the frame
+	vector<bool> defective(width * height, false);
+	for(unsigned int i=0; i<map.defects.size(); i++)
+	{
+		assert(map.defects[i].index < (uint32_t)(width * height));
+		defective[map.defects[i].index] = true;
+	}
+
+	int step = bayer ? 2 : 1;
+	const int offsets[8][2] = { {-step, 0}, {step, 0}, {0, -step}, {0, step},
+								{-step, -step}, {step, -step}, {-step, step}, {step, step} };
+
+	for(unsigned int i=0; i<map.defects.size(); i++)
+	{
+		int x = map.defects[i].index % width;
+		int y = map.defects[i].index / width;
+
+		// Direct neighbours first; diagonals only when none of them is usable
+		vector<uint32_t> valid;
+		for(int k=0; k<8; k++)
+		{
+			if(k == 4 && !valid.empty())
+				break;
+
+			int nx = x + offsets[k][0], ny = y + offsets[k][1];
+			if(nx < 0 || ny < 0 || nx >= width || ny >= height || defective[ny*width + nx])
+				continue;
+			valid.push_back(ny*width + nx);
+		}
+		if(valid.empty())
+			continue;
+
+		Tap tap;
+		tap.pixel = map.defects[i].index;
+		for(int k=0; k<4; k++)
+			tap.neighbour[k] = valid[k % valid.size()];
+		taps.push_back(tap);
+	}
+}
+
+
+void DefectCorrector::Apply(Mat &img)
+{
+	if(taps.empty())
+		return;
+
+	if(img.rows != height || img.cols != width || !img.isContinuous())
+	{
+		if(!sizeWarning)
+			cout << "Defect map is " << width << "x" << height << ", frame is " << img.cols << "x" << img.rows << ". Not corrected." << endl;
+		sizeWarning = true;
+		return;
+	}
+
+	if(img.depth() == CV_16U)
+	{
+		uint16_t *pixels = img.ptr<uint16_t>(0);
+		for(unsigned int i=0; i<taps.size(); i++)
+		{
+			const Tap &t = taps[i];
+			pixels[t.pixel] = (uint16_t)(((uint32_t)pixels[t.neighbour[0]] + pixels[t.neighbour[1]] +
+			                              pixels[t.neighbour[2]] + pixels[t.neighbour[3]] + 2) >> 2);
+		}
+	}
+	else
+	{
+		uint8_t *pixels = img.ptr<uint8_t>(0);
+		for(unsigned int i=0; i<taps.size(); i++)
+		{
+			const Tap &t = taps[i];
+			pixels[t.pixel] = (uint8_t)((pixels[t.neighbour[0]] + pixels[t.neighbour[1]] +
+			                             pixels[t.neighbour[2]] + pixels[t.neighbour[3]] + 2) >> 2);
+		}
+	}
+}
@@ -0,0 +1,111 @@
+#ifndef PIXEL_DEFECTS_H
+#define PIXEL_DEFECTS_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+
+enum DefectType
+{
+	DEFECT_HOT = 1,			// bright in the dark frame
+	DEFECT_DEAD = 2,		// little or no response in the flat frame
+	DEFECT_BRIGHT = 3		// too much response in the flat frame
+};
+
+
+struct PixelDefect
+{
+	uint32_t index;			// y * width + x
+	uint8_t type;
+};
+
+
+//
+// Defective pixels of one sensor, stored as <dir>/<serial>.defects
+//
+// *** NOTES ***
+// File: "DEFMAP1" header, width, height and number of defects, then one
+// uint32 index and one type byte per defect, sorted by index. A sensor with
+// a few hundred defects takes a few kilobytes.
+//
+struct DefectMap
+{
+	int width;
+	int height;
+	std::vector<PixelDefect> defects;
+
+	int Save(const std::string &fileName);
+	// 1 if there is no map, -1 if it cannot be read
+	int Load(const std::string &fileName);
+};
+
+std::string DefectMapFileName(const std::string &dir, const std::string &serial);
+
+
+//
+// Finds defective pixels in the mean dark and flat frames of a camera
+// (see FlatField). Either may be empty.
+//
+// *** NOTES ***
+// Hot:    dark above the median of its 2x2 phase by more than hotSigma
+//         robust standard deviations (1.4826 * MAD), and at least minHot DN.
+// Dead / bright: flat response (flat - dark) below deadRatio or above
+//         brightRatio times the median of its same colour neighbours, so
+//         vignetting does not count as a defect.
+//
+struct DefectDetector
+{
+	DefectDetector();
+
+	int Detect(const cv::Mat &dark, const cv::Mat &flat, bool bayer, DefectMap &map);
+
+	double hotSigma;
+	double minHot;
+	double deadRatio;
+	double brightRatio;
+};
+
+
+//
+// In-line replacement of the defective pixels of one camera.
+//
+// *** NOTES ***
+// Each defect is replaced by the mean of its four nearest neighbours of
+// the same colour: 2 pixels away on a Bayer sensor, 1 on a mono sensor.
+// Neighbours that are defective themselves or outside the image are left
+// out. The neighbour indices are resolved in Build(), with missing ones
+// filled by repeating valid ones, so Apply() is a fixed 4 tap gather per
+// defect and costs O(number of defects), not O(pixels).
+//
+class DefectCorrector
+{
+public:
+	DefectCorrector();
+
+	// 0 if a map was loaded, 1 if the camera has none, -1 on error
+	int Load(const std::string &dir, const std::string &serial, bool bayer);
+	void Build(const DefectMap &map, bool bayer);
+
+	bool IsActive() { return !taps.empty(); }
+	int GetNumDefects() { return taps.size(); }
+
+	// In place, CV_8UC1 or CV_16UC1 of the size of the map
+	void Apply(cv::Mat &img);
+
+private:
+	struct Tap
+	{
+		uint32_t pixel;
+		uint32_t neighbour[4];
+	};
+
+	int width;
+	int height;
+	std::vector<Tap> taps;
+	bool sizeWarning;
+};
+
+#endif
@@ -0,0 +1,361 @@
+#include "PixelUnpack.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXEL_UNPACK_SSSE3
+#include <tmmintrin.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace cv;
+
+
+UnpackFormat UnpackFormatFromName(const string &pixelFormat)
+{
+	if(pixelFormat == "Mono8")
+		return UNPACK_MONO8;
+	if(pixelFormat == "Mono12p")
+		return UNPACK_MONO12P;
+	if(pixelFormat == "Mono12Packed")
+		return UNPACK_MONO12_PACKED;
+	if(pixelFormat == "Mono12" || pixelFormat == "Mono16")
+		return UNPACK_MONO16;
+	return UNPACK_UNSUPPORTED;
+}
+
+
+int UnpackBitDepth(const string &pixelFormat)
+{
+	if(pixelFormat.find("12") != string::npos)
+		return 12;
+	if(pixelFormat.find("16") != string::npos)
+		return 16;
+	return 8;
+}
+
+
+const char *UnpackFormatName(UnpackFormat format)
+{
+	switch(format)
+	{
+	case UNPACK_MONO8:			return "Mono8";
+	case UNPACK_MONO12P:		return "Mono12p";
+	case UNPACK_MONO12_PACKED:	return "Mono12Packed";
+	case UNPACK_MONO16:			return "Mono16";
+	default:					return "unsupported";
+	}
+}
+
+
+//
+// Scalar kernels
+//
+static void UnpackMono12pScalar(const uint8_t *src, uint16_t *dst, int numPixels)
+{
+	int i = 0;
+	for(; i+1<numPixels; i+=2, src+=3)
+	{
+		dst[i]   = src[0] | ((src[1] & 0x0f) << 8);
+		dst[i+1] = (src[1] >> 4) | (src[2] << 4);
+	}
+	if(i < numPixels)
+		dst[i] = src[0] | ((src[1] & 0x0f) << 8);
+}
+
+
+static void UnpackMono12PackedScalar(const uint8_t *src, uint16_t *dst, int numPixels)
+{
+	int i = 0;
+	for(; i+1<numPixels; i+=2, src+=3)
+	{
+		dst[i]   = (src[0] << 4) | (src[1] & 0x0f);
+		dst[i+1] = (src[2] << 4) | (src[1] >> 4);
+	}
+	if(i < numPixels)
+		dst[i] = (src[0] << 4) | (src[1] & 0x0f);
+}
+
+
+static void WidenMono8Scalar(const uint8_t *src, uint16_t *dst, int numPixels)
+{
+	for(int i=0; i<numPixels; i++)
+		dst[i] = src[i];
+}
+
+
+#ifdef PIXEL_UNPACK_SSSE3
+//
+// SSSE3 kernels. Each step loads 16 bytes and unpacks the 8 pixels in the
+// first 12; the loops stop while 16 bytes can still be read and leave the
+// rest to the scalar kernels.
+//
+__attribute__((target("ssse3")))
+static int UnpackMono12pSsse3(const uint8_t *src, uint16_t *dst, int numPixels)
+{
+	// Pixel pairs (b0 b1 b2): even pixel from bytes 0,1, odd pixel from 1,2
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+	const __m128i evenMask = _mm_setr_epi16(0x0fff, 0, 0x0fff, 0, 0x0fff, 0, 0x0fff, 0);
+	const __m128i oddMask = _mm_setr_epi16(0, -1, 0, -1, 0, -1, 0, -1);
+
+	int i = 0;
+	for(; i+11<=numPixels; i+=8, src+=12)
+	{
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle);
+		__m128i even = _mm_and_si128(v, evenMask);
+		__m128i odd = _mm_and_si128(_mm_srli_epi16(v, 4), oddMask);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(even, odd));
+	}
+	return i;
+}
+
+
+__attribute__((target("ssse3")))
+static int UnpackMono12PackedSsse3(const uint8_t *src, uint16_t *dst, int numPixels)
+{
+	// Even pixel: b0 high, low nibble of b1. Odd pixel: b2 high, high nibble of b1.
+	const __m128i shuffle = _mm_setr_epi8(1, 0, 1, 2, 4, 3, 4, 5, 7, 6, 7, 8, 10, 9, 10, 11);
+	const __m128i highMask = _mm_set1_epi16((short)0xff00);
+	const __m128i evenLowMask = _mm_setr_epi16(0x000f, 0, 0x000f, 0, 0x000f, 0, 0x000f, 0);
+	const __m128i oddLowMask = _mm_setr_epi16(0, 0x00f0, 0, 0x00f0, 0, 0x00f0, 0, 0x00f0);
+
+	int i = 0;
+	for(; i+11<=numPixels; i+=8, src+=12)
+	{
+		__m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)src), shuffle);
+		__m128i high = _mm_srli_epi16(_mm_and_si128(v, highMask), 4);
+		__m128i evenLow = _mm_and_si128(v, evenLowMask);
+		__m128i oddLow = _mm_srli_epi16(_mm_and_si128(v, oddLowMask), 4);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(high, _mm_or_si128(evenLow, oddLow)));
+	}
+	return i;
+}
+
+
+__attribute__((target("ssse3")))
+static int WidenMono8Ssse3(const uint8_t *src, uint16_t *dst, int numPixels)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	int i = 0;
+	for(; i+16<=numPixels; i+=16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+	}
+	return i;
+}
+#endif
+
+
+bool UnpackHasSimd()
+{
+#ifdef PIXEL_UNPACK_SSSE3
+	static const bool hasSsse3 = __builtin_cpu_supports("ssse3");
+	return hasSsse3;
+#else
+	return false;
+#endif
+}
+
+
+void UnpackRow(const uint8_t *src, uint16_t *dst, int numPixels, UnpackFormat format, bool useSimd)
+{
+	int done = 0;
+
+#ifdef PIXEL_UNPACK_SSSE3
+	if(useSimd && UnpackHasSimd())
+	{
+		if(format == UNPACK_MONO12P)
+			done = UnpackMono12pSsse3(src, dst, numPixels);
+		else if(format == UNPACK_MONO12_PACKED)
+			done = UnpackMono12PackedSsse3(src, dst, numPixels);
+		else if(format == UNPACK_MONO8)
+			done = WidenMono8Ssse3(src, dst, numPixels);
+	}
+#endif
+
+	// Pixels not handled by the SIMD kernels. Packed formats resume on a
+	// pair boundary, which done always is.
+	switch(format)
+	{
+	case UNPACK_MONO8:
+		WidenMono8Scalar(src + done, dst + done, numPixels - done);
+		break;
+	case UNPACK_MONO12P:
+		UnpackMono12pScalar(src + done / 2 * 3, dst + done, numPixels - done);
+		break;
+	case UNPACK_MONO12_PACKED:
+		UnpackMono12PackedScalar(src + done / 2 * 3, dst + done, numPixels - done);
+		break;
+	case UNPACK_MONO16:
+		memcpy(dst, src, numPixels * sizeof(uint16_t));
+		break;
+	default:
+		break;
+	}
+}
+
+
+#ifdef __SSE2__
+// 32 source pixels of a row pair -> 16 output pixels per step. Pairs are
+// summed as 16 bit values, so the quad is rounded once like the scalar loop.
+static int BayerDownscaleRowSse2(const uint8_t *r0, const uint8_t *r1, uint8_t *out, int width)
+{
+	const __m128i lowMask = _mm_set1_epi16(0x00FF);
+	const __m128i two = _mm_set1_epi16(2);
+
+	int x = 0;
+	for(; x+16<=width; x+=16)
+	{
+		__m128i sum[2];
+		for(int half=0; half<2; half++)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(r0 + 2*x + 16*half));
+			__m128i b = _mm_loadu_si128((const __m128i *)(r1 + 2*x + 16*half));
+			__m128i pairA = _mm_add_epi16(_mm_and_si128(a, lowMask), _mm_srli_epi16(a, 8));
+			__m128i pairB = _mm_add_epi16(_mm_and_si128(b, lowMask), _mm_srli_epi16(b, 8));
+			sum[half] = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pairA, pairB), two), 2);
+		}
+		_mm_storeu_si128((__m128i *)(out + x), _mm_packus_epi16(sum[0], sum[1]));
+	}
+	return x;
+}
+#endif
+
+
+void BayerDownscale2x2(const Mat &src, Mat &dst, bool useSimd)
+{
+	for(int y=0; y<dst.rows; y++)
+	{
+		const uint8_t *r0 = src.ptr<uint8_t>(2*y);
+		const uint8_t *r1 = src.ptr<uint8_t>(2*y + 1);
+		uint8_t *out = dst.ptr<uint8_t>(y);
+		int x = 0;
+
+#ifdef __SSE2__
+		if(useSimd)
+			x = BayerDownscaleRowSse2(r0, r1, out, dst.cols);
+#endif
+		for(; x<dst.cols; x++)
+		{
+			out[x] = (uint8_t)((r0[2*x] + r0[2*x + 1] + r1[2*x] + r1[2*x + 1] + 2) >> 2);
+		}
+	}
+}
+
+
+int UnpackImage(const uint8_t *src, size_t srcStride, int width, int height, UnpackFormat format, Mat &dst, bool useSimd)
+{
+	if(format == UNPACK_UNSUPPORTED)
+		return -1;
+
+	dst.create(height, width, CV_16UC1);
+
+	for(int y=0; y<height; y++)
+	{
+		UnpackRow(src + y * srcStride, dst.ptr<uint16_t>(y), width, format, useSimd);
+	}
+	return 0;
+}
+
+
+ToneMapper::ToneMapper(int bitDepth, double gamma, double clipPercent, int step)
+	: blackPoint(-1), whitePoint(-1), bitDepth(bitDepth), gamma(gamma), clipPercent(clipPercent), step(step),
+	  histogram(1 << bitDepth), table(1 << 16, 255)
+{
+}
+
+
+void ToneMapper::UpdateLevels(const Mat &src16)
+{
+	fill(histogram.begin(), histogram.end(), 0);
+
+	int maxValue = (1 << bitDepth) - 1;
+	int numSamples = 0;
+	for(int y=0; y<src16.rows; y+=step)
+	{
+		const uint16_t *row = src16.ptr<uint16_t>(y);
+		for(int x=0; x<src16.cols; x+=step)
+		{
+			histogram[min((int)row[x], maxValue)]++;
+			numSamples++;
+		}
+	}
+
+	int clipCount = (int)(numSamples * clipPercent / 100.0);
+	int black = 0, white = maxValue;
+	int count = 0;
+	for(; black<maxValue; black++)
+	{
+		count += histogram[black];
+		if(count > clipCount)
+			break;
+	}
+	count = 0;
+	for(; white>0; white--)
+	{
+		count += histogram[white];
+		if(count > clipCount)
+			break;
+	}
+	if(white <= black)
+		white = min(black + 1, maxValue);
+
+	if(black != blackPoint || white != whitePoint)
+	{
+		blackPoint = black;
+		whitePoint = white;
+		BuildTable();
+	}
+}
+
+
+void ToneMapper::BuildTable()
+{
+	// Values above whitePoint, including out of range ones, stay at 255
+	fill(table.begin(), table.begin() + blackPoint + 1, 0);
+	double range = whitePoint - blackPoint;
+	for(int v=blackPoint+1; v<whitePoint; v++)
+	{
+		table[v] = (uint8_t)(255.0 * pow((v - blackPoint) / range, gamma) + 0.5);
+	}
+	fill(table.begin() + whitePoint, table.end(), 255);
+}
+
+
+void ToneMapper::Apply(const Mat &src16, Mat &dst8)
+{
+	UpdateLevels(src16);
+
+	dst8.create(src16.rows, src16.cols, CV_8UC1);
+	const uint8_t *lut = &table[0];
+	for(int y=0; y<src16.rows; y++)
+	{
+		const uint16_t *src = src16.ptr<uint16_t>(y);
+		uint8_t *dst = dst8.ptr<uint8_t>(y);
+		for(int x=0; x<src16.cols; x++)
+			dst[x] = lut[src[x]];
+	}
+}
+
+
+void ToneMapper::Shift(const Mat &src16, Mat &dst8, int bitDepth)
+{
+	int shift = max(bitDepth - 8, 0);
+	dst8.create(src16.rows, src16.cols, CV_8UC1);
+	for(int y=0; y<src16.rows; y++)
+	{
+		const uint16_t *src = src16.ptr<uint16_t>(y);
+		uint8_t *dst = dst8.ptr<uint8_t>(y);
+		for(int x=0; x<src16.cols; x++)
+			dst[x] = (uint8_t)min(src[x] >> shift, 255);
+	}
+}
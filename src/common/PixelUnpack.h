@@ -0,0 +1,98 @@
+#ifndef PIXEL_UNPACK_H
+#define PIXEL_UNPACK_H
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+
+//
+// Unpacking of high bit depth mono images to 16 bits per pixel, and 8-bit
+// previews of the result.
+//
+// *** NOTES ***
+// Supported camera formats:
+//
+//   Mono12p       PFNC packing: 2 pixels in 3 bytes, LSB first
+//                   p0 = b0 | (b1 & 0x0f) << 8,  p1 = b1 >> 4 | b2 << 4
+//   Mono12Packed  IIDC/GigE packing: 2 pixels in 3 bytes, MSB first
+//                   p0 = b0 << 4 | (b1 & 0x0f),  p1 = b2 << 4 | b1 >> 4
+//   Mono12/Mono16 one pixel in 2 bytes, copied as is
+//   Mono8         widened to 16 bits
+//
+// Unpacked values keep the sensor range: 0..4095 for 12-bit formats, so
+// bitDepth has to travel with the image. The packed kernels use SSSE3 on
+// x86 when the CPU has it (checked at run time, no build flags needed) and
+// a scalar loop otherwise. Both give identical results.
+//
+enum UnpackFormat
+{
+	UNPACK_UNSUPPORTED,
+	UNPACK_MONO8,
+	UNPACK_MONO12P,
+	UNPACK_MONO12_PACKED,
+	UNPACK_MONO16
+};
+
+// Format of a pixel format name (PixelFormat node or GetPixelFormatName())
+UnpackFormat UnpackFormatFromName(const std::string &pixelFormat);
+// Significant bits of the unpacked pixels
+int UnpackBitDepth(const std::string &pixelFormat);
+const char *UnpackFormatName(UnpackFormat format);
+
+// Unpack one row of numPixels. useSimd = false forces the scalar kernels.
+void UnpackRow(const uint8_t *src, uint16_t *dst, int numPixels, UnpackFormat format, bool useSimd = true);
+
+// Unpack a whole image into a CV_16UC1 Mat. srcStride is the number of
+// bytes per source row. Returns -1 for unsupported formats.
+int UnpackImage(const uint8_t *src, size_t srcStride, int width, int height, UnpackFormat format, cv::Mat &dst, bool useSimd = true);
+
+// True when the SSSE3 kernels are used
+bool UnpackHasSimd();
+
+// Downscale a raw 8-bit Bayer frame by 2 in each direction, averaging every
+// 2x2 Bayer quad into one grey pixel, rounded: (sum + 2) >> 2. dst must
+// already have its size, and may be a view (ROI) of a larger image. Uses
+// SSE2 where the build has it; useSimd = false forces the scalar loop.
+// Both give identical results.
+void BayerDownscale2x2(const cv::Mat &src, cv::Mat &dst, bool useSimd = true);
+
+
+//
+// 8-bit preview of a 16-bit image.
+//
+// *** NOTES ***
+// The black and white points come from a subsampled histogram (every
+// step-th pixel of every step-th row); a gamma curve lifts the shadows that
+// a plain shift to 8 bits would crush. The curve is a lookup table rebuilt
+// per frame, so the per pixel cost is one table read.
+//
+class ToneMapper
+{
+public:
+	ToneMapper(int bitDepth, double gamma = 1.0/2.2, double clipPercent = 0.5, int step = 8);
+
+	void Apply(const cv::Mat &src16, cv::Mat &dst8);
+
+	// Plain shift to 8 bits, no tone curve
+	static void Shift(const cv::Mat &src16, cv::Mat &dst8, int bitDepth);
+
+	int blackPoint;
+	int whitePoint;
+
+private:
+	void UpdateLevels(const cv::Mat &src16);
+	void BuildTable();
+
+	int bitDepth;
+	double gamma;
+	double clipPercent;
+	int step;
+	std::vector<int> histogram;
+	std::vector<uint8_t> table;
+};
+
+#endif
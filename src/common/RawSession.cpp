@@ -0,0 +1,307 @@
+#include "RawSession.h"
+#include "BayerCodec.h"
+
+#include <iostream>
+#include <cstring>
+#include <climits>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+
+static_assert(sizeof(RawFrameHeader) == 72, "RawFrameHeader is written as is");
+
+
+const char *RawCodecName(uint32_t codec)
+{
+	switch(codec)
+	{
+		case RAW_CODEC_NONE: return "none";
+		case RAW_CODEC_RICE: return "rice";
+		default: return "unknown";
+	}
+}
+
+
+int ParseRawCodec(const string &name)
+{
+	if(name == "none")
+		return RAW_CODEC_NONE;
+	if(name == "rice")
+		return RAW_CODEC_RICE;
+	return -1;
+}
+
+
+// OpenCV names a Bayer pattern by the second row; the cameras by the first
+int DemosaicCode(const string &pixelFormat)
+{
+	if(pixelFormat.compare(0, 7, "BayerRG") == 0)
+		return COLOR_BayerBG2BGR;
+	if(pixelFormat.compare(0, 7, "BayerBG") == 0)
+		return COLOR_BayerRG2BGR;
+	if(pixelFormat.compare(0, 7, "BayerGR") == 0)
+		return COLOR_BayerGB2BGR;
+	if(pixelFormat.compare(0, 7, "BayerGB") == 0)
+		return COLOR_BayerGR2BGR;
+	return -1;
+}
+
+
+int DecodeRawFrame(const RawFrameHeader &header, const vector<uint8_t> &payload, Mat &img)
+{
+	if(header.codec != RAW_CODEC_NONE && header.codec != RAW_CODEC_RICE)
+	{
+		cout << "Frame " << header.slot << ": unknown codec " << header.codec << endl;
+		return -1;
+	}
+
+	img.create(header.height, header.width, header.type);
+	if(header.codec == RAW_CODEC_RICE)
+	{
+		if(payload.empty() || DecodeBayer(&payload[0], payload.size(), img) < 0)
+		{
+			cout << "Frame " << header.slot << ": damaged " << RawCodecName(header.codec) << " payload" << endl;
+			return -1;
+		}
+		return 0;
+	}
+
+	size_t rowBytes = (size_t)header.width * img.elemSize();
+	if(payload.size() != rowBytes * header.height)
+	{
+		cout << "Frame " << header.slot << ": " << payload.size() << " bytes for a " << header.width << "x" << header.height << " frame" << endl;
+		return -1;
+	}
+
+	for(uint32_t y=0; y<header.height; y++)
+		memcpy(img.ptr(y), &payload[y * rowBytes], rowBytes);
+	return 0;
+}
+
+
+RawWriter::RawWriter()
+	: numFrames(0), bytesWritten(0), frameBytes(0), file(NULL), bitDepth(8), codec(RAW_CODEC_NONE), numThreads(1)
+{
+}
+
+
+RawWriter::~RawWriter()
+{
+	Close();
+}
+
+
+int RawWriter::Open(const string &fileName, const string &pixelFormat, int bitDepth, uint32_t codec, int numThreads)
+{
+	Close();
+
+	if(codec != RAW_CODEC_NONE && codec != RAW_CODEC_RICE)
+	{
+		cout << "Unable to create " << fileName << ": unknown codec " << codec << endl;
+		return -1;
+	}
+
+	file = fopen(fileName.c_str(), "wb");
+	if(file == NULL)
+	{
+		cout << "Unable to create " << fileName << endl;
+		return -1;
+	}
+
+	// Large writes; a frame is a few MB
+	fileBuffer.resize(8 << 20);
+	setvbuf(file, &fileBuffer[0], _IOFBF, fileBuffer.size());
+
+	this->pixelFormat = pixelFormat;
+	this->bitDepth = bitDepth;
+	this->codec = codec;
+	this->numThreads = numThreads;
+	numFrames = 0;
+	bytesWritten = 0;
+	frameBytes = 0;
+	return 0;
+}
+
+
+void RawWriter::Close()
+{
+	if(file != NULL)
+	{
+		fclose(file);
+		file = NULL;
+	}
+}
+
+
+int RawWriter::Write(const Mat &img, uint64_t slot, uint64_t rigTime)
+{
+	if(file == NULL)
+		return -1;
+
+	size_t rowBytes = img.cols * img.elemSize();
+
+	RawFrameHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "RAWF", 4);
+	header.version = 1;
+	header.width = img.cols;
+	header.height = img.rows;
+	header.type = img.type();
+	header.bitDepth = (img.depth() == CV_16U) ? bitDepth : 8;
+	header.codec = codec;
+	header.slot = slot;
+	header.rigTime = rigTime;
+	header.payloadBytes = rowBytes * img.rows;
+	strncpy(header.pixelFormat, pixelFormat.c_str(), sizeof(header.pixelFormat) - 1);
+
+	if(codec == RAW_CODEC_RICE)
+	{
+		if(EncodeBayer(img, encoded, numThreads) < 0)
+			return -1;
+		header.payloadBytes = encoded.size();
+	}
+
+	if(fwrite(&header, sizeof(header), 1, file) != 1)
+		return -1;
+	if(codec == RAW_CODEC_RICE)
+	{
+		if(fwrite(&encoded[0], encoded.size(), 1, file) != 1)
+			return -1;
+	}
+	else if(img.isContinuous())
+	{
+		if(fwrite(img.ptr(), header.payloadBytes, 1, file) != 1)
+			return -1;
+	}
+	else
+	{
+		for(int y=0; y<img.rows; y++)
+		{
+			if(fwrite(img.ptr(y), rowBytes, 1, file) != 1)
+				return -1;
+		}
+	}
+
+	numFrames++;
+	bytesWritten += sizeof(header) + header.payloadBytes;
+	frameBytes += rowBytes * img.rows;
+	return 0;
+}
+
+
+// A header the fields of which a frame can have: a type Write() stores,
+// a size a Mat can take and a payload no larger than the codec makes of
+// it. Anything else is taken for damage, so no size from it is used.
+static bool ValidHeader(const RawFrameHeader &header)
+{
+	if(memcmp(header.magic, "RAWF", 4) != 0 || header.version != 1)
+		return false;
+	if(header.type != CV_8UC1 && header.type != CV_16UC1)
+		return false;
+	if(header.width == 0 || header.height == 0 || header.width > INT_MAX || header.height > INT_MAX)
+		return false;
+
+	int elemBits = (header.type == CV_16UC1) ? 16 : 8;
+	uint64_t frameBytes = (uint64_t)header.width * header.height * (elemBits / 8);
+	if(header.codec == RAW_CODEC_NONE)
+		return header.payloadBytes == frameBytes;
+	if(header.codec == RAW_CODEC_RICE)
+		return header.payloadBytes <= MaxEncodedBytes(header.height, header.width, elemBits);
+	return false;
+}
+
+
+RawReader::RawReader()
+	: file(NULL), fileSize(0), payloadLeft(0)
+{
+}
+
+
+RawReader::~RawReader()
+{
+	Close();
+}
+
+
+int RawReader::Open(const string &fileName)
+{
+	Close();
+
+	file = fopen(fileName.c_str(), "rb");
+	if(file == NULL)
+	{
+		cout << "Unable to open " << fileName << endl;
+		return -1;
+	}
+
+	fileBuffer.resize(8 << 20);
+	setvbuf(file, &fileBuffer[0], _IOFBF, fileBuffer.size());
+	payloadLeft = 0;
+
+	fileSize = 0;
+	if(fseeko(file, 0, SEEK_END) == 0)
+		fileSize = ftello(file);
+	rewind(file);
+	return 0;
+}
+
+
+void RawReader::Close()
+{
+	if(file != NULL)
+	{
+		fclose(file);
+		file = NULL;
+	}
+}
+
+
+bool RawReader::Next(RawFrameHeader &header)
+{
+	if(file == NULL)
+		return false;
+	if(payloadLeft > 0 && SkipPayload() < 0)
+		return false;
+
+	if(fread(&header, sizeof(header), 1, file) != 1)
+		return false;
+
+	// A payload past the end of the file is a record cut off by a crash
+	off_t position = ftello(file);
+	if(!ValidHeader(header) || position < 0 || header.payloadBytes > (uint64_t)(fileSize - position))
+	{
+		cout << "Damaged record; the rest of the file is left out" << endl;
+		payloadLeft = 0;
+		Close();
+		return false;
+	}
+	header.pixelFormat[sizeof(header.pixelFormat) - 1] = 0;
+
+	payloadLeft = header.payloadBytes;
+	return true;
+}
+
+
+int RawReader::ReadPayload(vector<uint8_t> &payload)
+{
+	payload.resize(payloadLeft);
+	if(payloadLeft > 0 && fread(&payload[0], payloadLeft, 1, file) != 1)
+	{
+		payloadLeft = 0;
+		return -1;
+	}
+	payloadLeft = 0;
+	return 0;
+}
+
+
+int RawReader::SkipPayload()
+{
+	if(fseeko(file, payloadLeft, SEEK_CUR) != 0)
+		return -1;
+	payloadLeft = 0;
+	return 0;
+}
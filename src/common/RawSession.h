@@ -0,0 +1,118 @@
+#ifndef RAW_SESSION_H
+#define RAW_SESSION_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <opencv2/core/core.hpp>
+
+
+//
+// Raw recording container: the frames of one camera, unencoded, in one
+// file per camera (<camera output>/frames.raws), for recordings that have
+// to keep up with the cameras. Transcode turns it into image files later.
+//
+// *** NOTES ***
+// The file is a sequence of records, each a RawFrameHeader followed by
+// payloadBytes of frame data. There is no index; a reader walks the
+// headers and seeks over the payloads it does not need. A record cut off
+// by a crash ends the file for the reader, everything before it is kept.
+//
+// codec tells how the payload is stored. RAW_CODEC_NONE is the rows of
+// the frame back to back (width * elemSize bytes each), RAW_CODEC_RICE
+// the lossless prediction coding of BayerCodec, encoded on numThreads
+// threads in Write().
+//
+enum RawCodec
+{
+	RAW_CODEC_NONE = 0,
+	RAW_CODEC_RICE = 1
+};
+
+struct RawFrameHeader
+{
+	char magic[4];			// "RAWF"
+	uint32_t version;		// 1
+	uint32_t width;
+	uint32_t height;
+	int32_t type;			// OpenCV type of the frame, CV_8UC1 or CV_16UC1
+	uint32_t bitDepth;		// significant bits of 16-bit frames
+	uint32_t codec;			// RawCodec
+	uint32_t reserved;
+	uint64_t slot;			// frameset slot, the number of the image files
+	uint64_t rigTime;		// ns
+	uint64_t payloadBytes;
+	char pixelFormat[16];	// camera pixel format, e.g. BayerRG8; may be empty
+};
+
+const char *RawCodecName(uint32_t codec);
+// RawCodec of a name, -1 if there is none
+int ParseRawCodec(const std::string &name);
+
+// Frame data of a record back into a Mat; -1 for an unknown codec or a
+// payload that does not fit the header
+int DecodeRawFrame(const RawFrameHeader &header, const std::vector<uint8_t> &payload, cv::Mat &img);
+
+// cvtColor code that demosaics frames of a camera pixel format (e.g. the
+// pixelFormat of a header) to BGR, -1 if it is not a Bayer format
+int DemosaicCode(const std::string &pixelFormat);
+
+
+class RawWriter
+{
+public:
+	RawWriter();
+	~RawWriter();
+
+	// Creates (truncates) the file; -1 also for a codec that is not a
+	// RawCodec, e.g. ParseRawCodec() of an unknown name
+	int Open(const std::string &fileName, const std::string &pixelFormat, int bitDepth,
+	         uint32_t codec = RAW_CODEC_NONE, int numThreads = 1);
+	void Close();
+	bool IsOpen() { return file != NULL; }
+
+	int Write(const cv::Mat &img, uint64_t slot, uint64_t rigTime);
+
+	uint64_t numFrames;
+	uint64_t bytesWritten;
+	uint64_t frameBytes;	// of the frames before encoding
+
+private:
+	FILE *file;
+	std::vector<char> fileBuffer;
+	std::string pixelFormat;
+	int bitDepth;
+	uint32_t codec;
+	int numThreads;
+	std::vector<uint8_t> encoded;
+};
+
+
+class RawReader
+{
+public:
+	RawReader();
+	~RawReader();
+
+	int Open(const std::string &fileName);
+	void Close();
+
+	// Next header; false at the end of the file or at a damaged record,
+	// which ends the file: a header that does not describe a frame of
+	// the codec, or a payload past the end of the file
+	bool Next(RawFrameHeader &header);
+	// Payload of the record Next() returned; read or skip it, not both
+	int ReadPayload(std::vector<uint8_t> &payload);
+	int SkipPayload();
+
+private:
+	FILE *file;
+	std::vector<char> fileBuffer;
+	off_t fileSize;
+	uint64_t payloadLeft;
+};
+
+#endif
@@ -0,0 +1,391 @@
+#include "RigExposure.h"
+
+#include <iostream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+using namespace cv;
+
+
+// Sum of a row of 8-bit pixels
+static uint64_t SumRow8(const uint8_t *row, int width)
+{
+	uint64_t sum = 0;
+	int x = 0;
+
+#ifdef __SSE2__
+	// psadbw against zero adds 8 bytes into each 64-bit half
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	for(; x+16<=width; x+=16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(row + x)), zero));
+
+	uint64_t halves[2];
+	_mm_storeu_si128((__m128i *)halves, acc);
+	sum = halves[0] + halves[1];
+#endif
+
+	for(; x<width; x++)
+		sum += row[x];
+	return sum;
+}
+
+
+void ComputeFrameStatistics(const Mat &img, int bitDepth, int step, FrameStatistics &stats)
+{
+	bool wide = (img.depth() == CV_16U);
+	int shift = wide ? max(bitDepth - 6, 0) : 2;
+	double fullScale = wide ? (double)((1 << bitDepth) - 1) : 255.0;
+	step = max(step, 1);
+
+	// Four histograms filled in turn, so consecutive samples of the same
+	// bin do not wait on each other's store
+	uint32_t banks[4][64];
+	memset(banks, 0, sizeof(banks));
+
+	uint64_t sum = 0, numSummed = 0;
+	uint32_t count = 0;
+
+	for(int y=0; y<img.rows; y+=step)
+	{
+		if(wide)
+		{
+			const uint16_t *row = img.ptr<uint16_t>(y);
+			for(int x=0; x<img.cols; x++)
+				sum += row[x];
+			for(int x=0; x<img.cols; x+=step, count++)
+				banks[count & 3][min(row[x] >> shift, 63)]++;
+		}
+		else
+		{
+			const uint8_t *row = img.ptr<uint8_t>(y);
+			sum += SumRow8(row, img.cols);
+			for(int x=0; x<img.cols; x+=step, count++)
+				banks[count & 3][row[x] >> shift]++;
+		}
+		numSummed += img.cols;
+	}
+
+	for(int b=0; b<64; b++)
+		stats.histogram[b] = banks[0][b] + banks[1][b] + banks[2][b] + banks[3][b];
+	stats.count = count;
+	stats.mean = (numSummed > 0) ? sum / (double)numSummed / fullScale : 0;
+}
+
+
+double StatisticsPercentile(const FrameStatistics &stats, double p)
+{
+	double limit = p * stats.count;
+	uint32_t below = 0;
+	for(int b=0; b<64; b++)
+	{
+		below += stats.histogram[b];
+		if(below >= limit)
+			return (b + 1) / 64.0;
+	}
+	return 1.0;
+}
+
+
+RigExposureSettings::RigExposureSettings()
+	: target(0.4), minExposure(50), maxExposure(10000), maxGain(18),
+	  every(8), maxStep(1.25), deadband(0.04)
+{
+}
+
+
+RigExposure::RigExposure(vector<CameraPtr> cameras, vector<int> bitDepths, const RigExposureSettings &settings, double startExposure)
+	: cameras(cameras), bitDepths(bitDepths), settings(settings),
+	  exposure(startExposure), gain(0), lastLevel(0), numUpdates(0), numRounds(0),
+	  pending(cameras.size()), active(cameras.size(), true), running(false)
+{
+}
+
+
+RigExposure::~RigExposure()
+{
+	Stop();
+}
+
+
+// Set an auto function (ExposureAuto, GainAuto) to Off
+static void AutoOff(INodeMap & nodeMap, const char *name)
+{
+	CEnumerationPtr ptrAuto = nodeMap.GetNode(name);
+	if (!IsAvailable(ptrAuto) || !IsWritable(ptrAuto))
+		return;
+
+	CEnumEntryPtr ptrAutoOff = ptrAuto->GetEntryByName("Off");
+	if (IsAvailable(ptrAutoOff) && IsReadable(ptrAutoOff))
+		ptrAuto->SetIntValue(ptrAutoOff->GetValue());
+}
+
+
+int RigExposure::Write(CameraPtr pCam, double exposure, double gain)
+{
+	try
+	{
+		INodeMap & nodeMap = pCam->GetNodeMap();
+
+		CFloatPtr ptrExposureTime = nodeMap.GetNode("ExposureTime");
+		if (!IsAvailable(ptrExposureTime) || !IsWritable(ptrExposureTime))
+		{
+			cout << "Unable to set exposure time" << endl;
+			return -1;
+		}
+		ptrExposureTime->SetValue(max(min(exposure, ptrExposureTime->GetMax()), ptrExposureTime->GetMin()));
+
+		CFloatPtr ptrGain = nodeMap.GetNode("Gain");
+		if (!IsAvailable(ptrGain) || !IsWritable(ptrGain))
+		{
+			cout << "Unable to set gain" << endl;
+			return -1;
+		}
+		ptrGain->SetValue(max(min(gain, ptrGain->GetMax()), ptrGain->GetMin()));
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int RigExposure::Start()
+{
+	exposure = max(min(exposure, settings.maxExposure), settings.minExposure);
+
+	for(unsigned int i=0; i<cameras.size(); i++)
+	{
+		try
+		{
+			AutoOff(cameras[i]->GetNodeMap(), "ExposureAuto");
+			AutoOff(cameras[i]->GetNodeMap(), "GainAuto");
+		}
+		catch (Spinnaker::Exception &e)
+		{
+			cout << "Error: " << e.what() << endl;
+			return -1;
+		}
+
+		if(Write(cameras[i], exposure, gain) < 0)
+		{
+			cout << "Camera " << i << ": rig auto exposure not available" << endl;
+			return -1;
+		}
+	}
+
+	cout << "Rig auto exposure: target " << settings.target << ", start " << exposure << " us, every "
+		 << settings.every << " frames" << endl;
+
+	running = true;
+	serviceThread = thread(&RigExposure::ServiceLoop, this);
+	return 0;
+}
+
+
+void RigExposure::Stop()
+{
+	{
+		lock_guard<mutex> lock(exposureMutex);
+		if(!running)
+			return;
+		running = false;
+	}
+	wakeUp.notify_all();
+	serviceThread.join();
+}
+
+
+void RigExposure::Offer(int camNum, uint64_t frameId, const Mat &img)
+{
+	if(frameId % settings.every != 0)
+		return;
+
+	{
+		lock_guard<mutex> lock(exposureMutex);
+		if(!running)
+			return;
+		pending[camNum] = img;
+	}
+	wakeUp.notify_one();
+}
+
+
+void RigExposure::Detach(int camNum)
+{
+	lock_guard<mutex> lock(exposureMutex);
+	active[camNum] = false;
+	pending[camNum].release();
+}
+
+
+int RigExposure::Attach(int camNum, CameraPtr pCam)
+{
+	// The cached configuration of a camera that came back has the start
+	// exposure; bring it to the current values of the rig
+	double currentExposure, currentGain;
+	{
+		lock_guard<mutex> lock(exposureMutex);
+		cameras[camNum] = pCam;
+		currentExposure = exposure;
+		currentGain = gain;
+	}
+
+	try
+	{
+		AutoOff(pCam->GetNodeMap(), "ExposureAuto");
+		AutoOff(pCam->GetNodeMap(), "GainAuto");
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+	}
+	int result = Write(pCam, currentExposure, currentGain);
+
+	lock_guard<mutex> lock(exposureMutex);
+	active[camNum] = true;
+	return result;
+}
+
+
+void RigExposure::Update(const vector<FrameStatistics> &stats, const vector<bool> &fresh)
+{
+	double levelSum = 0;
+	int numLevels = 0;
+	bool clipping = false;
+	for(unsigned int i=0; i<stats.size(); i++)
+	{
+		if(!fresh[i])
+			continue;
+		levelSum += stats[i].mean;
+		numLevels++;
+		if(StatisticsPercentile(stats[i], 0.99) >= 1.0)
+			clipping = true;
+	}
+	if(numLevels == 0)
+		return;
+
+	double level = levelSum / numLevels;
+	lastLevel = level;
+
+	double ratio = settings.target / max(level, 1e-3);
+	if(clipping)
+		ratio = min(ratio, 1.0);
+	if(fabs(ratio - 1) < settings.deadband)
+		return;
+	ratio = max(min(ratio, settings.maxStep), 1 / settings.maxStep);
+
+	// Exposure first, the rest in gain
+	double total = exposure * pow(10.0, gain / 20) * ratio;
+	double newExposure = max(min(total, settings.maxExposure), settings.minExposure);
+	double newGain = max(min(20 * log10(total / newExposure), settings.maxGain), 0.0);
+
+	if(fabs(newExposure - exposure) < 1 && fabs(newGain - gain) < 0.01)
+		return;
+
+	vector<CameraPtr> targets;
+	{
+		lock_guard<mutex> lock(exposureMutex);
+		exposure = newExposure;
+		gain = newGain;
+		for(unsigned int i=0; i<cameras.size(); i++)
+		{
+			if(active[i])
+				targets.push_back(cameras[i]);
+		}
+	}
+
+	// All cameras in the same pass, so they change between the same frames
+	// as far as the bus allows
+	for(unsigned int i=0; i<targets.size(); i++)
+		Write(targets[i], newExposure, newGain);
+
+	numUpdates++;
+	cout << "Rig exposure: level " << level << " -> " << newExposure << " us, " << newGain << " dB" << endl;
+}
+
+
+void RigExposure::ServiceLoop()
+{
+	unsigned int numCameras = cameras.size();
+	vector<FrameStatistics> stats(numCameras);
+	vector<bool> fresh(numCameras, false);
+	vector<Mat> frames(numCameras);
+	vector<bool> attached(numCameras);
+	bool skipRound = false;
+	auto roundStart = chrono::steady_clock::now();
+
+	unique_lock<mutex> lock(exposureMutex);
+	while(running)
+	{
+		wakeUp.wait_for(lock, chrono::milliseconds(100));
+		if(!running)
+			break;
+
+		for(unsigned int i=0; i<numCameras; i++)
+		{
+			frames[i] = pending[i];
+			pending[i].release();
+			attached[i] = active[i];
+		}
+		lock.unlock();
+
+		// Statistics outside the lock; the frames are only read
+		for(unsigned int i=0; i<numCameras; i++)
+		{
+			if(frames[i].empty())
+				continue;
+			ComputeFrameStatistics(frames[i], bitDepths[i], 4, stats[i]);
+			fresh[i] = true;
+			frames[i].release();
+		}
+
+		bool allFresh = true, anyFresh = false;
+		for(unsigned int i=0; i<numCameras; i++)
+		{
+			if(attached[i] && !fresh[i])
+				allFresh = false;
+			if(fresh[i])
+				anyFresh = true;
+		}
+
+		bool late = (chrono::steady_clock::now() - roundStart > chrono::seconds(1));
+		if(allFresh || (late && anyFresh))
+		{
+			numRounds++;
+			if(skipRound)
+				skipRound = false;
+			else
+			{
+				int updatesBefore = numUpdates;
+				Update(stats, fresh);
+				skipRound = (numUpdates != updatesBefore);
+			}
+
+			fill(fresh.begin(), fresh.end(), false);
+			roundStart = chrono::steady_clock::now();
+		}
+
+		lock.lock();
+	}
+}
+
+
+void RigExposure::PrintReport()
+{
+	cout << "Rig auto exposure: " << numUpdates << " updates in " << numRounds << " rounds, last level "
+		 << lastLevel << ", exposure " << exposure << " us, gain " << gain << " dB" << endl;
+}
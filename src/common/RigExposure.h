@@ -0,0 +1,114 @@
+#ifndef RIG_EXPOSURE_H
+#define RIG_EXPOSURE_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+
+//
+// Brightness statistics of one frame, from every step-th pixel of every
+// step-th row
+//
+struct FrameStatistics
+{
+	uint32_t histogram[64];
+	uint32_t count;
+	double mean;			// fraction of full scale
+};
+
+// CV_8UC1, or CV_16UC1 with bitDepth significant bits
+void ComputeFrameStatistics(const cv::Mat &img, int bitDepth, int step, FrameStatistics &stats);
+
+// Level below which a fraction p of the sampled pixels lie, as a fraction
+// of full scale
+double StatisticsPercentile(const FrameStatistics &stats, double p);
+
+
+struct RigExposureSettings
+{
+	RigExposureSettings();
+
+	double target;			// mean level of the rig, fraction of full scale
+	double minExposure;		// us
+	double maxExposure;		// us; keep below the trigger period
+	double maxGain;			// dB
+	int every;				// frames of a camera between two statistics
+	double maxStep;			// largest change of exposure * gain per update
+	double deadband;		// relative error left alone
+};
+
+
+//
+// Host side auto exposure for the whole rig.
+//
+// *** NOTES ***
+// ExposureAuto and GainAuto stay off on the cameras, so every camera runs
+// with the same ExposureTime and Gain. The capture threads hand every
+// settings.every-th frame to Offer(), which only keeps a reference; the
+// service thread computes the statistics (SSE2 row sums, 64 bin histogram
+// of a subsampled grid) off the capture path.
+//
+// Once every attached camera has reported, or after a second with at
+// least one report, the mean level of the rig is compared with the target.
+// exposure * gain is scaled by target / level, limited to maxStep per
+// update and left alone within the deadband; it is not raised while the
+// 99th percentile of a camera is at full scale. Exposure takes the change
+// first, up to maxExposure, then gain. The new values are written to all
+// cameras together and the next round of statistics is skipped, so frames
+// still in flight with the old settings do not count.
+//
+// A camera that rejoins gets the current values on Attach().
+//
+class RigExposure
+{
+public:
+	RigExposure(std::vector<Spinnaker::CameraPtr> cameras, std::vector<int> bitDepths, const RigExposureSettings &settings, double startExposure);
+	~RigExposure();
+
+	// Turn the camera auto functions off, write the start values and start
+	// the service thread
+	int Start();
+	void Stop();
+
+	// Called by the capture thread of a camera with every frame
+	void Offer(int camNum, uint64_t frameId, const cv::Mat &img);
+
+	void Detach(int camNum);
+	int Attach(int camNum, Spinnaker::CameraPtr pCam);
+
+	void PrintReport();
+
+private:
+	int Write(Spinnaker::CameraPtr pCam, double exposure, double gain);
+	void Update(const std::vector<FrameStatistics> &stats, const std::vector<bool> &fresh);
+	void ServiceLoop();
+
+	std::vector<Spinnaker::CameraPtr> cameras;
+	std::vector<int> bitDepths;
+	RigExposureSettings settings;
+
+	double exposure;		// us
+	double gain;			// dB
+	double lastLevel;
+	int numUpdates;
+	int numRounds;
+
+	// Frames handed over by the capture threads
+	std::vector<cv::Mat> pending;
+	std::vector<bool> active;
+
+	std::mutex exposureMutex;
+	std::condition_variable wakeUp;
+	bool running;
+	std::thread serviceThread;
+};
+
+#endif
@@ -0,0 +1,417 @@
+#include "RigPlan.h"
+#include "CaptureProfile.h"
+
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <cstdlib>
+#include <cerrno>
+#include <sys/stat.h>
+
+using namespace std;
+
+
+static string Trim(const string &s)
+{
+	size_t first = s.find_first_not_of(" \t\r");
+	if(first == string::npos)
+		return "";
+	size_t last = s.find_last_not_of(" \t\r");
+	return s.substr(first, last - first + 1);
+}
+
+
+// "0-3,8" -> 0 1 2 3 8
+int ParseCpuList(const string &value, vector<int> &cpus)
+{
+	cpus.clear();
+	stringstream ss(value);
+	string item;
+	while(getline(ss, item, ','))
+	{
+		int first, last;
+		char dash;
+		stringstream range(item);
+		if(!(range >> first))
+			return -1;
+		last = first;
+		if(range >> dash)
+		{
+			if(dash != '-' || !(range >> last) || last < first)
+				return -1;
+		}
+		for(int cpu=first; cpu<=last; cpu++)
+			cpus.push_back(cpu);
+	}
+	return cpus.empty() ? -1 : 0;
+}
+
+
+// mkdir -p
+static int MakeDirectories(const string &path)
+{
+	for(size_t pos = 1; pos <= path.size(); pos++)
+	{
+		if(pos < path.size() && path[pos] != '/')
+			continue;
+
+		string dir = path.substr(0, pos);
+		if(mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+		{
+			cout << "Unable to create directory " << dir << endl;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+static int BitsPerPixel(const string &pixelFormat)
+{
+	if(pixelFormat.empty() || pixelFormat.find('8') != string::npos)
+		return 8;
+	if(pixelFormat.find("12p") != string::npos || pixelFormat.find("12Packed") != string::npos)
+		return 12;
+	if(pixelFormat.find("10p") != string::npos || pixelFormat.find("10Packed") != string::npos)
+		return 10;
+	return 16;
+}
+
+
+RigPlan::RigPlan()
+	: numImages(1000), recordFormat("jpg"), rawCodec("none"), rawThreads(2), realtime(false), rtPriority(50),
+	  autoExposure(false), aeTarget(0.4), aeMaxExposure(10000), aeMaxGain(18), aeEvery(8),
+	  videoFps(0), videoQuality(75), videoBitrate(1000000), segmentMB(1024), segmentSeconds(0), videoQueue(60),
+	  motionGate(false), gateThreshold(2.0), gatePreRoll(15), gatePostRoll(30)
+{
+}
+
+
+int RigPlan::Load(const string &fileName)
+{
+	ifstream in(fileName.c_str());
+	if(!in)
+	{
+		cout << "Unable to open rig file " << fileName << endl;
+		return -1;
+	}
+
+	if(Parse(in, fileName) < 0)
+		return -1;
+
+	return Compile();
+}
+
+
+int RigPlan::Parse(istream &in, const string &fileName)
+{
+	// Rig defaults, copied into every camera when it starts
+	CameraPlan defaults;
+	defaults.isPrimary = false;
+	defaults.offsetX = defaults.offsetY = 0;
+	defaults.width = defaults.height = 0;
+	defaults.fps = 0;
+	defaults.exposureTime = 5500.0;
+	defaults.numaNode = -1;
+	defaults.bitsPerPixel = 8;
+	defaults.frameBytes = 0;
+
+	cameras.clear();
+
+	string line;
+	int lineNum = 0;
+	while(getline(in, line))
+	{
+		lineNum++;
+
+		size_t comment = line.find('#');
+		if(comment != string::npos)
+			line = line.substr(0, comment);
+		line = Trim(line);
+		if(line.empty())
+			continue;
+
+		size_t colon = line.find(':');
+		if(colon == string::npos)
+		{
+			cout << fileName << ":" << lineNum << ": expected \"key: value\"" << endl;
+			return -1;
+		}
+		string key = Trim(line.substr(0, colon));
+		string value = Trim(line.substr(colon + 1));
+
+		if(key == "camera")
+		{
+			cameras.push_back(defaults);
+			cameras.back().serial = value;
+		}
+		else if(key == "name" && cameras.empty())
+			name = value;
+		else if(key == "images" && cameras.empty())
+			numImages = atoi(value.c_str());
+		else if(key == "format" && cameras.empty() && (value == "jpg" || value == "raw" || value == "mjpg" || value == "h264"))
+			recordFormat = value;
+		else if(key == "rawCodec" && cameras.empty() && (value == "none" || value == "rice"))
+			rawCodec = value;
+		else if(key == "rawThreads" && cameras.empty() && atoi(value.c_str()) > 0)
+			rawThreads = atoi(value.c_str());
+		else if(key == "videoFps" && cameras.empty() && atof(value.c_str()) > 0)
+			videoFps = atof(value.c_str());
+		else if(key == "videoQuality" && cameras.empty() && atoi(value.c_str()) >= 1 && atoi(value.c_str()) <= 100)
+			videoQuality = atoi(value.c_str());
+		else if(key == "videoBitrate" && cameras.empty() && atoi(value.c_str()) > 0)
+			videoBitrate = atoi(value.c_str());
+		else if(key == "segmentMB" && cameras.empty() && atof(value.c_str()) > 0)
+			segmentMB = atof(value.c_str());
+		else if(key == "segmentSeconds" && cameras.empty() && atof(value.c_str()) >= 0)
+			segmentSeconds = atof(value.c_str());
+		else if(key == "videoQueue" && cameras.empty() && atoi(value.c_str()) > 0)
+			videoQueue = atoi(value.c_str());
+		else if(key == "output" && cameras.empty())
+			outputDir = value;
+		else if(key == "calibration" && cameras.empty())
+			calibrationDir = value;
+		else if(key == "realtime" && cameras.empty())
+			realtime = (value == "yes");
+		else if(key == "priority" && cameras.empty())
+			rtPriority = atoi(value.c_str());
+		else if(key == "autoExposure" && cameras.empty())
+			autoExposure = (value == "yes");
+		else if(key == "aeTarget" && cameras.empty() && atof(value.c_str()) > 0 && atof(value.c_str()) < 1)
+			aeTarget = atof(value.c_str());
+		else if(key == "aeMaxExposure" && cameras.empty() && atof(value.c_str()) > 0)
+			aeMaxExposure = atof(value.c_str());
+		else if(key == "aeMaxGain" && cameras.empty() && atof(value.c_str()) >= 0)
+			aeMaxGain = atof(value.c_str());
+		else if(key == "aeEvery" && cameras.empty() && atoi(value.c_str()) > 0)
+			aeEvery = atoi(value.c_str());
+		else if(key == "motionGate" && cameras.empty())
+			motionGate = (value == "yes");
+		else if(key == "gateThreshold" && cameras.empty() && atof(value.c_str()) > 0)
+			gateThreshold = atof(value.c_str());
+		else if(key == "gatePreRoll" && cameras.empty() && atoi(value.c_str()) >= 0)
+			gatePreRoll = atoi(value.c_str());
+		else if(key == "gatePostRoll" && cameras.empty() && atoi(value.c_str()) >= 0)
+			gatePostRoll = atoi(value.c_str());
+		else if(key == "sdkCpus" && cameras.empty() && ParseCpuList(value, sdkCpus) == 0)
+			continue;
+		else if(SetKey(cameras.empty() ? defaults : cameras.back(), key, value) < 0)
+		{
+			cout << fileName << ":" << lineNum << ": invalid " << key << ": " << value << endl;
+			return -1;
+		}
+	}
+
+	if(cameras.empty())
+	{
+		cout << fileName << ": no cameras" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int RigPlan::SetKey(CameraPlan &camera, const string &key, const string &value)
+{
+	stringstream ss(value);
+
+	if(key == "role")
+	{
+		if(value != "primary" && value != "secondary")
+			return -1;
+		camera.isPrimary = (value == "primary");
+	}
+	else if(key == "trigger")
+	{
+		if(value != "Line2" && value != "Line3" && value != "Software")
+			return -1;
+		camera.triggerSource = value;
+	}
+	else if(key == "roi")
+	{
+		if(!(ss >> camera.offsetX >> camera.offsetY >> camera.width >> camera.height))
+			return -1;
+	}
+	else if(key == "pixelFormat")
+		camera.pixelFormat = value;
+	else if(key == "profile")
+	{
+		if(FindCaptureProfile(value) == NULL)
+			return -1;
+		camera.profile = value;
+	}
+	else if(key == "lens")
+		camera.lensFile = value;
+	else if(key == "bracket")
+	{
+		camera.bracket.clear();
+		double exposure;
+		while(ss >> exposure)
+		{
+			if(exposure <= 0)
+				return -1;
+			camera.bracket.push_back(exposure);
+		}
+		if(!ss.eof() || camera.bracket.size() < 2 || camera.bracket.size() > 4)
+			return -1;
+	}
+	else if(key == "fps")
+	{
+		if(!(ss >> camera.fps))
+			return -1;
+	}
+	else if(key == "exposure")
+	{
+		if(!(ss >> camera.exposureTime))
+			return -1;
+	}
+	else if(key == "cpus")
+		return ParseCpuList(value, camera.cpus);
+	else if(key == "writerCpus")
+		return ParseCpuList(value, camera.writerCpus);
+	else if(key == "numa")
+	{
+		if(!(ss >> camera.numaNode))
+			return -1;
+	}
+	else if(key == "controller")
+		camera.controller = value;
+	else if(key == "output")
+		camera.outputDir = value;
+	else
+		return -1;
+
+	return 0;
+}
+
+
+int RigPlan::Compile()
+{
+	set<string> serials;
+	int numPrimary = 0;
+
+	for(unsigned int i=0; i<cameras.size(); i++)
+	{
+		CameraPlan &camera = cameras[i];
+
+		if(!serials.insert(camera.serial).second)
+		{
+			cout << "Rig: camera " << camera.serial << " is listed twice" << endl;
+			return -1;
+		}
+		if(camera.isPrimary)
+			numPrimary++;
+
+		if(camera.triggerSource.empty())
+			camera.triggerSource = camera.isPrimary ? "Line2" : "Line3";
+
+		if(camera.outputDir.empty())
+			camera.outputDir = "Cam" + to_string(i + 1);
+		if(camera.outputDir[0] != '/' && !outputDir.empty())
+			camera.outputDir = outputDir + "/" + camera.outputDir;
+
+		camera.bitsPerPixel = BitsPerPixel(camera.pixelFormat);
+		camera.frameBytes = (size_t)camera.width * camera.height * camera.bitsPerPixel / 8;
+	}
+
+	if(numPrimary > 1)
+	{
+		cout << "Rig: more than one primary camera" << endl;
+		return -1;
+	}
+
+	// The framesets are numbered by bracket, so all cameras bracket alike
+	for(unsigned int i=1; i<cameras.size(); i++)
+	{
+		if(cameras[i].bracket != cameras[0].bracket)
+		{
+			cout << "Rig: camera " << cameras[i].serial << " has another bracket than camera " << cameras[0].serial << endl;
+			return -1;
+		}
+	}
+
+	if(calibrationDir.empty())
+		calibrationDir = outputDir.empty() ? "calibration" : outputDir + "/calibration";
+
+	return 0;
+}
+
+
+int RigPlan::Preallocate()
+{
+	for(unsigned int i=0; i<cameras.size(); i++)
+	{
+		if(MakeDirectories(cameras[i].outputDir) < 0)
+			return -1;
+	}
+	if(MakeDirectories(calibrationDir) < 0)
+		return -1;
+	return 0;
+}
+
+
+int RigPlan::GetPrimary()
+{
+	for(unsigned int i=0; i<cameras.size(); i++)
+	{
+		if(cameras[i].isPrimary)
+			return i;
+	}
+	return -1;
+}
+
+
+int RigPlan::Find(const string &serial)
+{
+	for(unsigned int i=0; i<cameras.size(); i++)
+	{
+		if(cameras[i].serial == serial)
+			return i;
+	}
+	return -1;
+}
+
+
+void RigPlan::Print(ostream &out)
+{
+	out << "Rig " << name << ": " << cameras.size() << " cameras, " << numImages << " images, " << recordFormat;
+	if(recordFormat == "raw" && rawCodec != "none")
+		out << " (" << rawCodec << ", " << rawThreads << " threads per camera)";
+	out << endl;
+	if(autoExposure)
+		out << "  auto exposure: target " << aeTarget << ", up to " << aeMaxExposure << " us and " << aeMaxGain << " dB, every " << aeEvery << " frames" << endl;
+	if(recordFormat == "mjpg" || recordFormat == "h264")
+	{
+		out << "  video: " << (recordFormat == "mjpg" ? to_string(videoQuality) + " quality" : to_string(videoBitrate) + " bit/s")
+			<< ", segments of " << segmentMB << " MB";
+		if(segmentSeconds > 0)
+			out << " or " << segmentSeconds << " s";
+		out << ", queue " << videoQueue << endl;
+	}
+	if(motionGate)
+		out << "  motion gate: threshold " << gateThreshold << ", " << gatePreRoll << " frames pre-roll, " << gatePostRoll << " post-roll" << endl;
+	for(unsigned int i=0; i<cameras.size(); i++)
+	{
+		const CameraPlan &camera = cameras[i];
+		out << "  " << i << " SerialNum:" << camera.serial << (camera.isPrimary ? " primary" : "")
+			<< "  trigger " << camera.triggerSource;
+		if(camera.width > 0)
+			out << "  roi " << camera.offsetX << "," << camera.offsetY << " " << camera.width << "x" << camera.height;
+		if(!camera.pixelFormat.empty())
+			out << "  " << camera.pixelFormat;
+		if(!camera.profile.empty())
+			out << "  profile " << camera.profile;
+		if(!camera.lensFile.empty())
+			out << "  lens " << camera.lensFile;
+		if(!camera.bracket.empty())
+		{
+			out << "  bracket";
+			for(unsigned int b=0; b<camera.bracket.size(); b++)
+				out << " " << camera.bracket[b];
+		}
+		if(camera.fps > 0)
+			out << "  " << camera.fps << " fps";
+		out << "  exposure " << camera.exposureTime << " us  -> " << camera.outputDir << endl;
+	}
+}
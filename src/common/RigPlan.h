@@ -0,0 +1,154 @@
+#ifndef RIG_PLAN_H
+#define RIG_PLAN_H
+
+#include <vector>
+#include <string>
+#include <iostream>
+
+
+//
+// Settings of one camera of the rig, with the rig defaults filled in
+//
+struct CameraPlan
+{
+	std::string serial;
+	bool isPrimary;
+	std::string triggerSource;	// Line2, Line3, Software
+	int offsetX, offsetY;
+	int width, height;			// 0: keep the sensor size
+	std::string pixelFormat;	// empty: keep the camera setting
+	std::string profile;		// capture profile (see CaptureProfile); empty: none
+	std::string lensFile;		// calib*.txt to undistort with (see Undistort); empty: none
+	std::vector<double> bracket;	// exposures (us) of an HDR bracket (see HdrBracket); empty: none
+	double fps;					// 0: set by the trigger
+	double exposureTime;		// us
+	std::vector<int> cpus;		// cores near the camera's host controller
+	std::vector<int> writerCpus;	// cores of the writer thread; empty: cpus
+	int numaNode;				// -1: unknown
+	std::string controller;		// host controller, for the layout printout
+	std::string outputDir;
+	int bitsPerPixel;
+	size_t frameBytes;			// 0 when the ROI is not given
+};
+
+
+// Parse a list of cores such as "0-3,8" (rig files, sysfs cpulist)
+int ParseCpuList(const std::string &value, std::vector<int> &cpus);
+
+
+//
+// Rig description read from a rig file and compiled into a plan.
+//
+// *** NOTES ***
+// A rig file has one "key: value" per line; '#' starts a comment. Keys
+// before the first "camera:" line are rig defaults, keys after it belong
+// to that camera and override the defaults:
+//
+//     name: lab
+//     images: 1000
+//     output: /data/bufferTest
+//     exposure: 5500
+//     pixelFormat: BayerRG8
+//
+//     camera: 16276645
+//     role: primary
+//     cpus: 0-3
+//
+//     camera: 16290054
+//     output: Cam2
+//
+// Camera keys: role (primary|secondary), trigger (Line2|Line3|Software;
+// defaults to Line2 for the primary and Line3 for secondaries), roi
+// (x y width height; with a profile, in pixels after its binning),
+// pixelFormat, profile (full|bin2|decim2|strip, see CaptureProfile), fps,
+// exposure, cpus (list and ranges, "0-3,8"), writerCpus, numa, controller
+// (PCI address, e.g. 0000:00:14.0), output (relative to the rig output;
+// defaults to Cam<n>, n counting from 1), lens (calib*.txt; frames are
+// undistorted while recording), bracket (2 to 4 exposures in us cycled by
+// the sequencer and merged into one 16-bit HDR frame; the same on every
+// camera, replaces exposure and autoExposure).
+//
+// Thread topology keys, rig level only (see ThreadTopology):
+// realtime (yes|no), priority (SCHED_FIFO priority), sdkCpus (cores left
+// to the SDK's own threads).
+//
+// Rig auto exposure keys, rig level only (see RigExposure): autoExposure
+// (yes|no), aeTarget (mean level, fraction of full scale), aeMaxExposure
+// (us), aeMaxGain (dB), aeEvery (frames between statistics).
+//
+// Motion gate keys, rig level only (see MotionGate): motionGate (yes|no),
+// gateThreshold (mean 8x8 block difference in levels of 255), gatePreRoll
+// and gatePostRoll (frames written before and after a change).
+//
+// format: how frames are recorded, jpg (default; 16-bit frames as png)
+// or raw (frames.raws per camera, see RawSession; Transcode makes images
+// of it later), mjpg or h264 (video files per camera, see VideoRecorder).
+// rawCodec: none (default) or rice, lossless compression of raw frames
+// (see BayerCodec) on rawThreads threads per camera.
+// Video keys, rig level only: videoFps (frame rate of the files; defaults
+// to the fps of the camera, else 30), videoQuality (MJPG, 1-100),
+// videoBitrate (H264, bit/s), segmentMB and segmentSeconds (a new file
+// after this size or rig time), videoQueue (frames waiting for the
+// encoder before frames are dropped).
+//
+// calibration: directory of the dark and flat reference frames and the
+// defect maps, named by camera serial; defaults to <output>/calibration.
+//
+// Load() parses and checks the file: serials are unique and there is at
+// most one primary. Everything derived from it (output paths, frame sizes)
+// is computed there and Preallocate() creates the output directories, so
+// nothing is looked up or allocated for the plan once frames arrive.
+//
+class RigPlan
+{
+public:
+	RigPlan();
+
+	int Load(const std::string &fileName);
+	int Preallocate();
+
+	// Index of the primary camera, -1 if there is none
+	int GetPrimary();
+	// Index of the camera with this serial, -1 if it is not in the rig
+	int Find(const std::string &serial);
+
+	void Print(std::ostream &out);
+
+	std::string name;
+	std::string outputDir;
+	std::string calibrationDir;	// dark and flat reference frames (see FlatField)
+	int numImages;
+	std::string recordFormat;	// jpg, raw, mjpg, h264
+	std::string rawCodec;		// none, rice
+	int rawThreads;
+	std::vector<CameraPlan> cameras;
+
+	bool realtime;
+	int rtPriority;
+	std::vector<int> sdkCpus;
+
+	bool autoExposure;
+	double aeTarget;
+	double aeMaxExposure;
+	double aeMaxGain;
+	int aeEvery;
+
+	double videoFps;			// 0: fps of the camera
+	int videoQuality;
+	unsigned int videoBitrate;
+	double segmentMB;
+	double segmentSeconds;
+	int videoQueue;
+
+	bool motionGate;
+	double gateThreshold;
+	int gatePreRoll;
+	int gatePostRoll;
+
+private:
+	int Parse(std::istream &in, const std::string &fileName);
+	int SetKey(CameraPlan &camera, const std::string &key, const std::string &value);
+	int Compile();
+};
+
+#endif
@@ -0,0 +1,213 @@
+#include "ThreadTopology.h"
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+using namespace std;
+
+
+// From <numaif.h>; called through syscall() so libnuma is not needed
+#define MPOL_DEFAULT	0
+#define MPOL_PREFERRED	1
+
+
+static string ReadFirstLine(const string &fileName)
+{
+	ifstream in(fileName.c_str());
+	string line;
+	getline(in, line);
+	return line;
+}
+
+
+int ThreadTopology::NumaNodeOfCpu(int cpu)
+{
+	vector<int> nodes;
+	string online = ReadFirstLine("/sys/devices/system/node/online");
+	if(online.empty() || ParseCpuList(online, nodes) < 0)
+		return -1;
+
+	for(unsigned int i=0; i<nodes.size(); i++)
+	{
+		vector<int> cpus = CpusOfNode(nodes[i]);
+		for(unsigned int j=0; j<cpus.size(); j++)
+		{
+			if(cpus[j] == cpu)
+				return nodes[i];
+		}
+	}
+	return -1;
+}
+
+
+int ThreadTopology::NumaNodeOfPciDevice(const string &address)
+{
+	string node = ReadFirstLine("/sys/bus/pci/devices/" + address + "/numa_node");
+	if(node.empty())
+		return -1;
+	return atoi(node.c_str());
+}
+
+
+vector<int> ThreadTopology::CpusOfNode(int node)
+{
+	vector<int> cpus;
+	string cpuList = ReadFirstLine("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+	if(cpuList.empty() || ParseCpuList(cpuList, cpus) < 0)
+		cpus.clear();
+	return cpus;
+}
+
+
+ThreadTopology::ThreadTopology(RigPlan &rig)
+	: rig(rig), cameraNode(rig.cameras.size(), -1)
+{
+	for(unsigned int i=0; i<rig.cameras.size(); i++)
+	{
+		CameraPlan &camera = rig.cameras[i];
+
+		int node = camera.numaNode;
+		if(node < 0 && !camera.controller.empty())
+			node = NumaNodeOfPciDevice(camera.controller);
+		if(node < 0 && !camera.cpus.empty())
+			node = NumaNodeOfCpu(camera.cpus[0]);
+		cameraNode[i] = node;
+
+		if(camera.cpus.empty() && node >= 0)
+			camera.cpus = CpusOfNode(node);
+	}
+}
+
+
+int ThreadTopology::PlaceSdkThreads()
+{
+	if(rig.sdkCpus.empty())
+		return 0;
+	return Place("main / SDK", rig.sdkCpus, -1, false);
+}
+
+
+int ThreadTopology::PlaceAcquisition(int camNum, const string &name)
+{
+	return Place(name, rig.cameras[camNum].cpus, cameraNode[camNum], rig.realtime);
+}
+
+
+int ThreadTopology::PlaceWriter(int camNum, const string &name)
+{
+	const CameraPlan &camera = rig.cameras[camNum];
+	return Place(name, camera.writerCpus.empty() ? camera.cpus : camera.writerCpus, cameraNode[camNum], false);
+}
+
+
+int ThreadTopology::Place(const string &name, const vector<int> &cpus, int numaNode, bool realtime)
+{
+	int result = 0;
+	pthread_t self = pthread_self();
+
+	// Threads inherit the SDK cores from main; without cores of their own
+	// they get all of them back
+	vector<int> threadCpus = cpus;
+	if(threadCpus.empty() && !rig.sdkCpus.empty())
+	{
+		for(int cpu=0; cpu<sysconf(_SC_NPROCESSORS_ONLN); cpu++)
+			threadCpus.push_back(cpu);
+	}
+
+	if(!threadCpus.empty())
+	{
+		cpu_set_t cpuSet;
+		CPU_ZERO(&cpuSet);
+		for(unsigned int i=0; i<threadCpus.size(); i++)
+			CPU_SET(threadCpus[i], &cpuSet);
+
+		int err = pthread_setaffinity_np(self, sizeof(cpuSet), &cpuSet);
+		if(err != 0)
+		{
+			cout << name << ": unable to set CPU affinity (" << strerror(err) << ")" << endl;
+			result = -1;
+		}
+	}
+
+	if(realtime)
+	{
+		sched_param param;
+		param.sched_priority = rig.rtPriority;
+		int err = pthread_setschedparam(self, SCHED_FIFO, &param);
+		if(err != 0)
+			cout << name << ": unable to use SCHED_FIFO (" << strerror(err) << "). Running with normal priority." << endl;
+	}
+
+	// What the thread really got
+	cpu_set_t cpuSet;
+	CPU_ZERO(&cpuSet);
+	pthread_getaffinity_np(self, sizeof(cpuSet), &cpuSet);
+
+	int policy;
+	sched_param param;
+	pthread_getschedparam(self, &policy, &param);
+
+	stringstream cpuList;
+	for(int cpu=0; cpu<CPU_SETSIZE; cpu++)
+	{
+		if(CPU_ISSET(cpu, &cpuSet))
+			cpuList << (cpuList.str().empty() ? "" : ",") << cpu;
+	}
+
+	lock_guard<mutex> lock(printMutex);
+	cout << "Thread " << name << ": cpus " << cpuList.str();
+	if(numaNode >= 0)
+		cout << "  memory node " << numaNode;
+	cout << "  " << ((policy == SCHED_FIFO) ? "SCHED_FIFO " + to_string(param.sched_priority) : string("SCHED_OTHER")) << endl;
+
+	return result;
+}
+
+
+int ThreadTopology::BindMemory(int camNum)
+{
+	int node = cameraNode[camNum];
+	long err;
+
+	if(node < 0)
+	{
+		err = syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+	}
+	else
+	{
+		unsigned long nodeMask[4] = {0, 0, 0, 0};
+		if(node >= (int)(sizeof(nodeMask) * 8))
+			return -1;
+		nodeMask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+		err = syscall(SYS_set_mempolicy, MPOL_PREFERRED, nodeMask, sizeof(nodeMask) * 8);
+	}
+
+	if(err != 0)
+	{
+		cout << "Camera " << camNum << ": unable to set memory policy (" << strerror(errno) << ")" << endl;
+		return -1;
+	}
+	return 0;
+}
+
+
+void ThreadTopology::Print(ostream &out)
+{
+	out << endl << "*** THREAD TOPOLOGY ***" << endl;
+	for(unsigned int i=0; i<rig.cameras.size(); i++)
+	{
+		const CameraPlan &camera = rig.cameras[i];
+		out << "Camera " << i << " SerialNum:" << camera.serial << "  node " << cameraNode[i] << "  cpus ";
+		for(unsigned int j=0; j<camera.cpus.size(); j++)
+			out << (j ? "," : "") << camera.cpus[j];
+		if(!camera.controller.empty())
+			out << "  controller " << camera.controller;
+		out << endl;
+	}
+	out << "SCHED_FIFO for acquisition: " << (rig.realtime ? "priority " + to_string(rig.rtPriority) : string("off")) << endl << endl;
+}
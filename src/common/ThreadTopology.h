@@ -0,0 +1,67 @@
+#ifndef THREAD_TOPOLOGY_H
+#define THREAD_TOPOLOGY_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <iostream>
+
+#include "RigPlan.h"
+
+
+//
+// Places the capture threads and their frame memory on the cores and
+// NUMA node of each camera's USB host controller.
+//
+// *** NOTES ***
+// The node of a camera is taken from the rig file (numa), else from the
+// controller's PCI device (/sys/bus/pci/devices/<controller>/numa_node),
+// else from its first core. Cameras without cores get all cores of their
+// node; cameras without anything are left alone.
+//
+// PlaceSdkThreads() restricts the calling thread to sdkCpus. It must run
+// before System::GetInstance(): the SDK threads inherit the affinity of
+// the thread that creates them, so they stay off the capture cores.
+//
+// PlaceAcquisition() / PlaceWriter() are called by the thread itself as
+// its first statement and print the affinity and policy the thread really
+// got. Acquisition threads run under SCHED_FIFO with the rig priority when
+// realtime is set; without CAP_SYS_NICE (or an rtprio limit) a warning is
+// printed and the thread keeps the normal policy.
+//
+// BindMemory() sets the memory policy of the calling thread to prefer the
+// camera's node, so pages it touches first from then on are placed there.
+// malloc may hand out heap pages another thread touched before, so the
+// capture thread keeps its frames in a FramePool, allocated and written
+// after BindMemory() and reused, rather than allocating every frame.
+//
+class ThreadTopology
+{
+public:
+	ThreadTopology(RigPlan &rig);
+
+	int PlaceSdkThreads();
+
+	int PlaceAcquisition(int camNum, const std::string &name);
+	int PlaceWriter(int camNum, const std::string &name);
+
+	// Called from a thread that allocates frames of camNum
+	int BindMemory(int camNum);
+
+	// NUMA node and cores of every camera
+	void Print(std::ostream &out);
+
+	static int NumaNodeOfCpu(int cpu);
+	static int NumaNodeOfPciDevice(const std::string &address);
+	static std::vector<int> CpusOfNode(int node);
+
+private:
+	int Place(const std::string &name, const std::vector<int> &cpus, int numaNode, bool realtime);
+
+	RigPlan &rig;
+	std::vector<int> cameraNode;
+	std::mutex printMutex;
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include "TriggerJitter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+
+TriggerJitterAnalyzer::TriggerJitterAnalyzer(int numCams)
+	: numCams(numCams), aligned(false), pending(numCams), firstFrameId(numCams, 0)
+{
+}
+
+
+void TriggerJitterAnalyzer::AddEvent(int camNum, uint64_t frameId, uint64_t exposureEndTime)
+{
+	lock_guard<mutex> lock(eventMutex);
+
+	if(aligned)
+	{
+		Record(camNum, frameId, exposureEndTime);
+		return;
+	}
+
+	Event event;
+	event.frameId = frameId;
+	event.time = exposureEndTime;
+	pending[camNum].push_back(event);
+
+	if(Align())
+	{
+		for(int i=0; i<numCams; i++)
+		{
+			for(unsigned int k=0; k<pending[i].size(); k++)
+				Record(i, pending[i][k].frameId, pending[i][k].time);
+			pending[i].clear();
+		}
+	}
+}
+
+
+// Finds the first trigger of all cameras, see the notes; false while the
+// events so far do not tell
+bool TriggerJitterAnalyzer::Align()
+{
+	// The camera that started last
+	int last = -1;
+	for(int i=0; i<numCams; i++)
+	{
+		if(pending[i].size() < 2)
+			return false;
+		if(last < 0 || pending[i][0].time > pending[last][0].time)
+			last = i;
+	}
+
+	// Try its events in turn, in case another camera dropped the first
+	const vector<Event> &events = pending[last];
+	for(unsigned int k=0; k<events.size(); k++)
+	{
+		uint64_t t = events[k].time;
+		vector<uint64_t> match(numCams);
+		bool found = true;
+
+		for(int i=0; i<numCams && found; i++)
+		{
+			const vector<Event> &e = pending[i];
+
+			// Later events may still be closer
+			if(e.back().time < t)
+				return false;
+
+			int64_t period = INT64_MAX;
+			unsigned int nearest = 0;
+			for(unsigned int j=0; j<e.size(); j++)
+			{
+				if(j > 0)
+					period = min(period, (int64_t)(e[j].time - e[j-1].time));
+				if(llabs((int64_t)(e[j].time - t)) < llabs((int64_t)(e[nearest].time - t)))
+					nearest = j;
+			}
+			match[i] = e[nearest].frameId;
+			found = llabs((int64_t)(e[nearest].time - t)) < period / 2;
+		}
+
+		if(found)
+		{
+			firstFrameId = match;
+			aligned = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void TriggerJitterAnalyzer::Record(int camNum, uint64_t frameId, uint64_t exposureEndTime)
+{
+	// Before the first common trigger
+	if(frameId < firstFrameId[camNum])
+		return;
+
+	vector<int64_t> &times = triggers[frameId - firstFrameId[camNum]];
+	if(times.empty())
+		times.assign(numCams, -1);
+	times[camNum] = exposureEndTime;
+}
+
+
+int TriggerJitterAnalyzer::GetNumComplete()
+{
+	lock_guard<mutex> lock(eventMutex);
+
+	int numComplete = 0;
+	for(map< uint64_t, vector<int64_t> >::iterator it = triggers.begin(); it != triggers.end(); ++it)
+	{
+		if(find(it->second.begin(), it->second.end(), -1) == it->second.end())
+			numComplete++;
+	}
+	return numComplete;
+}
+
+
+static double Percentile(const vector<double> &sorted, double p)
+{
+	if(sorted.empty())
+		return 0;
+	size_t idx = (size_t)(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[idx];
+}
+
+
+void TriggerJitterAnalyzer::Report(ostream &out, double binWidthUs)
+{
+	lock_guard<mutex> lock(eventMutex);
+
+	vector<double> skews;
+	vector<double> offsetSum(numCams, 0), offsetSqSum(numCams, 0);
+	int numIncomplete = 0;
+
+	for(map< uint64_t, vector<int64_t> >::iterator it = triggers.begin(); it != triggers.end(); ++it)
+	{
+		const vector<int64_t> &t = it->second;
+		if(find(t.begin(), t.end(), -1) != t.end())
+		{
+			numIncomplete++;
+			continue;
+		}
+
+		int64_t first = *min_element(t.begin(), t.end());
+		int64_t last = *max_element(t.begin(), t.end());
+		skews.push_back((last - first) / 1000.0);
+
+		// Offsets against the mean of this trigger, taken relative to the
+		// earliest camera to keep the sums small
+		double mean = 0;
+		for(int i=0; i<numCams; i++)
+			mean += (t[i] - first);
+		mean /= numCams;
+
+		for(int i=0; i<numCams; i++)
+		{
+			double offset = ((t[i] - first) - mean) / 1000.0;
+			offsetSum[i] += offset;
+			offsetSqSum[i] += offset * offset;
+		}
+	}
+
+	out << endl << "*** TRIGGER JITTER REPORT ***" << endl << endl;
+	out << "Triggers seen by all cameras: " << skews.size() << endl;
+	out << "Triggers missing a camera: " << numIncomplete << endl;
+
+	if(skews.empty())
+		return;
+
+	int n = skews.size();
+	out << endl << "Per camera offset against trigger mean (us):" << endl;
+	for(int i=0; i<numCams; i++)
+	{
+		double mean = offsetSum[i] / n;
+		double stddev = sqrt(max(0.0, offsetSqSum[i] / n - mean * mean));
+		out << "  Camera " << i << ": mean " << mean << "  jitter (std) " << stddev << endl;
+	}
+
+	vector<double> sorted = skews;
+	sort(sorted.begin(), sorted.end());
+	double sum = 0;
+	for(int i=0; i<n; i++)
+		sum += sorted[i];
+
+	out << endl << "Skew between cameras (us):" << endl;
+	out << "  mean " << sum / n << "  p50 " << Percentile(sorted, 50) << "  p90 " << Percentile(sorted, 90)
+		<< "  p99 " << Percentile(sorted, 99) << "  max " << sorted.back() << endl;
+
+	// Histogram of the skew
+	int numBins = (int)(sorted.back() / binWidthUs) + 1;
+	vector<int> bins(numBins, 0);
+	for(int i=0; i<n; i++)
+		bins[(int)(sorted[i] / binWidthUs)]++;
+
+	int maxBin = *max_element(bins.begin(), bins.end());
+	out << endl;
+	for(int b=0; b<numBins; b++)
+	{
+		if(bins[b] == 0)
+			continue;
+		out << "  " << b * binWidthUs << " - " << (b + 1) * binWidthUs << " us\t" << bins[b] << "\t"
+			<< string(50 * bins[b] / maxBin, '#') << endl;
+	}
+	out << endl;
+}
+
+
+MockExposureEndSource::MockExposureEndSource(int numCams, double periodUs, double jitterUs, double driftPpm, double dropRate, unsigned int seed)
+	: latencyUs(numCams), numCams(numCams), periodUs(periodUs), jitterUs(jitterUs),
+	  driftPpm(driftPpm), dropRate(dropRate), rng(seed)
+{
+	uniform_real_distribution<double> latency(0.0, 3.0 * jitterUs);
+	for(int i=0; i<numCams; i++)
+		latencyUs[i] = latency(rng);
+}
+
+
+void MockExposureEndSource::Run(TriggerJitterAnalyzer &analyzer, int numTriggers)
+{
+	normal_distribution<double> jitter(0.0, jitterUs);
+	uniform_real_distribution<double> drop(0.0, 1.0);
+	uniform_real_distribution<double> drift(-driftPpm, driftPpm);
+
+	// Each camera counts frames from a different start value and has its
+	// own residual drift that clock sync did not remove
+	vector<double> camDrift(numCams);
+	vector<uint64_t> frameIdStart(numCams);
+	for(int i=0; i<numCams; i++)
+	{
+		camDrift[i] = drift(rng) * 1e-6;
+		frameIdStart[i] = 1000 * i;
+	}
+
+	for(int k=0; k<numTriggers; k++)
+	{
+		double triggerUs = k * periodUs;
+		for(int i=0; i<numCams; i++)
+		{
+			// Armed one after the other
+			if(k < i || drop(rng) < dropRate)
+				continue;
+
+			double t = triggerUs * (1.0 + camDrift[i]) + latencyUs[i] + jitter(rng);
+			analyzer.AddEvent(i, frameIdStart[i] + k - i, (uint64_t)(1e9 + t * 1000.0));
+		}
+	}
+}
@@ -0,0 +1,91 @@
+#ifndef TRIGGER_JITTER_H
+#define TRIGGER_JITTER_H
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <random>
+#include <iostream>
+#include <stdint.h>
+
+
+//
+// Collects ExposureEnd events from all cameras and reports how far apart
+// the cameras expose for the same trigger.
+//
+// *** NOTES ***
+// Events are matched by frame ID, taken relative to the frame ID of the
+// first trigger all cameras saw, so the cameras do not need to start
+// counting at the same value nor at the same trigger (a free running
+// primary exposes before the secondaries are armed). That trigger is found
+// by time: the first event of the camera that started last, with the
+// event of every other camera closest to it, within half the event period
+// of that camera. Events are held back until it is found; earlier ones are
+// left out. All times must be in one clock domain (rig time, see
+// ClockSync).
+//
+// For every trigger seen by all cameras the report gives
+// - skew: latest minus earliest exposure end over all cameras
+// - offset of each camera against the mean of the trigger
+// and over all triggers the distribution (percentiles and histogram) of
+// the skew, and mean and standard deviation (jitter) of every camera's
+// offset.
+//
+class TriggerJitterAnalyzer
+{
+public:
+	TriggerJitterAnalyzer(int numCams);
+
+	// Thread safe; called from the device event handlers
+	void AddEvent(int camNum, uint64_t frameId, uint64_t exposureEndTime);
+
+	int GetNumComplete();
+	void Report(std::ostream &out, double binWidthUs = 5.0);
+
+private:
+	struct Event
+	{
+		uint64_t frameId;
+		uint64_t time;
+	};
+
+	bool Align();
+	void Record(int camNum, uint64_t frameId, uint64_t exposureEndTime);
+
+	int numCams;
+	bool aligned;
+	std::vector< std::vector<Event> > pending;	// until aligned
+	std::vector<uint64_t> firstFrameId;
+	std::map< uint64_t, std::vector<int64_t> > triggers;
+	std::mutex eventMutex;
+};
+
+
+//
+// Generates ExposureEnd events for offline testing of the analyzer.
+//
+// Every camera gets a fixed latency, a clock that drifts by driftPpm and
+// gaussian jitter. A fraction of events is dropped. Camera i starts at
+// trigger i, like cameras armed one after the other.
+//
+class MockExposureEndSource
+{
+public:
+	MockExposureEndSource(int numCams, double periodUs, double jitterUs, double driftPpm = 0.0, double dropRate = 0.0, unsigned int seed = 1);
+
+	// Emit events for numTriggers triggers to the analyzer
+	void Run(TriggerJitterAnalyzer &analyzer, int numTriggers);
+
+	// Latency of each camera, to compare with the reported offsets
+	std::vector<double> latencyUs;
+
+private:
+	int numCams;
+	double periodUs;
+	double jitterUs;
+	double driftPpm;
+	double dropRate;
+	std::mt19937 rng;
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include "Undistort.h"
+
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+
+LensCalibration::LensCalibration()
+	: width(0), height(0), fx(0), fy(0), cx(0), cy(0), k1(0), k2(0)
+{
+}
+
+
+int LensCalibration::Load(const string &fileName)
+{
+	ifstream file(fileName.c_str());
+	if(!file)
+	{
+		cout << "Unable to open " << fileName << endl;
+		return -1;
+	}
+
+	int found = 0;
+	string key;
+	double value;
+	while(file >> key >> value)
+	{
+		if(key == "ImageWidth:")
+			width = (int)value;
+		else if(key == "ImageHeight:")
+			height = (int)value;
+		else if(key == "FocalLengthX:")
+			fx = value;
+		else if(key == "FocalLengthY:")
+			fy = value;
+		else if(key == "PrincipalPointX:")
+			cx = value;
+		else if(key == "PrincipalPointY:")
+			cy = value;
+		else if(key == "k1:")
+			k1 = value;
+		else if(key == "k2:")
+			k2 = value;
+		else
+			continue;
+		found++;
+	}
+
+	if(found < 8 || width <= 1 || height <= 1 || fx <= 0 || fy <= 0)
+	{
+		cout << fileName << " is not a lens calibration" << endl;
+		return -1;
+	}
+	return 0;
+}
+
+
+void UndistortPoints(const LensCalibration &lens, double *x, double *y, int n, int numIterations)
+{
+	const double k1 = lens.k1, k2 = lens.k2;
+
+	// Normalized coordinates and distorted radius
+	vector<double> rd(n), r(n);
+	for(int i=0; i<n; i++)
+	{
+		x[i] = (x[i] - lens.cx) / lens.fx;
+		y[i] = (y[i] - lens.cy) / lens.fy;
+		rd[i] = sqrt(x[i]*x[i] + y[i]*y[i]);
+		r[i] = rd[i];
+	}
+
+	// One iteration over all points at a time, so the inner loop vectorizes
+	for(int k=0; k<numIterations; k++)
+	{
+		#pragma omp simd
+		for(int i=0; i<n; i++)
+		{
+			double r2 = r[i] * r[i];
+			double f = r[i] * (1 + k1*r2 + k2*r2*r2) - rd[i];
+			double df = 1 + 3*k1*r2 + 5*k2*r2*r2;
+			r[i] = max(r[i] - f / df, 0.0);
+		}
+	}
+
+	// r / rd, 1 at the center
+	for(int i=0; i<n; i++)
+	{
+		double scale = (rd[i] > 1e-12) ? r[i] / rd[i] : 1.0;
+		x[i] = x[i] * scale * lens.fx + lens.cx;
+		y[i] = y[i] * scale * lens.fy + lens.cy;
+	}
+}
+
+
+UndistortMap::UndistortMap()
+	: active(false), width(0), height(0), bayer(false), sizeWarning(false)
+{
+}
+
+
+int UndistortMap::Load(const string &fileName, bool bayer)
+{
+	LensCalibration lens;
+	if(lens.Load(fileName) != 0)
+		return -1;
+
+	Build(lens, lens.width, lens.height, bayer);
+	return 0;
+}
+
+
+void UndistortMap::Build(const LensCalibration &lens, int width, int height, bool bayer)
+{
+	calibration = lens;
+	this->width = width;
+	this->height = height;
+	this->bayer = bayer;
+
+	// Intrinsics of a binned or decimated frame
+	double scaleX = (double)width / lens.width;
+	double scaleY = (double)height / lens.height;
+	double fx = lens.fx * scaleX, fy = lens.fy * scaleY;
+	double cx = (lens.cx + 0.5) * scaleX - 0.5, cy = (lens.cy + 0.5) * scaleY - 0.5;
+
+	offsets.resize(width * height);
+	weights.resize(width * height * 2);
+
+	for(int v=0; v<height; v++)
+	{
+		double y = (v - cy) / fy;
+		for(int u=0; u<width; u++)
+		{
+			double x = (u - cx) / fx;
+			double r2 = x*x + y*y;
+			double d = 1 + lens.k1 * r2 + lens.k2 * r2 * r2;
+			double sx = fx * x * d + cx;
+			double sy = fy * y * d + cy;
+
+			// Position in the plane of the colour of (u, v), whose pixel i
+			// is at 2i + phase; the full frame is one plane of step 1
+			int step = bayer ? 2 : 1;
+			int phaseX = bayer ? (u & 1) : 0, phaseY = bayer ? (v & 1) : 0;
+			int planeWidth = (width - phaseX + step - 1) / step;
+			int planeHeight = (height - phaseY + step - 1) / step;
+			double px = (sx - phaseX) / step, py = (sy - phaseY) / step;
+
+			int i = v*width + u;
+			if(!(px >= 0 && py >= 0 && px <= planeWidth - 1 && py <= planeHeight - 1) || planeWidth < 2 || planeHeight < 2)
+			{
+				offsets[i] = -1;
+				weights[2*i] = weights[2*i + 1] = 0;
+				continue;
+			}
+
+			// The last row and column interpolate from the one before
+			int x0 = min((int)px, planeWidth - 2);
+			int y0 = min((int)py, planeHeight - 2);
+			offsets[i] = (y0*step + phaseY)*width + x0*step + phaseX;
+			weights[2*i] = (uint8_t)floor((px - x0) * 128 + 0.5);
+			weights[2*i + 1] = (uint8_t)floor((py - y0) * 128 + 0.5);
+		}
+	}
+
+	active = true;
+}
+
+
+// step: distance of the interpolated pixels, 2 within a Bayer plane
+template <typename T, int cn>
+static void UndistortRow(const T *src, T *dst, const int32_t *offsets, const uint8_t *weights, int width, int step)
+{
+	const int right = step * cn;
+	const int below = step * width * cn;
+
+	for(int x=0; x<width; x++, dst+=cn)
+	{
+		if(offsets[x] < 0)
+		{
+			for(int c=0; c<cn; c++)
+				dst[c] = 0;
+			continue;
+		}
+
+		const T *p = src + offsets[x] * cn;
+		uint32_t wx = weights[2*x], wy = weights[2*x + 1];
+		for(int c=0; c<cn; c++)
+		{
+			uint32_t top = p[c] * (128 - wx) + p[c + right] * wx;
+			uint32_t bottom = p[c + below] * (128 - wx) + p[c + below + right] * wx;
+			dst[c] = (T)((top * (128 - wy) + bottom * wy + 8192) >> 14);
+		}
+	}
+}
+
+
+template <typename T, int cn>
+static void UndistortImage(const Mat &src, Mat &dst, const vector<int32_t> &offsets, const vector<uint8_t> &weights, int step, int numThreads)
+{
+	int width = src.cols, height = src.rows;
+	const T *data = src.ptr<T>(0);
+
+	#pragma omp parallel for num_threads(numThreads) if(numThreads > 1)
+	for(int y=0; y<height; y++)
+		UndistortRow<T, cn>(data, dst.ptr<T>(y), &offsets[y*width], &weights[2*y*width], width, step);
+}
+
+
+void UndistortMap::Apply(const Mat &src, Mat &dst, int numThreads)
+{
+	if(!active)
+	{
+		src.copyTo(dst);
+		return;
+	}
+
+	if(src.rows != height || src.cols != width)
+	{
+		// Binned or decimated: same field of view, scaled intrinsics
+		if((int64_t)src.cols * calibration.height == (int64_t)src.rows * calibration.width && src.cols > 1)
+		{
+			Build(calibration, src.cols, src.rows, bayer);
+		}
+		else
+		{
+			if(!sizeWarning)
+				cout << "Undistort: frame is " << src.cols << "x" << src.rows << ", calibration is " << calibration.width << "x" << calibration.height << ". Not corrected." << endl;
+			sizeWarning = true;
+			src.copyTo(dst);
+			return;
+		}
+	}
+
+	if(bayer && src.channels() != 1)
+	{
+		if(!sizeWarning)
+			cout << "Undistort: the map is for Bayer frames, the frame has " << src.channels() << " channels. Not corrected." << endl;
+		sizeWarning = true;
+		src.copyTo(dst);
+		return;
+	}
+
+	// The offsets index a continuous image
+	Mat continuous = src.isContinuous() ? src : src.clone();
+	dst.create(src.rows, src.cols, src.type());
+
+	bool wide = (src.depth() == CV_16U);
+	if(src.channels() == 3)
+	{
+		if(wide)
+			UndistortImage<uint16_t, 3>(continuous, dst, offsets, weights, 1, numThreads);
+		else
+			UndistortImage<uint8_t, 3>(continuous, dst, offsets, weights, 1, numThreads);
+	}
+	else
+	{
+		if(wide)
+			UndistortImage<uint16_t, 1>(continuous, dst, offsets, weights, bayer ? 2 : 1, numThreads);
+		else
+			UndistortImage<uint8_t, 1>(continuous, dst, offsets, weights, bayer ? 2 : 1, numThreads);
+	}
+}
+
+
+void UndistortMap::Apply(Mat &img, int numThreads)
+{
+	if(!active)
+		return;
+
+	Apply(img, buffer, numThreads);
+	buffer.copyTo(img);
+}
@@ -0,0 +1,110 @@
+#ifndef UNDISTORT_H
+#define UNDISTORT_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+
+//
+// Intrinsics and radial distortion of one camera, read from a calib*.txt
+// file (see PCVisualize/calib):
+//
+//     ImageWidth: 1280
+//     ImageHeight: 1024
+//     FocalLengthX: 807.54976
+//     FocalLengthY: 808.45871
+//     PrincipalPointX: 611.61806
+//     PrincipalPointY: 516.11650
+//     k1: -0.35308
+//     k2: 0.11623
+//
+struct LensCalibration
+{
+	LensCalibration();
+
+	// 0 on success, -1 if the file cannot be read or a key is missing
+	int Load(const std::string &fileName);
+
+	int width, height;
+	double fx, fy;
+	double cx, cy;
+	double k1, k2;
+};
+
+
+//
+// Undistorted pixel coordinates of n points found in the distorted image,
+// in place; the inverse of the model of UndistortMap, so the points land
+// where they are in its output.
+//
+// *** NOTES ***
+// The radius is solved by Newton's method, r + k1 r^3 + k2 r^5 = r_d,
+// starting from r_d, with the same number of iterations for every point.
+// Each iteration is one branch free pass over all points, vectorized with
+// "omp simd" when built with -fopenmp. For the radial distortion of these lenses 6
+// iterations converge to well below 0.001 pixel.
+//
+void UndistortPoints(const LensCalibration &lens, double *x, double *y, int n, int numIterations = 6);
+
+
+//
+// Lens undistortion with a remap table computed once per camera.
+//
+// *** NOTES ***
+// Same model and output as cv::undistort with the camera matrix as the new
+// camera matrix (myUndistort.py): the output pixel (u, v) is sampled at
+//
+//     x = (u - cx) / fx,  y = (v - cy) / fy,  d = 1 + k1 r^2 + k2 r^4
+//     src = (fx x d + cx, fy y d + cy)
+//
+// bilinearly, black outside the image. cv::undistort builds the float
+// maps again on every call; here Build() stores for every output pixel the
+// index of the top left source pixel (int32, -1 outside) and the two
+// interpolation weights in Q7, 6 bytes per pixel. Apply() is then integer
+// only, rows split across numThreads OpenMP threads.
+//
+// Frames of another size than the calibration are corrected when they are
+// a uniform scale of it (binned or decimated, see CaptureProfile): the
+// intrinsics are scaled and the table rebuilt on the first such frame.
+// Other sizes (ROI) are left as they are.
+//
+// A raw Bayer frame is remapped one colour plane at a time: the source
+// position of an output pixel is interpolated from the four nearest pixels
+// of its own colour, two pixels apart, so the colours of the mosaic are
+// never mixed and it can still be demosaiced afterwards. Its offsets then
+// index the top left of these, the weights are in plane pixels.
+//
+class UndistortMap
+{
+public:
+	UndistortMap();
+
+	// bayer: frames are single channel mosaics, see above
+	void Build(const LensCalibration &calibration, int width, int height, bool bayer = false);
+	int Load(const std::string &fileName, bool bayer = false);
+
+	bool IsActive() { return active; }
+
+	// CV_8U or CV_16U with 1 or 3 channels (1 for a Bayer map); dst is (re)allocated and must
+	// not be src
+	void Apply(const cv::Mat &src, cv::Mat &dst, int numThreads = 1);
+
+	// In place, through a buffer kept by the map
+	void Apply(cv::Mat &img, int numThreads = 1);
+
+private:
+	bool active;
+	LensCalibration calibration;
+	int width;
+	int height;
+	bool bayer;
+	std::vector<int32_t> offsets;
+	std::vector<uint8_t> weights;	// x and y weight of each pixel
+	cv::Mat buffer;
+	bool sizeWarning;
+};
+
+#endif
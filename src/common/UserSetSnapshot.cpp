@@ -0,0 +1,174 @@
+#include "UserSetSnapshot.h"
+
+#include <iostream>
+#include <cstdio>
+
+using namespace Spinnaker;
+using namespace Spinnaker::GenApi;
+using namespace Spinnaker::GenICam;
+using namespace std;
+
+
+// FNV-1a
+static uint32_t Hash(uint32_t h, const string &s)
+{
+	for (unsigned int i = 0; i < s.size(); i++)
+	{
+		h ^= (unsigned char)s[i];
+		h *= 16777619u;
+	}
+	// Separator, so ("ab", "c") and ("a", "bc") differ
+	h ^= 0xff;
+	h *= 16777619u;
+	return h;
+}
+
+
+UserSetSnapshot::UserSetSnapshot(const char *userSet)
+	: userSet(userSet)
+{
+}
+
+
+void UserSetSnapshot::Add(const char *nodeName, const char *value)
+{
+	settings.push_back(make_pair(string(nodeName), string(value)));
+}
+
+
+int UserSetSnapshot::SelectUserSet(INodeMap & nodeMap)
+{
+	CEnumerationPtr ptrSelector = nodeMap.GetNode("UserSetSelector");
+	if (!IsAvailable(ptrSelector) || !IsWritable(ptrSelector))
+	{
+		cout << "Unable to select user set (node retrieval). Aborting..." << endl;
+		return -1;
+	}
+
+	CEnumEntryPtr ptrUserSet = ptrSelector->GetEntryByName(userSet.c_str());
+	if (!IsAvailable(ptrUserSet) || !IsReadable(ptrUserSet))
+	{
+		cout << "Unable to select " << userSet << " (enum entry retrieval). Aborting..." << endl;
+		return -1;
+	}
+
+	ptrSelector->SetIntValue(ptrUserSet->GetValue());
+	return 0;
+}
+
+
+uint32_t UserSetSnapshot::ReadBackHash(INodeMap & nodeMap)
+{
+	uint32_t desired = 2166136261u;
+	uint32_t actual = 2166136261u;
+
+	for (unsigned int i = 0; i < settings.size(); i++)
+	{
+		desired = Hash(desired, settings[i].first);
+		desired = Hash(desired, settings[i].second);
+
+		CValuePtr ptrValue = nodeMap.GetNode(settings[i].first.c_str());
+		actual = Hash(actual, settings[i].first);
+		if (IsAvailable(ptrValue) && IsReadable(ptrValue))
+			actual = Hash(actual, string(ptrValue->ToString().c_str()));
+	}
+
+	return Hash(desired, to_string(actual));
+}
+
+
+int UserSetSnapshot::Load(CameraPtr pCam)
+{
+	try
+	{
+		INodeMap & nodeMap = pCam->GetNodeMap();
+
+		CStringPtr ptrUserID = nodeMap.GetNode("DeviceUserID");
+		if (!IsAvailable(ptrUserID) || !IsReadable(ptrUserID))
+		{
+			cout << "Unable to read DeviceUserID. Full configuration needed." << endl;
+			return 1;
+		}
+
+		// Not snapshotted yet: leave the camera alone
+		string stored = ptrUserID->GetValue().c_str();
+		if (stored.compare(0, 4, "rig:") != 0)
+			return 1;
+
+		if (SelectUserSet(nodeMap) < 0)
+			return -1;
+
+		CCommandPtr ptrLoad = nodeMap.GetNode("UserSetLoad");
+		if (!IsAvailable(ptrLoad) || !IsWritable(ptrLoad))
+		{
+			cout << "Unable to load user set. Aborting..." << endl;
+			return -1;
+		}
+		ptrLoad->Execute();
+
+		char expected[16];
+		snprintf(expected, sizeof(expected), "rig:%08x", ReadBackHash(nodeMap));
+		if (stored != expected)
+		{
+			cout << userSet << " does not match the rig configuration (" << stored << ", expected " << expected << ")" << endl;
+			return 1;
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int UserSetSnapshot::Save(CameraPtr pCam)
+{
+	try
+	{
+		INodeMap & nodeMap = pCam->GetNodeMap();
+
+		if (SelectUserSet(nodeMap) < 0)
+			return -1;
+
+		CCommandPtr ptrSave = nodeMap.GetNode("UserSetSave");
+		if (!IsAvailable(ptrSave) || !IsWritable(ptrSave))
+		{
+			cout << "Unable to save user set. Aborting..." << endl;
+			return -1;
+		}
+		ptrSave->Execute();
+
+		// Power up with the rig configuration; the node name depends on the firmware
+		CEnumerationPtr ptrDefault = nodeMap.GetNode("UserSetDefault");
+		if (!IsAvailable(ptrDefault) || !IsWritable(ptrDefault))
+			ptrDefault = nodeMap.GetNode("UserSetDefaultSelector");
+		if (IsAvailable(ptrDefault) && IsWritable(ptrDefault))
+		{
+			CEnumEntryPtr ptrUserSet = ptrDefault->GetEntryByName(userSet.c_str());
+			if (IsAvailable(ptrUserSet) && IsReadable(ptrUserSet))
+				ptrDefault->SetIntValue(ptrUserSet->GetValue());
+		}
+
+		CStringPtr ptrUserID = nodeMap.GetNode("DeviceUserID");
+		if (!IsAvailable(ptrUserID) || !IsWritable(ptrUserID))
+		{
+			cout << "Unable to write DeviceUserID. Aborting..." << endl;
+			return -1;
+		}
+
+		char hash[16];
+		snprintf(hash, sizeof(hash), "rig:%08x", ReadBackHash(nodeMap));
+		ptrUserID->SetValue(hash);
+		cout << "Rig configuration saved to " << userSet << " (" << hash << ")" << endl;
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Error: " << e.what() << endl;
+		return -1;
+	}
+
+	return 0;
+}
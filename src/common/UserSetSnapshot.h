@@ -0,0 +1,53 @@
+#ifndef USER_SET_SNAPSHOT_H
+#define USER_SET_SNAPSHOT_H
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <stdint.h>
+
+#include "Spinnaker.h"
+#include "SpinGenApi/SpinnakerGenApi.h"
+
+
+//
+// Stores the rig configuration of a camera in one of its user sets, so
+// later startups load it with a single command instead of writing every
+// node.
+//
+// *** NOTES ***
+// Add() lists the desired settings. Only the list is used for the hash;
+// the settings are written by the full configuration path as before.
+//
+// Load() selects the user set, executes UserSetLoad, reads the listed
+// nodes back and hashes their values together with the hash of the
+// desired settings. The result must match the hash saved in DeviceUserID.
+// It does not match if the desired settings changed, if the user set was
+// overwritten by hand, or if the camera was never snapshotted. The caller
+// then runs the full configuration and calls Save().
+//
+// Save() executes UserSetSave, makes the user set the power-up default
+// and writes the hash to DeviceUserID ("rig:xxxxxxxx"). Both must be
+// called while the camera is not acquiring.
+//
+class UserSetSnapshot
+{
+public:
+	UserSetSnapshot(const char *userSet = "UserSet1");
+
+	void Add(const char *nodeName, const char *value);
+
+	// 0 if the camera is configured, 1 if it needs full configuration,
+	// -1 on error
+	int Load(Spinnaker::CameraPtr pCam);
+	int Save(Spinnaker::CameraPtr pCam);
+
+private:
+	uint32_t ReadBackHash(Spinnaker::GenApi::INodeMap & nodeMap);
+	int SelectUserSet(Spinnaker::GenApi::INodeMap & nodeMap);
+
+	std::string userSet;
+	std::vector< std::pair<std::string, std::string> > settings;
+};
+
+#endif
@@ -0,0 +1,333 @@
+#include "VideoRecorder.h"
+#include "RawSession.h"
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+#include <glob.h>
+#include <sys/stat.h>
+
+#include <opencv2/imgproc/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+using namespace Spinnaker;
+
+
+VideoSettings::VideoSettings()
+	: codec("mjpg"), frameRate(30), quality(75), bitrate(1000000),
+	  segmentMB(1024), segmentSeconds(0), maxQueue(60), reportSeconds(10)
+{
+}
+
+
+VideoRecorder::VideoRecorder(const string &baseName, const string &pixelFormat, int bitDepth, const VideoSettings &settings)
+	: baseName(baseName), pixelFormat(pixelFormat), bitDepth(bitDepth), settings(settings), running(false),
+	  segmentOpen(false), segmentNum(0), segmentFrames(0), segmentStart(0), framesAtReport(0), maxLagMs(0),
+	  numEncoded(0), numDropped(0), numFailed(0), lastLagMs(0), maxQueued(0)
+{
+	// AVIRecorder files end at 2 GB
+	this->settings.segmentMB = min(max(this->settings.segmentMB, 1.0), 1900.0);
+	this->settings.maxQueue = max(this->settings.maxQueue, 1u);
+}
+
+
+VideoRecorder::~VideoRecorder()
+{
+	Stop();
+}
+
+
+void VideoRecorder::Start()
+{
+	if(running)
+		return;
+	running = true;
+	lastReport = chrono::steady_clock::now();
+	encodeThread = thread(&VideoRecorder::EncodeLoop, this);
+}
+
+
+void VideoRecorder::Stop()
+{
+	{
+		lock_guard<mutex> lock(queueMutex);
+		if(!running)
+			return;
+		running = false;
+		queueReady.notify_all();
+	}
+	encodeThread.join();
+}
+
+
+bool VideoRecorder::Push(const Mat &img, uint64_t slot, uint64_t rigTime)
+{
+	lock_guard<mutex> lock(queueMutex);
+	if(queue.size() >= settings.maxQueue)
+	{
+		numDropped++;
+		return false;
+	}
+
+	Job job;
+	job.img = img;
+	job.slot = slot;
+	job.rigTime = rigTime;
+	job.queued = chrono::steady_clock::now();
+	queue.push_back(job);
+	maxQueued = max(maxQueued, queue.size());
+	queueReady.notify_one();
+	return true;
+}
+
+
+size_t VideoRecorder::GetQueued()
+{
+	lock_guard<mutex> lock(queueMutex);
+	return queue.size();
+}
+
+
+void VideoRecorder::EncodeLoop()
+{
+	Job job;
+	while(true)
+	{
+		{
+			unique_lock<mutex> lock(queueMutex);
+			queueReady.wait(lock, [this] { return !queue.empty() || !running; });
+			// Drain the queue before stopping
+			if(queue.empty())
+				break;
+			job = queue.front();
+			queue.pop_front();
+		}
+
+		Encode(job);
+		job.img.release();
+
+		if(settings.reportSeconds > 0 &&
+		   chrono::duration<double>(chrono::steady_clock::now() - lastReport).count() >= settings.reportSeconds)
+		{
+			Report();
+		}
+	}
+	CloseSegment();
+}
+
+
+void VideoRecorder::Encode(Job &job)
+{
+	// 8 bit, demosaiced
+	const Mat *img = &job.img;
+	if(img->depth() == CV_16U)
+	{
+		img->convertTo(gray8, CV_8U, 1.0 / (1 << max(bitDepth - 8, 0)));
+		img = &gray8;
+	}
+	PixelFormatEnums format = PixelFormat_Mono8;
+	int code = DemosaicCode(pixelFormat);
+	if(code >= 0 && img->channels() == 1)
+	{
+		cvtColor(*img, bgr, code);
+		img = &bgr;
+	}
+	if(img->channels() == 3)
+		format = PixelFormat_BGR8;
+	if(!img->isContinuous())
+	{
+		gray8 = img->clone();
+		img = &gray8;
+	}
+
+	if(segmentOpen && SegmentFull(job.rigTime))
+		CloseSegment();
+	if(!segmentOpen && OpenSegment(img->cols, img->rows) < 0)
+	{
+		numFailed++;
+		return;
+	}
+
+	try
+	{
+		ImagePtr frame = Image::Create(img->cols, img->rows, 0, 0, format, img->data);
+		recorder.AVIAppend(frame);
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << segmentFile << ": frame " << job.slot << ": " << e.what() << endl;
+		numFailed++;
+		// Carry on in a new file
+		CloseSegment();
+		return;
+	}
+
+	// Some versions create the file on the first frame
+	if(segmentFile.empty() && ResolveSegmentFile() < 0)
+	{
+		cout << "No file " << segmentPattern << " after recording to it" << endl;
+		numFailed++;
+		CloseSegment();
+		return;
+	}
+
+	if(segmentFrames == 0)
+		segmentStart = job.rigTime;
+	indexFile << segmentFrames << " " << job.slot << " " << job.rigTime << endl;
+	segmentFrames++;
+	numEncoded++;
+
+	double lagMs = chrono::duration<double, milli>(chrono::steady_clock::now() - job.queued).count();
+	lastLagMs = lagMs;
+	maxLagMs = max(maxLagMs, lagMs);
+}
+
+
+int VideoRecorder::OpenSegment(int width, int height)
+{
+	char name[1000];
+	sprintf(name, "%s-%04d", baseName.c_str(), segmentNum + 1);
+
+	try
+	{
+		if(settings.codec == "h264")
+		{
+			H264Option option;
+			option.frameRate = static_cast<float>(settings.frameRate);
+			option.bitrate = settings.bitrate;
+			option.width = width;
+			option.height = height;
+			recorder.AVIOpen(name, option);
+			segmentPattern = string(name) + "*.mp4";
+		}
+		else
+		{
+			MJPGOption option;
+			option.frameRate = static_cast<float>(settings.frameRate);
+			option.quality = settings.quality;
+			recorder.AVIOpen(name, option);
+			segmentPattern = string(name) + "*.avi";
+		}
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Unable to open " << name << ": " << e.what() << endl;
+		return -1;
+	}
+
+	segmentNum++;
+	segmentOpen = true;
+	segmentFrames = 0;
+	segmentStart = 0;
+	segmentFile.clear();
+	ResolveSegmentFile();
+	return 0;
+}
+
+
+// AVIRecorder adds a number of its own and the extension to the name it is
+// given (<name>-0000.avi); the file is the newest one of that name. The
+// index is named after it.
+int VideoRecorder::ResolveSegmentFile()
+{
+	glob_t found;
+	if(glob(segmentPattern.c_str(), 0, NULL, &found) != 0)
+		return -1;
+
+	time_t newest = 0;
+	for(size_t i=0; i<found.gl_pathc; i++)
+	{
+		struct stat info;
+		if(stat(found.gl_pathv[i], &info) == 0 && (segmentFile.empty() || info.st_mtime >= newest))
+		{
+			segmentFile = found.gl_pathv[i];
+			newest = info.st_mtime;
+		}
+	}
+	globfree(&found);
+
+	if(segmentFile.empty())
+		return -1;
+	indexFile.open((segmentFile + ".txt").c_str());
+	return 0;
+}
+
+
+void VideoRecorder::CloseSegment()
+{
+	if(!segmentOpen)
+		return;
+
+	try
+	{
+		recorder.AVIClose();
+	}
+	catch (Spinnaker::Exception &e)
+	{
+		cout << "Unable to close " << segmentFile << ": " << e.what() << endl;
+	}
+	if(indexFile.is_open())
+		indexFile.close();
+	segmentOpen = false;
+}
+
+
+bool VideoRecorder::SegmentFull(uint64_t rigTime)
+{
+	if(settings.segmentSeconds > 0 && rigTime > segmentStart &&
+	   (rigTime - segmentStart) / 1e9 >= settings.segmentSeconds)
+	{
+		return true;
+	}
+
+	// The file size is looked at every few frames; a frame adds at most
+	// a few MB, far below the margin to the 2 GB limit. A file that cannot
+	// be looked at ends the segment: its size is unknown.
+	if(segmentFrames % 16 == 0)
+	{
+		struct stat info;
+		if(stat(segmentFile.c_str(), &info) != 0)
+		{
+			cout << "Unable to get the size of " << segmentFile << "; a new file is started" << endl;
+			numFailed++;
+			return true;
+		}
+		if(info.st_size / (1024.0 * 1024.0) >= settings.segmentMB)
+			return true;
+	}
+	return false;
+}
+
+
+void VideoRecorder::Report()
+{
+	auto now = chrono::steady_clock::now();
+	double seconds = chrono::duration<double>(now - lastReport).count();
+	uint64_t encoded = numEncoded;
+	size_t queued = GetQueued();
+
+	ios::fmtflags flags = cout.flags();
+	streamsize precision = cout.precision();
+	cout << fixed << setprecision(1) << baseName << ": " << (encoded - framesAtReport) / seconds << " fps encoded, queue "
+		 << queued << "/" << settings.maxQueue << ", lag " << lastLagMs.load() << " ms (max " << maxLagMs << ")";
+	if(numDropped > 0)
+		cout << ", " << numDropped << " dropped";
+	cout << endl;
+	if(queued > settings.maxQueue * 3 / 4)
+		cout << baseName << ": the encoder falls behind the cameras" << endl;
+	cout.flags(flags);
+	cout.precision(precision);
+
+	lastReport = now;
+	framesAtReport = encoded;
+}
+
+
+void VideoRecorder::PrintStatistics(const string &name)
+{
+	cout << name << ": " << numEncoded << " frames in " << segmentNum << " " << settings.codec << " files, "
+		 << numDropped << " dropped (encoder behind), " << numFailed << " failed, most queued " << maxQueued
+		 << " of " << settings.maxQueue << ", max lag " << maxLagMs << " ms" << endl;
+}
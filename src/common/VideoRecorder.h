@@ -0,0 +1,128 @@
+#ifndef VIDEO_RECORDER_H
+#define VIDEO_RECORDER_H
+
+#include <string>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+#include <opencv2/core/core.hpp>
+
+#include "Spinnaker.h"
+#include "AVIRecorder.h"
+
+
+struct VideoSettings
+{
+	VideoSettings();
+
+	std::string codec;		// mjpg, h264
+	double frameRate;		// of the video file
+	int quality;			// MJPG, 1-100
+	unsigned int bitrate;	// H264, bit/s
+	double segmentMB;		// a new file after this size; kept below the 2 GB of AVIRecorder
+	double segmentSeconds;	// a new file after this much rig time; 0: no limit
+	unsigned int maxQueue;	// frames waiting for the encoder
+	double reportSeconds;	// between lag reports; 0: none
+};
+
+
+//
+// Records the frames of one camera into a video file with AVIRecorder (see
+// src/SaveToAvi), on its own encode thread.
+//
+// *** NOTES ***
+// Push() is called by the writer thread of the camera and only queues the
+// frame (the Mat is shared, not copied). When maxQueue frames wait, the
+// frame is dropped and Push() returns false, so a slow encoder never holds
+// up the writer and the capture buffers behind it.
+//
+// The encode thread makes 8-bit frames (16-bit frames keep their
+// significant bits), demosaics Bayer frames to BGR and appends them to the
+// current segment, <baseName>-<n>-0000.avi for MJPG or .mp4 for H264, n
+// counting from 1; the suffix after <n> is AVIRecorder's own. A segment ends when its file reaches segmentMB or its
+// frames span segmentSeconds of rig time, so files stay below the AVI
+// size limit and a long recording is a series of closed files. Next to
+// every segment, <segment>.txt lists its frames: number in the segment,
+// slot, rig time (ns).
+//
+// Lag: the time a frame waited in the queue plus its encode time. The
+// encode thread prints queue depth, lag and encode rate every
+// reportSeconds, and warns when the queue is more than 3/4 full, i.e. the
+// encoder does not keep up with the cameras and frames will be dropped.
+//
+class VideoRecorder
+{
+public:
+	// pixelFormat of the camera (Bayer frames are demosaiced), bitDepth of
+	// 16-bit frames
+	VideoRecorder(const std::string &baseName, const std::string &pixelFormat, int bitDepth, const VideoSettings &settings);
+	~VideoRecorder();
+
+	void Start();
+	// Encode everything queued, close the segment and stop the thread
+	void Stop();
+
+	bool Push(const cv::Mat &img, uint64_t slot, uint64_t rigTime);
+
+	// Frames waiting and the lag of the last encoded frame (ms)
+	size_t GetQueued();
+	double GetLagMs() { return lastLagMs.load(); }
+
+	void PrintStatistics(const std::string &name);
+
+private:
+	struct Job
+	{
+		cv::Mat img;
+		uint64_t slot;
+		uint64_t rigTime;
+		std::chrono::steady_clock::time_point queued;
+	};
+
+	void EncodeLoop();
+	void Encode(Job &job);
+	int OpenSegment(int width, int height);
+	void CloseSegment();
+	int ResolveSegmentFile();
+	bool SegmentFull(uint64_t rigTime);
+	void Report();
+
+	std::string baseName;
+	std::string pixelFormat;
+	int bitDepth;
+	VideoSettings settings;
+
+	std::mutex queueMutex;
+	std::condition_variable queueReady;
+	std::deque<Job> queue;
+	bool running;
+	std::thread encodeThread;
+
+	// Encode thread only
+	Spinnaker::AVIRecorder recorder;
+	bool segmentOpen;
+	int segmentNum;
+	std::string segmentPattern;	// name given to AVIOpen, with a wildcard
+	std::string segmentFile;	// as AVIRecorder named it; empty until found
+	std::ofstream indexFile;
+	uint64_t segmentFrames;
+	uint64_t segmentStart;		// rig time of its first frame
+	cv::Mat gray8, bgr;
+	std::chrono::steady_clock::time_point lastReport;
+	uint64_t framesAtReport;
+	double maxLagMs;
+
+	std::atomic<uint64_t> numEncoded;
+	std::atomic<uint64_t> numDropped;
+	std::atomic<uint64_t> numFailed;
+	std::atomic<double> lastLagMs;
+	size_t maxQueued;
+};
+
+#endif